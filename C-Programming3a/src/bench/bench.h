@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdio.h>
+#include "../lib/data_handler.h"
+
+// 計測対象のカーネル
+// bench_kernels.c, bench_rrange_calc.c, bench_rrange_num.cを
+// OPTIMIZEマクロあり/なしでそれぞれコンパイルし、bench_main.cとリンクする
+extern const char *bench_variant;
+
+double bench_calc_dist(const data_fmt *datas, unsigned int n);
+double bench_calc_cog(const data_fmt *datas, unsigned int n);
+double bench_derive_features(feature *feature_datas, const data_fmt *datas, unsigned int n);
+double bench_down_sample_features(feature *feature_datas, const data_fmt *datas, unsigned int n, unsigned int merge_num);
+double bench_derive_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int n);
+double bench_down_sample_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int n, unsigned int merge_num);
+double bench_down_sample_features_pairwise(feature *feature_datas, const data_fmt *datas, unsigned int n, unsigned int merge_num);
+long bench_rrange_calc(unsigned int n);
+long bench_rrange_num(unsigned int n);
@@ -0,0 +1,118 @@
+// data_handler.cのstatic関数(calc_dist, calc_cog)を直接呼び出すために、
+// ソースファイルごと取り込む。
+// OPTIMIZEマクロの有無で、インラインマクロ版と関数版のどちらかが計測対象となる。
+#include "../lib/data_handler.c"
+#include "bench.h"
+
+#ifdef OPTIMIZE
+const char *bench_variant = "macro";     //!< 計測対象の実装の名前
+#else
+const char *bench_variant = "function";  //!< 計測対象の実装の名前
+#endif
+
+
+
+
+/*!
+ * calc_distをn回呼び出す
+ * @param [in] datas 入力データ
+ * @param [in] n     呼び出し回数(データ数)
+ * @return 結果の総和(最適化で呼び出しが消されないようにするため)
+ */
+double bench_calc_dist(const data_fmt *datas, unsigned int n) {
+  unsigned int i;
+  double sum = 0.0;
+  for (i = 0; i < n; i++, datas++) {
+    sum += calc_dist(&datas->pos1, &datas->pos2);
+  }
+  return sum;
+}
+
+
+/*!
+ * calc_cogをn回呼び出す
+ * @param [in] datas 入力データ
+ * @param [in] n     呼び出し回数(データ数)
+ * @return 結果の総和(最適化で呼び出しが消されないようにするため)
+ */
+double bench_calc_cog(const data_fmt *datas, unsigned int n) {
+  unsigned int i;
+  double sum = 0.0;
+  for (i = 0; i < n; i++, datas++) {
+    position cog_pos;
+    calc_cog(&cog_pos, datas);
+    sum += cog_pos.x + cog_pos.y + cog_pos.z;
+  }
+  return sum;
+}
+
+
+/*!
+ * derive_featuresをn個のデータに適用する
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         入力データ
+ * @param [in]  n             データ数
+ * @return 結果の一部(最適化で呼び出しが消されないようにするため)
+ */
+double bench_derive_features(feature *feature_datas, const data_fmt *datas, unsigned int n) {
+  derive_features(feature_datas, datas, n);
+  return feature_datas[n - 1].area;
+}
+
+
+/*!
+ * down_sample_featuresをn個のデータに適用する
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         入力データ
+ * @param [in]  n             データ数
+ * @param [in]  merge_num     結合する数
+ * @return 結果の一部(最適化で呼び出しが消されないようにするため)
+ */
+double bench_down_sample_features(feature *feature_datas, const data_fmt *datas, unsigned int n, unsigned int merge_num) {
+  down_sample_features(feature_datas, datas, n, merge_num);
+  return feature_datas[0].area;
+}
+
+
+/*!
+ * derive_features_approxをn個のデータに適用する
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         入力データ
+ * @param [in]  n             データ数
+ * @return 結果の一部(最適化で呼び出しが消されないようにするため)
+ */
+double bench_derive_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int n) {
+  position prev_cog_pos = {0.0, 0.0, 0.0};
+  derive_features_approx(feature_datas, datas, n, &prev_cog_pos, 1);
+  return feature_datas[n - 1].area;
+}
+
+
+/*!
+ * down_sample_features_approxをn個のデータに適用する
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         入力データ
+ * @param [in]  n             データ数
+ * @param [in]  merge_num     結合する数
+ * @return 結果の一部(最適化で呼び出しが消されないようにするため)
+ */
+double bench_down_sample_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int n, unsigned int merge_num) {
+  down_sample_features_approx(feature_datas, datas, n, merge_num);
+  return feature_datas[0].area;
+}
+
+
+/*!
+ * down_sample_featuresを、ブロックの総和を二分木で求める設定(--pairwise)でn個のデータに適用する
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         入力データ
+ * @param [in]  n             データ数
+ * @param [in]  merge_num     結合する数
+ * @return 結果の一部(最適化で呼び出しが消されないようにするため)
+ */
+double bench_down_sample_features_pairwise(feature *feature_datas, const data_fmt *datas, unsigned int n, unsigned int merge_num) {
+  set_sum_mode(SUM_PAIRWISE);
+  down_sample_features(feature_datas, datas, n, merge_num);
+  set_sum_mode(SUM_SEQUENTIAL);
+  return feature_datas[0].area;
+}
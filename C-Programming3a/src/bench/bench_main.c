@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define USE_RDTSC
+#endif
+#include "bench.h"
+
+#define DEFAULT_FILENAME   "../enshu3.txt"
+#define DEFAULT_N_ITEMS    (1 << 16)
+#define DEFAULT_N_SAMPLES  30
+#define DEFAULT_MERGE_NUM  30
+
+
+// 計測の設定と入力データ
+typedef struct {
+  data_fmt     *datas;          // 入力データ(キャプチャを繰り返して並べたもの)
+  feature      *feature_datas;  // 特徴データの出力先
+  unsigned int  n_items;        // 1回の計測で処理するデータ数
+  unsigned int  merge_num;      // down_sample_featuresで結合する数
+} bench_ctx;
+
+// 1つのベンチマーク
+typedef struct {
+  const char *name;                        // ベンチマーク名
+  const char *unit;                        // 1単位の名前(call, frame, ...)
+  double    (*run)(const bench_ctx *ctx);  // 計測対象の処理(戻り値は最適化避けに用いる)
+  unsigned int (*n_units)(const bench_ctx *ctx);  // 1回の処理の単位数
+} benchmark;
+
+// perfのハードウェアカウンタ
+typedef struct {
+  int fd_cycles;  // CPUサイクル数のカウンタ(グループリーダ)
+  int fd_instrs;  // 命令数のカウンタ
+} perf_counters;
+
+// 1回の計測結果
+typedef struct {
+  double ticks;   // TSCサイクル数(TSCが無い環境ではナノ秒)
+  double cycles;  // perfで計測したCPUサイクル数
+  double instrs;  // perfで計測した命令数
+} sample;
+
+
+static double       run_calc_dist(const bench_ctx *ctx);
+static double       run_calc_cog(const bench_ctx *ctx);
+static double       run_derive_features(const bench_ctx *ctx);
+static double       run_down_sample_features(const bench_ctx *ctx);
+static double       run_derive_features_approx(const bench_ctx *ctx);
+static double       run_down_sample_features_approx(const bench_ctx *ctx);
+static double       run_down_sample_features_pairwise(const bench_ctx *ctx);
+static double       run_rrange_calc(const bench_ctx *ctx);
+static double       run_rrange_num(const bench_ctx *ctx);
+static unsigned int units_items(const bench_ctx *ctx);
+static unsigned int units_blocks(const bench_ctx *ctx);
+static int          load_datas(const char *filename, bench_ctx *ctx);
+static int          open_perf_counters(perf_counters *pc);
+static int          pin_cpu(int cpu);
+static uint64_t     read_ticks(void);
+static void         measure(const benchmark *bm, const bench_ctx *ctx, const perf_counters *pc, sample *s);
+static void         report_accuracy(const bench_ctx *ctx);
+static void         summarize(const double *vals, unsigned int n, double *mean, double *ci, double *min);
+static int          compare_double(const void *a, const void *b);
+static void         show_usage(const char *prog_name);
+
+static const benchmark BENCHMARKS[] = {
+  {"calc_dist",            "call",  run_calc_dist,            units_items},
+  {"calc_cog",             "call",  run_calc_cog,             units_items},
+  {"derive_features",      "frame", run_derive_features,      units_items},
+  {"down_sample_features", "frame", run_down_sample_features, units_items},
+  {"down_sample_features", "block", run_down_sample_features, units_blocks},
+  {"derive_features(-a)",  "frame", run_derive_features_approx,      units_items},
+  {"down_sample_feat(-a)", "frame", run_down_sample_features_approx, units_items},
+  {"down_sample_feat(pw)", "frame", run_down_sample_features_pairwise, units_items},
+  {"rrange(calc-game)",    "call",  run_rrange_calc,          units_items},
+  {"rrange(number-game)",  "call",  run_rrange_num,           units_items},
+};
+
+static volatile double sink;  //!< 計測対象の戻り値の格納先(最適化による処理の削除を防ぐ)
+
+
+
+
+/*!
+ * ベンチマークのエントリポイント
+ * OPTIMIZEマクロあり(macro)/なし(function)でビルドした同じプログラムを実行し、
+ * 結果を比較することを想定している
+ * @param [in] argc コマンドライン引数の個数(プログラム名も含む)
+ * @param [in] argv コマンドライン引数の配列
+ * @return 終了コード
+ */
+int main(int argc, char *argv[]) {
+  const char    *filename  = DEFAULT_FILENAME;
+  unsigned int   n_samples = DEFAULT_N_SAMPLES;
+  int            cpu       = -1;
+  int            use_perf  = 0;
+  bench_ctx      ctx;
+  perf_counters  pc = {-1, -1};
+  sample        *samples;
+  double        *vals;
+  unsigned int   i, j;
+  int            ch;
+
+  ctx.n_items   = DEFAULT_N_ITEMS;
+  ctx.merge_num = DEFAULT_MERGE_NUM;
+  while ((ch = getopt(argc, argv, "c:f:hm:n:pr:")) != -1) {
+    switch (ch) {
+      case 'c':  // 計測に用いるCPUを固定する
+        cpu = atoi(optarg);
+        break;
+      case 'f':  // 入力データのファイル名を指定する
+        filename = optarg;
+        break;
+      case 'h':
+        show_usage(argv[0]);
+        return EXIT_SUCCESS;
+      case 'm':  // down_sample_featuresで結合する数を指定する
+        ctx.merge_num = (unsigned int)atoi(optarg);
+        break;
+      case 'n':  // 1回の計測で処理するデータ数を指定する
+        ctx.n_items = (unsigned int)atoi(optarg);
+        break;
+      case 'p':  // perfのハードウェアカウンタを用いる
+        use_perf = 1;
+        break;
+      case 'r':  // 計測回数を指定する
+        n_samples = (unsigned int)atoi(optarg);
+        break;
+      default:
+        show_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (ctx.n_items == 0 || ctx.merge_num == 0 || n_samples < 2) {
+    fputs("データ数と結合する数には1以上、計測回数には2以上の値を指定してください\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (cpu >= 0 && pin_cpu(cpu) != 0) return EXIT_FAILURE;
+  if (use_perf && open_perf_counters(&pc) != 0) {
+    fputs("perfのカウンタを開けないので、TSCのみで計測します\n", stderr);
+    use_perf = 0;
+  }
+  if (load_datas(filename, &ctx) != 0) return EXIT_FAILURE;
+  samples = (sample *)malloc(sizeof(sample) * n_samples);
+  vals    = (double *)malloc(sizeof(double) * n_samples);
+  if (samples == NULL || vals == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  printf("variant: %s, items: %u, samples: %u, cpu: %d, unit: %s (mean +- 95%% CI)\n",
+      bench_variant, ctx.n_items, n_samples, cpu,
+#ifdef USE_RDTSC
+      "TSC cycles"
+#else
+      "ns"
+#endif
+      );
+  printf("%-22s %-6s %10s %8s %10s%s\n", "benchmark", "per", "mean", "ci", "min",
+      use_perf ? "     cycles  instrs" : "");
+
+  for (i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+    const benchmark *bm    = &BENCHMARKS[i];
+    double           units = bm->n_units(&ctx);
+    double           mean, ci, min;
+
+    measure(bm, &ctx, &pc, &samples[0]);  // ウォームアップ(キャッシュと分岐予測を温める)
+    for (j = 0; j < n_samples; j++) {
+      measure(bm, &ctx, &pc, &samples[j]);
+      vals[j] = samples[j].ticks / units;
+    }
+    summarize(vals, n_samples, &mean, &ci, &min);
+    printf("%-22s %-6s %10.3f %8.3f %10.3f", bm->name, bm->unit, mean, ci, min);
+    if (use_perf) {
+      double cycles = 0.0, instrs = 0.0;
+      for (j = 0; j < n_samples; j++) {
+        cycles += samples[j].cycles;
+        instrs += samples[j].instrs;
+      }
+      printf(" %10.3f %7.3f", cycles / n_samples / units, instrs / n_samples / units);
+    }
+    putchar('\n');
+  }
+  report_accuracy(&ctx);
+
+  free(samples);
+  free(vals);
+  free(ctx.datas);
+  free(ctx.feature_datas);
+  return EXIT_SUCCESS;
+}
+
+
+
+
+/*! calc_distの計測 */
+static double run_calc_dist(const bench_ctx *ctx) {
+  return bench_calc_dist(ctx->datas, ctx->n_items);
+}
+
+/*! calc_cogの計測 */
+static double run_calc_cog(const bench_ctx *ctx) {
+  return bench_calc_cog(ctx->datas, ctx->n_items);
+}
+
+/*! derive_featuresの計測 */
+static double run_derive_features(const bench_ctx *ctx) {
+  return bench_derive_features(ctx->feature_datas, ctx->datas, ctx->n_items);
+}
+
+/*! down_sample_featuresの計測 */
+static double run_down_sample_features(const bench_ctx *ctx) {
+  return bench_down_sample_features(ctx->feature_datas, ctx->datas, ctx->n_items, ctx->merge_num);
+}
+
+/*! derive_features_approxの計測 */
+static double run_derive_features_approx(const bench_ctx *ctx) {
+  return bench_derive_features_approx(ctx->feature_datas, ctx->datas, ctx->n_items);
+}
+
+/*! down_sample_features_approxの計測 */
+static double run_down_sample_features_approx(const bench_ctx *ctx) {
+  return bench_down_sample_features_approx(ctx->feature_datas, ctx->datas, ctx->n_items, ctx->merge_num);
+}
+
+/*! down_sample_features(--pairwise)の計測 */
+static double run_down_sample_features_pairwise(const bench_ctx *ctx) {
+  return bench_down_sample_features_pairwise(ctx->feature_datas, ctx->datas, ctx->n_items, ctx->merge_num);
+}
+
+/*! calc-gameのrrangeの計測 */
+static double run_rrange_calc(const bench_ctx *ctx) {
+  return (double)bench_rrange_calc(ctx->n_items);
+}
+
+/*! number-gameのrrangeの計測 */
+static double run_rrange_num(const bench_ctx *ctx) {
+  return (double)bench_rrange_num(ctx->n_items);
+}
+
+/*! 1回の処理の単位数(データ数) */
+static unsigned int units_items(const bench_ctx *ctx) {
+  return ctx->n_items;
+}
+
+/*! 1回の処理の単位数(ダウンサンプリングのブロック数) */
+static unsigned int units_blocks(const bench_ctx *ctx) {
+  return (ctx->n_items + ctx->merge_num - 1) / ctx->merge_num;
+}
+
+
+/*!
+ * キャプチャファイルを読み込み、n_items個になるまで繰り返して並べる
+ * @param [in]     filename キャプチャファイル名
+ * @param [in,out] ctx      計測の設定(datasとfeature_datasを確保する)
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int load_datas(const char *filename, bench_ctx *ctx) {
+  size_t       len, i;
+  data_fmt    *raw;
+  FILE        *f = fopen(filename, "r");
+
+  if (f == NULL) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    return -1;
+  }
+  raw                = read_csv(f, &len);
+  ctx->datas         = (data_fmt *)malloc(sizeof(data_fmt) * ctx->n_items);
+  ctx->feature_datas = (feature  *)malloc(sizeof(feature)  * ctx->n_items);
+  if (raw == NULL || ctx->datas == NULL || ctx->feature_datas == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return -1;
+  }
+  fclose(f);
+  if (len == 0) {
+    fprintf(stderr, "ファイル:%sに有効なデータがありません\n", filename);
+    return -1;
+  }
+  for (i = 0; i < ctx->n_items; i++) {
+    ctx->datas[i] = raw[i % len];
+  }
+  free(raw);
+  return 0;
+}
+
+
+/*!
+ * perfのハードウェアカウンタ(CPUサイクル数と命令数)を開く
+ * @param [out] pc 開いたカウンタ
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int open_perf_counters(perf_counters *pc) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = PERF_COUNT_HW_CPU_CYCLES;
+  attr.disabled       = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  attr.read_format    = PERF_FORMAT_GROUP;  // グループの値をまとめて読み出す
+  pc->fd_cycles = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if (pc->fd_cycles < 0) return -1;
+
+  attr.config   = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 0;
+  pc->fd_instrs = (int)syscall(__NR_perf_event_open, &attr, 0, -1, pc->fd_cycles, 0);
+  if (pc->fd_instrs < 0) {
+    close(pc->fd_cycles);
+    pc->fd_cycles = -1;
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 実行するCPUを固定する
+ * @param [in] cpu CPU番号
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int pin_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    perror("sched_setaffinity");
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 現在のタイムスタンプを得る
+ * @return TSCの値(TSCが無い環境では、単調増加時計のナノ秒)
+ */
+static uint64_t read_ticks(void) {
+#ifdef USE_RDTSC
+  unsigned int aux;
+  return __rdtscp(&aux);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+/*!
+ * ベンチマークを1回実行し、計測する
+ * @param [in]  bm  実行するベンチマーク
+ * @param [in]  ctx 計測の設定
+ * @param [in]  pc  perfのカウンタ(fd_cyclesが負なら用いない)
+ * @param [out] s   計測結果
+ */
+static void measure(const benchmark *bm, const bench_ctx *ctx, const perf_counters *pc, sample *s) {
+  uint64_t start, end;
+  uint64_t counts[3] = {0, 0, 0};  // 読み出したイベント数, サイクル数, 命令数
+
+  if (pc->fd_cycles >= 0) {
+    ioctl(pc->fd_cycles, PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+    ioctl(pc->fd_cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  start = read_ticks();
+  sink  = bm->run(ctx);
+  end   = read_ticks();
+  if (pc->fd_cycles >= 0) {
+    ioctl(pc->fd_cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(pc->fd_cycles, counts, sizeof(counts)) < 0) {
+      counts[1] = counts[2] = 0;
+    }
+  }
+  s->ticks  = (double)(end - start);
+  s->cycles = (double)counts[1];
+  s->instrs = (double)counts[2];
+}
+
+
+/*!
+ * 近似計算(-aオプション)の精度を、通常の計算との相対誤差で表示する
+ * 入力データそのもの(derive_features)と、ダウンサンプリングしたもの
+ * (down_sample_features)の両方について、特徴ごとの最大値と平均値を求める
+ * @param [in] ctx 計測の設定
+ */
+static void report_accuracy(const bench_ctx *ctx) {
+  feature      *exact  = (feature *)malloc(sizeof(feature) * ctx->n_items);
+  feature      *approx = (feature *)malloc(sizeof(feature) * ctx->n_items);
+  const char   *names[3] = {"len", "area", "cog_change"};
+  unsigned int  i, k, pass, n;
+
+  if (exact == NULL || approx == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    free(exact);
+    free(approx);
+    return;
+  }
+  printf("\naccuracy of -a (relative error against the exact path)\n");
+  printf("%-22s %-10s %12s %12s\n", "path", "feature", "max", "mean");
+  for (pass = 0; pass < 2; pass++) {
+    if (pass == 0) {
+      position prev_cog_pos = {0.0, 0.0, 0.0};
+      n = ctx->n_items;
+      derive_features(exact, ctx->datas, n);
+      derive_features_approx(approx, ctx->datas, n, &prev_cog_pos, 1);
+    } else {
+      n = (ctx->n_items + ctx->merge_num - 1) / ctx->merge_num;
+      down_sample_features(exact, ctx->datas, ctx->n_items, ctx->merge_num);
+      down_sample_features_approx(approx, ctx->datas, ctx->n_items, ctx->merge_num);
+    }
+    for (k = 0; k < 3; k++) {
+      double       max = 0.0, sum = 0.0;
+      unsigned int cnt = 0;
+      for (i = 0; i < n; i++) {
+        double x = k == 0 ? exact[i].len  : k == 1 ? exact[i].area  : exact[i].cog_change;
+        double y = k == 0 ? approx[i].len : k == 1 ? approx[i].area : approx[i].cog_change;
+        double e;
+        if (x == 0.0) continue;  // 最初のステップの重心位置の変化など
+        e = fabs(y - x) / fabs(x);
+        if (e > max) max = e;
+        sum += e;
+        cnt++;
+      }
+      printf("%-22s %-10s %12.3e %12.3e\n", pass == 0 ? "derive_features" : "down_sample_features",
+          names[k], max, cnt > 0 ? sum / cnt : 0.0);
+    }
+  }
+  free(exact);
+  free(approx);
+}
+
+
+/*!
+ * 計測値の平均、95%信頼区間の半幅、最小値を求める
+ * 信頼区間はt分布(自由度n-1)に基づく
+ * @param [in]  vals 計測値の配列(並べ替えられる)
+ * @param [in]  n    計測値の個数(2以上)
+ * @param [out] mean 平均
+ * @param [out] ci   95%信頼区間の半幅
+ * @param [out] min  最小値
+ */
+static void summarize(const double *vals, unsigned int n, double *mean, double *ci, double *min) {
+  // t分布の両側95%点(自由度1 ~ 30)
+  static const double T_TABLE[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+  unsigned int i;
+  double sum = 0.0, var = 0.0;
+  double t   = n - 1 <= 30 ? T_TABLE[n - 2] : 1.960;
+
+  for (i = 0; i < n; i++) sum += vals[i];
+  *mean = sum / n;
+  for (i = 0; i < n; i++) var += (vals[i] - *mean) * (vals[i] - *mean);
+  *ci = t * sqrt(var / (n - 1)) / sqrt((double)n);
+  qsort((void *)vals, n, sizeof(double), compare_double);
+  *min = vals[0];
+}
+
+
+/*!
+ * qsort用のdoubleの比較関数
+ * @param [in] a 比較する値1
+ * @param [in] b 比較する値2
+ * @return a < bなら負、a == bなら0、a > bなら正の値
+ */
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+/*!
+ * ベンチマークの使い方を表示する
+ * @param [in] prog_name プログラム名
+ */
+static void show_usage(const char *prog_name) {
+  puts  ("使い方:");
+  printf("    %s [-options]\n\n", prog_name);
+  puts("オプション:");
+  puts("  -c : 計測に用いるCPUを固定します");
+  puts("  -f : 入力csvファイル名を指定します(デフォルト: " DEFAULT_FILENAME ")");
+  puts("  -h : 使い方を表示します");
+  puts("  -m : down_sample_featuresで結合する要素数を指定します");
+  puts("  -n : 1回の計測で処理するデータ数を指定します");
+  puts("  -p : perfのハードウェアカウンタで、CPUサイクル数と命令数も計測します");
+  puts("  -r : 計測回数を指定します");
+}
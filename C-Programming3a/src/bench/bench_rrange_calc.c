@@ -0,0 +1,24 @@
+// calcgame.cのstatic関数rrangeを直接呼び出すために、ソースファイルごと取り込む。
+// number-gameと公開関数の名前が重複するので、名前を付け替えておく。
+#define play_game_server  calcgame_play_game_server
+#define play_game_client  calcgame_play_game_client
+#define read_question     calcgame_read_question
+#include "calcgame.c"
+#include "bench.h"
+
+
+
+
+/*!
+ * calcgame.cのrrangeをn回呼び出す(calcgame.cと同じく、引数は大小逆順で与える)
+ * @param [in] n 呼び出し回数
+ * @return 結果の総和(最適化で呼び出しが消されないようにするため)
+ */
+long bench_rrange_calc(unsigned int n) {
+  unsigned int i;
+  long sum = 0;
+  for (i = 0; i < n; i++) {
+    sum += rrange(RANGE_MAX, RANGE_MIN);
+  }
+  return sum;
+}
@@ -0,0 +1,24 @@
+// numgame.cのstatic関数rrangeを直接呼び出すために、ソースファイルごと取り込む。
+// calc-gameと公開関数の名前が重複するので、名前を付け替えておく。
+#define play_game_server  numgame_play_game_server
+#define play_game_client  numgame_play_game_client
+#define read_question     numgame_read_question
+#include "numgame.c"
+#include "bench.h"
+
+
+
+
+/*!
+ * numgame.cのrrangeをn回呼び出す
+ * @param [in] n 呼び出し回数
+ * @return 結果の総和(最適化で呼び出しが消されないようにするため)
+ */
+long bench_rrange_num(unsigned int n) {
+  unsigned int i;
+  long sum = 0;
+  for (i = 0; i < n; i++) {
+    sum += rrange(RANGE_MIN, RANGE_MAX);
+  }
+  return sum;
+}
@@ -0,0 +1,688 @@
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lib/dtw.h"
+#include "lib/feature_file.h"
+#include "lib/pose_index.h"
+#include "lib/thread_pool.h"
+
+#define DEFAULT_TOP_K       10
+#define DEFAULT_BAND_RATIO  10  // 帯の幅を指定しないときの、クエリの長さに対する割合(%)
+#define LIST_LINE_LEN     4096  // 候補のファイル名のリストの1行の最大の長さ
+#define CH_LEN               1  // 距離の総和のチャンネル
+#define CH_AREA              2  // 面積のチャンネル
+#define CH_COG               4  // 重心位置の変化のチャンネル
+#define CH_ALL  (CH_LEN | CH_AREA | CH_COG)
+
+// コマンドライン引数で指定される設定
+typedef struct {
+  const char   *query_filename;  // クエリを取り出す特徴データのファイル名
+  size_t        query_start;     // クエリの先頭の行
+  size_t        query_len;       // クエリの行数(0なら末尾まで)
+  unsigned int  top_k;           // 書き出す候補の数
+  int           band;            // Sakoe-Chibaの帯の幅(負ならクエリの長さのDEFAULT_BAND_RATIO%)
+  int           channels;        // 比べる特徴(CH_xxxの論理和)
+  const char   *list_filename;   // 候補のファイル名のリスト(NULLなら引数のみ)
+  unsigned int  n_threads;       // ワーカスレッド数
+  int           verbose;         // 枝刈りの統計を表示するかどうか
+  int           use_pose;        // 重心位置の索引から、点の近くのブロックを探すかどうか(-pオプション)
+  double        point[3];        // 探す点(x, y, z)
+  double        radius;          // 探す半径
+} cmd_options;
+
+// 1つの候補のファイルで見つかった、最も近い部分系列
+typedef struct {
+  double       dist;        // DTW距離(2乗和)
+  unsigned int file_index;  // 候補のファイルの番号
+  size_t       pos;         // 部分系列の先頭の行
+  double       start_time;  // 部分系列の最初の行の時間
+  double       end_time;    // 部分系列の最後の行の時間
+} match;
+
+// 全てのタスクで共有する探索の状態
+typedef struct {
+  const dtw_query *query;
+  int              channels;    // 比べる特徴(CH_xxxの論理和)
+  match           *top;         // 距離の小さい順に並べた上位の候補(top_k個分の領域)
+  unsigned int     top_k;
+  unsigned int     n_top;       // 上位の候補の数
+  dtw_stats        stats;       // 全てのタスクの枝刈りの統計
+  unsigned int     n_failed;    // 読み込めなかった候補のファイルの数
+  pthread_mutex_t  lock;        // 上記の可変なメンバを保護する
+} search_state;
+
+// 点の近くで見つかったブロック
+typedef struct {
+  const pose_record *rec;   // 索引のレコード
+  double             dist;  // 点からの距離
+} pose_hit;
+
+// 1つの索引ファイルで見つかったブロックの一覧
+typedef struct {
+  pose_hit *hits;
+  size_t    n_hits;
+  size_t    cap;
+  int       failed;  // メモリ確保に失敗したかどうか
+} pose_hits;
+
+// 1つの候補のファイルを探すタスク
+typedef struct {
+  search_state *state;
+  const char   *filename;
+  unsigned int  file_index;
+} search_task;
+
+static int    opt_parse(int argc, char *argv[], cmd_options *opts);
+static int    parse_channels(const char *str);
+static int    parse_point(const char *str, double p[3]);
+static long   convert_str2long(const char *str, const char *name, long min_val);
+static void   show_usage(const char *prog_name);
+static int    extract_channels(double **ch, const feature *rows, size_t len, int channels);
+static int    read_list(const char *filename, char ***names, unsigned int *n_names);
+static void   run_task(void *arg, unsigned int worker_id);
+static double current_threshold(search_state *s);
+static void   insert_match(search_state *s, const match *mt);
+static int    run_pose_query(const cmd_options *opts, const search_task *tasks, unsigned int n_files);
+static void   collect_pose(const pose_record *rec, double dist, void *arg);
+static int    compare_hits(const void *a, const void *b);
+
+
+
+
+/*!
+ * プログラムのエントリポイント
+ * 特徴データのファイルから切り出したクエリに最も近い動きを含む候補のファイルを、
+ * DTW距離の小さい順にtop_k個書き出す
+ * -pオプションを指定した場合は、代わりに候補の索引ファイルから、重心位置が点の近くにあるブロックを書き出す
+ * @param [in] argc コマンドライン引数の個数(プログラム名も含む)
+ * @param [in] argv コマンドライン引数の配列
+ * @return 終了コード
+ */
+int main(int argc, char *argv[]) {
+  cmd_options   opts;
+  feature_seq   query_seq;
+  dtw_query     query;
+  search_state  state;
+  search_task  *tasks;
+  thread_pool  *pool;
+  double       *query_ch[DTW_MAX_CHANNELS];
+  char        **names = NULL;
+  unsigned int  n_names = 0, n_files, n_ch, i;
+  size_t        m;
+
+  opts.query_filename = NULL;
+  opts.query_start    = 0;
+  opts.query_len      = 0;
+  opts.top_k          = DEFAULT_TOP_K;
+  opts.band           = -1;
+  opts.channels       = CH_ALL;
+  opts.list_filename  = NULL;
+  opts.n_threads      = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+  opts.verbose        = 0;
+  opts.use_pose       = 0;
+  opts.radius         = 0.0;
+  if (opt_parse(argc, argv, &opts) != 0) {
+    return EXIT_FAILURE;
+  }
+  if (opts.query_filename == NULL && !opts.use_pose) {
+    fputs("クエリのファイルを-qオプションで指定してください\n", stderr);
+    show_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (opts.use_pose && !(opts.radius > 0.0)) {
+    fputs("-pオプションでは、探す半径を-Rオプションで指定してください\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  /* ----- 候補のファイルの一覧 ----- */
+  if (opts.list_filename != NULL && read_list(opts.list_filename, &names, &n_names) != 0) {
+    return EXIT_FAILURE;
+  }
+  n_files = n_names + (unsigned int)(argc - optind);
+  if (n_files == 0) {
+    fputs("候補のファイルを指定してください\n", stderr);
+    return EXIT_FAILURE;
+  }
+  tasks = (search_task *)malloc(sizeof(search_task) * n_files);
+  if (tasks == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < n_files; i++) {
+    tasks[i].state      = &state;
+    tasks[i].filename   = i < n_names ? names[i] : argv[optind + i - n_names];
+    tasks[i].file_index = i;
+  }
+
+  /* ----- 索引から点の近くのブロックを探す(-pオプション) ----- */
+  if (opts.use_pose) {
+    int ret = run_pose_query(&opts, tasks, n_files);
+    free(tasks);
+    for (i = 0; i < n_names; i++) free(names[i]);
+    free(names);
+    return ret == 0 && fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  /* ----- クエリの準備 ----- */
+  if (load_feature_file(&query_seq, opts.query_filename) != 0) {
+    return EXIT_FAILURE;
+  }
+  if (opts.query_start >= query_seq.len) {
+    fprintf(stderr, "クエリの先頭の行が、ファイル:%sの行数(%zu)を超えています\n", opts.query_filename, query_seq.len);
+    return EXIT_FAILURE;
+  }
+  m = opts.query_len != 0 ? opts.query_len : query_seq.len - opts.query_start;
+  if (m > query_seq.len - opts.query_start || m > UINT_MAX) {
+    fprintf(stderr, "クエリの行が、ファイル:%sの末尾を超えています\n", opts.query_filename);
+    return EXIT_FAILURE;
+  }
+  if (opts.band < 0) opts.band = (int)(m * DEFAULT_BAND_RATIO / 100);
+  n_ch = extract_channels(query_ch, query_seq.rows + opts.query_start, m, opts.channels);
+  if (n_ch == 0 || dtw_query_init(&query, (const double *const *)query_ch, n_ch, (unsigned int)m, (unsigned int)opts.band) != 0) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return EXIT_FAILURE;
+  }
+  free(query_ch[0]);
+  release_feature_file(&query_seq);
+
+  /* ----- 候補のファイルごとに並列に探索 ----- */
+  // 他のタスクが見つけた上位の候補の距離を、各タスクの打ち切りの初期値に用いる
+  memset(&state, 0, sizeof(state));
+  state.query    = &query;
+  state.channels = opts.channels;
+  state.top_k    = opts.top_k;
+  state.top      = (match *)malloc(sizeof(match) * opts.top_k);
+  if (state.top == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return EXIT_FAILURE;
+  }
+  pthread_mutex_init(&state.lock, NULL);
+  pool = thread_pool_create(opts.n_threads);
+  if (pool == NULL) {
+    fputs("スレッドプールを作成できませんでした\n", stderr);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < n_files; i++) {
+    if (thread_pool_submit(pool, run_task, &tasks[i]) != 0) {
+      run_task(&tasks[i], 0);  // 投入できなかったタスクはこのスレッドで処理する
+    }
+  }
+  thread_pool_wait(pool);
+  thread_pool_destroy(pool);
+  pthread_mutex_destroy(&state.lock);
+
+  /* ----- 結果の書き出し ----- */
+  printf("# query=%s start=%zu rows=%zu band=%u channels=%s%s%s%s%s\n", opts.query_filename, opts.query_start, m, query.r,
+      opts.channels & CH_LEN ? "len" : "",
+      (opts.channels & CH_LEN) && (opts.channels & (CH_AREA | CH_COG)) ? "+" : "",
+      opts.channels & CH_AREA ? "area" : "",
+      (opts.channels & CH_AREA) && (opts.channels & CH_COG) ? "+" : "",
+      opts.channels & CH_COG ? "cog" : "");
+  for (i = 0; i < state.n_top; i++) {
+    const match *mt = &state.top[i];
+    printf("%u %lf %lf %lf %zu %s\n", i + 1, sqrt(mt->dist), mt->start_time, mt->end_time, mt->pos, tasks[mt->file_index].filename);
+  }
+  if (opts.verbose) {
+    const dtw_stats *st = &state.stats;
+    fprintf(stderr, "位置:%llu LB_Kim:%llu LB_Keogh(クエリ):%llu LB_Keogh(候補):%llu DTW:%llu(打ち切り:%llu)\n",
+        st->n_windows, st->kim, st->keogh_eq, st->keogh_ec, st->dtw, st->abandoned);
+  }
+  if (state.n_failed > 0) {
+    fprintf(stderr, "%u個の候補のファイルを読み込めなかったので、飛ばしました\n", state.n_failed);
+  }
+
+  dtw_query_destroy(&query);
+  free(state.top);
+  free(tasks);
+  for (i = 0; i < n_names; i++) free(names[i]);
+  free(names);
+  return fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*!
+ * オプションを解析する
+ * @param [in]     argc コマンドライン引数の個数(プログラム名も含む)
+ * @param [in]     argv コマンドライン引数の配列
+ * @param [in,out] opts 解析結果を格納する設定(あらかじめデフォルト値を設定しておくこと)
+ * @return 正常に解析出来たならば0を、プログラムを終了させるときは-1を返す
+ */
+static int opt_parse(int argc, char *argv[], cmd_options *opts) {
+  int ch;  // オプション文字格納用変数
+  while ((ch = getopt(argc, argv, "c:hj:k:l:n:p:q:R:r:s:v")) != -1) {
+    switch (ch) {
+      case 'c':  // 比べる特徴を指定する
+        opts->channels = parse_channels(optarg);
+        if (opts->channels == 0) return -1;
+        break;
+      case 'h':  // ヘルプを表示する
+        show_usage(argv[0]);
+        exit(EXIT_SUCCESS);
+      case 'j':  // ワーカスレッド数を指定
+        opts->n_threads = (unsigned int)convert_str2long(optarg, "スレッド数", 1);
+        break;
+      case 'k':  // 書き出す候補の数を指定
+        opts->top_k = (unsigned int)convert_str2long(optarg, "候補の数", 1);
+        break;
+      case 'l':  // 候補のファイル名のリストを指定
+        opts->list_filename = optarg;
+        break;
+      case 'n':  // クエリの行数を指定
+        opts->query_len = (size_t)convert_str2long(optarg, "クエリの行数", 1);
+        break;
+      case 'p':  // 重心位置の索引から、点の近くのブロックを探す
+        if (parse_point(optarg, opts->point) != 0) return -1;
+        opts->use_pose = 1;
+        break;
+      case 'q':  // クエリを取り出すファイルを指定
+        opts->query_filename = optarg;
+        break;
+      case 'R':  // 点の近くのブロックを探す半径を指定
+        {
+          char *check;
+          opts->radius = strtod(optarg, &check);
+          if (check == optarg || *check != '\0' || !(opts->radius > 0.0) || !isfinite(opts->radius)) {
+            fputs("半径には0より大きい有限の値を指定してください\n", stderr);
+            return -1;
+          }
+        }
+        break;
+      case 'r':  // 帯の幅を指定
+        opts->band = (int)convert_str2long(optarg, "帯の幅", 0);
+        break;
+      case 's':  // クエリの先頭の行を指定
+        opts->query_start = (size_t)convert_str2long(optarg, "クエリの先頭の行", 0);
+        break;
+      case 'v':  // 枝刈りの統計を表示する
+        opts->verbose = 1;
+        break;
+      default:   // 存在しないオプションが指定されたとき
+        fputs("無効なオプションが指定されています\n", stderr);
+        return -1;
+    }
+  }
+  return 0;
+}
+
+
+/*!
+ * 比べる特徴の指定を解析する
+ * len, area, cog を+でつないだもの、もしくは all
+ * @param [in] str 解析する文字列
+ * @return CH_xxxの論理和(不正な指定なら0)
+ */
+static int parse_channels(const char *str) {
+  static const struct {
+    const char *name;
+    int         flag;
+  } CHANNEL_NAMES[] = {
+    {"len", CH_LEN}, {"area", CH_AREA}, {"cog", CH_COG}, {"all", CH_ALL}
+  };
+  int channels = 0;
+
+  for (;;) {
+    size_t       name_len = strcspn(str, "+");
+    unsigned int i;
+
+    for (i = 0; i < sizeof(CHANNEL_NAMES) / sizeof(CHANNEL_NAMES[0]); i++) {
+      if (strlen(CHANNEL_NAMES[i].name) == name_len && strncmp(str, CHANNEL_NAMES[i].name, name_len) == 0) break;
+    }
+    if (i == sizeof(CHANNEL_NAMES) / sizeof(CHANNEL_NAMES[0])) {
+      fprintf(stderr, "特徴の名前:%.*sは無効です(len, area, cog, allのいずれかを指定してください)\n", (int)name_len, str);
+      return 0;
+    }
+    channels |= CHANNEL_NAMES[i].flag;
+    str += name_len;
+    if (*str == '\0') return channels;
+    str++;
+  }
+}
+
+
+/*!
+ * 点の指定"x,y,z"を解析する
+ * @param [in]  str 解析する文字列
+ * @param [out] p   点(x, y, z)
+ * @return 成功したなら0を、指定が不正なら-1を返す
+ */
+static int parse_point(const char *str, double p[3]) {
+  const char *s = str;
+  char       *end;
+  int         a;
+
+  for (a = 0; a < 3; a++) {
+    p[a] = strtod(s, &end);
+    if (end == s || !isfinite(p[a]) || *end != (a < 2 ? ',' : '\0')) {
+      fprintf(stderr, "点の指定:%sが不正です(x,y,z)\n", str);
+      return -1;
+    }
+    s = end + 1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 引数の文字列を、min_val以上の数値に変換する。
+ * @param [in] str     数値に変換する文字列
+ * @param [in] name    エラーメッセージに用いる、値の名前
+ * @param [in] min_val 値の最小値
+ * @return 変換した数値
+ */
+static long convert_str2long(const char *str, const char *name, long min_val) {
+  char *check;
+  long  num = strtol(str, &check, 10);
+  if (check == str || *check != '\0') {
+    fputs("文字列に数値以外がありました\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (num < min_val) {
+    fprintf(stderr, "%sに%ld未満の値を指定しないでください\n", name, min_val);
+    exit(EXIT_FAILURE);
+  } else if (num >= INT_MAX) {
+    fprintf(stderr, "%sの値が大きすぎます\n", name);
+    exit(EXIT_FAILURE);
+  }
+  return num;
+}
+
+
+/*!
+ * プログラムの使い方を表示する
+ * @param [in] prog_name プログラム名
+ */
+static void show_usage(const char *prog_name) {
+  puts  ("使い方:");
+  printf("    %s -q query [-options] candidate...\n", prog_name);
+  puts  ("  または");
+  printf("    %s -p x,y,z -R radius index...\n\n", prog_name);
+
+  puts("オプション:");
+  puts("  -c : 比べる特徴を指定します(len, area, cog を+でつないだもの、または all。デフォルトは all)");
+  puts("  -h : 使い方を表示します");
+  puts("  -j : ワーカスレッド数を指定します");
+  printf("  -k : 書き出す候補の数を指定します(デフォルトは%d)\n", DEFAULT_TOP_K);
+  puts("  -l : 候補のファイル名を1行に1つずつ書いたファイルを指定します");
+  puts("  -n : クエリの行数を指定します(デフォルトはファイルの末尾まで)");
+  puts("  -p : 索引ファイル(group03の--indexオプション)から、重心位置が点の近くにあるブロックを探します");
+  puts("  -q : クエリを取り出す特徴データのファイルを指定します");
+  puts("  -R : -pオプションで探す半径を指定します");
+  printf("  -r : DTWで対応付ける行のずれの上限を指定します(デフォルトはクエリの行数の%d%%)\n", DEFAULT_BAND_RATIO);
+  puts("  -s : クエリの先頭の行を指定します(0から数える。デフォルトは0)");
+  puts("  -v : 下界による枝刈りの統計を表示します\n");
+
+  puts("使用例:");
+  puts("  $ g3search -q session1.g3f -s 120 -n 40 -k 5 sessions/*.g3f");
+  puts("  $ g3search -q query.txt -c len+cog -r 4 -l list.txt");
+  puts("  $ g3search -p 1200,300,950 -R 50 sessions/*.txt.g3kd\n");
+
+  puts("補足:");
+  puts("  特徴データのファイルは、group03の--binaryオプションで書き出したもの(mmapして読み込む)か、");
+  puts("  通常のテキストの出力です");
+}
+
+
+/*!
+ * 特徴データから、比べる特徴のチャンネルごとの配列を作る
+ * @param [out] ch       チャンネルごとの配列(ch[0]に全ての領域をまとめて確保するので、ch[0]を解放する)
+ * @param [in]  rows     特徴データの配列
+ * @param [in]  len      特徴データの要素数
+ * @param [in]  channels 比べる特徴(CH_xxxの論理和)
+ * @return チャンネル数(メモリ確保に失敗したなら0)
+ */
+static int extract_channels(double **ch, const feature *rows, size_t len, int channels) {
+  int     n_ch = (channels & CH_LEN ? 1 : 0) + (channels & CH_AREA ? 1 : 0) + (channels & CH_COG ? 1 : 0);
+  int     c = 0;
+  size_t  i;
+  double *d = (double *)malloc(sizeof(double) * (len * n_ch + 1));
+
+  if (d == NULL) return 0;
+  if (channels & CH_LEN) {
+    ch[c] = d + len * c;
+    for (i = 0; i < len; i++) ch[c][i] = rows[i].len;
+    c++;
+  }
+  if (channels & CH_AREA) {
+    ch[c] = d + len * c;
+    for (i = 0; i < len; i++) ch[c][i] = rows[i].area;
+    c++;
+  }
+  if (channels & CH_COG) {
+    ch[c] = d + len * c;
+    for (i = 0; i < len; i++) ch[c][i] = rows[i].cog_change;
+    c++;
+  }
+  return n_ch;
+}
+
+
+/*!
+ * 候補のファイル名のリストを読み込む(空行は無視する)
+ * @param [in]  filename リストのファイル名
+ * @param [out] names    ファイル名の配列(各要素と配列をfree()で解放する)
+ * @param [out] n_names  ファイル名の数
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int read_list(const char *filename, char ***names, unsigned int *n_names) {
+  char         line[LIST_LINE_LEN];
+  unsigned int cap = 0;
+  FILE        *f = fopen(filename, "r");
+
+  if (f == NULL) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    return -1;
+  }
+  *names   = NULL;
+  *n_names = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0') continue;
+    if (*n_names == cap) {
+      char **grown;
+      cap   = cap == 0 ? 64 : cap * 2;
+      grown = (char **)realloc(*names, sizeof(char *) * cap);
+      if (grown == NULL) goto nomem;
+      *names = grown;
+    }
+    (*names)[*n_names] = strdup(line);
+    if ((*names)[*n_names] == NULL) goto nomem;
+    (*n_names)++;
+  }
+  fclose(f);
+  return 0;
+
+nomem:
+  fputs("メモリ確保に失敗しました\n", stderr);
+  fclose(f);
+  return -1;
+}
+
+
+/*!
+ * 1つの候補のファイルを読み込んで探索する(スレッドプールのタスク)
+ * 打ち切りの初期値は、その時点の上位の候補のうち最も遠いものの距離とする
+ * (距離が同じ場合はファイルの番号の小さい方を優先するので、同じ距離も探せるよう少しだけ大きくする)
+ * @param [in,out] arg       探索するファイル(search_task)
+ * @param [in]     worker_id ワーカスレッドの番号(未使用)
+ */
+static void run_task(void *arg, unsigned int worker_id) {
+  search_task  *t = (search_task *)arg;
+  search_state *s = t->state;
+  feature_seq   seq;
+  double       *ch[DTW_MAX_CHANNELS];
+  dtw_stats     stats;
+  match         mt;
+  int           ret;
+  (void)worker_id;
+
+  if (load_feature_file(&seq, t->filename) != 0) {
+    pthread_mutex_lock(&s->lock);
+    s->n_failed++;
+    pthread_mutex_unlock(&s->lock);
+    return;
+  }
+  memset(&stats, 0, sizeof(stats));
+  if (extract_channels(ch, seq.rows, seq.len, s->channels) == 0) {
+    ret = -1;
+  } else {
+    ret = dtw_search(s->query, (const double *const *)ch, seq.len, nextafter(current_threshold(s), INFINITY),
+        &mt.dist, &mt.pos, &stats);
+    free(ch[0]);
+  }
+  if (ret == 0) {
+    mt.file_index = t->file_index;
+    mt.start_time = seq.rows[mt.pos].time;
+    mt.end_time   = seq.rows[mt.pos + s->query->m - 1].time;
+  }
+  release_feature_file(&seq);
+
+  pthread_mutex_lock(&s->lock);
+  if (ret < 0) {
+    fprintf(stderr, "ファイル:%sの探索中に、メモリ確保に失敗しました\n", t->filename);
+    s->n_failed++;
+  }
+  s->stats.n_windows += stats.n_windows;
+  s->stats.kim       += stats.kim;
+  s->stats.keogh_eq  += stats.keogh_eq;
+  s->stats.keogh_ec  += stats.keogh_ec;
+  s->stats.dtw       += stats.dtw;
+  s->stats.abandoned += stats.abandoned;
+  pthread_mutex_unlock(&s->lock);
+  if (ret == 0) insert_match(s, &mt);
+}
+
+
+/*!
+ * 上位の候補に入るために必要な距離を得る
+ * @param [in] s 探索の状態
+ * @return 上位の候補が揃っていれば最も遠いものの距離、揃っていなければINFINITY
+ */
+static double current_threshold(search_state *s) {
+  double thr;
+
+  pthread_mutex_lock(&s->lock);
+  thr = s->n_top == s->top_k ? s->top[s->n_top - 1].dist : INFINITY;
+  pthread_mutex_unlock(&s->lock);
+  return thr;
+}
+
+
+/*!
+ * 見つかった部分系列を、距離(同じならファイルの番号)の小さい順に上位の候補へ挿入する
+ * 候補の処理の順序によらず、同じ結果になる
+ * @param [in,out] s  探索の状態
+ * @param [in]     mt 見つかった部分系列
+ */
+static void insert_match(search_state *s, const match *mt) {
+  unsigned int i;
+
+  pthread_mutex_lock(&s->lock);
+  for (i = s->n_top; i > 0; i--) {
+    const match *prev = &s->top[i - 1];
+    if (prev->dist < mt->dist || (prev->dist == mt->dist && prev->file_index < mt->file_index)) break;
+  }
+  if (i < s->top_k) {
+    unsigned int last = s->n_top < s->top_k ? s->n_top : s->top_k - 1;
+    memmove(&s->top[i + 1], &s->top[i], sizeof(match) * (last - i));
+    s->top[i] = *mt;
+    if (s->n_top < s->top_k) s->n_top++;
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+
+/*!
+ * 候補の索引ファイルごとに、重心位置が点から半径以内のブロックを探して書き出す
+ * 索引はk-d木なので、ブロック数nのファイルをO(log n + 見つかった数)で調べられる
+ * 結果はファイルの順に、各ファイルの中ではブロックの順に、1行に
+ * "距離 時間 ブロック 重心x 重心y 重心z 辺1 辺2 辺3 面積 ファイル名"の書式で書き出す
+ * @param [in] opts    コマンドライン引数で指定された設定
+ * @param [in] tasks   候補のファイル(filenameのみ用いる)
+ * @param [in] n_files 候補のファイルの数
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+static int run_pose_query(const cmd_options *opts, const search_task *tasks, unsigned int n_files) {
+  pose_hits    result = {NULL, 0, 0, 0};
+  size_t       total = 0;
+  unsigned int i, n_failed = 0;
+
+  printf("# pose=%lf,%lf,%lf radius=%lf\n", opts->point[0], opts->point[1], opts->point[2], opts->radius);
+  for (i = 0; i < n_files; i++) {
+    pose_index idx;
+    size_t     j;
+
+    if (load_pose_index(&idx, tasks[i].filename) != 0) {
+      n_failed++;
+      continue;
+    }
+    result.n_hits = 0;
+    pose_index_radius(&idx, opts->point, opts->radius, collect_pose, &result);
+    if (result.failed) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      release_pose_index(&idx);
+      free(result.hits);
+      return -1;
+    }
+    qsort(result.hits, result.n_hits, sizeof(pose_hit), compare_hits);
+    for (j = 0; j < result.n_hits; j++) {
+      const pose_record *rec = result.hits[j].rec;
+      printf("%lf %lf %u %lf %lf %lf %lf %lf %lf %lf %s\n", result.hits[j].dist, rec->time, rec->block,
+          rec->cog[0], rec->cog[1], rec->cog[2], rec->side[0], rec->side[1], rec->side[2], rec->area, tasks[i].filename);
+    }
+    total += result.n_hits;
+    release_pose_index(&idx);
+  }
+  if (opts->verbose) {
+    fprintf(stderr, "ファイル:%u ブロック:%zu\n", n_files - n_failed, total);
+  }
+  if (n_failed > 0) {
+    fprintf(stderr, "%u個の索引ファイルを読み込めなかったので、飛ばしました\n", n_failed);
+  }
+  free(result.hits);
+  return 0;
+}
+
+
+/*!
+ * 見つかったブロックを一覧に加える(pose_index_radius()に渡す関数)
+ * @param [in]     rec  見つかったレコード
+ * @param [in]     dist 点からの距離
+ * @param [in,out] arg  ブロックの一覧(pose_hits)
+ */
+static void collect_pose(const pose_record *rec, double dist, void *arg) {
+  pose_hits *h = (pose_hits *)arg;
+
+  if (h->failed) return;
+  if (h->n_hits == h->cap) {
+    size_t    cap   = h->cap == 0 ? 256 : h->cap * 2;
+    pose_hit *grown = (pose_hit *)realloc(h->hits, sizeof(pose_hit) * cap);
+    if (grown == NULL) {
+      h->failed = 1;
+      return;
+    }
+    h->hits = grown;
+    h->cap  = cap;
+  }
+  h->hits[h->n_hits].rec  = rec;
+  h->hits[h->n_hits].dist = dist;
+  h->n_hits++;
+}
+
+
+/*!
+ * 見つかったブロックを、ブロックの番号の順に並べるための比較関数
+ * @param [in] a 比較する要素
+ * @param [in] b 比較する要素
+ * @return aを先にするなら負、bを先にするなら正、同じなら0
+ */
+static int compare_hits(const void *a, const void *b) {
+  uint32_t x = ((const pose_hit *)a)->rec->block;
+  uint32_t y = ((const pose_hit *)b)->rec->block;
+
+  return x < y ? -1 : (x > y);
+}
@@ -0,0 +1,434 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "archive.h"
+
+#define N_COLUMNS           (FIXED_COL + 1)                // 列数(時間 + 座標)
+#define FILE_HEADER_SIZE    24                             // ファイルヘッダのバイト数
+#define COL_HEADER_SIZE      9                             // 列ヘッダ(先頭の値 + 符号化方式)のバイト数
+#define PACKED_SIZE(w)      ((w) * ARCHIVE_BLOCK_LEN / 8)  // ビット幅wでパックした値の列のバイト数
+#define MAX_BLOCK_SIZE      (8 + N_COLUMNS * (COL_HEADER_SIZE + PACKED_SIZE(64)))
+#define BUF_SLACK            8                             // 8バイト単位の読み書きがはみ出す分の余白
+#define ENC_DOD           0x80                             // 差分の差分(delta-of-delta)で符号化した列
+#define WIDTH_MASK        0x7f                             // 符号化方式のバイトのうち、ビット幅の部分
+#define INITIAL_LEN       8192                             // 最初に確保する配列の要素数(足りなくなったら倍に広げる)
+
+#define ZIGZAG_ENCODE(n)  (((uint64_t)(n) << 1) ^ (uint64_t)((n) >> 63))
+#define ZIGZAG_DECODE(u)  ((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+
+static uint32_t       load_le32(const uint8_t *p);
+static uint64_t       load_le64(const uint8_t *p);
+static void           store_le32(uint8_t *p, uint32_t v);
+static void           store_le64(uint8_t *p, uint64_t v);
+static int            bit_width(uint64_t v);
+static void           put_bits(uint8_t *buf, uint64_t bitpos, uint64_t v, int w);
+static uint64_t       get_bits(const uint8_t *buf, uint64_t bitpos, int w);
+static size_t         encode_column(uint8_t *out, const int64_t *v, unsigned int n);
+static const uint8_t *decode_column(const uint8_t *p, const uint8_t *end, int64_t *v);
+static void           unpack_bits(uint64_t *out, const uint8_t *p, int w);
+static void          *read_blocks(FILE *f, int is_fixed, size_t *len);
+
+
+
+
+/*!
+ * ファイルがアーカイブであるかどうかを、先頭のマジックで判定する
+ * @param [in] filename 判定するファイル名
+ * @return アーカイブなら1を、それ以外(開けない場合も含む)なら0を返す
+ */
+int is_archive_file(const char *filename) {
+  char  magic[4];
+  int   ret = 0;
+  FILE *f   = fopen(filename, "rb");
+  if (f == NULL) return 0;
+  if (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) {
+    ret = memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) == 0;
+  }
+  fclose(f);
+  return ret;
+}
+
+
+/*!
+ * 固定小数点数のデータを、アーカイブとして書き出す
+ * ARCHIVE_BLOCK_LENフレームごとに、列ごとの差分(または差分の差分)を
+ * ジグザグ符号化し、最小のビット幅でパックする
+ * @param [in] f     書き出し先のファイルポインタ(バイナリモードで開いておくこと)
+ * @param [in] datas 書き出すデータ
+ * @param [in] len   データ数
+ * @return 正常に書き出せたなら0を、それ以外なら-1を返す
+ */
+int write_archive(FILE *f, const fixed_fmt *datas, unsigned int len) {
+  static uint8_t block[MAX_BLOCK_SIZE + BUF_SLACK];   // 1ブロック分の書き出し用バッファ
+  static int64_t cols[N_COLUMNS][ARCHIVE_BLOCK_LEN];  // 列ごとに並べ替えた値
+  uint8_t      header[FILE_HEADER_SIZE];
+  unsigned int i;
+
+  memcpy(header, ARCHIVE_MAGIC, 4);
+  store_le32(header +  4, ARCHIVE_VERSION);
+  store_le64(header +  8, len);
+  store_le32(header + 16, ARCHIVE_BLOCK_LEN);
+  store_le32(header + 20, FIXED_SCALE);
+  if (fwrite(header, 1, sizeof(header), f) != sizeof(header)) return -1;
+
+  for (i = 0; i < len; i += ARCHIVE_BLOCK_LEN, datas += ARCHIVE_BLOCK_LEN) {
+    unsigned int n    = len - i < ARCHIVE_BLOCK_LEN ? len - i : ARCHIVE_BLOCK_LEN;
+    size_t       size = 8;
+    unsigned int j;
+    int          c;
+
+    for (j = 0; j < n; j++) {  // 行(フレーム)単位から列単位に並べ替える
+      cols[0][j] = datas[j].time;
+      for (c = 0; c < FIXED_COL; c++) {
+        cols[c + 1][j] = datas[j].pos[c];
+      }
+    }
+    for (c = 0; c < N_COLUMNS; c++) {
+      size += encode_column(block + size, cols[c], n);
+    }
+    store_le32(block,     (uint32_t)(size - 4));  // ブロックのバイト数(この4バイトを除く)
+    store_le32(block + 4, n);
+    if (fwrite(block, 1, size, f) != size) return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * アーカイブを読み込み、double型のデータに展開する
+ * @param [in]  f   アーカイブのファイルポインタ(バイナリモードで開いておくこと)
+ * @param [out] len 展開したデータ数
+ * @return 展開したデータの配列(free()で解放する)。アーカイブが不正なときや、メモリ確保に失敗したときは
+ *         エラーメッセージを出力してNULLを返す(途中までのデータは返さない)
+ */
+data_fmt *read_archive(FILE *f, size_t *len) {
+  return (data_fmt *)read_blocks(f, 0, len);
+}
+
+
+/*!
+ * アーカイブを読み込み、固定小数点数のデータに展開する
+ * 量子化した値をそのまま取り出すので、-xオプションの処理に直接渡すことができる
+ * @param [in]  f   アーカイブのファイルポインタ(バイナリモードで開いておくこと)
+ * @param [out] len 展開したデータ数
+ * @return 展開したデータの配列(free()で解放する)。アーカイブが不正なときや、メモリ確保に失敗したときは
+ *         エラーメッセージを出力してNULLを返す(途中までのデータは返さない)
+ */
+fixed_fmt *read_archive_fixed(FILE *f, size_t *len) {
+  return (fixed_fmt *)read_blocks(f, 1, len);
+}
+
+
+
+
+/*!
+ * リトルエンディアンの32bit整数を読み出す
+ * @param [in] p 読み出す位置
+ * @return 読み出した値
+ */
+static uint32_t load_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/*!
+ * リトルエンディアンの64bit整数を読み出す
+ * @param [in] p 読み出す位置
+ * @return 読み出した値
+ */
+static uint64_t load_le64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+
+/*!
+ * 32bit整数をリトルエンディアンで書き込む
+ * @param [out] p 書き込む位置
+ * @param [in]  v 書き込む値
+ */
+static void store_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+
+/*!
+ * 64bit整数をリトルエンディアンで書き込む
+ * @param [out] p 書き込む位置
+ * @param [in]  v 書き込む値
+ */
+static void store_le64(uint8_t *p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  memcpy(p, &v, sizeof(v));
+}
+
+
+/*!
+ * 値を表現するのに必要なビット数を求める
+ * @param [in] v 対象の値
+ * @return 必要なビット数(0 ~ 64)
+ */
+static int bit_width(uint64_t v) {
+  return v == 0 ? 0 : 64 - __builtin_clzll(v);
+}
+
+
+/*!
+ * ビット列に値を書き込む(書き込む領域はゼロで初期化しておくこと)
+ * 32bitずつ、8バイト単位の読み書きで処理する
+ * @param [in,out] buf    書き込み先のビット列
+ * @param [in]     bitpos 書き込む位置(ビット単位)
+ * @param [in]     v      書き込む値
+ * @param [in]     w      ビット幅
+ */
+static void put_bits(uint8_t *buf, uint64_t bitpos, uint64_t v, int w) {
+  for (; w > 0; w -= 32, bitpos += 32, v >>= 32) {
+    uint64_t chunk = w >= 32 ? (v & 0xffffffffULL) : (v & ((1ULL << w) - 1));
+    uint8_t *p     = buf + (bitpos >> 3);
+    store_le64(p, load_le64(p) | chunk << (bitpos & 7));
+  }
+}
+
+
+/*!
+ * ビット列から値を読み出す
+ * @param [in] buf    読み出すビット列
+ * @param [in] bitpos 読み出す位置(ビット単位)
+ * @param [in] w      ビット幅
+ * @return 読み出した値
+ */
+static uint64_t get_bits(const uint8_t *buf, uint64_t bitpos, int w) {
+  if (w <= 56) {
+    return load_le64(buf + (bitpos >> 3)) >> (bitpos & 7) & ((1ULL << w) - 1);
+  }
+  return get_bits(buf, bitpos, 32) | get_bits(buf, bitpos + 32, w - 32) << 32;
+}
+
+
+/*!
+ * 1ブロック分の1列を符号化する
+ * 差分と差分の差分のうち、ビット幅が小さくなる方を選ぶ
+ * ブロックのフレーム数がARCHIVE_BLOCK_LENに満たないときは、残りを0で埋める
+ * @param [out] out 書き込み先(列ヘッダ + パックした値)
+ * @param [in]  v   列の値
+ * @param [in]  n   値の個数
+ * @return 書き込んだバイト数
+ */
+static size_t encode_column(uint8_t *out, const int64_t *v, unsigned int n) {
+  uint64_t     delta[ARCHIVE_BLOCK_LEN];  // ジグザグ符号化した差分
+  uint64_t     dod[ARCHIVE_BLOCK_LEN];    // ジグザグ符号化した差分の差分
+  uint64_t     or_delta = 0, or_dod = 0;
+  uint64_t    *res;
+  unsigned int i;
+  int          w;
+  int          is_dod;
+
+  memset(delta, 0, sizeof(delta));
+  memset(dod,   0, sizeof(dod));
+  for (i = 1; i < n; i++) {
+    int64_t d = v[i] - v[i - 1];
+    delta[i]  = ZIGZAG_ENCODE(d);
+    dod[i]    = i == 1 ? delta[i] : ZIGZAG_ENCODE(d - (v[i - 1] - v[i - 2]));
+    or_delta |= delta[i];
+    or_dod   |= dod[i];
+  }
+  is_dod = bit_width(or_dod) < bit_width(or_delta);
+  res    = is_dod ? dod : delta;
+  w      = bit_width(is_dod ? or_dod : or_delta);
+
+  store_le64(out, (uint64_t)v[0]);
+  out[8] = (uint8_t)(w | (is_dod ? ENC_DOD : 0));
+  out += COL_HEADER_SIZE;
+  memset(out, 0, PACKED_SIZE(w) + BUF_SLACK);
+  for (i = 0; i < ARCHIVE_BLOCK_LEN && w > 0; i++) {
+    put_bits(out, (uint64_t)i * w, res[i], w);
+  }
+  return COL_HEADER_SIZE + PACKED_SIZE(w);
+}
+
+
+/*!
+ * 1ブロック分の1列を復号する
+ * @param [in]  p   列ヘッダの位置
+ * @param [in]  end ブロックの終端
+ * @param [out] v   復号した値(ARCHIVE_BLOCK_LEN個)
+ * @return 次の列ヘッダの位置。不正なデータならNULLを返す
+ */
+static const uint8_t *decode_column(const uint8_t *p, const uint8_t *end, int64_t *v) {
+  uint64_t     u[ARCHIVE_BLOCK_LEN];
+  int64_t      acc;
+  unsigned int i;
+  int          w;
+
+  if (end - p < COL_HEADER_SIZE) return NULL;
+  acc = (int64_t)load_le64(p);
+  w   = p[8] & WIDTH_MASK;
+  if (w > 64 || end - (p + COL_HEADER_SIZE) < PACKED_SIZE(w)) return NULL;
+
+  unpack_bits(u, p + COL_HEADER_SIZE, w);
+  for (i = 0; i < ARCHIVE_BLOCK_LEN; i++) {  // ジグザグ復号(ベクトル化される)
+    v[i] = ZIGZAG_DECODE(u[i]);
+  }
+  if (p[8] & ENC_DOD) {  // 差分の差分 -> 差分
+    for (i = 1; i < ARCHIVE_BLOCK_LEN; i++) {
+      v[i] += v[i - 1];
+    }
+  }
+  for (i = 0; i < ARCHIVE_BLOCK_LEN; i++) {  // 差分 -> 値
+    acc += v[i];
+    v[i] = acc;
+  }
+  return p + COL_HEADER_SIZE + PACKED_SIZE(w);
+}
+
+
+/*!
+ * ビット幅wでパックされたARCHIVE_BLOCK_LEN個の値を展開する
+ * AVX2が使え、ビット幅が56以下のときは、4個ずつgatherとシフトで展開する
+ * @param [out] out 展開した値
+ * @param [in]  p   パックされた値の先頭(後ろにBUF_SLACKバイトの余白が必要)
+ * @param [in]  w   ビット幅
+ */
+static void unpack_bits(uint64_t *out, const uint8_t *p, int w) {
+  unsigned int i;
+
+  if (w == 0) {
+    memset(out, 0, sizeof(uint64_t) * ARCHIVE_BLOCK_LEN);
+    return;
+  }
+#ifdef __AVX2__
+  if (w <= 56) {
+    const __m256i mask  = _mm256_set1_epi64x((long long)((1ULL << w) - 1));
+    const __m256i seven = _mm256_set1_epi64x(7);
+    const __m256i step  = _mm256_set1_epi64x(4LL * w);
+    __m256i bitpos      = _mm256_set_epi64x(3LL * w, 2LL * w, 1LL * w, 0);
+    for (i = 0; i < ARCHIVE_BLOCK_LEN; i += 4) {
+      __m256i words = _mm256_i64gather_epi64((const long long *)p, _mm256_srli_epi64(bitpos, 3), 1);
+      __m256i vals  = _mm256_and_si256(_mm256_srlv_epi64(words, _mm256_and_si256(bitpos, seven)), mask);
+      _mm256_storeu_si256((__m256i *)&out[i], vals);
+      bitpos = _mm256_add_epi64(bitpos, step);
+    }
+    return;
+  }
+#endif
+  for (i = 0; i < ARCHIVE_BLOCK_LEN; i++) {
+    out[i] = get_bits(p, (uint64_t)i * w, w);
+  }
+}
+
+
+/*!
+ * アーカイブのブロックを順に読み込み、展開する
+ * 配列はブロックを展開しながら倍に広げる(ヘッダのフレーム数だけを見て、一度に確保はしない)
+ * @param [in]  f        アーカイブのファイルポインタ
+ * @param [in]  is_fixed fixed_fmtの配列に展開するかどうか(0ならdata_fmt)
+ * @param [out] len      展開したデータ数
+ * @return 展開したデータの配列(free()で解放する)。ヘッダやブロックが不正なとき、ヘッダのフレーム数に
+ *         満たずにファイルが終わったとき、メモリ確保に失敗したときは、エラーメッセージを出力してNULLを返す
+ */
+static void *read_blocks(FILE *f, int is_fixed, size_t *len) {
+  static uint8_t block[MAX_BLOCK_SIZE + BUF_SLACK];
+  static int64_t cols[N_COLUMNS][ARCHIVE_BLOCK_LEN];
+  uint8_t  header[FILE_HEADER_SIZE];
+  uint64_t n_frames;
+  size_t   elem  = is_fixed ? sizeof(fixed_fmt) : sizeof(data_fmt);
+  size_t   cap   = INITIAL_LEN;
+  size_t   cnt   = 0;
+  void    *datas = malloc(elem * cap);
+
+  *len = 0;
+  if (datas == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return NULL;
+  }
+  if (fread(header, 1, sizeof(header), f) != sizeof(header)
+      || memcmp(header, ARCHIVE_MAGIC, 4) != 0
+      || load_le32(header + 4) != ARCHIVE_VERSION
+      || load_le32(header + 16) != ARCHIVE_BLOCK_LEN
+      || load_le32(header + 20) != FIXED_SCALE) {
+    fputs("アーカイブのヘッダが不正です\n", stderr);
+    free(datas);
+    return NULL;
+  }
+  n_frames = load_le64(header + 8);
+
+  while (cnt < n_frames) {
+    const uint8_t *p   = block + 4;
+    const uint8_t *end;
+    uint32_t       size;
+    unsigned int   n, j;
+    int            c;
+
+    if (fread(block, 1, 4, f) != 4
+        || (size = load_le32(block)) < 4 || size > MAX_BLOCK_SIZE - 4
+        || fread(block + 4, 1, size, f) != size) {
+      fputs("アーカイブのブロックが不正です\n", stderr);
+      free(datas);
+      return NULL;
+    }
+    memset(block + 4 + size, 0, BUF_SLACK);  // 8バイト単位の読み出しがはみ出す分
+    end = block + 4 + size;
+    n = load_le32(p);
+    p += 4;
+    for (c = 0; c < N_COLUMNS && p != NULL; c++) {
+      p = decode_column(p, end, cols[c]);
+    }
+    if (p == NULL || n == 0 || n > ARCHIVE_BLOCK_LEN) {
+      fputs("アーカイブのブロックが不正です\n", stderr);
+      free(datas);
+      return NULL;
+    }
+    if (n > n_frames - cnt) n = (unsigned int)(n_frames - cnt);
+    if (cnt + n > cap) {
+      void *grown = realloc(datas, elem * cap * 2);
+      if (grown == NULL) {
+        fputs("メモリ確保に失敗しました\n", stderr);
+        free(datas);
+        return NULL;
+      }
+      datas = grown;
+      cap  *= 2;
+    }
+
+    if (is_fixed) {
+      fixed_fmt *dst = (fixed_fmt *)datas + cnt;
+      for (j = 0; j < n; j++, dst++) {
+        dst->time = cols[0][j];
+        for (c = 0; c < FIXED_COL; c++) {
+          dst->pos[c] = (int32_t)cols[c + 1][j];
+        }
+      }
+    } else {
+      data_fmt *dst = (data_fmt *)datas + cnt;
+      for (j = 0; j < n; j++, dst++) {
+        dst->time   = (double)cols[0][j] / FIXED_SCALE;
+        dst->pos1.x = (double)cols[1][j] / FIXED_SCALE;
+        dst->pos1.y = (double)cols[2][j] / FIXED_SCALE;
+        dst->pos1.z = (double)cols[3][j] / FIXED_SCALE;
+        dst->pos2.x = (double)cols[4][j] / FIXED_SCALE;
+        dst->pos2.y = (double)cols[5][j] / FIXED_SCALE;
+        dst->pos2.z = (double)cols[6][j] / FIXED_SCALE;
+        dst->pos3.x = (double)cols[7][j] / FIXED_SCALE;
+        dst->pos3.y = (double)cols[8][j] / FIXED_SCALE;
+        dst->pos3.z = (double)cols[9][j] / FIXED_SCALE;
+      }
+    }
+    cnt += n;
+  }
+  *len = cnt;
+  return datas;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "data_handler.h"
+#include "fixed_point.h"
+
+#define ARCHIVE_MAGIC      "G3CA"  // アーカイブファイルの先頭の4バイト
+#define ARCHIVE_VERSION         1  // アーカイブのフォーマットのバージョン
+#define ARCHIVE_BLOCK_LEN     128  // 1ブロックにまとめるフレーム数
+
+
+// キャプチャデータの圧縮アーカイブ
+//   ヘッダ   : マジック(4バイト), バージョン(uint32), フレーム数(uint64),
+//              ブロック長(uint32), スケール(uint32)
+//   ブロック : ブロックのバイト数(uint32), フレーム数(uint32),
+//              列(時間 + 座標9列)ごとに
+//                先頭の値(int64), 符号化方式とビット幅(uint8),
+//                差分(またはその差分)をジグザグ符号化し、ビット幅でパックした
+//                ARCHIVE_BLOCK_LEN個の値
+// 数値はすべてリトルエンディアンで格納する
+int is_archive_file(const char *filename);
+int write_archive(FILE *f, const fixed_fmt *datas, unsigned int len);
+data_fmt *read_archive(FILE *f, size_t *len);
+fixed_fmt *read_archive_fixed(FILE *f, size_t *len);
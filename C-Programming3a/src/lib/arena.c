@@ -0,0 +1,189 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE  0
+#endif
+
+#define ARENA_ALIGN          64                 // 割り当てのアライメント(キャッシュライン)
+#define ARENA_MIN_SIZE       (64 * 1024)        // ブロックの最小サイズ
+#define HUGEPAGE_SIZE        (2 * 1024 * 1024)  // ヒュージページのサイズ
+#define PREFAULT_STRIDE      4096               // ページをあらかじめ割り当てるために書き込む間隔(通常のページのサイズ)
+#define ROUND_UP(n, align)   (((n) + (align) - 1) / (align) * (align))
+
+
+struct arena_block {
+  arena_block *prev;  // 以前に確保したブロック
+  size_t       size;  // ブロック全体のバイト数(ヘッダを含む)
+};
+
+#define BLOCK_HEADER_SIZE  ROUND_UP(sizeof(arena_block), ARENA_ALIGN)
+
+
+static arena_block *block_create(size_t size, int flags);
+static void         block_destroy(arena_block *block);
+static void         prefault(void *ptr, size_t size);
+
+
+
+
+/*!
+ * アリーナを初期化する
+ * @param [out] a         初期化するアリーナ
+ * @param [in]  init_size 最初に確保する容量(0なら最初の割り当てまで確保しない)
+ * @param [in]  flags     ARENA_xxxフラグ
+ */
+void arena_init(arena *a, size_t init_size, int flags) {
+  a->head  = NULL;
+  a->used  = 0;
+  a->total = 0;
+  a->flags = flags;
+  if (init_size > 0) arena_reserve(a, init_size);
+}
+
+
+/*!
+ * 現在のブロックに、指定したバイト数の空き容量を確保する
+ * 足りない場合は、それまでの合計容量の2倍以上のブロックを追加する(幾何級数的な拡張)
+ * 既に割り当てた領域は移動しない
+ * @param [in,out] a    対象のアリーナ
+ * @param [in]     size 必要な空き容量
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+int arena_reserve(arena *a, size_t size) {
+  arena_block *block;
+  size_t       need = BLOCK_HEADER_SIZE + ROUND_UP(size, ARENA_ALIGN);
+  size_t       block_size;
+
+  if (a->head != NULL && a->used + ROUND_UP(size, ARENA_ALIGN) <= a->head->size) return 0;
+
+  block_size = a->total * 2;
+  if (block_size < need)           block_size = need;
+  if (block_size < ARENA_MIN_SIZE) block_size = ARENA_MIN_SIZE;
+  block = block_create(block_size, a->flags);
+  if (block == NULL) return -1;
+  block->prev = a->head;
+  a->head     = block;
+  a->used     = BLOCK_HEADER_SIZE;
+  a->total   += block->size;
+  return 0;
+}
+
+
+/*!
+ * アリーナから領域を割り当てる
+ * @param [in,out] a    対象のアリーナ
+ * @param [in]     size 割り当てるバイト数
+ * @return 割り当てた領域へのポインタ(ARENA_ALIGNバイト境界)。失敗したならNULLを返す
+ */
+void *arena_alloc(arena *a, size_t size) {
+  void *ptr;
+  if (arena_reserve(a, size) != 0) return NULL;
+  ptr = (char *)a->head + a->used;
+  a->used += ROUND_UP(size, ARENA_ALIGN);
+  return ptr;
+}
+
+
+/*!
+ * アリーナの全ての割り当てを破棄し、再利用可能な状態に戻す
+ * 複数のブロックがあれば、合計容量の1ブロックにまとめ直すので、
+ * 同程度の大きさの入力が続く限り、以降はブロックの確保が発生しない
+ * @param [in,out] a 対象のアリーナ
+ */
+void arena_reset(arena *a) {
+  if (a->head != NULL && a->head->prev != NULL) {
+    size_t total = a->total;
+    arena_destroy(a);
+    a->head = block_create(total, a->flags);
+    if (a->head != NULL) {
+      a->head->prev = NULL;
+      a->total      = a->head->size;
+    }
+  }
+  a->used = BLOCK_HEADER_SIZE;
+}
+
+
+/*!
+ * アリーナの全てのブロックを解放する
+ * @param [in,out] a 対象のアリーナ
+ */
+void arena_destroy(arena *a) {
+  while (a->head != NULL) {
+    arena_block *prev = a->head->prev;
+    block_destroy(a->head);
+    a->head = prev;
+  }
+  a->used  = 0;
+  a->total = 0;
+}
+
+
+
+
+/*!
+ * ブロックを確保する
+ * mmapで確保し、ページをあらかじめ割り当てておく(ホットパスでのページフォールトを避ける)
+ * ヒュージページが指定され、MAP_HUGETLBで確保できない場合は、
+ * 透過的ヒュージページ(THP)の利用を要求してから、ページを割り当てる
+ * ARENA_FIRST_TOUCHが指定された場合は、確保したスレッドのノードにページが集まらないように、
+ * ページを割り当てずに返す(各ワーカスレッドが受け持つ部分に初めて書き込んだときに割り当てられる)
+ * @param [in] size  ブロックのバイト数
+ * @param [in] flags ARENA_xxxフラグ
+ * @return 確保したブロック。失敗したならNULLを返す
+ */
+static arena_block *block_create(size_t size, int flags) {
+  void *ptr      = MAP_FAILED;
+  int   populate = (flags & ARENA_FIRST_TOUCH) ? 0 : MAP_POPULATE;
+
+  if (flags & ARENA_HUGEPAGE) {
+    size = ROUND_UP(size, HUGEPAGE_SIZE);
+#ifdef MAP_HUGETLB
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+#endif
+    if (ptr == MAP_FAILED) {
+      // MAP_POPULATEを付けると、madvise()より前に通常のページで割り当てられてしまうので、
+      // 透過的ヒュージページを要求してから割り当てる
+      ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ptr != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+        if (populate) prefault(ptr, size);
+      }
+    }
+  } else {
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+  }
+  if (ptr == MAP_FAILED) return NULL;
+  ((arena_block *)ptr)->size = size;
+  return (arena_block *)ptr;
+}
+
+
+/*!
+ * ブロックを解放する
+ * @param [in] block 解放するブロック
+ */
+static void block_destroy(arena_block *block) {
+  munmap(block, block->size);
+}
+
+
+/*!
+ * 確保した領域のページを、あらかじめ割り当てる(MAP_POPULATEの代わり)
+ * MADV_POPULATE_WRITE(Linux 5.14以降)が使えなければ、ページごとに書き込んで割り当てる
+ * @param [in] ptr  領域の先頭
+ * @param [in] size 領域のバイト数
+ */
+static void prefault(void *ptr, size_t size) {
+  volatile uint8_t *p = (volatile uint8_t *)ptr;
+  size_t            i;
+
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) return;
+#endif
+  for (i = 0; i < size; i += PREFAULT_STRIDE) p[i] = 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+#define ARENA_HUGEPAGE     0x01  // ヒュージページで領域を確保する
+#define ARENA_FIRST_TOUCH  0x02  // ページをあらかじめ割り当てず、最初に書き込んだスレッドのNUMAノードに置く
+
+
+typedef struct arena_block arena_block;
+
+// パイプラインの作業領域用のアリーナ(バンプ)アロケータ
+// 個別の解放は行わず、arena_reset()でまとめて再利用可能な状態に戻す
+typedef struct {
+  arena_block *head;   // 現在割り当てに用いているブロック(以前のブロックへ連結)
+  size_t       used;   // 現在のブロックの使用済みバイト数
+  size_t       total;  // 全ブロックの容量の合計
+  int          flags;  // ARENA_xxxフラグ
+} arena;
+
+
+void  arena_init(arena *a, size_t init_size, int flags);
+int   arena_reserve(arena *a, size_t size);
+void *arena_alloc(arena *a, size_t size);
+void  arena_reset(arena *a);
+void  arena_destroy(arena *a);
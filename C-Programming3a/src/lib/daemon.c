@@ -0,0 +1,741 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "arena.h"
+#include "data_handler.h"
+#include "daemon.h"
+#include "thread_pool.h"
+
+#define MAX_EVENTS         64
+#define READ_CHUNK      65536
+#define MAX_HEADER_LEN    128
+#define MAX_PAYLOAD_SIZE  ((size_t)1 << 30)
+#define MAX_MERGE_NUM     (INT_MAX - 1)  // merge_numの上限(-mオプションと同じ)
+
+
+typedef enum {
+  REQ_TEXT,
+  REQ_BINARY
+} req_mode;
+
+typedef enum {
+  CONN_HEADER,   // リクエストヘッダの受信待ち
+  CONN_PAYLOAD,  // ペイロードの受信待ち
+  CONN_BUSY      // ワーカスレッドで処理中
+} conn_state;
+
+typedef struct {
+  char   *ptr;  // バッファの先頭
+  size_t  len;  // 有効データのバイト数
+  size_t  pos;  // 消費済み(送信済み)のバイト数
+  size_t  cap;  // 確保済みのバイト数
+} byte_buf;
+
+typedef struct connection {
+  int                 fd;            // クライアントのソケットディスクリプタ
+  conn_state          state;         // 接続の状態
+  int                 peer_eof;      // クライアントが送信を終えたかどうか
+  int                 is_closed;     // 処理中にクローズされたかどうか
+  int                 is_broken;     // プロトコルエラーにより、送信後にクローズするかどうか
+  byte_buf            in;            // 受信バッファ
+  byte_buf            out;           // 送信バッファ
+  req_mode            mode;          // 受信中のリクエストの種類
+  unsigned int        merge_num;     // 受信中のリクエストのダウンサンプリング数
+  size_t              payload_size;  // 受信中のリクエストのペイロードのバイト数
+  struct connection  *prev;          // 接続リストの前の要素
+  struct connection  *next;          // 接続リストの次の要素
+} connection;
+
+typedef struct daemon_ctx daemon_ctx;
+
+typedef struct job {
+  daemon_ctx    *ctx;           // デーモンのコンテキスト
+  connection    *conn;          // リクエスト元の接続
+  req_mode       mode;          // リクエストの種類
+  unsigned int   merge_num;     // ダウンサンプリングでまとめる数
+  char          *payload;       // ペイロード(末尾に'\0'を付加している)
+  size_t         payload_size;  // ペイロードのバイト数
+  byte_buf       result;        // レスポンス
+  struct job    *next;          // 完了リストの次の要素
+} job;
+
+struct daemon_ctx {
+  int              listen_fd;          // 待ち受けソケット
+  int              epoll_fd;           // epollのディスクリプタ
+  int              event_fd;           // ジョブの完了通知用のeventfd
+  thread_pool     *pool;               // ワーカスレッドプール
+  arena           *arenas;             // ワーカスレッドごとの作業領域(リクエスト間で再利用する)
+  pthread_mutex_t  done_mutex;         // 完了リストを保護するミューテックス
+  job             *done_head;          // 完了したジョブのリスト
+  connection      *conns;              // 全ての接続のリスト
+};
+
+
+static int  buf_reserve(byte_buf *buf, size_t size);
+static int  buf_append(byte_buf *buf, const void *data, size_t size);
+static int  buf_printf(byte_buf *buf, const char *fmt, ...);
+static int  set_nonblocking(int fd);
+static int  open_listen_socket(const char *sock_path);
+static void accept_clients(daemon_ctx *ctx);
+static void handle_conn_event(daemon_ctx *ctx, connection *conn, uint32_t events);
+static void handle_completions(daemon_ctx *ctx);
+static void process_input(daemon_ctx *ctx, connection *conn);
+static int  parse_header(connection *conn, const char *line);
+static int  parse_field(const char **p, unsigned long *value);
+static void reply_error(connection *conn, const char *msg);
+static int  flush_output(connection *conn);
+static void settle_conn(daemon_ctx *ctx, connection *conn);
+static void close_conn(daemon_ctx *ctx, connection *conn);
+static void free_conn(connection *conn);
+static void run_job(void *arg, unsigned int worker_id);
+static void sig_handler(int signum);
+
+static volatile sig_atomic_t is_stopped = 0;  // 終了シグナルを受け取ったかどうか
+
+
+
+
+/*!
+ * Unixドメインソケットで待ち受け、特徴抽出のリクエストを処理し続ける
+ * SIGINTかSIGTERMを受け取るまで戻らない
+ * @param [in] sock_path   待ち受けるソケットのパス
+ * @param [in] n_workers   ワーカスレッド数
+ * @param [in] arena_flags 作業領域のアリーナに与えるARENA_xxxフラグ
+ * @return 正常終了したなら0を、エラーが発生したなら-1を返す
+ */
+int run_daemon(const char *sock_path, unsigned int n_workers, int arena_flags) {
+  static struct epoll_event events[MAX_EVENTS];
+  struct sigaction  sa;
+  struct epoll_event ev;
+  daemon_ctx ctx;
+  int        ret = 0;
+  unsigned int i;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.event_fd  = -1;
+  ctx.epoll_fd  = -1;
+  ctx.listen_fd = open_listen_socket(sock_path);
+  if (ctx.listen_fd < 0) return -1;
+
+  ctx.event_fd = eventfd(0, EFD_NONBLOCK);
+  ctx.epoll_fd = epoll_create1(0);
+  ctx.pool     = thread_pool_create(n_workers);
+  ctx.arenas   = (arena *)malloc(sizeof(arena) * (n_workers == 0 ? 1 : n_workers));
+  if (ctx.event_fd < 0 || ctx.epoll_fd < 0 || ctx.pool == NULL || ctx.arenas == NULL) {
+    perror("run_daemon");
+    ret = -1;
+    goto cleanup;
+  }
+  for (i = 0; i < thread_pool_size(ctx.pool); i++) {
+    arena_init(&ctx.arenas[i], 0, arena_flags);
+  }
+  pthread_mutex_init(&ctx.done_mutex, NULL);
+
+  // epollのデータは、待ち受けソケットならNULL、eventfdならコンテキスト、それ以外は接続を指す
+  ev.events   = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.listen_fd, &ev);
+  ev.data.ptr = &ctx;
+  epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.event_fd, &ev);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sig_handler;  // SA_RESTARTを付けず、epoll_wait()を中断させる
+  sigaction(SIGINT,  &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  fprintf(stderr, "%s で待ち受けています (ワーカスレッド数: %u)\n", sock_path, thread_pool_size(ctx.pool));
+  while (!is_stopped) {
+    int n = epoll_wait(ctx.epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait");
+      ret = -1;
+      break;
+    }
+    for (i = 0; i < (unsigned int)n; i++) {
+      if (events[i].data.ptr == NULL) {
+        accept_clients(&ctx);
+      } else if (events[i].data.ptr == &ctx) {
+        handle_completions(&ctx);
+      } else {
+        handle_conn_event(&ctx, (connection *)events[i].data.ptr, events[i].events);
+      }
+    }
+  }
+
+cleanup:
+  if (ctx.pool != NULL) {
+    unsigned int n_arenas = thread_pool_size(ctx.pool);  // 破棄した後には参照できない
+    thread_pool_destroy(ctx.pool);  // 処理中のジョブの終了を待つ
+    while (ctx.done_head != NULL) {
+      job *j = ctx.done_head;
+      ctx.done_head = j->next;
+      if (j->conn->is_closed) free_conn(j->conn);  // 処理中にクローズした接続は、接続リストに無い
+      free(j->result.ptr);
+      free(j);
+    }
+    pthread_mutex_destroy(&ctx.done_mutex);
+    for (i = 0; ctx.arenas != NULL && i < n_arenas; i++) {
+      arena_destroy(&ctx.arenas[i]);
+    }
+  }
+  free(ctx.arenas);
+  while (ctx.conns != NULL) {
+    connection *conn = ctx.conns;
+    ctx.conns = conn->next;
+    if (!conn->is_closed) close(conn->fd);
+    free_conn(conn);
+  }
+  if (ctx.epoll_fd >= 0) close(ctx.epoll_fd);
+  if (ctx.event_fd >= 0) close(ctx.event_fd);
+  close(ctx.listen_fd);
+  unlink(sock_path);
+  return ret;
+}
+
+
+
+
+/*!
+ * バッファの容量を確保する
+ * @param [in,out] buf  対象のバッファ
+ * @param [in]     size 必要な容量(バイト数)
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int buf_reserve(byte_buf *buf, size_t size) {
+  size_t  cap = buf->cap == 0 ? 256 : buf->cap;
+  char   *ptr;
+  if (size <= buf->cap) return 0;
+  while (cap < size) cap *= 2;
+  ptr = (char *)realloc(buf->ptr, cap);
+  if (ptr == NULL) return -1;
+  buf->ptr = ptr;
+  buf->cap = cap;
+  return 0;
+}
+
+
+/*!
+ * バッファの末尾にデータを追加する
+ * @param [in,out] buf  対象のバッファ
+ * @param [in]     data 追加するデータ
+ * @param [in]     size 追加するデータのバイト数
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int buf_append(byte_buf *buf, const void *data, size_t size) {
+  if (buf_reserve(buf, buf->len + size) != 0) return -1;
+  memcpy(buf->ptr + buf->len, data, size);
+  buf->len += size;
+  return 0;
+}
+
+
+/*!
+ * バッファの末尾に書式付きで文字列を追加する
+ * @param [in,out] buf 対象のバッファ
+ * @param [in]     fmt 書式指定文字列
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int buf_printf(byte_buf *buf, const char *fmt, ...) {
+  va_list ap;
+  int     n;
+  if (buf_reserve(buf, buf->len + 1) != 0) return -1;
+  for (;;) {
+    size_t rest = buf->cap - buf->len;
+    va_start(ap, fmt);
+    n = vsnprintf(buf->ptr + buf->len, rest, fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if ((size_t)n < rest) break;
+    if (buf_reserve(buf, buf->len + n + 1) != 0) return -1;
+  }
+  buf->len += n;
+  return 0;
+}
+
+
+/*!
+ * ディスクリプタをノンブロッキングモードにする
+ * @param [in] fd 対象のディスクリプタ
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+/*!
+ * Unixドメインソケットを作成し、待ち受けを開始する
+ * 既にソケットファイルが存在する場合は、削除してから作成する
+ * @param [in] sock_path ソケットのパス
+ * @return 待ち受けソケットのディスクリプタ。失敗したなら-1を返す
+ */
+static int open_listen_socket(const char *sock_path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "ソケットのパスが長すぎます: %s\n", sock_path);
+    return -1;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sock_path);
+  unlink(sock_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+      || listen(fd, SOMAXCONN) != 0
+      || set_nonblocking(fd) != 0) {
+    perror(sock_path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+/*!
+ * 接続要求を全て受け付ける
+ * @param [in] ctx デーモンのコンテキスト
+ */
+static void accept_clients(daemon_ctx *ctx) {
+  for (;;) {
+    struct epoll_event ev;
+    connection *conn;
+    int fd = accept(ctx->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("accept");
+      }
+      return;
+    }
+    conn = (connection *)calloc(1, sizeof(connection));
+    if (conn == NULL || set_nonblocking(fd) != 0) {
+      free(conn);
+      close(fd);
+      continue;
+    }
+    conn->fd    = fd;
+    conn->state = CONN_HEADER;
+    conn->next  = ctx->conns;
+    if (ctx->conns != NULL) ctx->conns->prev = conn;
+    ctx->conns = conn;
+
+    ev.events   = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+
+/*!
+ * 接続に対するイベントを処理する
+ * @param [in] ctx    デーモンのコンテキスト
+ * @param [in] conn   イベントが発生した接続
+ * @param [in] events 発生したイベント
+ */
+static void handle_conn_event(daemon_ctx *ctx, connection *conn, uint32_t events) {
+  // 双方向とも切断されたときは、レスポンスを返せないので即座に閉じる
+  if ((events & (EPOLLHUP | EPOLLERR)) || ((events & EPOLLOUT) && flush_output(conn) != 0)) {
+    close_conn(ctx, conn);
+    return;
+  }
+  if (events & EPOLLIN) {
+    ssize_t n;
+    if (conn->in.pos > 0) {  // 消費済みの領域を詰める
+      memmove(conn->in.ptr, conn->in.ptr + conn->in.pos, conn->in.len - conn->in.pos);
+      conn->in.len -= conn->in.pos;
+      conn->in.pos  = 0;
+    }
+    if (buf_reserve(&conn->in, conn->in.len + READ_CHUNK) != 0) {
+      close_conn(ctx, conn);
+      return;
+    }
+    n = recv(conn->fd, conn->in.ptr + conn->in.len, READ_CHUNK, 0);
+    if (n > 0) {
+      conn->in.len += n;
+    } else if (n == 0) {
+      conn->peer_eof = 1;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      close_conn(ctx, conn);
+      return;
+    }
+    process_input(ctx, conn);
+  }
+  settle_conn(ctx, conn);
+}
+
+
+/*!
+ * ワーカスレッドで処理が完了したジョブのレスポンスを、各接続の送信バッファに移す
+ * @param [in] ctx デーモンのコンテキスト
+ */
+static void handle_completions(daemon_ctx *ctx) {
+  uint64_t  cnt;
+  job      *j;
+
+  if (read(ctx->event_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+    perror("read(eventfd)");
+  }
+  pthread_mutex_lock(&ctx->done_mutex);
+  j = ctx->done_head;
+  ctx->done_head = NULL;
+  pthread_mutex_unlock(&ctx->done_mutex);
+
+  while (j != NULL) {
+    job        *next = j->next;
+    connection *conn = j->conn;
+    if (conn->is_closed) {  // 処理中にクライアントが切断していたとき
+      free_conn(conn);
+    } else {
+      if (conn->out.len == conn->out.pos) {  // 送信待ちが無ければ、バッファごと引き継ぐ
+        free(conn->out.ptr);
+        conn->out = j->result;
+        j->result.ptr = NULL;
+      } else if (buf_append(&conn->out, j->result.ptr, j->result.len) != 0) {
+        conn->is_broken = 1;
+      }
+      conn->state = CONN_HEADER;
+      process_input(ctx, conn);  // バッファに溜まっている次のリクエストを処理
+      settle_conn(ctx, conn);
+    }
+    free(j->result.ptr);
+    free(j);
+    j = next;
+  }
+}
+
+
+/*!
+ * 受信バッファ中のリクエストを解析し、揃ったリクエストをワーカスレッドに渡す
+ * 1つの接続につき、同時に処理するリクエストは1つまでとし、レスポンスの順序を保つ
+ * @param [in] ctx  デーモンのコンテキスト
+ * @param [in] conn 対象の接続
+ */
+static void process_input(daemon_ctx *ctx, connection *conn) {
+  while (conn->state != CONN_BUSY && !conn->is_broken) {
+    char   *head = conn->in.ptr + conn->in.pos;
+    size_t  rest = conn->in.len - conn->in.pos;
+
+    if (conn->state == CONN_HEADER) {
+      char *nl = (char *)memchr(head, '\n', rest);
+      if (nl == NULL) {
+        if (rest > MAX_HEADER_LEN) reply_error(conn, "header too long");
+        return;
+      }
+      *nl = '\0';
+      conn->in.pos += nl - head + 1;
+      if (parse_header(conn, head) != 0) return;
+      conn->state = CONN_PAYLOAD;
+    } else {
+      job *j;
+      if (rest < conn->payload_size) {
+        // ペイロード全体を受け取れるように、あらかじめ容量を確保しておく
+        if (buf_reserve(&conn->in, conn->in.pos + conn->payload_size + READ_CHUNK) != 0) {
+          reply_error(conn, "out of memory");
+        }
+        return;
+      }
+      j = (job *)calloc(1, sizeof(job));
+      if (j != NULL) j->payload = (char *)malloc(conn->payload_size + 1);
+      if (j == NULL || j->payload == NULL) {
+        free(j);
+        reply_error(conn, "out of memory");
+        return;
+      }
+      memcpy(j->payload, head, conn->payload_size);
+      j->payload[conn->payload_size] = '\0';
+      j->payload_size = conn->payload_size;
+      j->ctx          = ctx;
+      j->conn         = conn;
+      j->mode         = conn->mode;
+      j->merge_num    = conn->merge_num;
+      conn->in.pos   += conn->payload_size;
+      conn->state     = CONN_BUSY;
+      if (thread_pool_submit(ctx->pool, run_job, j) != 0) {
+        free(j->payload);
+        free(j);
+        conn->state = CONN_HEADER;
+        reply_error(conn, "out of memory");
+        return;
+      }
+    }
+  }
+}
+
+
+/*!
+ * リクエストヘッダを解析する
+ * @param [in] conn 対象の接続
+ * @param [in] line ヘッダ行('\n'は取り除いたもの)
+ * @return 正しいヘッダなら0を、それ以外なら-1を返す
+ */
+static int parse_header(connection *conn, const char *line) {
+  char           mode[16];
+  unsigned long  merge_num;
+  unsigned long  size;
+  const char    *p;
+  int            n;
+
+  if (sscanf(line, "%15s%n", mode, &n) != 1 || !isspace((unsigned char)line[n])) {
+    reply_error(conn, "malformed header");
+    return -1;
+  }
+  p = line + n;
+  if (parse_field(&p, &merge_num) != 0 || parse_field(&p, &size) != 0) {
+    reply_error(conn, "malformed header");
+    return -1;
+  }
+  while (isspace((unsigned char)*p)) p++;
+  if (*p != '\0') {
+    reply_error(conn, "malformed header");
+    return -1;
+  }
+  if (merge_num == 0 || merge_num > MAX_MERGE_NUM) {
+    reply_error(conn, "invalid merge_num");
+    return -1;
+  }
+  if (strcmp(mode, "TEXT") == 0) {
+    conn->mode         = REQ_TEXT;
+    conn->payload_size = size;
+  } else if (strcmp(mode, "BINARY") == 0) {
+    conn->mode         = REQ_BINARY;
+    conn->payload_size = size > MAX_PAYLOAD_SIZE / sizeof(data_fmt) ? MAX_PAYLOAD_SIZE + 1 : size * sizeof(data_fmt);
+  } else {
+    reply_error(conn, "unknown mode");
+    return -1;
+  }
+  if (conn->payload_size > MAX_PAYLOAD_SIZE) {
+    reply_error(conn, "payload too large");
+    return -1;
+  }
+  conn->merge_num = (unsigned int)merge_num;
+  return 0;
+}
+
+
+/*!
+ * ヘッダの10進数の欄を1つ読み、pを欄の直後に進める
+ * strtoul()は"-1"を受け付けて符号を反転するので、数字で始まらない欄は誤りとする
+ * @param [in,out] p     読む位置
+ * @param [out]    value 読んだ値
+ * @return 読めたなら0を、数字で始まらないか、unsigned longに収まらないなら-1を返す
+ */
+static int parse_field(const char **p, unsigned long *value) {
+  char *end;
+
+  while (isspace((unsigned char)**p)) (*p)++;
+  if (!isdigit((unsigned char)**p)) return -1;
+  errno  = 0;
+  *value = strtoul(*p, &end, 10);
+  if (errno == ERANGE) return -1;
+  *p = end;
+  return 0;
+}
+
+
+/*!
+ * エラーレスポンスを送信バッファに書き込む
+ * エラーの後はストリームの同期が取れないので、送信後に接続を閉じる
+ * @param [in] conn 対象の接続
+ * @param [in] msg  エラーメッセージ
+ */
+static void reply_error(connection *conn, const char *msg) {
+  buf_printf(&conn->out, "ERR %s\n", msg);
+  conn->is_broken = 1;
+}
+
+
+/*!
+ * 送信バッファのデータを、送信できるだけ送信する
+ * @param [in] conn 対象の接続
+ * @return 成功したなら0を、接続にエラーが発生したなら-1を返す
+ */
+static int flush_output(connection *conn) {
+  while (conn->out.pos < conn->out.len) {
+    ssize_t n = send(conn->fd, conn->out.ptr + conn->out.pos, conn->out.len - conn->out.pos, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    conn->out.pos += n;
+  }
+  conn->out.len = conn->out.pos = 0;
+  return 0;
+}
+
+
+/*!
+ * 接続の状態に合わせて、送信とepollの監視イベントの更新、または切断を行う
+ * @param [in] ctx  デーモンのコンテキスト
+ * @param [in] conn 対象の接続
+ */
+static void settle_conn(daemon_ctx *ctx, connection *conn) {
+  struct epoll_event ev;
+  int has_output;
+
+  if (flush_output(conn) != 0) {
+    close_conn(ctx, conn);
+    return;
+  }
+  has_output = conn->out.pos < conn->out.len;
+  if (!has_output && conn->state != CONN_BUSY && (conn->is_broken || conn->peer_eof)) {
+    close_conn(ctx, conn);
+    return;
+  }
+  // 処理中、またはクライアントが送信を終えた後は受信を止める(受信バッファの肥大化を防ぐ)
+  ev.events   = (conn->state != CONN_BUSY && !conn->peer_eof && !conn->is_broken ? EPOLLIN : 0)
+              | (has_output ? EPOLLOUT : 0);
+  ev.data.ptr = conn;
+  epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+
+/*!
+ * 接続を閉じる
+ * ワーカスレッドで処理中の場合、接続構造体の解放はジョブの完了時に行う
+ * @param [in] ctx  デーモンのコンテキスト
+ * @param [in] conn 対象の接続
+ */
+static void close_conn(daemon_ctx *ctx, connection *conn) {
+  epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  if (conn->prev != NULL) {
+    conn->prev->next = conn->next;
+  } else {
+    ctx->conns = conn->next;
+  }
+  if (conn->next != NULL) conn->next->prev = conn->prev;
+
+  if (conn->state == CONN_BUSY) {
+    conn->is_closed = 1;
+  } else {
+    free_conn(conn);
+  }
+}
+
+
+/*!
+ * 接続構造体を解放する
+ * @param [in] conn 対象の接続
+ */
+static void free_conn(connection *conn) {
+  free(conn->in.ptr);
+  free(conn->out.ptr);
+  free(conn);
+}
+
+
+/*!
+ * ワーカスレッドで、1つのリクエストを処理する
+ * @param [in] arg       job構造体へのポインタ
+ * @param [in] worker_id ワーカスレッドの番号
+ */
+static void run_job(void *arg, unsigned int worker_id) {
+  job          *j     = (job *)arg;
+  daemon_ctx   *ctx   = j->ctx;
+  arena        *work  = &ctx->arenas[worker_id];
+  data_fmt     *datas = NULL;
+  feature      *feature_datas = NULL;
+  unsigned int  len   = 0;
+  unsigned int  alloc_num;
+  unsigned int  i;
+  uint64_t      one   = 1;
+
+  // 作業領域は、前回のリクエストで確保したものを解放せずに使い回す
+  arena_reset(work);
+
+  /* ----- ペイロードの解析 ----- */
+  if (j->mode == REQ_BINARY) {
+    datas = (data_fmt *)j->payload;  // mallocの返すアドレスなので、アライメントは満たされている
+    len   = j->payload_size / sizeof(data_fmt);
+    arena_reserve(work, sizeof(feature) * (size_t)len + 64);
+  } else {
+    char   *p   = j->payload;
+    char   *end = j->payload + j->payload_size;
+    size_t  n_lines = 1;
+    for (; (p = (char *)memchr(p, '\n', end - p)) != NULL; p++) n_lines++;
+    // 行数を上限として、入力データと特徴データの領域をまとめて確保しておく
+    arena_reserve(work, (sizeof(data_fmt) + sizeof(feature)) * n_lines + 128);
+    datas = (data_fmt *)arena_alloc(work, sizeof(data_fmt) * n_lines);
+    if (datas == NULL) {
+      buf_printf(&j->result, "ERR out of memory\n");
+      goto done;
+    }
+    for (p = j->payload; p < end; ) {
+      char *nl = (char *)memchr(p, '\n', end - p);
+      if (nl != NULL) *nl = '\0';
+      if (parse_data_line(p, &datas[len])) len++;  // 無効な行は無視する
+      p = nl == NULL ? end : nl + 1;
+    }
+  }
+
+  if (len == 0) {
+    buf_printf(&j->result, "OK 0\n");
+    goto done;
+  }
+
+  /* -----  ダウンサンプリングと特徴データの抽出 ----- */
+  alloc_num       = len % j->merge_num == 0 ? (len / j->merge_num) : (len / j->merge_num + 1);
+  feature_datas = (feature *)arena_alloc(work, sizeof(feature) * alloc_num);
+  if (feature_datas == NULL) {
+    buf_printf(&j->result, "ERR out of memory\n");
+    goto done;
+  }
+  down_sample_features(feature_datas, datas, len, j->merge_num);
+
+  /* ----- レスポンスの作成(出力ファイルと同じ書式) ----- */
+  buf_reserve(&j->result, (size_t)alloc_num * 64);
+  buf_printf(&j->result, "OK %u\n", alloc_num);
+  buf_printf(&j->result, "%lf %lf %lf\n", feature_datas[0].time, feature_datas[0].len, feature_datas[0].area);
+  for (i = 1; i < alloc_num; i++) {
+    buf_printf(&j->result, "%lf %lf %lf %lf\n",
+        feature_datas[i].time,
+        feature_datas[i].len,
+        feature_datas[i].area,
+        feature_datas[i].cog_change);
+  }
+
+done:
+  free(j->payload);
+  j->payload = NULL;
+
+  pthread_mutex_lock(&ctx->done_mutex);
+  j->next = ctx->done_head;
+  ctx->done_head = j;
+  pthread_mutex_unlock(&ctx->done_mutex);
+  if (write(ctx->event_fd, &one, sizeof(one)) < 0) {
+    perror("write(eventfd)");
+  }
+}
+
+
+/*!
+ * 終了シグナルのハンドラ
+ * @param [in] signum シグナル番号
+ */
+static void sig_handler(int signum) {
+  (void)signum;
+  is_stopped = 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+
+// デーモンモードのプロトコル
+//   リクエスト : "TEXT <merge_num> <payload_bytes>\n" + csvテキスト(payload_bytesバイト)
+//                "BINARY <merge_num> <frames>\n"     + data_fmt構造体の配列(frames個)
+//                merge_numは1以上、INT_MAX未満とする
+//   レスポンス : "OK <rows>\n" + 特徴データの行(rows行)
+//                "ERR <message>\n"
+// 1つの接続で、複数のリクエストを続けて送ることができる
+int run_daemon(const char *sock_path, unsigned int n_workers, int arena_flags);
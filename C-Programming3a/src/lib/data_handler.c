@@ -1,11 +1,33 @@
+#include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "data_handler.h"
 
 #define BUF_SIZE  512
+#define INITIAL_LEN  8192  // 最初に確保する配列の要素数(足りなくなったら倍に広げる)
 #define DATA_COL   10
+#define PAIRWISE_LEAF  8   // SUM_PAIRWISEで、二分木の葉として先頭から順に足すデータの最大数
 #define SQUARE(n) ((n) * (n))
+#define SQUARE_DIST(pos1, pos2)  \
+  (SQUARE((pos2)->x - (pos1)->x) + SQUARE((pos2)->y - (pos1)->y) + SQUARE((pos2)->z - (pos1)->z))
+
+
+static void         average_block(data_fmt *avg, const data_fmt *datas, unsigned int n);
+static void         sum_pairwise(data_fmt *sum, const data_fmt *datas, unsigned int n);
+static void         approx_sqrt4(double *v);
+static unsigned int gallop_time(const data_fmt *datas, unsigned int lo, unsigned int len, double t);
 
+static sum_mode     block_sum_mode = SUM_SEQUENTIAL;  // ブロックの総和の求め方(set_sum_mode()で変える)
+
+// FEATURE_xxxごとの、特徴データの中の位置と名前(イベント検出とヒストグラムで共有する)
+const size_t        FEATURE_OFFSET[N_FEATURES] = {offsetof(feature, len), offsetof(feature, area), offsetof(feature, cog_change)};
+const char *const   FEATURE_NAME[N_FEATURES]   = {"len", "area", "cog"};
 
 #ifndef OPTIMIZE
 static double calc_dist(const position *pos1, const position *pos2);
@@ -31,30 +53,64 @@ static void   calc_cog(position *cog_pos, const data_fmt *datas);
 
 /**
  * csvファイルを読み込む
- * @param [in] f     csvファイルのファイルポインタ
- * @param [in] datas csvファイルを格納する配列
- * @return 有効データ数
+ * 配列は読みながら倍に広げるので、有効データ数に上限は無い
+ * @param [in]  f   csvファイルのファイルポインタ
+ * @param [out] len 有効データ数
+ * @return 有効データの配列(free()で解放する)。メモリ確保に失敗したときはNULLを返す
  */
-unsigned int read_csv(FILE *f, data_fmt *datas) {
-  unsigned int  cnt     = 0;    // 有効データ数のカウンタ
-  unsigned int  line_no = 0;    // 入力ファイルの行番号(エラー出力に用いる)
+data_fmt *read_csv(FILE *f, size_t *len) {
+  size_t        cnt     = 0;    // 有効データ数のカウンタ
+  size_t        cap     = INITIAL_LEN;
+  size_t        line_no = 0;    // 入力ファイルの行番号(エラー出力に用いる)
   static   char buf[BUF_SIZE];  // 読み込み用バッファ
+  data_fmt     *datas   = (data_fmt *)malloc(sizeof(data_fmt) * cap);
 
+  if (datas == NULL) return NULL;
   while (fgets(buf, sizeof(buf), f) != NULL) {
-    int match = sscanf(buf, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
-        &datas->time,
-        &datas->pos1.x, &datas->pos1.y, &datas->pos1.z,
-        &datas->pos2.x, &datas->pos2.y, &datas->pos2.z,
-        &datas->pos3.x, &datas->pos3.y, &datas->pos3.z);
     line_no++;
-    if (match == DATA_COL) {  // データファイルの1行が正しいフォーマットとマッチするなら、
+    if (cnt == cap) {
+      data_fmt *grown = (data_fmt *)realloc(datas, sizeof(data_fmt) * cap * 2);
+      if (grown == NULL) {
+        free(datas);
+        return NULL;
+      }
+      datas = grown;
+      cap  *= 2;
+    }
+    if (parse_data_line(buf, &datas[cnt])) {  // データファイルの1行が正しいフォーマットとマッチするなら、
       cnt++;    // 有効データ数をインクリメント
-      datas++;  // 読み込み用のデータアドレスを次に進める
     } else {
-      fprintf(stderr, "Invalid format data at line %d ... ignored!\n", line_no);
+      fprintf(stderr, "Invalid format data at line %zu ... ignored!\n", line_no);
     }
   }
-  return cnt;  // 有効データ数を返す
+  *len = cnt;
+  return datas;
+}
+
+
+/*!
+ * csvファイルの1行を解析する
+ * @param [in]  line 解析する1行分の文字列
+ * @param [out] data 解析結果を格納するデータ
+ * @return 正しいフォーマットの行なら1を、それ以外なら0を返す
+ */
+int parse_data_line(const char *line, data_fmt *data) {
+  int match = sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+      &data->time,
+      &data->pos1.x, &data->pos1.y, &data->pos1.z,
+      &data->pos2.x, &data->pos2.y, &data->pos2.z,
+      &data->pos3.x, &data->pos3.y, &data->pos3.z);
+  return match == DATA_COL;
+}
+
+
+/*!
+ * ダウンサンプリングでブロックの総和を求める方法を設定する
+ * 以降の全てのダウンサンプリング(down_sample()など、ブロックの平均を取る関数)に適用される
+ * @param [in] mode 総和の求め方
+ */
+void set_sum_mode(sum_mode mode) {
+  block_sum_mode = mode;
 }
 
 
@@ -66,30 +122,18 @@ unsigned int read_csv(FILE *f, data_fmt *datas) {
  * @param [in]  merge_num       結合する数
  */
 void down_sample(data_fmt *down_smpl_datas, const data_fmt *datas, unsigned int len, unsigned int merge_num) {
-  static const data_fmt ZERO_DATA = {0.0, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
   unsigned int i;
   unsigned int repeat = len / merge_num;
   unsigned int rest   = len % merge_num;
 
-  for (i = 0; i < repeat; i++, down_smpl_datas++) {
-    unsigned int j;
-    *down_smpl_datas = ZERO_DATA;  // down_smpl_dataの各要素にゼロをセット
-    down_smpl_datas->time = datas->time;
-    for (j = 0; j < merge_num; j++, datas++) {
-      REC_ASSIGN_DATA2DATA(+, down_smpl_datas, datas);   // 時間を除く各要素の再帰代入演算
-    }
-    REC_ASSIGN_DATA2NUM(/, down_smpl_datas, merge_num);  // 時間を除く各要素の再帰代入演算
+  for (i = 0; i < repeat; i++, down_smpl_datas++, datas += merge_num) {
+    average_block(down_smpl_datas, datas, merge_num);
   }
 
   if (rest == 0) return;
 
   // 元のデータ数がダウンサンプリングでまとめる数で割り切れないとき、
-  *down_smpl_datas = ZERO_DATA;  // down_smpl_dataの各要素にゼロをセット
-  down_smpl_datas->time = datas->time;
-  for (i = 0; i < rest; i++, datas++) {
-    REC_ASSIGN_DATA2DATA(+, down_smpl_datas, datas);  // 時間を除く各要素の再帰代入演算
-  }
-  REC_ASSIGN_DATA2NUM(/, down_smpl_datas, rest);      // 時間を除く各要素の再帰代入演算
+  average_block(down_smpl_datas, datas, rest);  // 残ったデータ数だけで平均を取る
 }
 
 
@@ -103,28 +147,347 @@ void derive_features(feature *feature_datas, const data_fmt *datas, unsigned int
   unsigned int i;
   position prev_cog_pos = {0.0, 0.0, 0.0};  // 1つ前のステップの重心位置記憶用変数
 
-  feature_datas->cog_change = 0.0;  // 最初の重心位置変化は0.0とする
   for (i = 0; i < len; i++, feature_datas++, datas++) {
-    position cog_pos;
-    double   s;
-    double   dist1 = calc_dist(&datas->pos1, &datas->pos2);
-    double   dist2 = calc_dist(&datas->pos2, &datas->pos3);
-    double   dist3 = calc_dist(&datas->pos3, &datas->pos1);
-
-    feature_datas->time = datas->time;            // 時間の代入
-    feature_datas->len  = dist1 + dist2 + dist3;  // 距離の総和の計算
-
-    // ヘロンの公式により、三角形の面積を計算
-    s = feature_datas->len / 2;
-    feature_datas->area = sqrt(s * (s - dist1) * (s - dist2) * (s - dist3));
-
-    // 重心位置の変化を計算
-    calc_cog(&cog_pos, datas);
-    if (i > 0) {
-      // 重心位置の変化量(距離を記憶)
-      feature_datas->cog_change = calc_dist(&cog_pos, &prev_cog_pos);
+    derive_feature(feature_datas, datas, &prev_cog_pos, i == 0);
+  }
+}
+
+
+/*!
+ * ダウンサンプリングと特徴データの抽出を、1パスで行う
+ * down_sample()とderive_features()を続けて呼ぶのと同じ結果になるが、
+ * ブロックの平均値をレジスタ(またはL1キャッシュ)に置いたまま特徴を計算するので、
+ * ダウンサンプリングデータの配列を必要としない
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         オリジナルのデータ
+ * @param [in]  len           オリジナルのデータ数
+ * @param [in]  merge_num     結合する数
+ */
+void down_sample_features(feature *feature_datas, const data_fmt *datas, unsigned int len, unsigned int merge_num) {
+  unsigned int i;
+  unsigned int repeat = len / merge_num;
+  unsigned int rest   = len % merge_num;
+  position prev_cog_pos = {0.0, 0.0, 0.0};  // 1つ前のステップの重心位置記憶用変数
+  data_fmt avg;                             // ブロックの平均値
+
+  for (i = 0; i < repeat; i++, feature_datas++, datas += merge_num) {
+    average_block(&avg, datas, merge_num);
+    derive_feature(feature_datas, &avg, &prev_cog_pos, i == 0);
+  }
+
+  if (rest == 0) return;
+
+  average_block(&avg, datas, rest);
+  derive_feature(feature_datas, &avg, &prev_cog_pos, repeat == 0);
+}
+
+
+/*!
+ * 1つのデータから特徴を引き出す
+ * @param [out]    f            特徴データを格納する構造体
+ * @param [in]     data         特徴データを抜き出す元となるデータ
+ * @param [in,out] prev_cog_pos 1つ前のステップの重心位置(現在の重心位置に更新される)
+ * @param [in]     is_first     最初のステップかどうか(最初の重心位置変化は0.0とする)
+ */
+void derive_feature(feature *f, const data_fmt *data, position *prev_cog_pos, int is_first) {
+  position cog_pos;
+  double   s;
+  double   dist1 = calc_dist(&data->pos1, &data->pos2);
+  double   dist2 = calc_dist(&data->pos2, &data->pos3);
+  double   dist3 = calc_dist(&data->pos3, &data->pos1);
+
+  f->time = data->time;             // 時間の代入
+  f->len  = dist1 + dist2 + dist3;  // 距離の総和の計算
+
+  // ヘロンの公式により、三角形の面積を計算
+  s = f->len / 2;
+  f->area = sqrt(s * (s - dist1) * (s - dist2) * (s - dist3));
+
+  // 重心位置の変化を計算
+  calc_cog(&cog_pos, data);
+  // 重心位置の変化量(距離を記憶)
+  f->cog_change = is_first ? 0.0 : calc_dist(&cog_pos, prev_cog_pos);
+  *prev_cog_pos = cog_pos;  // 現在の重心位置を記憶(次のステップで用いる)
+}
+
+
+/*!
+ * 特徴データを近似計算で引き出す
+ * derive_feature()をlen個のデータに適用するのと同じだが、平方根をapprox_sqrt4()で
+ * APPROX_BATCH個ずつまとめて単精度で計算する(平方根ごとの相対誤差は1e-7未満)
+ * 面積は、ヘロンの公式ではなく外積の大きさから求める(辺の長さの誤差が、
+ * 細長い三角形で増幅されないようにするため)。そのため、細長い三角形では、
+ * ヘロンの公式の桁落ちの分だけ、derive_feature()の面積との差が1e-7より大きくなる
+ * @param [out]    feature_datas 特徴データを格納する配列
+ * @param [in]     datas         特徴データを抜き出す元となるデータ
+ * @param [in]     len           データ数
+ * @param [in,out] prev_cog_pos  1つ前のステップの重心位置(最後の重心位置に更新される)
+ * @param [in]     is_first      datasの先頭が最初のステップかどうか
+ */
+void derive_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int len, position *prev_cog_pos, int is_first) {
+  double       sq[5][APPROX_BATCH];  // 距離1~3, 外積の大きさ, 重心位置の変化の、それぞれの2乗
+  position     cog_pos[APPROX_BATCH];
+  position     prev = *prev_cog_pos;  // datasとの別名の可能性を除くため、ローカルに置く
+  unsigned int i, j, k, n;
+
+  for (i = 0; i < len; i += n, datas += n, feature_datas += n) {
+    n = len - i < APPROX_BATCH ? len - i : APPROX_BATCH;
+    for (j = 0; j < APPROX_BATCH; j++) {
+      const data_fmt *d = &datas[j < n ? j : 0];  // 端数の要素は、先頭のデータで埋めておく
+      double ux = d->pos2.x - d->pos1.x, uy = d->pos2.y - d->pos1.y, uz = d->pos2.z - d->pos1.z;
+      double vx = d->pos3.x - d->pos1.x, vy = d->pos3.y - d->pos1.y, vz = d->pos3.z - d->pos1.z;
+
+      sq[0][j] = SQUARE_DIST(&d->pos1, &d->pos2);
+      sq[1][j] = SQUARE_DIST(&d->pos2, &d->pos3);
+      sq[2][j] = SQUARE_DIST(&d->pos3, &d->pos1);
+      sq[3][j] = SQUARE(uy * vz - uz * vy) + SQUARE(uz * vx - ux * vz) + SQUARE(ux * vy - uy * vx);
+      // 重心は、3での除算の代わりに1/3を掛けて求める(誤差は1ulp以内)
+      cog_pos[j].x = (d->pos1.x + d->pos2.x + d->pos3.x) * (1.0 / 3);
+      cog_pos[j].y = (d->pos1.y + d->pos2.y + d->pos3.y) * (1.0 / 3);
+      cog_pos[j].z = (d->pos1.z + d->pos2.z + d->pos3.z) * (1.0 / 3);
+    }
+    for (j = 0; j < APPROX_BATCH; j++) {
+      sq[4][j] = SQUARE_DIST(&cog_pos[j], j == 0 ? &prev : &cog_pos[j - 1]);
+    }
+    if (is_first && i == 0) sq[4][0] = 0.0;
+    prev = cog_pos[n - 1];
+    for (k = 0; k < 5; k++) {
+      approx_sqrt4(sq[k]);
+    }
+    for (j = 0; j < n; j++) {
+      feature_datas[j].time       = datas[j].time;
+      feature_datas[j].len        = sq[0][j] + sq[1][j] + sq[2][j];
+      feature_datas[j].area       = sq[3][j] / 2;
+      feature_datas[j].cog_change = sq[4][j];
     }
-    prev_cog_pos = cog_pos;  // 現在の重心位置を記憶(次のステップで用いる)
+  }
+  *prev_cog_pos = prev;
+}
+
+
+/*!
+ * ダウンサンプリングと特徴データの抽出を、近似計算で1パスで行う
+ * APPROX_BATCH個のブロックの平均値をまとめてから、derive_features_approx()に渡す
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         オリジナルのデータ
+ * @param [in]  len           オリジナルのデータ数
+ * @param [in]  merge_num     結合する数
+ */
+void down_sample_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int len, unsigned int merge_num) {
+  unsigned int n_blocks = len / merge_num + (len % merge_num != 0);
+  unsigned int i, j, n;
+  position prev_cog_pos = {0.0, 0.0, 0.0};  // 1つ前のステップの重心位置記憶用変数
+  data_fmt avg[APPROX_BATCH];               // ブロックの平均値
+
+  for (i = 0; i < n_blocks; i += n) {
+    n = n_blocks - i < APPROX_BATCH ? n_blocks - i : APPROX_BATCH;
+    for (j = 0; j < n; j++) {
+      unsigned int start = (i + j) * merge_num;
+      average_block(&avg[j], datas + start, len - start < merge_num ? len - start : merge_num);
+    }
+    derive_features_approx(feature_datas + i, avg, n, &prev_cog_pos, i == 0);
+  }
+}
+
+
+
+
+/*!
+ * 時間の列により、データを一定の時間幅のバケットに分ける
+ * k番目のバケットは、[datas[0].time + k * span, datas[0].time + (k + 1) * span) の
+ * 時間のデータから成る。バケットの終わりはgalloping searchで求めるので、計算量は
+ * データ数に対して線形以下である。
+ * データの無いバケットは飛ばして(bounds[]に含めず)、その数をn_emptyに数える
+ * @param [out] bounds    i番目のバケットがdatas[bounds[i]] ~ datas[bounds[i + 1] - 1]
+ *                        となる配列(len + 1個分の領域が必要)
+ * @param [in]  datas     オリジナルのデータ(時間の昇順であること)
+ * @param [in]  len       オリジナルのデータ数
+ * @param [in]  span      バケットの時間幅(正の値)
+ * @param [out] n_buckets データのあるバケットの数
+ * @param [out] n_empty   飛ばした、データの無いバケットの数
+ * @return 成功したなら0を、時間の列が昇順でない(NaNを含む)なら-1を返す
+ */
+int time_buckets(unsigned int *bounds, const data_fmt *datas, unsigned int len, double span, unsigned int *n_buckets, unsigned int *n_empty) {
+  unsigned int       i, n = 0;
+  unsigned long long k, prev_k = 0;
+  int                is_unsorted = 0;
+  double             t0;
+
+  *n_buckets = 0;
+  *n_empty   = 0;
+  if (len == 0) return 0;
+  // 分岐の無いループにして、まとめて判定する
+  for (i = 1; i < len; i++) {
+    is_unsorted |= !(datas[i].time >= datas[i - 1].time);
+  }
+  if (is_unsorted || datas[0].time != datas[0].time) return -1;
+
+  t0 = datas[0].time;
+  for (i = 0; i < len; ) {
+    // 先頭のデータが属するバケットを求め、丸め誤差を境界の比較で補正する
+    k = (unsigned long long)((datas[i].time - t0) / span);
+    while (k > 0 && t0 + k * span > datas[i].time) k--;
+    while (t0 + (k + 1) * span <= datas[i].time) k++;
+
+    if (n > 0 && k - prev_k - 1 < UINT_MAX - *n_empty) {
+      *n_empty += (unsigned int)(k - prev_k - 1);
+    }
+    bounds[n++] = i;
+    prev_k = k;
+    i = gallop_time(datas, i + 1, len, t0 + (k + 1) * span);
+  }
+  bounds[n]  = len;
+  *n_buckets = n;
+  return 0;
+}
+
+
+/*!
+ * バケットごとにダウンサンプリングを行う
+ * @param [out] down_smpl_datas ダウンサンプリングデータを格納する配列
+ * @param [in]  datas           オリジナルのデータ
+ * @param [in]  bounds          バケットの境界(time_buckets()で求めたもの)
+ * @param [in]  n_buckets       バケットの数
+ */
+void down_sample_buckets(data_fmt *down_smpl_datas, const data_fmt *datas, const unsigned int *bounds, unsigned int n_buckets) {
+  unsigned int i;
+  for (i = 0; i < n_buckets; i++, down_smpl_datas++) {
+    average_block(down_smpl_datas, datas + bounds[i], bounds[i + 1] - bounds[i]);
+  }
+}
+
+
+/*!
+ * バケットごとに、ダウンサンプリングと特徴データの抽出を1パスで行う
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         オリジナルのデータ
+ * @param [in]  bounds        バケットの境界(time_buckets()で求めたもの)
+ * @param [in]  n_buckets     バケットの数
+ */
+void down_sample_features_buckets(feature *feature_datas, const data_fmt *datas, const unsigned int *bounds, unsigned int n_buckets) {
+  unsigned int i;
+  position prev_cog_pos = {0.0, 0.0, 0.0};  // 1つ前のステップの重心位置記憶用変数
+  data_fmt avg;                             // バケットの平均値
+
+  for (i = 0; i < n_buckets; i++, feature_datas++) {
+    average_block(&avg, datas + bounds[i], bounds[i + 1] - bounds[i]);
+    derive_feature(feature_datas, &avg, &prev_cog_pos, i == 0);
+  }
+}
+
+
+
+
+/*!
+ * 1ブロック分のデータの平均を取る
+ * 時間は、ブロックの先頭のデータの時間とする
+ * @param [out] avg   平均値を格納するデータ
+ * @param [in]  datas ブロックの先頭のデータ
+ * @param [in]  n     ブロックのデータ数
+ */
+static void average_block(data_fmt *avg, const data_fmt *datas, unsigned int n) {
+  static const data_fmt ZERO_DATA = {0.0, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+  unsigned int i;
+
+  if (block_sum_mode == SUM_PAIRWISE) {
+    sum_pairwise(avg, datas, n);
+  } else {
+    *avg = ZERO_DATA;  // avgの各要素にゼロをセット
+    for (i = 0; i < n; i++) {
+      REC_ASSIGN_DATA2DATA(+, avg, &datas[i]);  // 時間を除く各要素の再帰代入演算
+    }
+  }
+  avg->time = datas->time;
+  REC_ASSIGN_DATA2NUM(/, avg, n);  // 時間を除く各要素の再帰代入演算
+}
+
+
+/*!
+ * ブロックの総和を、データ数だけで形の決まる二分木で求める(pairwise summation)
+ * PAIRWISE_LEAF個以下なら先頭から順に足し、それより多ければ前半(n / 2個)と後半に分けて
+ * それぞれの総和を足す。加算の順序はデータ数nだけで決まり、スレッド数やSIMDの幅、
+ * コンパイラの最適化(浮動小数点の加算は結合則を仮定して並べ替えられない)によらないので、
+ * どの環境でもビット単位で同じ結果になる。丸め誤差も、順に足す場合のO(n)からO(log n)に減る
+ * @param [out] sum   総和を格納するデータ(時間は0とする)
+ * @param [in]  datas ブロックの先頭のデータ
+ * @param [in]  n     ブロックのデータ数
+ */
+static void sum_pairwise(data_fmt *sum, const data_fmt *datas, unsigned int n) {
+  static const data_fmt ZERO_DATA = {0.0, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+  data_fmt     right;
+  unsigned int i;
+
+  if (n <= PAIRWISE_LEAF) {
+    *sum = ZERO_DATA;
+    for (i = 0; i < n; i++) {
+      REC_ASSIGN_DATA2DATA(+, sum, &datas[i]);
+    }
+    return;
+  }
+  sum_pairwise(sum, datas, n / 2);
+  sum_pairwise(&right, datas + n / 2, n - n / 2);
+  REC_ASSIGN_DATA2DATA(+, sum, &right);
+}
+
+
+/*!
+ * 時間がt以上となる最初のデータを、loから指数的に範囲を広げて探し(galloping)、
+ * 見つけた範囲を二分探索する
+ * 探索の手間は、lo から答えまでの距離をdとしてO(log d)である
+ * @param [in] datas 時間の昇順に並んだデータ
+ * @param [in] lo    探索を始める位置
+ * @param [in] len   データ数
+ * @param [in] t     探す時間
+ * @return 時間がt以上となる最初のデータの位置(無ければlen)
+ */
+static unsigned int gallop_time(const data_fmt *datas, unsigned int lo, unsigned int len, double t) {
+  unsigned int hi   = lo;
+  unsigned int step = 1;
+
+  while (hi < len && datas[hi].time < t) {
+    lo   = hi + 1;
+    hi   = len - hi > step ? hi + step : len;
+    step *= 2;
+  }
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (datas[mid].time < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+/*!
+ * 4つの値の平方根を単精度で計算する(相対誤差は2^-24程度)
+ * SSE2が使える場合は、単精度に変換してsqrtps命令で4つまとめて計算する
+ * (倍精度のsqrtsd命令を4回発行するより、レイテンシとスループットが小さい)。
+ * それ以外の環境では、sqrtf()で1つずつ計算する。
+ * 単精度の正規化数の範囲(FLT_MIN ~ FLT_MAX)の外にある値は、単精度に変換すると
+ * 無限大や0になるので、その値だけ倍精度のsqrt()で計算し直す(0はそのまま0になる)
+ * @param [in,out] v 平方根を求める4つの値(0以上)。平方根に置き換えられる
+ */
+static void approx_sqrt4(double *v) {
+  double orig[4];
+  int    i;
+
+  for (i = 0; i < 4; i++) orig[i] = v[i];
+#ifdef __SSE2__
+  {
+    __m128 y = _mm_sqrt_ps(_mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(v)), _mm_cvtpd_ps(_mm_loadu_pd(v + 2))));
+    _mm_storeu_pd(v,     _mm_cvtps_pd(y));
+    _mm_storeu_pd(v + 2, _mm_cvtps_pd(_mm_movehl_ps(y, y)));
+  }
+#else
+  for (i = 0; i < 4; i++) {
+    v[i] = sqrtf((float)v[i]);
+  }
+#endif
+  for (i = 0; i < 4; i++) {
+    if (orig[i] != 0.0 && !(orig[i] >= FLT_MIN && orig[i] <= FLT_MAX)) v[i] = sqrt(orig[i]);
   }
 }
 
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdio.h>
+
+#define APPROX_BATCH  4  // 近似計算でまとめて処理するデータ数
+
 
 typedef struct {
   double x;
@@ -21,6 +25,25 @@ typedef struct {
   double cog_change;
 } feature;
 
+// 特徴データの特徴の番号(イベント検出やヒストグラムで、どの特徴を見るかの指定に用いる)
+#define FEATURE_LEN   0  // 距離の総和
+#define FEATURE_AREA  1  // 面積
+#define FEATURE_COG   2  // 重心位置の変化
+#define N_FEATURES    3  // 特徴の数
+
+// 特徴データの、オフセットoffsetの位置にある値
+#define FEATURE_VALUE(fd, offset)  (*(const double *)((const char *)(fd) + (offset)))
+
+// FEATURE_xxxごとの、特徴データの中の位置と名前
+extern const size_t      FEATURE_OFFSET[N_FEATURES];
+extern const char *const FEATURE_NAME[N_FEATURES];
+
+// ダウンサンプリングでブロックの総和を求める方法
+typedef enum {
+  SUM_SEQUENTIAL,  // 先頭から順に足す(既定)
+  SUM_PAIRWISE     // データ数だけで形の決まる二分木で足す(実装や環境によらず同じ結果になる)
+} sum_mode;
+
 
 // data_fmt用の再帰代入演算用マクロ(data_fmt 対 data_fmt)
 #define REC_ASSIGN_DATA2DATA(op, data1, data2) { \
@@ -49,6 +72,15 @@ typedef struct {
 }
 
 
-unsigned int read_csv(FILE *f, data_fmt *datas);
+data_fmt *read_csv(FILE *f, size_t *len);
+int parse_data_line(const char *line, data_fmt *data);
+void set_sum_mode(sum_mode mode);
 void down_sample(data_fmt *down_smpl_datas, const data_fmt *datas, unsigned int len, unsigned int merge_num);
 void derive_features(feature *feature_datas, const data_fmt *datas, unsigned int len);
+void derive_feature(feature *f, const data_fmt *data, position *prev_cog_pos, int is_first);
+void down_sample_features(feature *feature_datas, const data_fmt *datas, unsigned int len, unsigned int merge_num);
+int time_buckets(unsigned int *bounds, const data_fmt *datas, unsigned int len, double span, unsigned int *n_buckets, unsigned int *n_empty);
+void down_sample_buckets(data_fmt *down_smpl_datas, const data_fmt *datas, const unsigned int *bounds, unsigned int n_buckets);
+void down_sample_features_buckets(feature *feature_datas, const data_fmt *datas, const unsigned int *bounds, unsigned int n_buckets);
+void derive_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int len, position *prev_cog_pos, int is_first);
+void down_sample_features_approx(feature *feature_datas, const data_fmt *datas, unsigned int len, unsigned int merge_num);
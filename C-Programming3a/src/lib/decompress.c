@@ -0,0 +1,397 @@
+#define _GNU_SOURCE  // fopencookie
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#include "thread_pool.h"
+#endif
+#include "decompress.h"
+
+#define GZIP_BUF_SIZE          (128u << 10)  // zlibの入力バッファのバイト数
+#define ZSTD_MAX_TASK_SIZE      (64u << 20)  // 並列に展開するフレームの、展開後の最大のバイト数
+#define ZSTD_TASKS_PER_THREAD            4   // 一度に並列に展開する、ワーカスレッドあたりのフレームの数
+
+
+#ifdef USE_ZLIB
+static FILE   *open_gzip(const char *filename);
+static ssize_t gzip_read(void *cookie, char *buf, size_t size);
+static int     gzip_close(void *cookie);
+#endif
+
+#ifdef USE_ZSTD
+// 並列に展開する1つのフレーム
+typedef struct {
+  const uint8_t *src;        // 圧縮されたフレーム
+  size_t         src_size;   // 圧縮されたフレームのバイト数
+  uint8_t       *dst;        // 展開結果(タスクの中で確保する)
+  size_t         dst_size;   // 展開後のバイト数(フレームのヘッダに記録された値)
+  int            is_failed;  // 展開に失敗したかどうか
+} zstd_task;
+
+// zstdの入力を、読みながら展開する状態
+typedef struct {
+  const char    *filename;   // エラーメッセージに用いるファイル名
+  const uint8_t *src;        // マップした圧縮データ
+  size_t         src_size;   // 圧縮データのバイト数
+  size_t         src_pos;    // 次に展開するフレームの位置
+  zstd_task     *tasks;      // 並列に展開したフレーム(ファイルの順)
+  unsigned int   max_tasks;  // 一度に展開するフレームの最大数
+  unsigned int   n_tasks;    // 展開したフレームの数
+  unsigned int   cur_task;   // 次に読むフレーム
+  size_t         out_pos;    // tasks[cur_task]の展開結果の、次に読む位置
+  ZSTD_DStream  *dstream;    // 大きなフレームを、少しずつ展開するストリーム
+  int            in_stream;  // dstreamでフレームを展開している途中かどうか
+  thread_pool   *pool;       // フレームを展開するスレッドプール(NULLなら、読むスレッドで展開する)
+} zstd_reader;
+
+static FILE   *open_zstd(const char *filename, unsigned int n_threads);
+static ssize_t zstd_read(void *cookie, char *buf, size_t size);
+static int     zstd_close(void *cookie);
+static int     zstd_fill_tasks(zstd_reader *r);
+static void    zstd_decode_task(void *arg, unsigned int worker_id);
+static void    zstd_free_tasks(zstd_reader *r);
+#endif
+
+
+
+
+/*!
+ * 入力ファイルの圧縮形式を、先頭のマジックで判定する
+ * @param [in] filename 入力ファイル名
+ * @return 圧縮形式(開けないファイルや、4バイトに満たないファイルはINPUT_PLAIN)
+ */
+input_format detect_input_format(const char *filename) {
+  static const unsigned char GZIP_MAGIC[2] = {0x1f, 0x8b};
+  static const unsigned char ZSTD_MAGIC[4] = {0x28, 0xb5, 0x2f, 0xfd};
+  static const unsigned char SKIPPABLE_MAGIC[3] = {0x2a, 0x4d, 0x18};  // スキップ可能フレームの上位3バイト
+  unsigned char magic[4];
+  input_format  fmt = INPUT_PLAIN;
+  FILE         *f   = fopen(filename, "rb");
+
+  if (f == NULL) return INPUT_PLAIN;
+  if (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) {
+    if (memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) {
+      fmt = INPUT_GZIP;
+    } else if (memcmp(magic, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0
+        || ((magic[0] & 0xf0) == 0x50 && memcmp(magic + 1, SKIPPABLE_MAGIC, sizeof(SKIPPABLE_MAGIC)) == 0)) {
+      fmt = INPUT_ZSTD;  // スキップ可能フレーム(0x184d2a50 ~ 0x184d2a5f)で始まるものも含む
+    }
+  }
+  fclose(f);
+  return fmt;
+}
+
+
+/*!
+ * 入力ファイルを読み取り用に開く
+ * gzipやzstdで圧縮されていれば、fopencookieで読みながら展開するFILEを返すので、
+ * 呼び出し側は一時ファイルに展開せずに、圧縮されていないファイルと同じように読める
+ * @param [in] filename  入力ファイル名
+ * @param [in] n_threads zstdのフレームを並列に展開するスレッド数
+ * @return ファイルポインタ(fcloseで閉じる)。開けなかったならNULLを返す(エラーメッセージは標準エラー出力に表示する)
+ */
+FILE *open_input(const char *filename, unsigned int n_threads) {
+  FILE *f;
+
+  switch (detect_input_format(filename)) {
+    case INPUT_GZIP:
+#ifdef USE_ZLIB
+      f = open_gzip(filename);
+      break;
+#else
+      fprintf(stderr, "ファイル:%sはgzipで圧縮されていますが、USE_ZLIBを定義せずにコンパイルされています\n", filename);
+      return NULL;
+#endif
+    case INPUT_ZSTD:
+#ifdef USE_ZSTD
+      f = open_zstd(filename, n_threads);
+      break;
+#else
+      fprintf(stderr, "ファイル:%sはzstdで圧縮されていますが、USE_ZSTDを定義せずにコンパイルされています\n", filename);
+      return NULL;
+#endif
+    default:
+      f = fopen(filename, "r");
+      break;
+  }
+  (void)n_threads;
+  if (f == NULL) fprintf(stderr, "ファイル:%sが開けません\n", filename);
+  return f;
+}
+
+
+
+
+#ifdef USE_ZLIB
+/*!
+ * gzipで圧縮されたファイルを、zlibで読みながら展開するFILEとして開く
+ * 複数のメンバを連結したファイル(pigzなどの出力)も、続けて展開する
+ * @param [in] filename 入力ファイル名
+ * @return ファイルポインタ(開けなかったならNULL)
+ */
+static FILE *open_gzip(const char *filename) {
+  cookie_io_functions_t io = {gzip_read, NULL, NULL, gzip_close};
+  gzFile                gz = gzopen(filename, "rb");
+  FILE                 *f;
+
+  if (gz == NULL) return NULL;
+  gzbuffer(gz, GZIP_BUF_SIZE);
+  f = fopencookie(gz, "r", io);
+  if (f == NULL) gzclose(gz);
+  return f;
+}
+
+
+/*!
+ * 展開したデータを読む(fopencookieの読み込み関数)
+ * @param [in]  cookie gzFile
+ * @param [out] buf    展開したデータを格納するバッファ
+ * @param [in]  size   bufのバイト数
+ * @return 読んだバイト数(ファイルの終わりなら0、失敗したなら-1)
+ */
+static ssize_t gzip_read(void *cookie, char *buf, size_t size) {
+  gzFile gz = (gzFile)cookie;
+  int    n, errnum;
+
+  n = gzread(gz, buf, size > GZIP_BUF_SIZE ? GZIP_BUF_SIZE : (unsigned int)size);
+  if (n < 0) {
+    fprintf(stderr, "gzipの展開に失敗しました(%s)\n", gzerror(gz, &errnum));
+    return -1;
+  }
+  if (n == 0 && (gzerror(gz, &errnum), errnum == Z_BUF_ERROR)) {  // メンバの途中でファイルが終わった
+    fputs("gzipのファイルが途中で切れています\n", stderr);
+    return -1;
+  }
+  return n;
+}
+
+
+/*!
+ * gzFileを閉じる(fopencookieの終了関数)
+ * @param [in] cookie gzFile
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int gzip_close(void *cookie) {
+  return gzclose((gzFile)cookie) == Z_OK ? 0 : -1;
+}
+#endif
+
+
+
+
+#ifdef USE_ZSTD
+/*!
+ * zstdで圧縮されたファイルを、読みながら展開するFILEとして開く
+ * 複数のフレームからなるファイル(zstd --seekableや、フレームごとに圧縮して連結したもの)は、
+ * 展開後の大きさがヘッダに記録されたフレームを、まとめてスレッドプールで並列に展開してから、
+ * ファイルの順に読ませる。大きさが分からないフレームや大きすぎるフレームは、読みながら順に展開する
+ * @param [in] filename  入力ファイル名
+ * @param [in] n_threads フレームを並列に展開するスレッド数
+ * @return ファイルポインタ(開けなかったならNULL)
+ */
+static FILE *open_zstd(const char *filename, unsigned int n_threads) {
+  cookie_io_functions_t io = {zstd_read, NULL, NULL, zstd_close};
+  struct stat           st;
+  zstd_reader          *r;
+  void                 *map;
+  FILE                 *f;
+  int                   fd = open(filename, O_RDONLY);
+
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+  madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  if (n_threads == 0) n_threads = 1;
+  r = (zstd_reader *)calloc(1, sizeof(zstd_reader));
+  if (r == NULL) {
+    munmap(map, (size_t)st.st_size);
+    return NULL;
+  }
+  r->filename  = filename;
+  r->src       = (const uint8_t *)map;
+  r->src_size  = (size_t)st.st_size;
+  r->max_tasks = n_threads * ZSTD_TASKS_PER_THREAD;
+  r->tasks     = (zstd_task *)calloc(r->max_tasks, sizeof(zstd_task));
+  r->dstream   = ZSTD_createDStream();
+  if (n_threads > 1) r->pool = thread_pool_create(n_threads);  // 作れなくても、読むスレッドで展開する
+  if (r->tasks == NULL || r->dstream == NULL || (f = fopencookie(r, "r", io)) == NULL) {
+    zstd_close(r);
+    return NULL;
+  }
+  return f;
+}
+
+
+/*!
+ * 展開したデータを読む(fopencookieの読み込み関数)
+ * 並列に展開したフレームを順に返し、読み終えたら次のフレームをまとめて展開する
+ * @param [in,out] cookie zstd_reader
+ * @param [out]    buf    展開したデータを格納するバッファ
+ * @param [in]     size   bufのバイト数
+ * @return 読んだバイト数(ファイルの終わりなら0、失敗したなら-1)
+ */
+static ssize_t zstd_read(void *cookie, char *buf, size_t size) {
+  zstd_reader *r = (zstd_reader *)cookie;
+
+  for (;;) {
+    if (r->cur_task < r->n_tasks) {
+      zstd_task *t = &r->tasks[r->cur_task];
+      size_t     n = t->dst_size - r->out_pos;
+      if (n > 0) {
+        if (n > size) n = size;
+        memcpy(buf, t->dst + r->out_pos, n);
+        r->out_pos += n;
+        return (ssize_t)n;
+      }
+      free(t->dst);  // 読み終えたフレームの展開結果は、すぐに解放する
+      t->dst     = NULL;
+      r->out_pos = 0;
+      r->cur_task++;
+      continue;
+    }
+    if (r->in_stream) {
+      ZSTD_inBuffer  in  = {r->src, r->src_size, r->src_pos};
+      ZSTD_outBuffer out = {buf, size, 0};
+      size_t         ret = ZSTD_decompressStream(r->dstream, &out, &in);
+      r->src_pos = in.pos;
+      if (ZSTD_isError(ret)) {
+        fprintf(stderr, "ファイル:%sの展開に失敗しました(%s)\n", r->filename, ZSTD_getErrorName(ret));
+        return -1;
+      }
+      if (ret == 0) r->in_stream = 0;  // フレームを展開し終えた
+      if (out.pos > 0) return (ssize_t)out.pos;
+      if (ret != 0 && in.pos == in.size) {
+        fprintf(stderr, "ファイル:%sは途中で切れています\n", r->filename);
+        return -1;
+      }
+      continue;
+    }
+    if (r->src_pos == r->src_size) return 0;
+    if (zstd_fill_tasks(r) != 0) return -1;
+  }
+}
+
+
+/*!
+ * 展開の状態を解放する(fopencookieの終了関数)
+ * @param [in] cookie zstd_reader
+ * @return 常に0を返す
+ */
+static int zstd_close(void *cookie) {
+  zstd_reader *r = (zstd_reader *)cookie;
+
+  if (r->pool != NULL) thread_pool_destroy(r->pool);
+  if (r->tasks != NULL) zstd_free_tasks(r);
+  free(r->tasks);
+  ZSTD_freeDStream(r->dstream);
+  munmap((void *)r->src, r->src_size);
+  free(r);
+  return 0;
+}
+
+
+/*!
+ * 次のフレームから、展開後の大きさが分かる小さなフレームを最大max_tasks個まとめて、並列に展開する
+ * 先頭のフレームの大きさが分からないか大きすぎるときは、並列に展開せずに、ストリームで展開し始める
+ * @param [in,out] r 展開の状態
+ * @return 成功したなら0を、フレームが壊れているか展開に失敗したなら-1を返す
+ */
+static int zstd_fill_tasks(zstd_reader *r) {
+  unsigned int i;
+  int          is_failed = 0;
+
+  zstd_free_tasks(r);
+  while (r->n_tasks < r->max_tasks && r->src_pos < r->src_size) {
+    const uint8_t      *p    = r->src + r->src_pos;
+    size_t              rest = r->src_size - r->src_pos;
+    size_t              csize = ZSTD_findFrameCompressedSize(p, rest);
+    unsigned long long  dsize = ZSTD_getFrameContentSize(p, rest);
+    zstd_task          *t;
+
+    if (ZSTD_isError(csize) || dsize == ZSTD_CONTENTSIZE_ERROR) {
+      fprintf(stderr, "ファイル:%sのフレームが壊れています\n", r->filename);
+      return -1;
+    }
+    if (dsize == ZSTD_CONTENTSIZE_UNKNOWN || dsize > ZSTD_MAX_TASK_SIZE) {
+      if (r->n_tasks == 0) {
+        ZSTD_DCtx_reset(r->dstream, ZSTD_reset_session_only);
+        r->in_stream = 1;
+      }
+      break;  // このフレームは、それまでのフレームを読み終えてからストリームで展開する
+    }
+    t = &r->tasks[r->n_tasks++];
+    t->src       = p;
+    t->src_size  = csize;
+    t->dst_size  = (size_t)dsize;
+    r->src_pos  += csize;
+  }
+
+  for (i = 0; i < r->n_tasks; i++) {
+    if (r->pool == NULL || thread_pool_submit(r->pool, zstd_decode_task, &r->tasks[i]) != 0) {
+      zstd_decode_task(&r->tasks[i], 0);
+    }
+  }
+  if (r->pool != NULL) thread_pool_wait(r->pool);
+  for (i = 0; i < r->n_tasks; i++) {
+    if (r->tasks[i].is_failed) is_failed = 1;
+  }
+  if (is_failed) {
+    fprintf(stderr, "ファイル:%sの展開に失敗しました\n", r->filename);
+    zstd_free_tasks(r);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 1つのフレームを展開する(スレッドプールのタスク)
+ * @param [in,out] arg       展開するフレーム(zstd_task)
+ * @param [in]     worker_id ワーカスレッドの番号(未使用)
+ */
+static void zstd_decode_task(void *arg, unsigned int worker_id) {
+  zstd_task *t = (zstd_task *)arg;
+  size_t     ret;
+  (void)worker_id;
+
+  t->dst = (uint8_t *)malloc(t->dst_size > 0 ? t->dst_size : 1);  // スキップ可能フレームは0バイト
+  if (t->dst == NULL) {
+    t->is_failed = 1;
+    return;
+  }
+  ret = ZSTD_decompress(t->dst, t->dst_size, t->src, t->src_size);
+  t->is_failed = ZSTD_isError(ret) || ret != t->dst_size;
+}
+
+
+/*!
+ * 展開したフレームを全て解放し、フレームの列を空にする
+ * @param [in,out] r 展開の状態
+ */
+static void zstd_free_tasks(zstd_reader *r) {
+  unsigned int i;
+
+  for (i = 0; i < r->n_tasks; i++) {
+    free(r->tasks[i].dst);
+  }
+  memset(r->tasks, 0, sizeof(zstd_task) * r->max_tasks);
+  r->n_tasks  = 0;
+  r->cur_task = 0;
+  r->out_pos  = 0;
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdio.h>
+
+
+// 入力ファイルの圧縮形式(先頭のマジックで判定する)
+typedef enum {
+  INPUT_PLAIN,  // 圧縮されていない
+  INPUT_GZIP,   // gzip(複数のメンバを連結したものも含む)
+  INPUT_ZSTD    // zstd(複数のフレームを連結したものも含む)
+} input_format;
+
+
+input_format detect_input_format(const char *filename);
+// 入力ファイルを読み取り用に開く。圧縮されていれば、読みながら展開するFILEを返す
+// (USE_ZLIB, USE_ZSTDを定義せずにコンパイルした形式は、エラーとしてNULLを返す)
+// zstdの複数のフレームは、n_threads個のスレッドで並列に展開する
+FILE *open_input(const char *filename, unsigned int n_threads);
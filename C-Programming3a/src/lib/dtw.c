@@ -0,0 +1,390 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dtw.h"
+
+#define QUERY_FLAT_RATIO   1e-12  // クエリの標準偏差が、平均の絶対値のこの割合以下なら平坦とみなす
+#define WINDOW_FLAT_RATIO  1e-6   // 部分系列の標準偏差が、系列全体の標準偏差のこの割合以下なら平坦とみなす
+
+
+// 位置と、下界への寄与の見込み(並べ替え用)
+typedef struct {
+  double       key;    // z正規化したクエリの値の絶対値の和
+  unsigned int index;  // クエリの中の位置
+} order_entry;
+
+
+static void   envelope(double *upper, double *lower, const double *t, size_t n, unsigned int r, size_t *work);
+static double banded_dtw(double *const *a, double *const *b, unsigned int n_ch, const double *cb,
+                         unsigned int m, unsigned int r, double bsf, double *work);
+static int    compare_order(const void *a, const void *b);
+
+
+
+
+/*!
+ * クエリをz正規化し、下界の計算の準備をする
+ * LB_Keoghは、z正規化した値が0から遠い位置ほど大きく寄与するので、
+ * 値の絶対値の大きい順に位置を並べておき、その順に足して早く打ち切れるようにする
+ * 平坦なクエリは、標準偏差を1として(全て0に)正規化する
+ * @param [out] dq       準備したクエリ(使い終わったらdtw_query_destroy()で解放する)
+ * @param [in]  channels チャンネルごとの、クエリの値の配列
+ * @param [in]  n_ch     チャンネル数(1以上DTW_MAX_CHANNELS以下)
+ * @param [in]  m        クエリの長さ(1以上)
+ * @param [in]  r        Sakoe-Chibaの帯の幅(m以上なら、m - 1とする)
+ * @return 成功したなら0を、引数が不正かメモリ確保に失敗したなら-1を返す
+ */
+int dtw_query_init(dtw_query *dq, const double *const *channels, unsigned int n_ch, unsigned int m, unsigned int r) {
+  order_entry  *entries;
+  size_t       *work;
+  double       *d, *upper, *lower;
+  unsigned int  c, i;
+
+  memset(dq, 0, sizeof(*dq));
+  if (m == 0 || n_ch == 0 || n_ch > DTW_MAX_CHANNELS) return -1;
+  dq->m    = m;
+  dq->r    = r < m ? r : m - 1;
+  dq->n_ch = n_ch;
+  dq->mem  = malloc(sizeof(double) * m * (4 * n_ch + 2) + sizeof(unsigned int) * m);
+  entries  = (order_entry *)malloc(sizeof(order_entry) * m);
+  work     = (size_t *)malloc(sizeof(size_t) * 2 * m);
+  if (dq->mem == NULL || entries == NULL || work == NULL) {
+    free(dq->mem);
+    free(entries);
+    free(work);
+    dq->mem = NULL;
+    return -1;
+  }
+  d = (double *)dq->mem;
+  for (c = 0; c < n_ch; c++) {
+    dq->q[c]         = d;
+    dq->q_ord[c]     = d + m;
+    dq->upper_ord[c] = d + 2 * (size_t)m;
+    dq->lower_ord[c] = d + 3 * (size_t)m;
+    d += 4 * (size_t)m;
+  }
+  upper     = d;
+  lower     = d + m;
+  dq->order = (unsigned int *)(d + 2 * (size_t)m);
+
+  for (i = 0; i < m; i++) {
+    entries[i].key   = 0.0;
+    entries[i].index = i;
+  }
+  for (c = 0; c < n_ch; c++) {
+    double mean = 0.0, var = 0.0, sd;
+    for (i = 0; i < m; i++) mean += channels[c][i];
+    mean /= m;
+    for (i = 0; i < m; i++) var += (channels[c][i] - mean) * (channels[c][i] - mean);
+    sd = sqrt(var / m);
+    if (sd <= QUERY_FLAT_RATIO * fabs(mean)) sd = 1.0;
+    for (i = 0; i < m; i++) {
+      dq->q[c][i] = (channels[c][i] - mean) / sd;
+      entries[i].key += fabs(dq->q[c][i]);
+    }
+  }
+  qsort(entries, m, sizeof(order_entry), compare_order);
+
+  for (i = 0; i < m; i++) dq->order[i] = entries[i].index;
+  for (c = 0; c < n_ch; c++) {
+    envelope(upper, lower, dq->q[c], m, dq->r, work);
+    for (i = 0; i < m; i++) {
+      unsigned int j = dq->order[i];
+      dq->q_ord[c][i]     = dq->q[c][j];
+      dq->upper_ord[c][i] = upper[j];
+      dq->lower_ord[c][i] = lower[j];
+    }
+  }
+  free(entries);
+  free(work);
+  return 0;
+}
+
+
+/*!
+ * クエリの領域を解放する
+ * @param [in,out] dq dtw_query_init()で準備したクエリ
+ */
+void dtw_query_destroy(dtw_query *dq) {
+  free(dq->mem);
+  memset(dq, 0, sizeof(*dq));
+}
+
+
+/*!
+ * 系列の中から、クエリとのDTW距離が最小となる部分系列を探す(UCR suiteと同じ手順)
+ * 位置ごとに、計算量の小さい下界から順に調べ、それまでの最良の距離以上になった時点で枝刈りする
+ *   1. LB_Kim : 両端の点は必ず対応付くので、その距離の和(O(1))
+ *   2. LB_Keogh : 部分系列の各点と、クエリの包絡線との距離の和(O(m)、大きく寄与する位置から足して打ち切る)
+ *   3. LB_Keogh : クエリの各点と、部分系列の包絡線との距離の和(同上)
+ *   4. DTW : 2., 3.のうち大きい方の位置ごとの寄与を後ろから累積し、
+ *            各行の最小値に残りの行の下界を足した値が最良の距離以上になれば打ち切る
+ * 部分系列の平均と分散は累積和から、包絡線は系列全体について一度だけ求める
+ * (系列全体の包絡線は部分系列の包絡線を内側に含むので、下界のままである)
+ * 累積和の桁落ちを抑えるため、系列全体の平均を引いてからlong doubleで累積する
+ * @param [in]  dq        準備したクエリ
+ * @param [in]  channels  チャンネルごとの、系列の値の配列(チャンネル数はクエリと同じ)
+ * @param [in]  n         系列の長さ
+ * @param [in]  threshold この距離以上の部分系列は探さない(打ち切りの初期値。制限しないならINFINITY)
+ * @param [out] best      見つかった最小の距離(DTWの経路上の点の距離の2乗和)。無ければINFINITY
+ * @param [out] best_pos  見つかった部分系列の先頭の位置
+ * @param [out] stats     枝刈りの統計(各カウンタに加算する)
+ * @return 見つかったなら0を、threshold未満の部分系列が無ければ1を、メモリ確保に失敗したなら-1を返す
+ */
+int dtw_search(const dtw_query *dq, const double *const *channels, size_t n, double threshold,
+    double *best, size_t *best_pos, dtw_stats *stats) {
+  unsigned int  m = dq->m, r = dq->r, n_ch = dq->n_ch;
+  double       *t[DTW_MAX_CHANNELS], *upper[DTW_MAX_CHANNELS], *lower[DTW_MAX_CHANNELS], *tz[DTW_MAX_CHANNELS];
+  long double  *s1[DTW_MAX_CHANNELS], *s2[DTW_MAX_CHANNELS];  // 平均を引いた値と、その2乗の累積和
+  double        flat[DTW_MAX_CHANNELS];                        // 平坦とみなす標準偏差
+  double       *d, *cb, *cb_eq, *cb_ec, *work;
+  long double  *ld;
+  size_t       *deque;
+  double        bsf = threshold;                               // それまでの最良の距離
+  size_t        i;
+  unsigned int  c, k;
+  int           found = 0;
+
+  *best     = INFINITY;
+  *best_pos = 0;
+  if (n < m) return 1;
+  d     = (double *)malloc(sizeof(double) * ((size_t)n * 3 * n_ch + (size_t)m * (n_ch + 3) + 1 + 3 * (2 * (size_t)r + 1)));
+  ld    = (long double *)malloc(sizeof(long double) * ((size_t)n + 1) * 2 * n_ch);
+  deque = (size_t *)malloc(sizeof(size_t) * 2 * n);
+  if (d == NULL || ld == NULL || deque == NULL) {
+    free(d);
+    free(ld);
+    free(deque);
+    return -1;
+  }
+  for (c = 0; c < n_ch; c++) {
+    t[c]     = d + (size_t)n * 3 * c;
+    upper[c] = t[c] + n;
+    lower[c] = t[c] + 2 * n;
+    tz[c]    = d + (size_t)n * 3 * n_ch + (size_t)m * c;
+    s1[c]    = ld + ((size_t)n + 1) * 2 * c;
+    s2[c]    = s1[c] + n + 1;
+  }
+  cb    = d + (size_t)n * 3 * n_ch + (size_t)m * n_ch;
+  cb_eq = cb + m + 1;
+  cb_ec = cb_eq + m;
+  work  = cb_ec + m;
+
+  for (c = 0; c < n_ch; c++) {
+    double mean = 0.0;
+    for (i = 0; i < n; i++) mean += channels[c][i];
+    mean /= n;
+    s1[c][0] = 0.0L;
+    s2[c][0] = 0.0L;
+    for (i = 0; i < n; i++) {
+      t[c][i]      = channels[c][i] - mean;
+      s1[c][i + 1] = s1[c][i] + t[c][i];
+      s2[c][i + 1] = s2[c][i] + (long double)t[c][i] * t[c][i];
+    }
+    flat[c] = WINDOW_FLAT_RATIO * sqrt((double)(s2[c][n] / n));
+    envelope(upper[c], lower[c], t[c], n, r, deque);
+  }
+
+  for (i = 0; i + m <= n; i++) {
+    double        mean[DTW_MAX_CHANNELS], sd[DTW_MAX_CHANNELS];
+    double        lb, lb_eq, dist;
+    const double *src;
+
+    stats->n_windows++;
+    for (c = 0; c < n_ch; c++) {
+      double var;
+      mean[c] = (double)((s1[c][i + m] - s1[c][i]) / m);
+      var     = (double)((s2[c][i + m] - s2[c][i]) / m) - mean[c] * mean[c];
+      sd[c]   = var > 0.0 ? sqrt(var) : 0.0;
+      if (sd[c] <= flat[c]) sd[c] = 1.0;
+    }
+
+    // 1. LB_Kim(両端の点)
+    lb = 0.0;
+    for (c = 0; c < n_ch; c++) {
+      double x0 = (t[c][i] - mean[c]) / sd[c] - dq->q[c][0];
+      double x1 = (t[c][i + m - 1] - mean[c]) / sd[c] - dq->q[c][m - 1];
+      lb += x0 * x0 + (m > 1 ? x1 * x1 : 0.0);
+    }
+    if (lb >= bsf) {
+      stats->kim++;
+      continue;
+    }
+
+    // 2. LB_Keogh(部分系列の各点と、クエリの包絡線)
+    lb = 0.0;
+    for (k = 0; k < m && lb < bsf; k++) {
+      unsigned int j = dq->order[k];
+      double       e = 0.0;
+      for (c = 0; c < n_ch; c++) {
+        double x = (t[c][i + j] - mean[c]) / sd[c];
+        if (x > dq->upper_ord[c][k]) {
+          e += (x - dq->upper_ord[c][k]) * (x - dq->upper_ord[c][k]);
+        } else if (x < dq->lower_ord[c][k]) {
+          e += (dq->lower_ord[c][k] - x) * (dq->lower_ord[c][k] - x);
+        }
+      }
+      cb_eq[j] = e;
+      lb += e;
+    }
+    if (lb >= bsf) {
+      stats->keogh_eq++;
+      continue;
+    }
+    lb_eq = lb;
+
+    // 3. LB_Keogh(クエリの各点と、部分系列の包絡線)
+    lb = 0.0;
+    for (k = 0; k < m && lb < bsf; k++) {
+      unsigned int j = dq->order[k];
+      double       e = 0.0;
+      for (c = 0; c < n_ch; c++) {
+        double u = (upper[c][i + j] - mean[c]) / sd[c];
+        double l = (lower[c][i + j] - mean[c]) / sd[c];
+        double x = dq->q_ord[c][k];
+        if (x > u) {
+          e += (x - u) * (x - u);
+        } else if (x < l) {
+          e += (l - x) * (l - x);
+        }
+      }
+      cb_ec[j] = e;
+      lb += e;
+    }
+    if (lb >= bsf) {
+      stats->keogh_ec++;
+      continue;
+    }
+
+    // 4. DTW(大きい方の下界の寄与を、後ろから累積して打ち切りに用いる)
+    src   = lb_eq > lb ? cb_eq : cb_ec;
+    cb[m] = 0.0;
+    for (k = m; k-- > 0; ) cb[k] = cb[k + 1] + src[k];
+    for (c = 0; c < n_ch; c++) {
+      for (k = 0; k < m; k++) tz[c][k] = (t[c][i + k] - mean[c]) / sd[c];
+    }
+    stats->dtw++;
+    dist = banded_dtw(dq->q, tz, n_ch, cb, m, r, bsf, work);
+    if (dist < bsf) {
+      bsf       = dist;
+      *best     = dist;
+      *best_pos = i;
+      found     = 1;
+    } else if (isinf(dist)) {
+      stats->abandoned++;
+    }
+  }
+  free(d);
+  free(ld);
+  free(deque);
+  return found ? 0 : 1;
+}
+
+
+
+
+/*!
+ * 系列の包絡線(各点の前後r点の最大値と最小値)を求める
+ * 単調な両端キューを用いて、rによらずO(n)で求める(Lemireのアルゴリズム)
+ * @param [out] upper 上側の包絡線(n個)
+ * @param [out] lower 下側の包絡線(n個)
+ * @param [in]  t     系列
+ * @param [in]  n     系列の長さ
+ * @param [in]  r     前後の幅
+ * @param [in]  work  作業領域(2n個)
+ */
+static void envelope(double *upper, double *lower, const double *t, size_t n, unsigned int r, size_t *work) {
+  size_t *du = work, *dl = work + n;  // 値の大きい順、小さい順に位置を並べたキュー
+  size_t  uh = 0, ut = 0, lh = 0, lt = 0;
+  size_t  i;
+
+  for (i = 0; i < n + r; i++) {
+    if (i < n) {
+      while (ut > uh && t[du[ut - 1]] <= t[i]) ut--;
+      du[ut++] = i;
+      while (lt > lh && t[dl[lt - 1]] >= t[i]) lt--;
+      dl[lt++] = i;
+    }
+    if (i >= r) {
+      size_t j = i - r;
+      while (du[uh] + r < j) uh++;
+      while (dl[lh] + r < j) lh++;
+      upper[j] = t[du[uh]];
+      lower[j] = t[dl[lh]];
+    }
+  }
+}
+
+
+/*!
+ * 帯の幅rのDTW距離を、途中で打ち切りながら求める
+ * 1行(aの1点)ごとに、帯の中のbの点との距離をまとめて求めてから、漸化式で累積する
+ * 距離は帯の中で連続した値の単純な積和なので、最も内側のループはSIMD命令にでき、
+ * 漸化式のループには比較と加算だけが残る
+ * @param [in] a    z正規化したクエリ(チャンネルごと)
+ * @param [in] b    z正規化した部分系列(チャンネルごと)
+ * @param [in] n_ch チャンネル数
+ * @param [in] cb   位置k以降の下界の寄与の和(m + 1個、cb[m] = 0)
+ * @param [in] m    系列の長さ
+ * @param [in] r    帯の幅
+ * @param [in] bsf  それまでの最良の距離(これ以上になると分かった時点で打ち切る)
+ * @param [in] work 作業領域(3(2r + 1)個)
+ * @return DTW距離(打ち切ったならINFINITY)
+ */
+static double banded_dtw(double *const *a, double *const *b, unsigned int n_ch, const double *cb,
+                         unsigned int m, unsigned int r, double bsf, double *work) {
+  unsigned int  w    = 2 * r + 1;
+  double       *cost = work;          // 現在の行の累積距離(帯の中の位置 k = j - i + r)
+  double       *prev = work + w;      // 1つ前の行の累積距離
+  double       *dist = work + 2 * w;  // 現在の行の、帯の中の点との距離
+  unsigned int  i, j, c;
+
+  for (i = 0; i < m; i++) {
+    unsigned int lo      = i > r ? i - r : 0;
+    unsigned int hi      = i + r < m - 1 ? i + r : m - 1;
+    unsigned int cnt     = hi - lo + 1;
+    double       row_min = INFINITY;
+    double      *tmp;
+
+    memset(dist, 0, sizeof(double) * cnt);
+    for (c = 0; c < n_ch; c++) {
+      const double  x  = a[c][i];
+      const double *bc = b[c] + lo;
+      for (j = 0; j < cnt; j++) dist[j] += (x - bc[j]) * (x - bc[j]);
+    }
+    for (j = lo; j <= hi; j++) {
+      unsigned int k = j + r - i;
+      double       v = 0.0;
+      if (i > 0 || j > 0) {
+        double left = j > lo ? cost[k - 1] : INFINITY;            // (i, j - 1)
+        double up   = i > 0 && k < 2 * r ? prev[k + 1] : INFINITY; // (i - 1, j)
+        double diag = i > 0 && j > 0 ? prev[k] : INFINITY;        // (i - 1, j - 1)
+        v = left < up ? left : up;
+        if (diag < v) v = diag;
+      }
+      cost[k] = v + dist[j - lo];
+      if (cost[k] < row_min) row_min = cost[k];
+    }
+    // 以降の経路は、帯の外側にあるi + r + 1以降の位置を必ず通る
+    if (row_min + cb[i + r + 1 < m ? i + r + 1 : m] >= bsf) return INFINITY;
+    tmp  = cost;
+    cost = prev;
+    prev = tmp;
+  }
+  return prev[r];
+}
+
+
+/*!
+ * 下界への寄与の見込みの大きい順に並べるための比較関数
+ * @param [in] a 比較する要素
+ * @param [in] b 比較する要素
+ * @return aを先にするなら負、bを先にするなら正、同じなら0
+ */
+static int compare_order(const void *a, const void *b) {
+  const order_entry *x = (const order_entry *)a;
+  const order_entry *y = (const order_entry *)b;
+
+  if (x->key != y->key) return x->key > y->key ? -1 : 1;
+  return x->index < y->index ? -1 : (x->index > y->index);
+}
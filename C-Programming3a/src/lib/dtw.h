@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+#define DTW_MAX_CHANNELS  3  // 1点あたりの値の数(特徴データの距離の総和, 面積, 重心位置の変化)
+
+
+// z正規化して、下界の計算の準備をしたクエリ
+typedef struct {
+  unsigned int  m;                            // クエリの長さ
+  unsigned int  r;                            // Sakoe-Chibaの帯の幅(|i - j| <= rの範囲だけを対応付ける)
+  unsigned int  n_ch;                         // チャンネル数
+  double       *q[DTW_MAX_CHANNELS];          // z正規化したクエリ
+  unsigned int *order;                        // 下界の寄与が大きいと見込まれる順に並べた位置
+  double       *q_ord[DTW_MAX_CHANNELS];      // orderの順に並べたクエリ
+  double       *upper_ord[DTW_MAX_CHANNELS];  // orderの順に並べたクエリの上側の包絡線
+  double       *lower_ord[DTW_MAX_CHANNELS];  // orderの順に並べたクエリの下側の包絡線
+  void         *mem;                          // 上記の領域をまとめて確保したもの
+} dtw_query;
+
+// 探索の各段階で枝刈りした位置の数
+typedef struct {
+  unsigned long long n_windows;  // 調べた位置
+  unsigned long long kim;        // LB_Kim(両端の点)で枝刈り
+  unsigned long long keogh_eq;   // LB_Keogh(クエリの包絡線)で枝刈り
+  unsigned long long keogh_ec;   // LB_Keogh(候補の包絡線)で枝刈り
+  unsigned long long dtw;        // DTWを計算した
+  unsigned long long abandoned;  // DTWを途中で打ち切った
+} dtw_stats;
+
+
+// 長さmのクエリ(チャンネルごとの配列)をz正規化し、帯の幅rの包絡線を求める
+int  dtw_query_init(dtw_query *dq, const double *const *channels, unsigned int n_ch, unsigned int m, unsigned int r);
+void dtw_query_destroy(dtw_query *dq);
+// 長さnの系列の全ての位置の部分系列(長さm、それぞれz正規化する)とクエリのDTW距離(2乗和)を求め、
+// threshold未満で最小のものを探す。見つかれば0を、無ければ1を、メモリ確保に失敗したなら-1を返す
+int  dtw_search(const dtw_query *dq, const double *const *channels, size_t n, double threshold,
+    double *best, size_t *best_pos, dtw_stats *stats);
@@ -0,0 +1,211 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "events.h"
+
+
+static unsigned int scan_enter(const feature *fd, unsigned int i, unsigned int len, size_t offset, double sign, double on);
+static unsigned int scan_leave(const feature *fd, unsigned int i, unsigned int len, size_t offset, double sign, double off, double *peak);
+static int          parse_event_value(const char **str, double *val);
+
+
+
+
+/*!
+ * イベント検出の設定の指定を解析する
+ * "feature>on[:off[:min_duration]]"(上回るのを検出)または"feature<on[:off[:min_duration]]"(下回るのを検出)の形式で、
+ * offを省略するとonと同じ(ヒステリシス無し)、min_durationを省略すると0となる
+ * @param [in]  spec 設定の指定
+ * @param [out] es   解析した設定
+ * @return 成功したなら0を、指定が不正なら-1を返す
+ */
+int parse_event_spec(const char *spec, event_spec *es) {
+  const char *p;
+  size_t      n;
+  int         i;
+
+  es->text = spec;
+  p = strpbrk(spec, "<>");
+  if (p == NULL) goto invalid;
+  n = (size_t)(p - spec);
+  for (i = 0; i < N_FEATURES; i++) {
+    if (strlen(FEATURE_NAME[i]) == n && strncmp(spec, FEATURE_NAME[i], n) == 0) break;
+  }
+  if (i == N_FEATURES) goto invalid;
+  es->feature  = i;
+  es->is_below = *p == '<';
+  p++;
+
+  if (parse_event_value(&p, &es->on) != 0) goto invalid;
+  es->off          = es->on;
+  es->min_duration = 0.0;
+  if (*p == ':' && (p++, parse_event_value(&p, &es->off) != 0)) goto invalid;
+  if (*p == ':' && (p++, parse_event_value(&p, &es->min_duration) != 0)) goto invalid;
+  if (*p != '\0') goto invalid;
+
+  // 終わりの閾値は、始まりの閾値よりイベントの外側(上回るのを検出するなら小さい方)になければならない
+  if (es->is_below ? es->off < es->on : es->off > es->on) {
+    fprintf(stderr, "イベント:%sの終わりの閾値は、始まりの閾値より%sにしてください\n", spec, es->is_below ? "大きい値" : "小さい値");
+    return -1;
+  }
+  if (es->min_duration < 0.0) {
+    fprintf(stderr, "イベント:%sの最小の長さに、負の値は指定できません\n", spec);
+    return -1;
+  }
+  return 0;
+
+invalid:
+  fprintf(stderr, "イベントの指定:%sが不正です(feature>on[:off[:min_duration]], featureはlen, area, cog)\n", spec);
+  return -1;
+}
+
+
+/*!
+ * 特徴データから、閾値をまたぐ区間をイベントとして検出する
+ * 特徴の値がon以上になった行からイベントが始まり、off未満になった行で終わる
+ * (下回るのを検出する場合は、符号を反転して同じ処理を行う)
+ * イベントの外では始まりの行を、中では終わりの行をSIMD命令で複数行ずつまとめて探すので、
+ * 閾値から遠い大部分の行は、比較のみで読み飛ばされる
+ * 最初の行は重心位置の変化を持たないので、重心位置の変化は2行目から調べる
+ * @param [out] events        検出したイベントを格納する配列((len + 1) / 2 個分の領域が必要)
+ * @param [in]  feature_datas 特徴データの配列
+ * @param [in]  len           特徴データの要素数
+ * @param [in]  es            イベント検出の設定
+ * @return 検出したイベントの数
+ */
+unsigned int detect_events(feature_event *events, const feature *feature_datas, unsigned int len, const event_spec *es) {
+  size_t       offset = FEATURE_OFFSET[es->feature];
+  double       sign   = es->is_below ? -1.0 : 1.0;
+  unsigned int i      = es->feature == EVENT_COG ? 1 : 0;
+  unsigned int n      = 0;
+
+  for (;;) {
+    unsigned int start, end;
+    double       peak, end_time;
+
+    start = scan_enter(feature_datas, i, len, offset, sign, sign * es->on);
+    if (start >= len) break;
+    peak = sign * FEATURE_VALUE(&feature_datas[start], offset);
+    end  = scan_leave(feature_datas, start + 1, len, offset, sign, sign * es->off, &peak);
+    end_time = feature_datas[end < len ? end : len - 1].time;
+    if (end_time - feature_datas[start].time >= es->min_duration) {
+      events[n].start  = feature_datas[start].time;
+      events[n].end    = end_time;
+      events[n].peak   = sign * peak;
+      events[n].n_rows = end - start;
+      n++;
+    }
+    if (end >= len) break;
+    i = end;
+  }
+  return n;
+}
+
+
+/*!
+ * 検出したイベントをファイルに書き出す
+ * "# events <指定> count=<数>"の見出し行に続けて、1行に1つずつ書き出す
+ * @param [in] f        出力ファイルのファイルポインタ
+ * @param [in] es       イベント検出の設定
+ * @param [in] events   検出したイベントの配列
+ * @param [in] n_events イベントの数
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+int write_events(FILE *f, const event_spec *es, const feature_event *events, unsigned int n_events) {
+  unsigned int i;
+
+  if (fprintf(f, "# events %s count=%u\n", es->text, n_events) < 0) return -1;
+  for (i = 0; i < n_events; i++, events++) {
+    if (fprintf(f, "%lf %lf %lf %u\n", events->start, events->end, events->peak, events->n_rows) < 0) return -1;
+  }
+  return 0;
+}
+
+
+
+
+/*!
+ * 符号を掛けた値がon以上となる最初の行を探す
+ * SSE2が使える場合は、4行分の値を2つのレジスタに集めて、まとめて比較する
+ * @param [in] fd     特徴データの配列
+ * @param [in] i      探し始める行
+ * @param [in] len    特徴データの要素数
+ * @param [in] offset 比べる特徴の、特徴データの中の位置
+ * @param [in] sign   値に掛ける符号(1か-1)
+ * @param [in] on     閾値(符号を掛けたもの)
+ * @return 見つかった行(見つからなければlen)
+ */
+static unsigned int scan_enter(const feature *fd, unsigned int i, unsigned int len, size_t offset, double sign, double on) {
+#ifdef __SSE2__
+  __m128d vs = _mm_set1_pd(sign);
+  __m128d vt = _mm_set1_pd(on);
+
+  for (; i + 4 <= len; i += 4) {
+    __m128d lo = _mm_mul_pd(_mm_set_pd(FEATURE_VALUE(&fd[i + 1], offset), FEATURE_VALUE(&fd[i], offset)), vs);
+    __m128d hi = _mm_mul_pd(_mm_set_pd(FEATURE_VALUE(&fd[i + 3], offset), FEATURE_VALUE(&fd[i + 2], offset)), vs);
+    if ((_mm_movemask_pd(_mm_cmpge_pd(lo, vt)) | _mm_movemask_pd(_mm_cmpge_pd(hi, vt))) != 0) break;
+  }
+#endif
+  for (; i < len; i++) {
+    if (sign * FEATURE_VALUE(&fd[i], offset) >= on) return i;
+  }
+  return len;
+}
+
+
+/*!
+ * 符号を掛けた値がoff未満となる最初の行を探し、それまでの値の最大値を求める
+ * SSE2が使える場合は、4行ずつまとめて比較し、終わりの行を含まない間は最大値もまとめて求める
+ * @param [in]     fd     特徴データの配列
+ * @param [in]     i      探し始める行
+ * @param [in]     len    特徴データの要素数
+ * @param [in]     offset 比べる特徴の、特徴データの中の位置
+ * @param [in]     sign   値に掛ける符号(1か-1)
+ * @param [in]     off    閾値(符号を掛けたもの)
+ * @param [in,out] peak   符号を掛けた値の最大値(それまでの最大値を与え、更新される)
+ * @return 見つかった行(見つからなければlen)
+ */
+static unsigned int scan_leave(const feature *fd, unsigned int i, unsigned int len, size_t offset, double sign, double off, double *peak) {
+#ifdef __SSE2__
+  __m128d vs = _mm_set1_pd(sign);
+  __m128d vt = _mm_set1_pd(off);
+  __m128d vm = _mm_set1_pd(*peak);
+  double  m[2];
+
+  for (; i + 4 <= len; i += 4) {
+    __m128d lo = _mm_mul_pd(_mm_set_pd(FEATURE_VALUE(&fd[i + 1], offset), FEATURE_VALUE(&fd[i], offset)), vs);
+    __m128d hi = _mm_mul_pd(_mm_set_pd(FEATURE_VALUE(&fd[i + 3], offset), FEATURE_VALUE(&fd[i + 2], offset)), vs);
+    if ((_mm_movemask_pd(_mm_cmplt_pd(lo, vt)) | _mm_movemask_pd(_mm_cmplt_pd(hi, vt))) != 0) break;
+    vm = _mm_max_pd(vm, _mm_max_pd(lo, hi));
+  }
+  _mm_storeu_pd(m, vm);
+  *peak = m[0] > m[1] ? m[0] : m[1];
+#endif
+  for (; i < len; i++) {
+    double v = sign * FEATURE_VALUE(&fd[i], offset);
+    if (v < off) return i;
+    if (v > *peak) *peak = v;
+  }
+  return len;
+}
+
+
+/*!
+ * 文字列の先頭から実数を読み取り、読み取った次の位置に進める
+ * @param [in,out] str 文字列の位置
+ * @param [out]    val 読み取った値
+ * @return 成功したなら0を、数値が無いか有限でないなら-1を返す
+ */
+static int parse_event_value(const char **str, double *val) {
+  char *end;
+
+  *val = strtod(*str, &end);
+  if (end == *str || !isfinite(*val)) return -1;
+  *str = end;
+  return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+#include "data_handler.h"
+
+#define MAX_EVENT_SPECS  8  // --eventsオプションを指定できる最大の回数
+
+#define EVENT_LEN   FEATURE_LEN   // 距離の総和
+#define EVENT_AREA  FEATURE_AREA  // 面積
+#define EVENT_COG   FEATURE_COG   // 重心位置の変化
+
+
+// イベント検出の設定
+typedef struct {
+  const char *text;          // 指定された文字列(見出し行に用いる)
+  int         feature;       // 閾値と比べる特徴(EVENT_xxx)
+  int         is_below;      // 閾値を下回るのを検出するか(0なら上回るのを検出する)
+  double      on;            // イベントの始まりとする閾値
+  double      off;           // イベントの終わりとする閾値(ヒステリシス)
+  double      min_duration;  // これより短いイベントは出力しない(秒)
+} event_spec;
+
+// 検出したイベント
+typedef struct {
+  double       start;   // 最初の行の時間
+  double       end;     // イベントが終わった行(データの末尾で終わったなら最後の行)の時間
+  double       peak;    // 特徴の最大値(下回るのを検出するなら最小値)
+  unsigned int n_rows;  // イベント中の行数
+} feature_event;
+
+
+// 指定 "feature>on[:off[:min_duration]]" または "feature<on[:off[:min_duration]]" を解析する
+// (featureは len, area, cog のいずれか)
+int parse_event_spec(const char *spec, event_spec *es);
+// 特徴データから閾値をまたぐ区間を検出し、eventsに格納してその数を返す
+// eventsには (len + 1) / 2 個分の領域が必要
+unsigned int detect_events(feature_event *events, const feature *feature_datas, unsigned int len, const event_spec *es);
+// 見出し行に続けて、1行に"開始時間 終了時間 ピーク値 行数"の書式でイベントを書き出す
+int write_events(FILE *f, const event_spec *es, const feature_event *events, unsigned int n_events);
@@ -0,0 +1,203 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "feature_file.h"
+
+#define TEXT_LINE_LEN   512  // テキスト形式の1行の最大の長さ
+#define TEXT_INIT_LEN  1024  // テキスト形式を読み込む配列の、最初に確保する要素数
+
+
+// バイナリ形式のヘッダ
+// ヘッダの直後から特徴データの配列が始まる(ヘッダは8の倍数のバイト数なので、配列はdoubleの境界に揃う)
+typedef struct {
+  char     magic[4];  // FEATURE_FILE_MAGIC
+  uint32_t version;   // FEATURE_FILE_VERSION
+  uint32_t row_size;  // 特徴データの1要素のバイト数(sizeof(feature))
+  uint32_t reserved;  // 0
+  uint64_t len;       // 特徴データの要素数
+} feature_file_header;
+
+
+static int map_binary(feature_seq *seq, int fd, const char *filename);
+static int parse_text(feature_seq *seq, FILE *f, const char *filename);
+
+
+
+
+/*!
+ * 特徴データを、バイナリ形式でファイルに書き出す
+ * @param [in] f             出力ファイルのファイルポインタ(バイナリモードで開いておくこと)
+ * @param [in] feature_datas 特徴データの配列
+ * @param [in] len           特徴データの要素数
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+int write_feature_file(FILE *f, const feature *feature_datas, unsigned int len) {
+  if (write_feature_header(f, len) != 0) return -1;
+  if (len > 0 && fwrite(feature_datas, sizeof(feature), len, f) != len) return -1;
+  return 0;
+}
+
+
+/*!
+ * バイナリ形式のヘッダだけを書き出す
+ * 要素数が分からないまま特徴データを続けて書き出すときは、先に0で書いておき、
+ * 書き終えてからファイルの先頭に戻って、正しい要素数で書き直す
+ * @param [in] f   出力ファイルのファイルポインタ(バイナリモードで開いておくこと)
+ * @param [in] len 特徴データの要素数
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+int write_feature_header(FILE *f, uint64_t len) {
+  feature_file_header h;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FEATURE_FILE_MAGIC, sizeof(h.magic));
+  h.version  = FEATURE_FILE_VERSION;
+  h.row_size = sizeof(feature);
+  h.len      = len;
+  return fwrite(&h, sizeof(h), 1, f) == 1 ? 0 : -1;
+}
+
+
+/*!
+ * 特徴データのファイルを読み込む
+ * 先頭がFEATURE_FILE_MAGICならバイナリ形式としてmmapし、コピーせずに配列として用いる
+ * そうでなければテキスト形式として解析する。最初の行は重心位置の変化を持たないので0とし、
+ * 各行の5列目以降(周波数特徴の列など)は読み飛ばす。'#'で始まる行は注釈として無視する
+ * @param [out] seq      読み込んだ系列(使い終わったらrelease_feature_file()で解放する)
+ * @param [in]  filename ファイル名
+ * @return 成功したなら0を、失敗したなら-1を返す(エラーメッセージは標準エラー出力に表示する)
+ */
+int load_feature_file(feature_seq *seq, const char *filename) {
+  char  magic[4];
+  int   fd, ret;
+  FILE *f;
+
+  memset(seq, 0, sizeof(*seq));
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    return -1;
+  }
+  if (read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(magic, FEATURE_FILE_MAGIC, sizeof(magic)) == 0) {
+    ret = map_binary(seq, fd, filename);
+    close(fd);
+    return ret;
+  }
+
+  f = fdopen(fd, "r");
+  if (f == NULL || fseek(f, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    if (f != NULL) fclose(f); else close(fd);
+    return -1;
+  }
+  ret = parse_text(seq, f, filename);
+  fclose(f);
+  return ret;
+}
+
+
+/*!
+ * 読み込んだ系列を解放する
+ * @param [in,out] seq load_feature_file()で読み込んだ系列
+ */
+void release_feature_file(feature_seq *seq) {
+  if (seq->map != NULL) munmap(seq->map, seq->map_size);
+  free(seq->owned);
+  memset(seq, 0, sizeof(*seq));
+}
+
+
+
+
+/*!
+ * バイナリ形式のファイルをmmapする
+ * @param [out] seq      読み込んだ系列
+ * @param [in]  fd       ファイルディスクリプタ
+ * @param [in]  filename エラーメッセージに用いるファイル名
+ * @return 成功したなら0を、ヘッダが不正かマップに失敗したなら-1を返す
+ */
+static int map_binary(feature_seq *seq, int fd, const char *filename) {
+  const feature_file_header *h;
+  struct stat                st;
+  void                      *map;
+
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(feature_file_header)) goto broken;
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "ファイル:%sをマップできません\n", filename);
+    return -1;
+  }
+  h = (const feature_file_header *)map;
+  if (h->version != FEATURE_FILE_VERSION || h->row_size != sizeof(feature)
+      || h->len > ((size_t)st.st_size - sizeof(*h)) / sizeof(feature)) {
+    munmap(map, (size_t)st.st_size);
+    goto broken;
+  }
+  seq->map      = map;
+  seq->map_size = (size_t)st.st_size;
+  seq->rows     = (const feature *)(h + 1);
+  seq->len      = (size_t)h->len;
+  return 0;
+
+broken:
+  fprintf(stderr, "ファイル:%sは、対応していないか壊れたバイナリ形式です\n", filename);
+  return -1;
+}
+
+
+/*!
+ * テキスト形式のファイルを解析する
+ * @param [out] seq      読み込んだ系列
+ * @param [in]  f        ファイルポインタ
+ * @param [in]  filename エラーメッセージに用いるファイル名
+ * @return 成功したなら0を、書式が不正かメモリ確保に失敗したなら-1を返す
+ */
+static int parse_text(feature_seq *seq, FILE *f, const char *filename) {
+  char          line[TEXT_LINE_LEN];
+  size_t        cap = 0, n = 0;
+  unsigned long line_no = 0;
+  feature      *rows = NULL;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    double  v[4] = {0.0, 0.0, 0.0, 0.0};
+    int     n_cols = n == 0 ? 3 : 4;  // 最初の行には重心位置の変化が無い
+    int     i;
+    char   *p = line, *end;
+
+    line_no++;
+    if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+    for (i = 0; i < n_cols; i++, p = end) {
+      v[i] = strtod(p, &end);
+      if (end == p) {
+        fprintf(stderr, "ファイル:%sの%lu行目は、特徴データの書式ではありません\n", filename, line_no);
+        free(rows);
+        return -1;
+      }
+    }
+    if (n == cap) {
+      feature *grown;
+      cap   = cap == 0 ? TEXT_INIT_LEN : cap * 2;
+      grown = (feature *)realloc(rows, sizeof(feature) * cap);
+      if (grown == NULL) {
+        fputs("メモリ確保に失敗しました\n", stderr);
+        free(rows);
+        return -1;
+      }
+      rows = grown;
+    }
+    rows[n].time       = v[0];
+    rows[n].len        = v[1];
+    rows[n].area       = v[2];
+    rows[n].cog_change = v[3];
+    n++;
+  }
+  seq->owned = rows;
+  seq->rows  = rows;
+  seq->len   = n;
+  return 0;
+}
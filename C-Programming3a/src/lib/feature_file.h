@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "data_handler.h"
+
+#define FEATURE_FILE_MAGIC    "G3FB"  // バイナリの特徴データファイルの先頭の4バイト
+#define FEATURE_FILE_VERSION       1  // フォーマットのバージョン
+
+
+// 読み込んだ特徴データの系列
+typedef struct {
+  const feature *rows;      // 特徴データの配列(読み取り専用)
+  size_t         len;       // 特徴データの要素数
+  void          *map;       // バイナリ形式ならマップした領域(テキスト形式ならNULL)
+  size_t         map_size;  // マップした領域のバイト数
+  feature       *owned;     // テキスト形式なら解析して確保した配列(バイナリ形式ならNULL)
+} feature_seq;
+
+
+// 特徴データを、ヘッダに続けてfeature構造体の配列をそのまま並べたバイナリ形式で書き出す
+// (同じホストでmmapして読むためのもので、ホストのバイトオーダーのまま格納する)
+int  write_feature_file(FILE *f, const feature *feature_datas, unsigned int len);
+// ヘッダだけを書き出す(特徴データを続けて書き出した後で、先頭に戻って要素数を書き直すため)
+int  write_feature_header(FILE *f, uint64_t len);
+// 特徴データのファイルを読み込む。バイナリ形式ならmmapし、そうでなければgroup03の
+// テキスト出力("時間 距離の総和 面積 [重心位置の変化 ...]")として解析する
+int  load_feature_file(feature_seq *seq, const char *filename);
+void release_feature_file(feature_seq *seq);
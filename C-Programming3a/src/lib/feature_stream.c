@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "feature_stream.h"
+
+
+static int flush_down_smpls(feature_stream *fs);
+
+
+
+
+/*!
+ * ストリームを初期化する
+ * merge_num個のフレームが揃うごとにdown_sample()で平均を取り、STREAM_CHUNK行ずつ
+ * derive_feature()(近似計算ならderive_features_approx())で特徴データにするので、
+ * フレームを全て並べた配列に対してdown_sample_features()を呼んだ場合と同じ結果になる
+ * 作業領域はフレームの数によらず一定なので、配列に収まらない入力も処理できる
+ * @param [out] fs         ストリーム(使い終わったらfeature_stream_destroy()で解放する)
+ * @param [in]  merge_num  ダウンサンプリングで結合するデータの数
+ * @param [in]  use_approx 平方根を近似計算するかどうか
+ * @param [in]  sink       特徴データを受け取る関数
+ * @param [in]  arg        sinkに渡す引数
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int feature_stream_init(feature_stream *fs, unsigned int merge_num, int use_approx, feature_sink sink, void *arg) {
+  memset(fs, 0, sizeof(*fs));
+  fs->merge_num  = merge_num;
+  fs->use_approx = use_approx;
+  fs->sink       = sink;
+  fs->arg        = arg;
+  fs->block      = (data_fmt *)malloc(sizeof(data_fmt) * ((size_t)merge_num + STREAM_CHUNK));
+  fs->features   = (feature *)malloc(sizeof(feature) * STREAM_CHUNK);
+  if (fs->block == NULL || fs->features == NULL) {
+    feature_stream_destroy(fs);
+    return -1;
+  }
+  fs->down_smpls = fs->block + merge_num;
+  return 0;
+}
+
+
+/*!
+ * フレームを1つ加える
+ * @param [in,out] fs    ストリーム
+ * @param [in]     frame フレーム(時間の順に加えること)
+ * @return 成功したなら0を、sinkが失敗したなら-1を返す
+ */
+int feature_stream_push(feature_stream *fs, const data_fmt *frame) {
+  fs->block[fs->n_block++] = *frame;
+  fs->n_frames++;
+  if (fs->n_block < fs->merge_num) return 0;
+  down_sample(&fs->down_smpls[fs->n_down_smpls++], fs->block, fs->merge_num, fs->merge_num);
+  fs->n_block = 0;
+  return fs->n_down_smpls == STREAM_CHUNK ? flush_down_smpls(fs) : 0;
+}
+
+
+/*!
+ * 最後のブロックは残ったフレームだけで平均を取り、残りの特徴データをsinkに渡す
+ * @param [in,out] fs ストリーム
+ * @return 成功したなら0を、sinkが失敗したなら-1を返す
+ */
+int feature_stream_finish(feature_stream *fs) {
+  if (fs->n_block > 0) {
+    down_sample(&fs->down_smpls[fs->n_down_smpls++], fs->block, fs->n_block, fs->n_block);
+    fs->n_block = 0;
+  }
+  return fs->n_down_smpls > 0 ? flush_down_smpls(fs) : 0;
+}
+
+
+/*!
+ * ストリームの作業領域を解放する
+ * @param [in,out] fs ストリーム
+ */
+void feature_stream_destroy(feature_stream *fs) {
+  free(fs->block);
+  free(fs->features);
+  fs->block      = NULL;
+  fs->down_smpls = NULL;
+  fs->features   = NULL;
+}
+
+
+
+
+/*!
+ * 溜まったダウンサンプリングデータを特徴データにして、sinkに渡す
+ * 重心位置の変化は、前のまとまりの最後のブロックから続けて求める
+ * @param [in,out] fs ストリーム
+ * @return 成功したなら0を、sinkが失敗したなら-1を返す
+ */
+static int flush_down_smpls(feature_stream *fs) {
+  unsigned int i, n = fs->n_down_smpls;
+
+  if (fs->use_approx) {
+    derive_features_approx(fs->features, fs->down_smpls, n, &fs->prev_cog_pos, fs->n_rows == 0);
+  } else {
+    for (i = 0; i < n; i++) {
+      derive_feature(&fs->features[i], &fs->down_smpls[i], &fs->prev_cog_pos, fs->n_rows + i == 0);
+    }
+  }
+  fs->n_down_smpls = 0;
+  if (fs->sink(fs->features, n, fs->n_rows, fs->arg) != 0) return -1;
+  fs->n_rows += n;
+  return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include "data_handler.h"
+
+#define STREAM_CHUNK  8192  // まとめて特徴データにするダウンサンプリングデータの数(APPROX_BATCHの倍数)
+
+
+// 特徴データを受け取る関数の型(first_rowは、feature_datas[0]の全体での行番号)
+typedef int (*feature_sink)(const feature *feature_datas, unsigned int len, uint64_t first_row, void *arg);
+
+// フレームを1つずつ受け取って、ダウンサンプリングしながら特徴データにする状態
+typedef struct {
+  data_fmt     *block;         // 平均を取る前のフレーム(merge_num個)
+  data_fmt     *down_smpls;    // 特徴データにする前のダウンサンプリングデータ(STREAM_CHUNK個)
+  feature      *features;      // sinkに渡す特徴データ(STREAM_CHUNK個)
+  unsigned int  merge_num;     // ダウンサンプリングで結合するデータの数
+  unsigned int  n_block;       // blockにあるフレームの数
+  unsigned int  n_down_smpls;  // down_smplsにあるダウンサンプリングデータの数
+  uint64_t      n_frames;      // 受け取ったフレームの数
+  uint64_t      n_rows;        // sinkに渡した特徴データの数
+  position      prev_cog_pos;  // 1つ前のブロックの重心位置
+  int           use_approx;    // 平方根を近似計算するかどうか
+  feature_sink  sink;          // 特徴データを受け取る関数
+  void         *arg;           // sinkに渡す引数
+} feature_stream;
+
+
+int  feature_stream_init(feature_stream *fs, unsigned int merge_num, int use_approx, feature_sink sink, void *arg);
+// フレームを1つ加える。STREAM_CHUNK行の特徴データが揃うごとにsinkに渡す
+int  feature_stream_push(feature_stream *fs, const data_fmt *frame);
+// 残ったフレームで最後のブロックの平均を取り、残りの特徴データをsinkに渡す
+int  feature_stream_finish(feature_stream *fs);
+void feature_stream_destroy(feature_stream *fs);
@@ -0,0 +1,372 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "feature_file.h"
+#include "feature_tee.h"
+#include "feature_writer.h"
+
+#define N_STATS  3  // 要約を求める特徴の数(距離の総和, 面積, 重心位置の変化)
+
+
+// 出力先に渡す特徴データの1つのまとまり
+typedef struct {
+  feature      *rows;       // 特徴データ(TEE_CHUNK行分の領域)
+  unsigned int  len;        // 特徴データの要素数
+  uint64_t      first_row;  // rows[0]の、全体での行番号
+} tee_chunk;
+
+// 1つの特徴の要約(Welfordの方法で、平均と偏差の2乗和を1行ずつ更新する)
+typedef struct {
+  uint64_t count;  // 値の数
+  double   min;    // 最小値
+  double   max;    // 最大値
+  double   mean;   // 平均
+  double   m2;     // 平均からの偏差の2乗和
+} feature_stats;
+
+// 1つの出力先と、それに書き出すスレッド
+typedef struct {
+  feature_tee     *tee;              // 所属するtee
+  sink_spec        spec;             // 設定
+  FILE            *f;                // 出力ファイルのファイルポインタ
+  feature_writer  *writer;           // テキスト形式で書き出すライタ(SINK_TEXT)
+  pthread_t        thread;           // 書き出すスレッド
+  int              started;          // スレッドを起動したかどうか
+  int              failed;           // 書き込みに失敗したかどうか
+  uint64_t         n_read;           // 書き終えたまとまりの数
+  feature_stats    stats[N_STATS];   // 特徴ごとの要約(SINK_SUMMARY)
+  double           first_time;       // 最初の行の時間(SINK_SUMMARY)
+  double           last_time;        // 最後の行の時間(SINK_SUMMARY)
+} tee_sink;
+
+struct feature_tee {
+  pthread_mutex_t  mutex;              // 以下のカウンタを保護するミューテックス
+  pthread_cond_t   produced;           // まとまりを渡したことを通知する条件変数
+  pthread_cond_t   consumed;           // まとまりを書き終えたことを通知する条件変数
+  tee_chunk        ring[TEE_DEPTH];    // まとまりのリングバッファ
+  uint64_t         n_written;          // 渡したまとまりの数
+  uint64_t         n_rows;             // 渡した行数
+  int              closing;            // これ以上渡さないかどうか
+  unsigned int     n_sinks;            // 出力先の数
+  tee_sink         sinks[MAX_SINKS];   // 出力先
+};
+
+
+static const char *FORMAT_NAME[] = {"text", "binary", "summary"};  // sink_formatごとの名前
+
+
+static void *sink_main(void *arg);
+static int   write_chunk(tee_sink *s, const tee_chunk *c);
+static int   finish_sink(tee_sink *s);
+static void  stop_sinks(feature_tee *tee);
+static void  free_tee(feature_tee *tee);
+
+
+
+
+/*!
+ * -oオプションの指定を解析する
+ * "format:path"(formatはtext, binary, summary)の形式なら形式と出力ファイル名に分け、
+ * そうでなければ(':'を含まないか、':'の前が形式の名前でなければ)全体を出力ファイル名とする
+ * @param [in]  arg 指定
+ * @param [out] ss  解析した設定(形式が付いていなければSINK_TEXT)
+ * @return 形式が付いていなければ0を、付いていれば1を、出力ファイル名が空なら-1を返す
+ */
+int parse_sink_spec(const char *arg, sink_spec *ss) {
+  const char *colon = strchr(arg, ':');
+  int         i;
+
+  ss->format = SINK_TEXT;
+  ss->path   = arg;
+  if (colon == NULL) return 0;
+  for (i = 0; i < (int)(sizeof(FORMAT_NAME) / sizeof(FORMAT_NAME[0])); i++) {
+    if (strlen(FORMAT_NAME[i]) == (size_t)(colon - arg) && strncmp(arg, FORMAT_NAME[i], (size_t)(colon - arg)) == 0) break;
+  }
+  if (i == (int)(sizeof(FORMAT_NAME) / sizeof(FORMAT_NAME[0]))) return 0;
+  if (colon[1] == '\0') {
+    fprintf(stderr, "出力先の指定:%sに、出力ファイル名がありません(format:path, formatはtext, binary, summary)\n", arg);
+    return -1;
+  }
+  ss->format = (sink_format)i;
+  ss->path   = colon + 1;
+  return 1;
+}
+
+
+/*!
+ * 出力先を全て開き、出力先ごとに書き出すスレッドを起動する
+ * 特徴データは1度だけ求めてtee_write()で渡し、各スレッドがそれぞれの形式に変換して書き出すので、
+ * 形式を増やした分の時間は、ほぼその形式への変換と書き込みの時間だけとなる
+ * @param [in] specs     出力先の設定の配列(teeを閉じるまで保持すること)
+ * @param [in] n_specs   出力先の数(MAX_SINKS以下)
+ * @param [in] n_threads テキスト形式で文字列に変換するワーカスレッド数
+ * @return 生成したtee。開けなかったときはNULLを返す(エラーメッセージは標準エラー出力に表示する)
+ */
+feature_tee *tee_open(const sink_spec *specs, unsigned int n_specs, unsigned int n_threads) {
+  feature_tee  *tee = (feature_tee *)calloc(1, sizeof(feature_tee));
+  unsigned int  i;
+
+  if (tee == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return NULL;
+  }
+  pthread_mutex_init(&tee->mutex, NULL);
+  pthread_cond_init(&tee->produced, NULL);
+  pthread_cond_init(&tee->consumed, NULL);
+  for (i = 0; i < TEE_DEPTH; i++) {
+    tee->ring[i].rows = (feature *)malloc(sizeof(feature) * TEE_CHUNK);
+    if (tee->ring[i].rows == NULL) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      free_tee(tee);
+      return NULL;
+    }
+  }
+
+  for (i = 0; i < n_specs; i++) {
+    tee_sink *s = &tee->sinks[i];
+    s->tee  = tee;
+    s->spec = specs[i];
+    s->f    = fopen(s->spec.path, s->spec.format == SINK_BINARY ? "wb" : "w");
+    if (s->f == NULL) {
+      fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", s->spec.path);
+      break;
+    }
+    tee->n_sinks++;
+    // テキスト形式は、出力先ごとのワーカスレッドを使い回して変換する
+    if (s->spec.format == SINK_TEXT && (s->writer = feature_writer_open(s->f, n_threads)) == NULL) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      break;
+    }
+    // バイナリ形式の要素数は、書き終えてから書き直す
+    if (s->spec.format == SINK_BINARY && write_feature_header(s->f, 0) != 0) s->failed = 1;
+    if (pthread_create(&s->thread, NULL, sink_main, s) != 0) {
+      fputs("スレッドを起動できません\n", stderr);
+      break;
+    }
+    s->started = 1;
+  }
+  if (i < n_specs) {
+    stop_sinks(tee);
+    for (i = 0; i < tee->n_sinks; i++) {
+      if (tee->sinks[i].writer != NULL) feature_writer_close(tee->sinks[i].writer);
+      fclose(tee->sinks[i].f);
+    }
+    free_tee(tee);
+    return NULL;
+  }
+  return tee;
+}
+
+
+/*!
+ * 特徴データを、TEE_CHUNK行ずつのまとまりに写して全ての出力先に渡す
+ * 全ての出力先が書き終えたまとまりの領域を再利用し、TEE_DEPTH個のまとまりが溜まっている間は待つ
+ * 続けて呼ぶと、全体を1度に渡した場合と同じ出力になる
+ * @param [in,out] tee           tee
+ * @param [in]     feature_datas 特徴データの配列
+ * @param [in]     len           特徴データの要素数
+ * @return 成功したなら0を、いずれかの出力先で書き込みに失敗していたなら-1を返す
+ */
+int tee_write(feature_tee *tee, const feature *feature_datas, unsigned int len) {
+  while (len > 0) {
+    unsigned int n = len < TEE_CHUNK ? len : TEE_CHUNK;
+    tee_chunk   *c = &tee->ring[tee->n_written % TEE_DEPTH];
+    unsigned int i;
+    int          failed = 0;
+
+    // 最も遅い出力先が、このまとまりの領域を書き終えるまで待つ
+    pthread_mutex_lock(&tee->mutex);
+    for (;;) {
+      uint64_t slowest = tee->n_written;
+      for (i = 0; i < tee->n_sinks; i++) {
+        if (tee->sinks[i].n_read < slowest) slowest = tee->sinks[i].n_read;
+        failed |= tee->sinks[i].failed;
+      }
+      if (failed || tee->n_written - slowest < TEE_DEPTH) break;
+      pthread_cond_wait(&tee->consumed, &tee->mutex);
+    }
+    pthread_mutex_unlock(&tee->mutex);
+    if (failed) return -1;
+
+    memcpy(c->rows, feature_datas, sizeof(feature) * n);
+    c->len       = n;
+    c->first_row = tee->n_rows;
+    pthread_mutex_lock(&tee->mutex);
+    tee->n_written++;
+    pthread_cond_broadcast(&tee->produced);
+    pthread_mutex_unlock(&tee->mutex);
+
+    tee->n_rows   += n;
+    feature_datas += n;
+    len           -= n;
+  }
+  return 0;
+}
+
+
+/*!
+ * 渡したまとまりを全て書き出すのを待ってスレッドを終了し、出力先を閉じる
+ * バイナリ形式はヘッダの要素数を書き直し、要約形式は要約をここで書き出す
+ * @param [in,out] tee tee(解放される)
+ * @return 全ての出力先に書き出せたなら0を、それ以外なら-1を返す(エラーメッセージは標準エラー出力に表示する)
+ */
+int tee_close(feature_tee *tee) {
+  unsigned int i;
+  int          ret = 0;
+
+  stop_sinks(tee);
+  for (i = 0; i < tee->n_sinks; i++) {
+    tee_sink *s = &tee->sinks[i];
+    if (!s->failed && finish_sink(s) != 0) s->failed = 1;
+    if (s->writer != NULL && feature_writer_close(s->writer) != 0) s->failed = 1;  // 変換中のものを書き出す
+    if (fclose(s->f) != 0) s->failed = 1;
+    if (s->failed) {
+      fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", s->spec.path);
+      ret = -1;
+    }
+  }
+  free_tee(tee);
+  return ret;
+}
+
+
+
+
+/*!
+ * 出力先のスレッドの処理。渡されたまとまりを、渡された順に書き出す
+ * 書き込みに失敗した後も、渡す側を待たせないよう、まとまりは読み進める
+ * @param [in,out] arg tee_sink
+ * @return NULLを返す
+ */
+static void *sink_main(void *arg) {
+  tee_sink    *s   = (tee_sink *)arg;
+  feature_tee *tee = s->tee;
+
+  for (;;) {
+    const tee_chunk *c;
+    int              failed;
+
+    pthread_mutex_lock(&tee->mutex);
+    while (s->n_read == tee->n_written && !tee->closing) {
+      pthread_cond_wait(&tee->produced, &tee->mutex);
+    }
+    if (s->n_read == tee->n_written) {  // 全て書き終えて、これ以上渡されない
+      pthread_mutex_unlock(&tee->mutex);
+      break;
+    }
+    c      = &tee->ring[s->n_read % TEE_DEPTH];
+    failed = s->failed;
+    pthread_mutex_unlock(&tee->mutex);
+
+    failed = failed || write_chunk(s, c) != 0;
+    pthread_mutex_lock(&tee->mutex);
+    s->failed = failed;
+    s->n_read++;
+    pthread_cond_broadcast(&tee->consumed);
+    pthread_mutex_unlock(&tee->mutex);
+  }
+  return NULL;
+}
+
+
+/*!
+ * 1つのまとまりを、出力先の形式で書き出す(要約形式では、要約を更新する)
+ * @param [in,out] s 出力先
+ * @param [in]     c まとまり
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+static int write_chunk(tee_sink *s, const tee_chunk *c) {
+  unsigned int i;
+  int          k;
+
+  switch (s->spec.format) {
+    case SINK_TEXT:
+      return feature_writer_write(s->writer, c->rows, c->len, c->first_row == 0);
+    case SINK_BINARY:
+      return fwrite(c->rows, sizeof(feature), c->len, s->f) == c->len ? 0 : -1;
+    case SINK_SUMMARY:
+      if (c->first_row == 0 && c->len > 0) s->first_time = c->rows[0].time;
+      if (c->len > 0) s->last_time = c->rows[c->len - 1].time;
+      for (i = 0; i < c->len; i++) {
+        const feature *fd = &c->rows[i];
+        double         v[N_STATS];
+        v[0] = fd->len;
+        v[1] = fd->area;
+        v[2] = fd->cog_change;
+        // 最初の行は重心位置の変化を持たない
+        for (k = 0; k < (c->first_row + i == 0 ? N_STATS - 1 : N_STATS); k++) {
+          feature_stats *st = &s->stats[k];
+          double         d  = v[k] - st->mean;
+          if (st->count == 0 || v[k] < st->min) st->min = v[k];
+          if (st->count == 0 || v[k] > st->max) st->max = v[k];
+          st->count++;
+          st->mean += d / (double)st->count;
+          st->m2   += d * (v[k] - st->mean);
+        }
+      }
+      return 0;
+  }
+  return -1;
+}
+
+
+/*!
+ * 全て書き終えた出力先の後処理を行う
+ * バイナリ形式なら先頭に戻ってヘッダの要素数を書き直し、要約形式なら
+ * "# summary rows=<行数> time=<最初の時間>:<最後の時間>"の見出し行に続けて、
+ * 特徴ごとに"名前 件数 最小値 最大値 平均 標準偏差"を書き出す
+ * @param [in,out] s 出力先
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+static int finish_sink(tee_sink *s) {
+  static const char *STAT_NAME[N_STATS] = {"len", "area", "cog"};
+  int                k;
+
+  if (s->spec.format == SINK_BINARY) {
+    return fflush(s->f) != 0 || fseek(s->f, 0, SEEK_SET) != 0 || write_feature_header(s->f, s->tee->n_rows) != 0 ? -1 : 0;
+  }
+  if (s->spec.format != SINK_SUMMARY) return 0;
+  if (fprintf(s->f, "# summary rows=%llu time=%lf:%lf\n", (unsigned long long)s->tee->n_rows, s->first_time,
+              s->last_time) < 0) return -1;
+  for (k = 0; k < N_STATS; k++) {
+    const feature_stats *st = &s->stats[k];
+    if (fprintf(s->f, "%s %llu %lf %lf %lf %lf\n", STAT_NAME[k], (unsigned long long)st->count, st->min, st->max,
+                st->mean, st->count > 0 ? sqrt(st->m2 / (double)st->count) : 0.0) < 0) return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * これ以上まとまりを渡さないことを通知し、起動した全てのスレッドの終了を待つ
+ * @param [in,out] tee tee
+ */
+static void stop_sinks(feature_tee *tee) {
+  unsigned int i;
+
+  pthread_mutex_lock(&tee->mutex);
+  tee->closing = 1;
+  pthread_cond_broadcast(&tee->produced);
+  pthread_mutex_unlock(&tee->mutex);
+  for (i = 0; i < tee->n_sinks; i++) {
+    if (tee->sinks[i].started) pthread_join(tee->sinks[i].thread, NULL);
+    tee->sinks[i].started = 0;
+  }
+}
+
+
+/*!
+ * teeの領域を解放する(出力先は閉じておくこと)
+ * @param [in,out] tee tee
+ */
+static void free_tee(feature_tee *tee) {
+  unsigned int i;
+
+  for (i = 0; i < TEE_DEPTH; i++) free(tee->ring[i].rows);
+  pthread_mutex_destroy(&tee->mutex);
+  pthread_cond_destroy(&tee->produced);
+  pthread_cond_destroy(&tee->consumed);
+  free(tee);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include "data_handler.h"
+
+#define MAX_SINKS   4     // -oオプションで指定できる出力先の最大の数
+#define TEE_CHUNK   8192  // 出力先に渡す特徴データの1つのまとまりの行数
+#define TEE_DEPTH   4     // 出力先が書き終えるのを待たずに溜めておける、まとまりの数
+
+
+// 出力先の形式
+typedef enum {
+  SINK_TEXT,     // テキスト形式(従来の出力)
+  SINK_BINARY,   // バイナリ形式(--binaryオプションと同じ)
+  SINK_SUMMARY   // 特徴ごとの件数、最小値、最大値、平均、標準偏差だけを書き出す
+} sink_format;
+
+// 出力先の設定
+typedef struct {
+  sink_format  format;  // 形式
+  const char  *path;    // 出力ファイル名
+} sink_spec;
+
+typedef struct feature_tee feature_tee;
+
+
+// -oオプションの指定 "format:path" を解析する(formatはtext, binary, summary)
+// 形式が付いていなければ0を、付いていれば1を、不正なら-1を返す
+int  parse_sink_spec(const char *arg, sink_spec *ss);
+// 出力先を全て開き、出力先ごとに書き出すスレッドを起動する
+feature_tee *tee_open(const sink_spec *specs, unsigned int n_specs, unsigned int n_threads);
+// 特徴データを全ての出力先に渡す(出力先の書き出しを待たずに戻るが、溜まりすぎたら待つ)
+int  tee_write(feature_tee *tee, const feature *feature_datas, unsigned int len);
+// 残りを書き出してスレッドを終了し、出力先を閉じる。いずれかの出力先で失敗したなら-1を返す
+int  tee_close(feature_tee *tee);
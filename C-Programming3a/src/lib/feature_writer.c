@@ -0,0 +1,383 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "feature_writer.h"
+#include "thread_pool.h"
+
+#define MIN_CHUNK_ROWS      1024  // 1つのタスクで変換する最小の行数
+#define CHUNKS_PER_THREAD      4  // ワーカスレッドあたりのタスク数(負荷の偏りをならすため)
+#define ROW_SIZE_HINT         64  // 1行の文字列のバイト数の見積もり
+#define IOV_BATCH             64  // 1回のwritevで書き出すバッファの数(IOV_MAX以下であること)
+
+
+// 1つのタスクで変換する行の範囲と、その変換結果
+typedef struct {
+  const feature          *feature_datas;  // 特徴データの配列の先頭
+  const spectral_feature *spectra;        // 周波数特徴の配列の先頭(NULLなら出力しない)
+  unsigned int            begin;          // 変換する最初の行
+  unsigned int            end;            // 変換する最後の行の次
+  int                     is_head;        // 配列の先頭が出力の最初の行かどうか
+  char                   *ptr;            // 変換結果の文字列(このタスク専用のバッファ)
+  size_t                  len;            // 変換結果のバイト数
+  size_t                  cap;            // バッファの確保済みのバイト数
+  int                     is_failed;      // メモリ確保に失敗したかどうか
+} chunk;
+
+// feature_writerに渡された1回分の特徴データ
+typedef struct {
+  feature      *rows;        // 特徴データの複製(呼び出し側の配列は、戻った後に書き換えられるため)
+  unsigned int  cap_rows;    // rowsの要素数
+  chunk        *chunks;      // 行の範囲ごとの変換結果(バッファは次に用いるときに再利用する)
+  unsigned int  n_chunks;    // 用いている範囲の数
+  unsigned int  cap_chunks;  // chunksの要素数
+} writer_batch;
+
+struct feature_writer {
+  FILE          *f;           // 出力ファイルのファイルポインタ
+  thread_pool   *pool;        // 文字列に変換するワーカスレッド(NULLなら呼び出したスレッドで変換する)
+  unsigned int   n_threads;   // ワーカスレッド数
+  writer_batch   batches[2];  // 変換中のものと、次に渡されたものを交互に用いる
+  writer_batch  *pending;     // 変換中で、まだ書き出していないもの(無ければNULL)
+  unsigned int   next;        // 次に用いるbatchesの番号
+  int            is_failed;   // いずれかの変換か書き込みに失敗したかどうか
+};
+
+
+static int          write_rows(FILE *f, const feature *feature_datas, const spectral_feature *spectra, unsigned int len, int is_head,
+                               unsigned int n_threads);
+static unsigned int split_rows(chunk *chunks, const feature *feature_datas, unsigned int len, int is_head, unsigned int n_threads);
+static int          flush_pending(feature_writer *w);
+static void         format_chunk(void *arg, unsigned int worker_id);
+static int          write_chunks(int fd, const chunk *chunks, unsigned int n_chunks);
+
+
+
+
+/*!
+ * 特徴データを、行の範囲ごとに並列に文字列に変換し、行の順にファイルに書き出す
+ * 各値は%lfで書式化し、最初の行には重心位置の変化を出力しない
+ * @param [in] f             出力ファイルのファイルポインタ
+ * @param [in] feature_datas 特徴データの配列
+ * @param [in] spectra       周波数特徴の配列(NULLなら、周波数特徴の列を出力しない)
+ * @param [in] len           特徴データの要素数
+ * @param [in] n_threads     ワーカスレッド数(1以下なら、呼び出したスレッドで変換する)
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+int write_features_parallel(FILE *f, const feature *feature_datas, const spectral_feature *spectra, unsigned int len, unsigned int n_threads) {
+  return write_rows(f, feature_datas, spectra, len, 1, n_threads);
+}
+
+
+/*!
+ * 特徴データを、全体の途中から続けて書き出す(入力を区切って処理するとき用)
+ * 書式はwrite_features_parallel()と同じで、is_headが0なら最初の行にも重心位置の変化を出力する
+ * @param [in] f             出力ファイルのファイルポインタ
+ * @param [in] feature_datas 特徴データの配列
+ * @param [in] len           特徴データの要素数
+ * @param [in] is_head       feature_datas[0]が出力の最初の行かどうか
+ * @param [in] n_threads     ワーカスレッド数(1以下なら、呼び出したスレッドで変換する)
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+int write_feature_rows(FILE *f, const feature *feature_datas, unsigned int len, int is_head, unsigned int n_threads) {
+  return write_rows(f, feature_datas, NULL, len, is_head, n_threads);
+}
+
+
+/*!
+ * 特徴データを何回にも分けて書き出すライタを開く(--streamオプションやteeの出力先用)
+ * write_feature_rows()を繰り返し呼ぶのと同じ出力になるが、ワーカスレッドは1度だけ起動して使い回し、
+ * 渡された特徴データの変換を、呼び出し側が次の特徴データを求めている間に行う
+ * @param [in] f         出力ファイルのファイルポインタ(ライタを閉じるまで、他の方法で書き込まないこと)
+ * @param [in] n_threads ワーカスレッド数(1以下なら、呼び出したスレッドで変換する)
+ * @return ライタ。メモリ確保に失敗したときはNULLを返す
+ */
+feature_writer *feature_writer_open(FILE *f, unsigned int n_threads) {
+  feature_writer *w = (feature_writer *)calloc(1, sizeof(feature_writer));
+
+  if (w == NULL) return NULL;
+  w->f         = f;
+  w->n_threads = n_threads == 0 ? 1 : n_threads;
+  // スレッドプールを作れなければ、呼び出したスレッドで変換する
+  if (w->n_threads > 1) w->pool = thread_pool_create(w->n_threads);
+  return w;
+}
+
+
+/*!
+ * 特徴データを複製して、行の範囲ごとにワーカスレッドで文字列に変換させる
+ * 前回に渡された特徴データは、変換し終えるのを待ってから書き出す
+ * (そのため、書き出しが遅れるのは1回分だけで、出力の順は渡された順になる)
+ * @param [in,out] w             ライタ
+ * @param [in]     feature_datas 特徴データの配列
+ * @param [in]     len           特徴データの要素数
+ * @param [in]     is_head       feature_datas[0]が出力の最初の行かどうか
+ * @return 成功したなら0を、これまでに変換か書き込みに失敗していたなら-1を返す
+ */
+int feature_writer_write(feature_writer *w, const feature *feature_datas, unsigned int len, int is_head) {
+  writer_batch *b = &w->batches[w->next];
+  unsigned int  n_chunks, i;
+
+  if (flush_pending(w) != 0) return -1;
+  if (len == 0) return 0;
+
+  if (b->cap_rows < len) {
+    feature *rows = (feature *)realloc(b->rows, sizeof(feature) * len);
+    if (rows == NULL) {
+      w->is_failed = 1;
+      return -1;
+    }
+    b->rows     = rows;
+    b->cap_rows = len;
+  }
+  memcpy(b->rows, feature_datas, sizeof(feature) * len);
+
+  n_chunks = split_rows(NULL, b->rows, len, is_head, w->n_threads);
+  if (b->cap_chunks < n_chunks) {
+    chunk *chunks = (chunk *)realloc(b->chunks, sizeof(chunk) * n_chunks);
+    if (chunks == NULL) {
+      w->is_failed = 1;
+      return -1;
+    }
+    memset(chunks + b->cap_chunks, 0, sizeof(chunk) * (n_chunks - b->cap_chunks));
+    b->chunks     = chunks;
+    b->cap_chunks = n_chunks;
+  }
+  b->n_chunks = split_rows(b->chunks, b->rows, len, is_head, w->n_threads);
+
+  for (i = 0; i < b->n_chunks; i++) {
+    if (w->pool == NULL || thread_pool_submit(w->pool, format_chunk, &b->chunks[i]) != 0) {
+      format_chunk(&b->chunks[i], 0);
+    }
+  }
+  w->pending = b;
+  w->next ^= 1;
+  return 0;
+}
+
+
+/*!
+ * 変換中の特徴データを書き出して、ライタを解放する(ファイルは閉じない)
+ * @param [in,out] w ライタ(解放される)
+ * @return 全て書き出せたなら0を、いずれかの変換か書き込みに失敗していたなら-1を返す
+ */
+int feature_writer_close(feature_writer *w) {
+  unsigned int i, j;
+  int          ret;
+
+  ret = flush_pending(w);
+  thread_pool_destroy(w->pool);
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < w->batches[i].cap_chunks; j++) free(w->batches[i].chunks[j].ptr);
+    free(w->batches[i].chunks);
+    free(w->batches[i].rows);
+  }
+  free(w);
+  return ret;
+}
+
+
+
+
+/*!
+ * 行の範囲ごとに並列に文字列に変換し、行の順にファイルに書き出す
+ * @param [in] f             出力ファイルのファイルポインタ
+ * @param [in] feature_datas 特徴データの配列
+ * @param [in] spectra       周波数特徴の配列(NULLなら、周波数特徴の列を出力しない)
+ * @param [in] len           特徴データの要素数
+ * @param [in] is_head       feature_datas[0]が出力の最初の行かどうか
+ * @param [in] n_threads     ワーカスレッド数(1以下なら、呼び出したスレッドで変換する)
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int write_rows(FILE *f, const feature *feature_datas, const spectral_feature *spectra, unsigned int len, int is_head,
+                      unsigned int n_threads) {
+  unsigned int  n_chunks, i;
+  chunk        *chunks;
+  thread_pool  *pool = NULL;
+  int           ret  = 0;
+
+  if (len == 0) return 0;
+  if (n_threads == 0) n_threads = 1;
+  n_chunks = split_rows(NULL, feature_datas, len, is_head, n_threads);
+  chunks   = (chunk *)calloc(n_chunks, sizeof(chunk));
+  if (chunks == NULL) return -1;
+  split_rows(chunks, feature_datas, len, is_head, n_threads);
+  for (i = 0; i < n_chunks; i++) {
+    chunks[i].spectra = spectra;
+  }
+
+  // タスクが1つしか無いときは、スレッドを起こさずにこのスレッドで変換する
+  if (n_threads > 1 && n_chunks > 1) pool = thread_pool_create(n_threads);
+  for (i = 0; i < n_chunks; i++) {
+    if (pool == NULL || thread_pool_submit(pool, format_chunk, &chunks[i]) != 0) {
+      format_chunk(&chunks[i], 0);
+    }
+  }
+  if (pool != NULL) {
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+  }
+
+  for (i = 0; i < n_chunks; i++) {
+    if (chunks[i].is_failed) ret = -1;
+  }
+  // FILEのバッファに残っているデータを先に書き出してから、ディスクリプタに直接書き込む
+  if (ret == 0 && (fflush(f) != 0 || write_chunks(fileno(f), chunks, n_chunks) != 0)) ret = -1;
+
+  for (i = 0; i < n_chunks; i++) {
+    free(chunks[i].ptr);
+  }
+  free(chunks);
+  return ret;
+}
+
+
+/*!
+ * 特徴データを、ワーカスレッドあたりCHUNKS_PER_THREAD個(1つはMIN_CHUNK_ROWS行以上)の範囲に分ける
+ * 変換結果のバッファ(ptr, cap)はそのまま残すので、前に用いた範囲の配列を渡せば再利用される
+ * @param [out] chunks        範囲の配列(NULLなら、範囲の数だけを求める)
+ * @param [in]  feature_datas 特徴データの配列
+ * @param [in]  len           特徴データの要素数(1以上)
+ * @param [in]  is_head       feature_datas[0]が出力の最初の行かどうか
+ * @param [in]  n_threads     ワーカスレッド数(1以上)
+ * @return 範囲の数
+ */
+static unsigned int split_rows(chunk *chunks, const feature *feature_datas, unsigned int len, int is_head, unsigned int n_threads) {
+  unsigned int chunk_rows = len / (n_threads * CHUNKS_PER_THREAD);
+  unsigned int n_chunks, i;
+
+  if (chunk_rows < MIN_CHUNK_ROWS) chunk_rows = MIN_CHUNK_ROWS;
+  n_chunks = len / chunk_rows + (len % chunk_rows != 0);
+  for (i = 0; chunks != NULL && i < n_chunks; i++) {
+    chunks[i].feature_datas = feature_datas;
+    chunks[i].spectra       = NULL;
+    chunks[i].is_head       = is_head;
+    chunks[i].begin         = i * chunk_rows;
+    chunks[i].end           = i == n_chunks - 1 ? len : (i + 1) * chunk_rows;
+    chunks[i].len           = 0;
+    chunks[i].is_failed     = 0;
+  }
+  return n_chunks;
+}
+
+
+/*!
+ * 変換中の特徴データがあれば、変換し終えるのを待って書き出す
+ * @param [in,out] w ライタ
+ * @return 成功したなら0を、これまでに変換か書き込みに失敗していたなら-1を返す
+ */
+static int flush_pending(feature_writer *w) {
+  writer_batch *b = w->pending;
+  unsigned int  i;
+
+  if (b == NULL) return w->is_failed ? -1 : 0;
+  w->pending = NULL;
+  if (w->pool != NULL) thread_pool_wait(w->pool);
+  for (i = 0; i < b->n_chunks; i++) {
+    if (b->chunks[i].is_failed) w->is_failed = 1;
+  }
+  // FILEのバッファに残っているデータを先に書き出してから、ディスクリプタに直接書き込む
+  if (!w->is_failed && (fflush(w->f) != 0 || write_chunks(fileno(w->f), b->chunks, b->n_chunks) != 0)) w->is_failed = 1;
+  return w->is_failed ? -1 : 0;
+}
+
+
+/*!
+ * 1つの範囲の行を文字列に変換する(スレッドプールのタスク)
+ * @param [in,out] arg       変換する範囲(chunk)
+ * @param [in]     worker_id ワーカスレッドの番号(未使用)
+ */
+static void format_chunk(void *arg, unsigned int worker_id) {
+  chunk        *c    = (chunk *)arg;
+  size_t        need = (size_t)(c->end - c->begin) * ROW_SIZE_HINT;
+  unsigned int  i;
+  (void)worker_id;
+
+  if (c->cap < need) {  // 前に用いたバッファが足りなければ、確保し直す
+    char *ptr = (char *)realloc(c->ptr, need);
+    if (ptr == NULL) {
+      c->is_failed = 1;
+      return;
+    }
+    c->ptr = ptr;
+    c->cap = need;
+  }
+  for (i = c->begin; i < c->end; ) {
+    const feature *fd   = &c->feature_datas[i];
+    size_t         rest = c->cap - c->len;
+    int            n;
+
+    if (c->spectra != NULL) {
+      const spectral_feature *sf = &c->spectra[i];
+      if (i == 0 && c->is_head) {  // 重心位置の変化の列は"nan"で埋め、周波数特徴の列を全ての行で揃える
+        n = snprintf(c->ptr + c->len, rest, "%lf %lf %lf nan %lf %lf\n", fd->time, fd->len, fd->area, sf->dom_freq, sf->band_energy);
+      } else {
+        n = snprintf(c->ptr + c->len, rest, "%lf %lf %lf %lf %lf %lf\n",
+            fd->time, fd->len, fd->area, fd->cog_change, sf->dom_freq, sf->band_energy);
+      }
+    } else if (i == 0 && c->is_head) {
+      n = snprintf(c->ptr + c->len, rest, "%lf %lf %lf\n", fd->time, fd->len, fd->area);
+    } else {
+      n = snprintf(c->ptr + c->len, rest, "%lf %lf %lf %lf\n", fd->time, fd->len, fd->area, fd->cog_change);
+    }
+    if (n < 0) {
+      c->is_failed = 1;
+      return;
+    }
+    if ((size_t)n >= rest) {  // 入りきらなかったときは、バッファを2倍にしてやり直す
+      char *ptr = (char *)realloc(c->ptr, c->cap * 2 + n);
+      if (ptr == NULL) {
+        c->is_failed = 1;
+        return;
+      }
+      c->ptr  = ptr;
+      c->cap  = c->cap * 2 + n;
+      continue;
+    }
+    c->len += n;
+    i++;
+  }
+}
+
+
+/*!
+ * 変換結果を、範囲の順にwritevで書き出す
+ * @param [in] fd       出力先のファイルディスクリプタ
+ * @param [in] chunks   変換結果の配列
+ * @param [in] n_chunks 変換結果の数
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int write_chunks(int fd, const chunk *chunks, unsigned int n_chunks) {
+  struct iovec  iov[IOV_BATCH];
+  unsigned int  i = 0;
+
+  while (i < n_chunks) {
+    struct iovec *p   = iov;
+    int           cnt = 0;
+
+    for (; i < n_chunks && cnt < IOV_BATCH; i++, cnt++) {
+      iov[cnt].iov_base = chunks[i].ptr;
+      iov[cnt].iov_len  = chunks[i].len;
+    }
+    while (cnt > 0) {
+      ssize_t written = writev(fd, p, cnt);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      // 書き出せた分のバッファを進める(途中まで書き出せた場合も考慮する)
+      while (cnt > 0 && (size_t)written >= p->iov_len) {
+        written -= p->iov_len;
+        p++;
+        cnt--;
+      }
+      if (cnt > 0) {
+        p->iov_base  = (char *)p->iov_base + written;
+        p->iov_len  -= written;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdio.h>
+#include "data_handler.h"
+#include "spectral.h"
+
+
+// 特徴データを、1行に"時間 距離の総和 面積 重心位置の変化"の書式でファイルに書き出す
+// (最初の行は重心位置の変化を除いた3列)。spectraがNULLでなければ、各行の末尾に
+// "卓越周波数 周波数帯の成分の分散"の2列を加える
+// 行の範囲ごとにワーカスレッドで文字列に変換し、変換し終えた順ではなく行の順に
+// writevでまとめて書き出す(fに溜まっているデータは、先にフラッシュする)
+int write_features_parallel(FILE *f, const feature *feature_datas, const spectral_feature *spectra, unsigned int len, unsigned int n_threads);
+// 入力を区切って処理するときに、特徴データを全体の途中から続けて書き出す
+// (is_headが0なら、最初の行にも重心位置の変化を出力する。周波数特徴の列は出力しない)
+int write_feature_rows(FILE *f, const feature *feature_datas, unsigned int len, int is_head, unsigned int n_threads);
+
+typedef struct feature_writer feature_writer;
+
+// 特徴データを何回にも分けて書き出すライタを開く(ワーカスレッドは、閉じるまで使い回す)
+feature_writer *feature_writer_open(FILE *f, unsigned int n_threads);
+// write_feature_rows()と同じ書式で書き出す。文字列への変換をワーカスレッドに任せて戻り、
+// 変換し終えたものは次の呼び出しかfeature_writer_close()で書き出す(feature_datasはすぐに再利用してよい)
+int feature_writer_write(feature_writer *w, const feature *feature_datas, unsigned int len, int is_head);
+// 残りを書き出して、ライタを解放する(fは閉じない)。いずれかの書き込みに失敗していたなら-1を返す
+int feature_writer_close(feature_writer *w);
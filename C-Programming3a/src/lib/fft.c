@@ -0,0 +1,244 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fft.h"
+
+#define PI  3.14159265358979323846
+
+
+// 変換の計画
+// 長さを素因数に分解し、素因数ごとにStockhamの自動整列アルゴリズムの1段を行う
+// (ビット反転の並べ替えが要らず、任意の素因数を同じ形で扱える)
+struct fft_plan {
+  unsigned int  n;                        // 変換の長さ
+  unsigned int  batch;                    // まとめて変換する系列の数
+  unsigned int  n_stages;                 // 段数
+  unsigned int  radix[FFT_MAX_STAGES];    // 段ごとの基数(素因数)
+  double       *tw_re[FFT_MAX_STAGES];    // 段ごとの回転因子 exp(-2πi qj / n_s) (q < n_s / p, 1 <= j < p)
+  double       *tw_im[FFT_MAX_STAGES];
+  double       *omega_re[FFT_MAX_STAGES]; // 段ごとの基数pの1のp乗根 exp(-2πi r / p) (r < p。DFTの係数はrjをpで割った余りで引く)
+  double       *omega_im[FFT_MAX_STAGES];
+  double       *work_re;                  // 作業領域(n * batch)
+  double       *work_im;
+  void         *mem;                      // 上記の領域をまとめて確保したもの
+};
+
+
+static void radix2_stage(const fft_plan *plan, unsigned int stage, unsigned int m, unsigned int s,
+                         const double *xr, const double *xi, double *yr, double *yi);
+static void radix_p_stage(const fft_plan *plan, unsigned int stage, unsigned int m, unsigned int s,
+                          const double *xr, const double *xi, double *yr, double *yi);
+
+
+
+
+/*!
+ * 変換の計画を作る
+ * 長さを小さい素因数から順に分解し、段ごとの回転因子と基数の1のp乗根を求めておく
+ * (基数のDFTの係数をp * p個並べると、大きな素数の長さでメモリがO(p^2)になるので、p個だけ持つ)
+ * @param [in] n     変換の長さ(1以上)
+ * @param [in] batch まとめて変換する系列の数(1以上FFT_MAX_BATCH以下)
+ * @return 作成した計画(失敗したならNULL)
+ */
+fft_plan *fft_plan_create(unsigned int n, unsigned int batch) {
+  fft_plan     *plan;
+  unsigned int  rest, p, stage, n_s;
+  size_t        total;
+  double       *d;
+
+  if (n == 0 || batch == 0 || batch > FFT_MAX_BATCH) return NULL;
+  plan = (fft_plan *)calloc(1, sizeof(fft_plan));
+  if (plan == NULL) return NULL;
+  plan->n     = n;
+  plan->batch = batch;
+
+  // 素因数分解(段ごとの回転因子はn_s / p * (p - 1)個、1のp乗根はp個)
+  total = (size_t)n * batch * 2;
+  for (rest = n, p = 2, n_s = n; rest > 1; ) {
+    if ((unsigned long long)p * p > rest) p = rest;
+    if (rest % p != 0) {
+      p++;
+      continue;
+    }
+    plan->radix[plan->n_stages++] = p;
+    total += ((size_t)(n_s / p) * (p - 1) + p) * 2;
+    n_s  /= p;
+    rest /= p;
+  }
+
+  plan->mem = malloc(sizeof(double) * total);
+  if (plan->mem == NULL) {
+    free(plan);
+    return NULL;
+  }
+  d = (double *)plan->mem;
+  plan->work_re = d;
+  plan->work_im = d + (size_t)n * batch;
+  d += (size_t)n * batch * 2;
+  for (stage = 0, n_s = n; stage < plan->n_stages; stage++) {
+    unsigned int q, j, m;
+    p = plan->radix[stage];
+    m = n_s / p;
+    plan->tw_re[stage] = d;
+    plan->tw_im[stage] = d + (size_t)m * (p - 1);
+    d += (size_t)m * (p - 1) * 2;
+    for (q = 0; q < m; q++) {
+      for (j = 1; j < p; j++) {
+        double a = -2.0 * PI * (double)((unsigned long long)q * j % n_s) / n_s;
+        plan->tw_re[stage][q * (p - 1) + j - 1] = cos(a);
+        plan->tw_im[stage][q * (p - 1) + j - 1] = sin(a);
+      }
+    }
+    plan->omega_re[stage] = d;
+    plan->omega_im[stage] = d + p;
+    d += (size_t)p * 2;
+    for (j = 0; j < p; j++) {
+      double a = -2.0 * PI * (double)j / p;
+      plan->omega_re[stage][j] = cos(a);
+      plan->omega_im[stage][j] = sin(a);
+    }
+    n_s = m;
+  }
+  return plan;
+}
+
+
+/*!
+ * batch個の系列を、その場で離散フーリエ変換する
+ * 各段では、要素ごとにbatch個の値が連続して並ぶので、最も内側のループは系列についての
+ * 単純な積和となり、コンパイラがSIMD命令(SSE2なら2系列、AVXなら4系列ずつ)にできる
+ * @param [in]     plan 変換の計画
+ * @param [in,out] re   系列の実部(re[t * batch + b])。変換結果で上書きする
+ * @param [in,out] im   系列の虚部(同上)
+ */
+void fft_execute(fft_plan *plan, double *re, double *im) {
+  double       *xr = re, *xi = im, *yr = plan->work_re, *yi = plan->work_im;
+  unsigned int  stage, m, s = 1;
+  unsigned int  n_s = plan->n;
+
+  for (stage = 0; stage < plan->n_stages; stage++) {
+    double *t;
+    m = n_s / plan->radix[stage];
+    if (plan->radix[stage] == 2) {
+      radix2_stage(plan, stage, m, s, xr, xi, yr, yi);
+    } else {
+      radix_p_stage(plan, stage, m, s, xr, xi, yr, yi);
+    }
+    t = xr; xr = yr; yr = t;
+    t = xi; xi = yi; yi = t;
+    s  *= plan->radix[stage];
+    n_s = m;
+  }
+  // 段数が奇数のときは、結果が作業領域にある
+  if (xr != re) {
+    memcpy(re, xr, sizeof(double) * plan->n * plan->batch);
+    memcpy(im, xi, sizeof(double) * plan->n * plan->batch);
+  }
+}
+
+
+/*!
+ * 変換の計画を破棄する
+ * @param [in] plan 変換の計画(NULLなら何もしない)
+ */
+void fft_plan_destroy(fft_plan *plan) {
+  if (plan == NULL) return;
+  free(plan->mem);
+  free(plan);
+}
+
+
+
+
+/*!
+ * 基数2の段(Stockhamの自動整列、周波数間引き)
+ * y[s(2q) + k] = a + b, y[s(2q + 1) + k] = (a - b) w^q (a = x[s q + k], b = x[s(q + m) + k])
+ * @param [in]  plan  変換の計画
+ * @param [in]  stage 段の番号
+ * @param [in]  m     この段の長さ / 2
+ * @param [in]  s     これまでの段の基数の積(ストライド)
+ * @param [in]  xr    入力の実部
+ * @param [in]  xi    入力の虚部
+ * @param [out] yr    出力の実部
+ * @param [out] yi    出力の虚部
+ */
+static void radix2_stage(const fft_plan *plan, unsigned int stage, unsigned int m, unsigned int s,
+                         const double *xr, const double *xi, double *yr, double *yi) {
+  unsigned int B = plan->batch;
+  unsigned int q, k, b;
+
+  for (q = 0; q < m; q++) {
+    double wr = plan->tw_re[stage][q];
+    double wi = plan->tw_im[stage][q];
+    for (k = 0; k < s; k++) {
+      const double *ar = xr + ((size_t)s * q + k) * B,       *ai = xi + ((size_t)s * q + k) * B;
+      const double *br = xr + ((size_t)s * (q + m) + k) * B, *bi = xi + ((size_t)s * (q + m) + k) * B;
+      double       *cr = yr + ((size_t)s * 2 * q + k) * B,   *ci = yi + ((size_t)s * 2 * q + k) * B;
+      double       *dr = cr + (size_t)s * B,                 *di = ci + (size_t)s * B;
+      for (b = 0; b < B; b++) {
+        double tr = ar[b] - br[b];
+        double ti = ai[b] - bi[b];
+        cr[b] = ar[b] + br[b];
+        ci[b] = ai[b] + bi[b];
+        dr[b] = tr * wr - ti * wi;
+        di[b] = tr * wi + ti * wr;
+      }
+    }
+  }
+}
+
+
+/*!
+ * 任意の素数pを基数とする段(Stockhamの自動整列、周波数間引き)
+ * y[s(pq + j) + k] = w^(qj) Σ_r x[s(q + mr) + k] exp(-2πi rj / p)
+ * @param [in]  plan  変換の計画
+ * @param [in]  stage 段の番号
+ * @param [in]  m     この段の長さ / p
+ * @param [in]  s     これまでの段の基数の積(ストライド)
+ * @param [in]  xr    入力の実部
+ * @param [in]  xi    入力の虚部
+ * @param [out] yr    出力の実部
+ * @param [out] yi    出力の虚部
+ */
+static void radix_p_stage(const fft_plan *plan, unsigned int stage, unsigned int m, unsigned int s,
+                          const double *xr, const double *xi, double *yr, double *yi) {
+  unsigned int  B = plan->batch;
+  unsigned int  p = plan->radix[stage];
+  const double *omr = plan->omega_re[stage];
+  const double *omi = plan->omega_im[stage];
+  unsigned int  q, k, j, r, b;
+
+  for (q = 0; q < m; q++) {
+    for (k = 0; k < s; k++) {
+      for (j = 0; j < p; j++) {
+        double       *cr = yr + ((size_t)s * (p * q + j) + k) * B;
+        double       *ci = yi + ((size_t)s * (p * q + j) + k) * B;
+        unsigned int  rj = 0;  // r * j % p(rを1増やすたびにjを足し、p以上になればpを引く)
+
+        memcpy(cr, xr + ((size_t)s * q + k) * B, sizeof(double) * B);  // r = 0の項(係数は1)
+        memcpy(ci, xi + ((size_t)s * q + k) * B, sizeof(double) * B);
+        for (r = 1; r < p; r++) {
+          const double *ar = xr + ((size_t)s * (q + (size_t)m * r) + k) * B;
+          const double *ai = xi + ((size_t)s * (q + (size_t)m * r) + k) * B;
+          double        c, d;
+          rj = rj >= p - j ? rj - (p - j) : rj + j;
+          c  = omr[rj];
+          d  = omi[rj];
+          for (b = 0; b < B; b++) {
+            cr[b] += ar[b] * c - ai[b] * d;
+            ci[b] += ar[b] * d + ai[b] * c;
+          }
+        }
+        if (j > 0 && q > 0) {
+          double wr = plan->tw_re[stage][q * (p - 1) + j - 1];
+          double wi = plan->tw_im[stage][q * (p - 1) + j - 1];
+          for (b = 0; b < B; b++) {
+            double tr = cr[b];
+            cr[b] = tr * wr - ci[b] * wi;
+            ci[b] = tr * wi + ci[b] * wr;
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#define FFT_MAX_STAGES  32  // 変換の段数の上限(長さの素因数の個数)
+#define FFT_MAX_BATCH   32  // まとめて変換できる系列の数の上限
+
+
+typedef struct fft_plan fft_plan;
+
+
+// 長さn(任意の正の整数)の系列をbatch個まとめて変換する計画を作る(回転因子はここで求めておく)
+fft_plan *fft_plan_create(unsigned int n, unsigned int batch);
+// batch個の系列を、その場で離散フーリエ変換する(X[k] = Σ x[t] exp(-2πi kt / n))
+// 系列は要素ごとに並べる(re[t * batch + b] が系列bのt番目の要素の実部)
+void fft_execute(fft_plan *plan, double *re, double *im);
+void fft_plan_destroy(fft_plan *plan);
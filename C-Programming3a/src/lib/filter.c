@@ -0,0 +1,235 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+
+// data_fmt用の積和演算用マクロ(時間を除く各要素に、data2の各要素のw倍を加える)
+// 9つの独立な積和なので、コンパイラが2つ(AVXなら4つ)ずつまとめてSIMD命令にできる
+#define MADD_DATA(data1, w, data2) { \
+  (data1)->pos1.x += (w) * (data2)->pos1.x; \
+  (data1)->pos1.y += (w) * (data2)->pos1.y; \
+  (data1)->pos1.z += (w) * (data2)->pos1.z; \
+  (data1)->pos2.x += (w) * (data2)->pos2.x; \
+  (data1)->pos2.y += (w) * (data2)->pos2.y; \
+  (data1)->pos2.z += (w) * (data2)->pos2.z; \
+  (data1)->pos3.x += (w) * (data2)->pos3.x; \
+  (data1)->pos3.y += (w) * (data2)->pos3.y; \
+  (data1)->pos3.z += (w) * (data2)->pos3.z; \
+}
+
+
+static int  parse_filter_uint(const char *str, char **end, unsigned int *val);
+static int  sg_coefficients(double *coef, unsigned int width, unsigned int order);
+static int  invert_matrix(double *m, unsigned int n);
+
+
+
+
+/*!
+ * フィルタの指定を解析する
+ * "ma:width"(移動平均)または"sg:width:order"(Savitzky-Golayフィルタ)の形式で、widthは奇数とする
+ * @param [in]  spec フィルタの指定
+ * @param [out] fs   解析したフィルタの設定
+ * @return 成功したなら0を、指定が不正なら-1を返す
+ */
+int parse_filter_spec(const char *spec, filter_spec *fs) {
+  char *p;
+
+  if (strncmp(spec, "ma:", 3) == 0) {
+    fs->order = 0;
+    if (parse_filter_uint(spec + 3, &p, &fs->width) != 0 || *p != '\0') goto invalid;
+  } else if (strncmp(spec, "sg:", 3) == 0) {
+    if (parse_filter_uint(spec + 3, &p, &fs->width) != 0 || *p != ':') goto invalid;
+    if (parse_filter_uint(p + 1, &p, &fs->order) != 0 || *p != '\0') goto invalid;
+  } else {
+    goto invalid;
+  }
+  if (fs->width % 2 == 0 || fs->width > MAX_FILTER_WIDTH) {
+    fprintf(stderr, "フィルタの幅には、%d以下の奇数を指定してください\n", MAX_FILTER_WIDTH);
+    return -1;
+  }
+  if (fs->order >= fs->width || fs->order > MAX_FILTER_ORDER) {
+    fprintf(stderr, "多項式の次数は、フィルタの幅より小さく、%d以下にしてください\n", MAX_FILTER_ORDER);
+    return -1;
+  }
+  return 0;
+
+invalid:
+  fprintf(stderr, "フィルタの指定:%sが不正です(ma:width, sg:width:order)\n", spec);
+  return -1;
+}
+
+
+/*!
+ * 座標の列を、Savitzky-Golayフィルタ(次数0なら移動平均)で平滑化する
+ * 各行を中心とする幅widthの窓に多項式を最小二乗で当てはめた値とするが、これは係数の
+ * 畳み込みと等しいので、係数をあらかじめ求めておき、窓の行との積和を取るだけでよい
+ * 両端の(width / 2)行は、先頭または末尾の窓に当てはめた多項式の、その行での値とする
+ * データ数がwidthより少ないときは、データ数以下の最大の奇数に幅を縮める
+ * @param [out] dst   平滑化したデータを格納する配列(srcと重なってはならない)
+ * @param [in]  src   オリジナルのデータ
+ * @param [in]  len   データ数
+ * @param [in]  fs    フィルタの設定
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int smooth_datas(data_fmt *dst, const data_fmt *src, unsigned int len, const filter_spec *fs) {
+  static const data_fmt ZERO_DATA = {0.0, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+  unsigned int  width = fs->width;
+  unsigned int  order = fs->order;
+  unsigned int  half, i, j;
+  double       *coef;  // 窓の中の評価位置ごとの係数(width x width)
+
+  if (len == 0) return 0;
+  if (width > len) width = len % 2 == 1 ? len : len - 1;
+  if (order >= width) order = width - 1;
+  half = width / 2;
+
+  coef = (double *)malloc(sizeof(double) * width * width);
+  if (coef == NULL || sg_coefficients(coef, width, order) != 0) {
+    free(coef);
+    return -1;
+  }
+  for (i = 0; i < len; i++, dst++) {
+    unsigned int    row;    // 用いる係数の行(窓の中の評価位置)
+    const data_fmt *s;      // 窓の先頭のデータ
+    const double   *w;
+
+    if (i < half) {                // 先頭の窓
+      s   = src;
+      row = i;
+    } else if (i >= len - half) {  // 末尾の窓
+      s   = src + (len - width);
+      row = i - (len - width);
+    } else {                       // 行iを中心とする窓
+      s   = src + (i - half);
+      row = half;
+    }
+    w    = coef + (size_t)row * width;
+    *dst = ZERO_DATA;
+    for (j = 0; j < width; j++, s++) {
+      MADD_DATA(dst, w[j], s);
+    }
+    dst->time = src[i].time;
+  }
+  free(coef);
+  return 0;
+}
+
+
+
+
+/*!
+ * 文字列の先頭から、正の整数を読み取る
+ * @param [in]  str 文字列
+ * @param [out] end 読み取った数字の次の位置
+ * @param [out] val 読み取った値
+ * @return 成功したなら0を、数字が無いか0以下なら-1を返す
+ */
+static int parse_filter_uint(const char *str, char **end, unsigned int *val) {
+  unsigned long num = strtoul(str, end, 10);
+  if (*end == str || *str == '-' || num == 0 || num > UINT_MAX) return -1;
+  *val = (unsigned int)num;
+  return 0;
+}
+
+
+/*!
+ * Savitzky-Golayフィルタの係数を、窓の中の評価位置ごとに求める
+ * 窓の位置を[-1, 1]に正規化した行列Aについて、評価位置uでの係数は A (A^T A)^-1 v(u)
+ * (v(u) = (1, u, u^2, ...)) となる。正規化するのは、A^T Aの条件数を抑えるためである
+ * @param [out] coef  係数(width x width、coef[評価位置 * width + 窓の中の位置])
+ * @param [in]  width 窓の幅(奇数)
+ * @param [in]  order 多項式の次数(widthより小さい)
+ * @return 成功したなら0を、メモリ確保に失敗したか行列が正則でないなら-1を返す
+ */
+static int sg_coefficients(double *coef, unsigned int width, unsigned int order) {
+  unsigned int  n    = order + 1;
+  unsigned int  half = width / 2;
+  unsigned int  i, j, k;
+  double        ata[(MAX_FILTER_ORDER + 1) * (MAX_FILTER_ORDER + 1)];
+  double        z[MAX_FILTER_ORDER + 1];
+  double       *pw;  // 窓の中の位置ごとの累乗(width x n)
+
+  pw = (double *)malloc(sizeof(double) * width * n);
+  if (pw == NULL) return -1;
+  for (j = 0; j < width; j++) {
+    double x = half > 0 ? ((double)j - half) / half : 0.0;
+    pw[j * n] = 1.0;
+    for (k = 1; k < n; k++) pw[j * n + k] = pw[j * n + k - 1] * x;
+  }
+  // A^T A (の逆行列)
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < n; k++) {
+      double sum = 0.0;
+      for (j = 0; j < width; j++) sum += pw[j * n + i] * pw[j * n + k];
+      ata[i * n + k] = sum;
+    }
+  }
+  if (invert_matrix(ata, n) != 0) {
+    free(pw);
+    return -1;
+  }
+  // 評価位置ごとに z = (A^T A)^-1 v(u) を求め、係数 A z を並べる
+  for (i = 0; i < width; i++) {
+    for (k = 0; k < n; k++) {
+      double sum = 0.0;
+      for (j = 0; j < n; j++) sum += ata[k * n + j] * pw[i * n + j];
+      z[k] = sum;
+    }
+    for (j = 0; j < width; j++) {
+      double sum = 0.0;
+      for (k = 0; k < n; k++) sum += pw[j * n + k] * z[k];
+      coef[(size_t)i * width + j] = sum;
+    }
+  }
+  free(pw);
+  return 0;
+}
+
+
+/*!
+ * 部分ピボット選択付きのGauss-Jordan法で、正方行列の逆行列を求める
+ * @param [in,out] m n x n の行列(逆行列で上書きする)
+ * @param [in]     n 行列の大きさ(MAX_FILTER_ORDER + 1 以下)
+ * @return 成功したなら0を、正則でないなら-1を返す
+ */
+static int invert_matrix(double *m, unsigned int n) {
+  double       inv[(MAX_FILTER_ORDER + 1) * (MAX_FILTER_ORDER + 1)];
+  unsigned int i, j, k;
+
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < n; j++) inv[i * n + j] = i == j ? 1.0 : 0.0;
+  }
+  for (i = 0; i < n; i++) {
+    unsigned int pivot = i;
+    double       d;
+
+    for (j = i + 1; j < n; j++) {
+      if (fabs(m[j * n + i]) > fabs(m[pivot * n + i])) pivot = j;
+    }
+    if (m[pivot * n + i] == 0.0) return -1;
+    if (pivot != i) {
+      for (k = 0; k < n; k++) {
+        double t = m[i * n + k];     m[i * n + k]   = m[pivot * n + k];   m[pivot * n + k]   = t;
+        t        = inv[i * n + k];   inv[i * n + k] = inv[pivot * n + k]; inv[pivot * n + k] = t;
+      }
+    }
+    d = m[i * n + i];
+    for (k = 0; k < n; k++) {
+      m[i * n + k]   /= d;
+      inv[i * n + k] /= d;
+    }
+    for (j = 0; j < n; j++) {
+      double f = m[j * n + i];
+      if (j == i || f == 0.0) continue;
+      for (k = 0; k < n; k++) {
+        m[j * n + k]   -= f * m[i * n + k];
+        inv[j * n + k] -= f * inv[i * n + k];
+      }
+    }
+  }
+  memcpy(m, inv, sizeof(double) * n * n);
+  return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "data_handler.h"
+
+#define MAX_FILTER_WIDTH  1001  // 平滑化の窓の最大幅
+#define MAX_FILTER_ORDER     8  // 当てはめる多項式の最大次数
+
+
+// 平滑化フィルタの設定(移動平均は、次数0のSavitzky-Golayフィルタとして扱う)
+typedef struct {
+  unsigned int width;  // 窓の幅(奇数)
+  unsigned int order;  // 当てはめる多項式の次数(widthより小さい)
+} filter_spec;
+
+
+// フィルタの指定 "ma:width" または "sg:width:order" を解析する
+int parse_filter_spec(const char *spec, filter_spec *fs);
+// 座標の列を平滑化したデータをdstに書き出す(時間はそのまま)
+// 両端の(width / 2)行は、端の窓に当てはめた多項式の値とする
+int smooth_datas(data_fmt *dst, const data_fmt *src, unsigned int len, const filter_spec *fs);
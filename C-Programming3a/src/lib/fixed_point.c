@@ -0,0 +1,411 @@
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "data_handler.h"
+#include "fixed_point.h"
+
+#define BUF_SIZE       512
+#define INITIAL_LEN   8192  // 最初に確保する配列の要素数(足りなくなったら倍に広げる)
+#define FRAC_DIGITS      3  // 小数点以下の桁数
+#define IS_DIGIT(c)    ('0' <= (c) && (c) <= '9')
+#define QUANTIZE_EPS   1e-4  // 千分の一単位にしたときに、doubleの丸め誤差とみなす端数の大きさ
+
+
+static int         quantize(double value, int64_t limit, int64_t *q);
+static const char *parse_fixed(const char *p, int64_t limit, int64_t *value);
+static void        average_block_fixed(data_fmt *avg, const fixed_fmt *datas, unsigned int n);
+static void        sum_block_fixed(int64_t acc[FIXED_COL], const fixed_fmt *datas, unsigned int n);
+static unsigned int gallop_time_fixed(const fixed_fmt *datas, unsigned int lo, unsigned int len, int64_t t);
+
+
+
+
+/**
+ * csvファイルを、固定小数点数として読み込む
+ * 配列は読みながら倍に広げるので、有効データ数に上限は無い
+ * @param [in]  f   csvファイルのファイルポインタ
+ * @param [out] len 有効データ数
+ * @return 有効データの配列(free()で解放する)。メモリ確保に失敗したときはNULLを返す
+ */
+fixed_fmt *read_csv_fixed(FILE *f, size_t *len) {
+  size_t        cnt     = 0;    // 有効データ数のカウンタ
+  size_t        cap     = INITIAL_LEN;
+  size_t        line_no = 0;    // 入力ファイルの行番号(エラー出力に用いる)
+  static   char buf[BUF_SIZE];  // 読み込み用バッファ
+  fixed_fmt    *datas   = (fixed_fmt *)malloc(sizeof(fixed_fmt) * cap);
+
+  if (datas == NULL) return NULL;
+  while (fgets(buf, sizeof(buf), f) != NULL) {
+    line_no++;
+    if (cnt == cap) {
+      fixed_fmt *grown = (fixed_fmt *)realloc(datas, sizeof(fixed_fmt) * cap * 2);
+      if (grown == NULL) {
+        free(datas);
+        return NULL;
+      }
+      datas = grown;
+      cap  *= 2;
+    }
+    if (parse_fixed_line(buf, &datas[cnt])) {  // データファイルの1行が正しいフォーマットとマッチするなら、
+      cnt++;    // 有効データ数をインクリメント
+    } else {
+      fprintf(stderr, "Invalid format data at line %zu ... ignored!\n", line_no);
+    }
+  }
+  *len = cnt;
+  return datas;
+}
+
+
+/*!
+ * csvファイルの1行を、doubleを経由せずに千分の一単位の整数として解析する
+ * 小数点以下が4桁以上ある値や、int32_tの範囲を超える座標を含む行は無効とする
+ * @param [in]  line 解析する1行分の文字列
+ * @param [out] data 解析結果を格納するデータ
+ * @return 正しいフォーマットの行なら1を、それ以外なら0を返す
+ */
+int parse_fixed_line(const char *line, fixed_fmt *data) {
+  int64_t value;
+  int     i;
+
+  if ((line = parse_fixed(line, INT64_MAX / 10, &data->time)) == NULL) return 0;
+  for (i = 0; i < FIXED_COL; i++) {
+    if ((line = parse_fixed(line, INT32_MAX, &value)) == NULL) return 0;
+    data->pos[i] = (int32_t)value;
+  }
+  return 1;
+}
+
+
+/*!
+ * double型のデータを、千分の一単位の固定小数点数に量子化する
+ * parse_fixed_line()と同じく、小数点以下が4桁以上ある値と、範囲(座標はint32_t、時間はその1/10の
+ * int64_t)を超える値は表せないので、丸めずにエラーとする
+ * @param [out] dst 量子化したデータを格納する配列
+ * @param [in]  src 量子化するデータ
+ * @param [in]  len データ数
+ * @return 全て量子化できたなら0を、表せない値があったならエラーメッセージを出力して-1を返す
+ */
+int quantize_datas(fixed_fmt *dst, const data_fmt *src, unsigned int len) {
+  int64_t      q;
+  unsigned int i;
+  int          c;
+
+  for (i = 0; i < len; i++, dst++, src++) {
+    const double pos[FIXED_COL] = {src->pos1.x, src->pos1.y, src->pos1.z,
+                                   src->pos2.x, src->pos2.y, src->pos2.z,
+                                   src->pos3.x, src->pos3.y, src->pos3.z};
+    if (!quantize(src->time, INT64_MAX / 10, &dst->time)) break;
+    for (c = 0; c < FIXED_COL && quantize(pos[c], INT32_MAX, &q); c++) {
+      dst->pos[c] = (int32_t)q;
+    }
+    if (c < FIXED_COL) break;
+  }
+  if (i < len) {
+    fprintf(stderr, "%u番目のデータは、千分の一単位の固定小数点数で表せません(範囲外か、小数点以下が4桁以上あります)\n", i + 1);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 固定小数点数のデータのダウンサンプリングを行う。
+ * ウィンドウ内の総和は整数で計算するので誤差が無く、加算の順序に依存しない
+ * @param [out] down_smpl_datas ダウンサンプリングデータを格納する配列
+ * @param [in]  datas           オリジナルのデータ
+ * @param [in]  len             オリジナルのデータ数
+ * @param [in]  merge_num       結合する数
+ */
+void down_sample_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas, unsigned int len, unsigned int merge_num) {
+  unsigned int i;
+  unsigned int repeat = len / merge_num;
+  unsigned int rest   = len % merge_num;
+
+  for (i = 0; i < repeat; i++, down_smpl_datas++, datas += merge_num) {
+    average_block_fixed(down_smpl_datas, datas, merge_num);
+  }
+  if (rest == 0) return;
+  average_block_fixed(down_smpl_datas, datas, rest);  // 残ったデータ数だけで平均を取る
+}
+
+
+/*!
+ * 固定小数点数のデータのダウンサンプリングと特徴データの抽出を、1パスで行う
+ * doubleに変換するのは、ブロックの平均値を求めた後(特徴の計算の直前)のみである
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         オリジナルのデータ
+ * @param [in]  len           オリジナルのデータ数
+ * @param [in]  merge_num     結合する数
+ */
+void down_sample_features_fixed(feature *feature_datas, const fixed_fmt *datas, unsigned int len, unsigned int merge_num) {
+  unsigned int i;
+  unsigned int repeat = len / merge_num;
+  unsigned int rest   = len % merge_num;
+  position prev_cog_pos = {0.0, 0.0, 0.0};  // 1つ前のステップの重心位置記憶用変数
+  data_fmt avg;                             // ブロックの平均値
+
+  for (i = 0; i < repeat; i++, feature_datas++, datas += merge_num) {
+    average_block_fixed(&avg, datas, merge_num);
+    derive_feature(feature_datas, &avg, &prev_cog_pos, i == 0);
+  }
+  if (rest == 0) return;
+  average_block_fixed(&avg, datas, rest);
+  derive_feature(feature_datas, &avg, &prev_cog_pos, repeat == 0);
+}
+
+
+/*!
+ * time_buckets()の固定小数点数版
+ * 時間も千分の一単位の整数なので、バケットの境界の計算に丸め誤差が無い
+ * @param [out] bounds    i番目のバケットがdatas[bounds[i]] ~ datas[bounds[i + 1] - 1]
+ *                        となる配列(len + 1個分の領域が必要)
+ * @param [in]  datas     オリジナルのデータ(時間の昇順であること)
+ * @param [in]  len       オリジナルのデータ数
+ * @param [in]  span      バケットの時間幅(千分の一単位、正の値)
+ * @param [out] n_buckets データのあるバケットの数
+ * @param [out] n_empty   飛ばした、データの無いバケットの数
+ * @return 成功したなら0を、時間の列が昇順でないなら-1を返す
+ */
+int time_buckets_fixed(unsigned int *bounds, const fixed_fmt *datas, unsigned int len, int64_t span, unsigned int *n_buckets, unsigned int *n_empty) {
+  unsigned int i, n = 0;
+  int64_t      k, prev_k = 0;
+  int          is_unsorted = 0;
+
+  *n_buckets = 0;
+  *n_empty   = 0;
+  if (len == 0) return 0;
+  for (i = 1; i < len; i++) {
+    is_unsorted |= datas[i].time < datas[i - 1].time;
+  }
+  if (is_unsorted) return -1;
+
+  for (i = 0; i < len; ) {
+    k = (datas[i].time - datas[0].time) / span;
+    if (n > 0 && (uint64_t)(k - prev_k - 1) < (uint64_t)(UINT_MAX - *n_empty)) {
+      *n_empty += (unsigned int)(k - prev_k - 1);
+    }
+    bounds[n++] = i;
+    prev_k = k;
+    i = gallop_time_fixed(datas, i + 1, len, datas[0].time + (k + 1) * span);
+  }
+  bounds[n]  = len;
+  *n_buckets = n;
+  return 0;
+}
+
+
+/*!
+ * down_sample_buckets()の固定小数点数版
+ * @param [out] down_smpl_datas ダウンサンプリングデータを格納する配列
+ * @param [in]  datas           オリジナルのデータ
+ * @param [in]  bounds          バケットの境界(time_buckets_fixed()で求めたもの)
+ * @param [in]  n_buckets       バケットの数
+ */
+void down_sample_buckets_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas, const unsigned int *bounds, unsigned int n_buckets) {
+  unsigned int i;
+  for (i = 0; i < n_buckets; i++, down_smpl_datas++) {
+    average_block_fixed(down_smpl_datas, datas + bounds[i], bounds[i + 1] - bounds[i]);
+  }
+}
+
+
+/*!
+ * down_sample_features_buckets()の固定小数点数版
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         オリジナルのデータ
+ * @param [in]  bounds        バケットの境界(time_buckets_fixed()で求めたもの)
+ * @param [in]  n_buckets     バケットの数
+ */
+void down_sample_features_buckets_fixed(feature *feature_datas, const fixed_fmt *datas, const unsigned int *bounds, unsigned int n_buckets) {
+  unsigned int i;
+  position prev_cog_pos = {0.0, 0.0, 0.0};  // 1つ前のステップの重心位置記憶用変数
+  data_fmt avg;                             // バケットの平均値
+
+  for (i = 0; i < n_buckets; i++, feature_datas++) {
+    average_block_fixed(&avg, datas + bounds[i], bounds[i + 1] - bounds[i]);
+    derive_feature(feature_datas, &avg, &prev_cog_pos, i == 0);
+  }
+}
+
+
+/*!
+ * down_sample_features_fixed()の近似計算版
+ * 平方根の近似はderive_features_approx()を参照
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [in]  datas         オリジナルのデータ
+ * @param [in]  len           オリジナルのデータ数
+ * @param [in]  merge_num     結合する数
+ */
+void down_sample_features_fixed_approx(feature *feature_datas, const fixed_fmt *datas, unsigned int len, unsigned int merge_num) {
+  unsigned int n_blocks = len / merge_num + (len % merge_num != 0);
+  unsigned int i, j, n;
+  position prev_cog_pos = {0.0, 0.0, 0.0};  // 1つ前のステップの重心位置記憶用変数
+  data_fmt avg[APPROX_BATCH];               // ブロックの平均値
+
+  for (i = 0; i < n_blocks; i += n) {
+    n = n_blocks - i < APPROX_BATCH ? n_blocks - i : APPROX_BATCH;
+    for (j = 0; j < n; j++) {
+      unsigned int start = (i + j) * merge_num;
+      average_block_fixed(&avg[j], datas + start, len - start < merge_num ? len - start : merge_num);
+    }
+    derive_features_approx(feature_datas + i, avg, n, &prev_cog_pos, i == 0);
+  }
+}
+
+
+
+
+/*!
+ * 1つの値を、千分の一単位の整数に量子化する
+ * 10進数の文字列から読んだ値の丸め誤差(QUANTIZE_EPS未満)は無視する
+ * @param [in]  value 量子化する値
+ * @param [in]  limit 許容する絶対値の最大値(千分の一単位)
+ * @param [out] q     量子化した値
+ * @return 量子化できたなら1を、範囲外か小数点以下が4桁以上あるなら0を返す
+ */
+static int quantize(double value, int64_t limit, int64_t *q) {
+  double scaled  = value * FIXED_SCALE;
+  double rounded = nearbyint(scaled);
+
+  if (!(fabs(rounded) <= (double)limit)) return 0;  // NaNも範囲外とする
+  if (fabs(scaled - rounded) >= QUANTIZE_EPS) return 0;
+  *q = (int64_t)rounded;
+  if (*q > limit || *q < -limit) return 0;  // limitがdoubleで丸められて大きくなった分
+  return 1;
+}
+
+
+/*!
+ * 10進数の固定小数点数を1つ解析する
+ * 先頭の空白は読み飛ばす
+ * @param [in]  p     解析を開始する位置
+ * @param [in]  limit 許容する絶対値の最大値(千分の一単位)
+ * @param [out] value 解析した値(千分の一単位)
+ * @return 解析した数値の直後の位置。解析できなかったときや、絶対値がlimitを超えるときはNULLを返す
+ */
+static const char *parse_fixed(const char *p, int64_t limit, int64_t *value) {
+  int64_t v      = 0;
+  int     is_neg = 0;
+  int     n_int  = 0;  // 整数部の桁数
+  int     n_frac = 0;  // 小数部の桁数
+
+  while (*p == ' ' || *p == '\t') p++;
+  if (*p == '-' || *p == '+') {
+    is_neg = *p == '-';
+    p++;
+  }
+  // 桁を足すたびに、掛ける前にlimitを超えないか調べる(超えてから調べると、int64_tがオーバーフローする)
+  for (; IS_DIGIT(*p); p++, n_int++) {
+    if (v > (limit - (*p - '0')) / 10) return NULL;
+    v = v * 10 + (*p - '0');
+  }
+  if (*p == '.') {
+    for (p++; IS_DIGIT(*p) && n_frac < FRAC_DIGITS; p++, n_frac++) {
+      if (v > (limit - (*p - '0')) / 10) return NULL;
+      v = v * 10 + (*p - '0');
+    }
+    if (IS_DIGIT(*p)) return NULL;  // 小数点以下が4桁以上ある
+  }
+  if (n_int == 0 && n_frac == 0) return NULL;
+  for (; n_frac < FRAC_DIGITS; n_frac++) {
+    if (v > limit / 10) return NULL;
+    v *= 10;
+  }
+  *value = is_neg ? -v : v;
+  return p;
+}
+
+
+/*!
+ * 1ブロック分の固定小数点数のデータの平均を取る
+ * 時間は、ブロックの先頭のデータの時間とする
+ * @param [out] avg   平均値を格納するデータ
+ * @param [in]  datas ブロックの先頭のデータ
+ * @param [in]  n     ブロックのデータ数
+ */
+static void average_block_fixed(data_fmt *avg, const fixed_fmt *datas, unsigned int n) {
+  int64_t acc[FIXED_COL];
+  double  div = (double)n * FIXED_SCALE;
+
+  sum_block_fixed(acc, datas, n);
+  avg->time   = (double)datas->time / FIXED_SCALE;
+  avg->pos1.x = acc[0] / div;
+  avg->pos1.y = acc[1] / div;
+  avg->pos1.z = acc[2] / div;
+  avg->pos2.x = acc[3] / div;
+  avg->pos2.y = acc[4] / div;
+  avg->pos2.z = acc[5] / div;
+  avg->pos3.x = acc[6] / div;
+  avg->pos3.y = acc[7] / div;
+  avg->pos3.z = acc[8] / div;
+}
+
+
+/*!
+ * 1ブロック分の座標の総和を、64bit整数で計算する
+ * AVX2が使える場合は、32bit整数を64bit整数に拡張しながら4列ずつ加算する
+ * @param [out] acc   列ごとの総和
+ * @param [in]  datas ブロックの先頭のデータ
+ * @param [in]  n     ブロックのデータ数
+ */
+static void sum_block_fixed(int64_t acc[FIXED_COL], const fixed_fmt *datas, unsigned int n) {
+  unsigned int i;
+#ifdef __AVX2__
+  __m256i acc0 = _mm256_setzero_si256();  // pos[0] ~ pos[3]の総和
+  __m256i acc1 = _mm256_setzero_si256();  // pos[4] ~ pos[7]の総和
+  int64_t acc8 = 0;                       // pos[8]の総和
+
+  for (i = 0; i < n; i++, datas++) {
+    acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)&datas->pos[0])));
+    acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)&datas->pos[4])));
+    acc8 += datas->pos[8];
+  }
+  _mm256_storeu_si256((__m256i *)&acc[0], acc0);
+  _mm256_storeu_si256((__m256i *)&acc[4], acc1);
+  acc[8] = acc8;
+#else
+  int j;
+  memset(acc, 0, sizeof(int64_t) * FIXED_COL);
+  for (i = 0; i < n; i++, datas++) {
+    for (j = 0; j < FIXED_COL; j++) {
+      acc[j] += datas->pos[j];
+    }
+  }
+#endif
+}
+
+
+/*!
+ * gallop_time()の固定小数点数版
+ * @param [in] datas 時間の昇順に並んだデータ
+ * @param [in] lo    探索を始める位置
+ * @param [in] len   データ数
+ * @param [in] t     探す時間(千分の一単位)
+ * @return 時間がt以上となる最初のデータの位置(無ければlen)
+ */
+static unsigned int gallop_time_fixed(const fixed_fmt *datas, unsigned int lo, unsigned int len, int64_t t) {
+  unsigned int hi   = lo;
+  unsigned int step = 1;
+
+  while (hi < len && datas[hi].time < t) {
+    lo   = hi + 1;
+    hi   = len - hi > step ? hi + step : len;
+    step *= 2;
+  }
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (datas[mid].time < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include "data_handler.h"
+
+#define FIXED_SCALE  1000  // 固定小数点数のスケール(小数点以下3桁)
+#define FIXED_COL       9  // 座標の列数(3点 x 3次元)
+
+
+// 座標を千分の一単位の整数で保持するデータ
+// pos[]は pos1.x, pos1.y, pos1.z, pos2.x, ..., pos3.z の順に並ぶ
+typedef struct {
+  int64_t time;             // 時間(千分の一単位)
+  int32_t pos[FIXED_COL];   // 座標(千分の一単位)
+} fixed_fmt;
+
+
+fixed_fmt *read_csv_fixed(FILE *f, size_t *len);
+int parse_fixed_line(const char *line, fixed_fmt *data);
+int quantize_datas(fixed_fmt *dst, const data_fmt *src, unsigned int len);
+void down_sample_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas, unsigned int len, unsigned int merge_num);
+void down_sample_features_fixed(feature *feature_datas, const fixed_fmt *datas, unsigned int len, unsigned int merge_num);
+int time_buckets_fixed(unsigned int *bounds, const fixed_fmt *datas, unsigned int len, int64_t span, unsigned int *n_buckets, unsigned int *n_empty);
+void down_sample_buckets_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas, const unsigned int *bounds, unsigned int n_buckets);
+void down_sample_features_buckets_fixed(feature *feature_datas, const fixed_fmt *datas, const unsigned int *bounds, unsigned int n_buckets);
+void down_sample_features_fixed_approx(feature *feature_datas, const fixed_fmt *datas, unsigned int len, unsigned int merge_num);
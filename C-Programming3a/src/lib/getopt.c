@@ -3,6 +3,7 @@
 #include "getopt.h"
 
 #define ERR(s, c) { if (opterr) fprintf (stderr, "%s%s%c\n", argv[0], s, c); }
+#define ERR_LONG(s, name) { if (opterr) fprintf (stderr, "%s%s%s\n", argv[0], s, name); }
 
 static int  opterr = 1;
 static int  optind = 1;
@@ -62,3 +63,60 @@ int getopt(int argc, char *const *argv, const char *opts) {
   }
   return c;
 }
+
+
+/**
+ * 長いオプションも扱うオプション解析関数
+ * gccのライブラリ<getopt.h>のgetopt_long()関数の独自実装
+ * "--name value"と"--name=value"の形式に対応する(名前の省略形は扱わない)
+ * "--"で始まらない引数は、getopt()で解析する
+ * @param [in]  argc      コマンドライン引数の個数(プログラム名も含む)
+ * @param [in]  argv      コマンドライン引数へのダブルポインタ
+ * @param [in]  opts      オプション文字列
+ * @param [in]  longopts  長いオプションの定義の配列
+ * @param [out] longindex 一致した長いオプションの添字を格納する変数(NULLなら格納しない)
+ * @return 長いオプションならその定義のvalを(flagがNULLでなければ0を)、
+ *         短いオプションならgetopt()と同じ値を、不正なオプションなら'?'を返す
+ */
+int getopt_long(int argc, char *const *argv, const char *opts, const struct option *longopts, int *longindex) {
+  const char *name;
+  size_t      n;
+  int         i;
+
+  if (optind >= argc || strncmp(argv[optind], "--", 2) != 0 || argv[optind][2] == '\0') {
+    return getopt(argc, argv, opts);
+  }
+
+  name = argv[optind++] + 2;
+  n    = strcspn(name, "=");
+  for (i = 0; longopts[i].name != NULL; i++) {
+    if (strlen(longopts[i].name) == n && strncmp(longopts[i].name, name, n) == 0) break;
+  }
+  if (longopts[i].name == NULL) {
+    ERR_LONG(": unrecognized option --", name);
+    return '?';
+  }
+
+  if (name[n] == '=') {
+    if (longopts[i].has_arg == no_argument) {
+      ERR_LONG(": option doesn't allow an argument --", longopts[i].name);
+      return '?';
+    }
+    optarg = (char *)&name[n + 1];
+  } else if (longopts[i].has_arg == required_argument) {
+    if (optind >= argc) {
+      ERR_LONG(": option requires an argument --", longopts[i].name);
+      return '?';
+    }
+    optarg = argv[optind++];
+  } else {
+    optarg = NULL;
+  }
+
+  if (longindex != NULL) *longindex = i;
+  if (longopts[i].flag != NULL) {
+    *longopts[i].flag = longopts[i].val;
+    return 0;
+  }
+  return longopts[i].val;
+}
@@ -1,4 +1,17 @@
 #pragma once
 
+#define no_argument        0  // 引数を取らない
+#define required_argument  1  // 引数を必ず取る
+#define optional_argument  2  // "--name=value"の形式でのみ引数を取る
+
+// getopt_long()に与える長いオプションの定義(配列の末尾はnameをNULLとする)
+struct option {
+  const char *name;     // オプション名("--"を除く)
+  int         has_arg;  // xxx_argument
+  int        *flag;     // NULLでなければ、valをここに格納して0を返す
+  int         val;      // 返す値
+};
+
 int getopt(int argc, char *const *argv, const char *opts);
+int getopt_long(int argc, char *const *argv, const char *opts, const struct option *longopts, int *longindex);
 extern char *optarg;
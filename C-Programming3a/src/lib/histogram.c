@@ -0,0 +1,512 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+#include "thread_pool.h"
+
+#define MIN_TASK_ROWS  4096  // 1つのタスクで数える最小の行数(これより少なければ分割しない)
+#define MAX_HIST_TOKS     7  // 指定を':'で区切った最大の個数(特徴, 区間の数, 範囲4つ, log)
+
+
+// ヒストグラムを数える1つのタスク(担当する行の範囲と、タスク専用の数の領域)
+typedef struct {
+  histogram     *hists;     // ヒストグラムの配列(範囲のみ参照する)
+  unsigned int   n_hists;   // ヒストグラムの数
+  const feature *fd;        // 特徴データの配列
+  unsigned int   begin;     // 担当する最初の行
+  unsigned int   end;       // 担当する最後の行の次
+  int            skip_cog;  // 担当する最初の行の重心位置の変化を数えないかどうか
+  uint64_t      *counts;    // タスク専用の数(ヒストグラムごとに total, underflow, overflow, 区間の数 の順)
+  double        *min;       // タスク専用の、ヒストグラム・軸ごとの最小値(範囲を求める場合)
+  double        *max;       // タスク専用の、ヒストグラム・軸ごとの最大値(同上)
+} hist_task;
+
+
+static unsigned int n_cells(const hist_spec *hs);
+static int          parse_feature(const char *str, size_t n);
+static void         set_range(histogram *h, const double *lo, const double *hi);
+static int          run_tasks(histogram *hists, unsigned int n_hists, const feature *fd, unsigned int len, int is_head,
+                              unsigned int n_threads, int fit);
+static void         count_task(void *arg, unsigned int worker_id);
+static void         range_task(void *arg, unsigned int worker_id);
+static long         bin_index(const histogram *h, int axis, double v);
+static double       bin_edge(const histogram *h, int axis, unsigned int i);
+
+
+
+
+/*!
+ * ヒストグラムの設定の指定を解析する
+ * "feature[,feature]:bins[xbins][:lo:hi[:lo:hi]][:log]"の形式で、featureを2つ指定すると
+ * 1つ目を横軸、2つ目を縦軸とする2次元の同時分布になる
+ * 範囲を省略すると、データの最小値と最大値を範囲とする
+ * @param [in]  spec 設定の指定
+ * @param [out] hs   解析した設定
+ * @return 成功したなら0を、指定が不正なら-1を返す
+ */
+int parse_hist_spec(const char *spec, hist_spec *hs) {
+  const char *toks[MAX_HIST_TOKS];
+  size_t      lens[MAX_HIST_TOKS];
+  const char *p = spec, *comma;
+  char       *end;
+  int         n_toks = 0, n_vals, i;
+
+  memset(hs, 0, sizeof(*hs));
+  hs->text = spec;
+  for (;;) {
+    const char *colon = strchr(p, ':');
+    if (n_toks == MAX_HIST_TOKS) goto invalid;
+    toks[n_toks] = p;
+    lens[n_toks] = colon != NULL ? (size_t)(colon - p) : strlen(p);
+    n_toks++;
+    if (colon == NULL) break;
+    p = colon + 1;
+  }
+  if (n_toks < 2) goto invalid;
+  if (lens[n_toks - 1] == 3 && strncmp(toks[n_toks - 1], "log", 3) == 0) {
+    hs->use_log = 1;
+    n_toks--;
+  }
+
+  // 特徴
+  comma      = memchr(toks[0], ',', lens[0]);
+  hs->n_axes = comma != NULL ? 2 : 1;
+  hs->axis[0] = parse_feature(toks[0], comma != NULL ? (size_t)(comma - toks[0]) : lens[0]);
+  if (hs->axis[0] < 0) goto invalid;
+  if (comma != NULL) {
+    hs->axis[1] = parse_feature(comma + 1, lens[0] - (size_t)(comma + 1 - toks[0]));
+    if (hs->axis[1] < 0) goto invalid;
+  }
+
+  // 区間の数(2次元で1つだけ指定したなら、両方の軸に用いる)
+  hs->bins[0] = (unsigned int)strtoul(toks[1], &end, 10);
+  hs->bins[1] = hs->bins[0];
+  if (hs->n_axes == 2 && *end == 'x') hs->bins[1] = (unsigned int)strtoul(end + 1, &end, 10);
+  if (end != toks[1] + lens[1] || hs->bins[0] == 0 || hs->bins[1] == 0) goto invalid;
+  if ((uint64_t)hs->bins[0] * (hs->n_axes == 2 ? hs->bins[1] : 1) > HIST_MAX_CELLS) {
+    fprintf(stderr, "ヒストグラム:%sの区間の数が多すぎます(最大%u)\n", spec, HIST_MAX_CELLS);
+    return -1;
+  }
+
+  // 範囲
+  n_vals = n_toks - 2;
+  if (n_vals != 0 && n_vals != 2 * hs->n_axes) goto invalid;
+  for (i = 0; i < n_vals; i++) {
+    double *val = i % 2 == 0 ? &hs->lo[i / 2] : &hs->hi[i / 2];
+    *val = strtod(toks[i + 2], &end);
+    if (end == toks[i + 2] || end != toks[i + 2] + lens[i + 2] || !isfinite(*val)) goto invalid;
+  }
+  hs->has_range = n_vals > 0;
+  for (i = 0; hs->has_range && i < hs->n_axes; i++) {
+    if (hs->lo[i] >= hs->hi[i]) {
+      fprintf(stderr, "ヒストグラム:%sの範囲の上限は、下限より大きい値にしてください\n", spec);
+      return -1;
+    }
+    if (hs->use_log && hs->lo[i] <= 0.0) {
+      fprintf(stderr, "ヒストグラム:%sは対数の区間なので、範囲の下限には正の値を指定してください\n", spec);
+      return -1;
+    }
+  }
+  return 0;
+
+invalid:
+  fprintf(stderr, "ヒストグラムの指定:%sが不正です(feature[,feature]:bins[xbins][:lo:hi[:lo:hi]][:log], featureはlen, area, cog)\n", spec);
+  return -1;
+}
+
+
+/*!
+ * ヒストグラムを初期化する(範囲を指定していれば、その範囲を用いる)
+ * @param [out] h  ヒストグラム(使い終わったらhistogram_destroy()で解放する)
+ * @param [in]  hs 設定(ヒストグラムを使い終わるまで保持すること)
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int histogram_init(histogram *h, const hist_spec *hs) {
+  memset(h, 0, sizeof(*h));
+  h->spec   = hs;
+  h->counts = (uint64_t *)calloc(n_cells(hs), sizeof(uint64_t));
+  if (h->counts == NULL) return -1;
+  if (hs->has_range) set_range(h, hs->lo, hs->hi);
+  return 0;
+}
+
+
+/*!
+ * ヒストグラムの領域を解放する
+ * @param [in,out] h ヒストグラム
+ */
+void histogram_destroy(histogram *h) {
+  free(h->counts);
+  h->counts = NULL;
+}
+
+
+/*!
+ * 範囲が決まっていないヒストグラムの範囲を、特徴データの最小値と最大値に合わせる
+ * 行の範囲をワーカスレッドに分けて最小値と最大値を求め、最後にまとめる
+ * 対数の区間では、正の値の最小値と最大値を用いる
+ * @param [in,out] hists         ヒストグラムの配列
+ * @param [in]     n_hists       ヒストグラムの数
+ * @param [in]     feature_datas 特徴データの配列(最初の行から全て)
+ * @param [in]     len           特徴データの要素数
+ * @param [in]     n_threads     ワーカスレッドの数
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int fit_histogram_ranges(histogram *hists, unsigned int n_hists, const feature *feature_datas, unsigned int len,
+                         unsigned int n_threads) {
+  return run_tasks(hists, n_hists, feature_datas, len, 1, n_threads, 1);
+}
+
+
+/*!
+ * 特徴データを数えて、ヒストグラムに加える
+ * 行の範囲をワーカスレッドに分け、タスクごとに専用の領域に数えてから、最後に足し合わせるので、
+ * スレッドの間で数を奪い合うことはなく、結果はスレッドの数によらない
+ * 特徴データを分けて何度か呼ぶと、全体をまとめて数えた場合と同じ結果になる
+ * @param [in,out] hists         ヒストグラムの配列(全て範囲が決まっていること)
+ * @param [in]     n_hists       ヒストグラムの数
+ * @param [in]     feature_datas 特徴データの配列
+ * @param [in]     len           特徴データの要素数
+ * @param [in]     is_head       feature_datas[0]が最初の行かどうか(最初の行の重心位置の変化は数えない)
+ * @param [in]     n_threads     ワーカスレッドの数
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int accumulate_histograms(histogram *hists, unsigned int n_hists, const feature *feature_datas, unsigned int len,
+                          int is_head, unsigned int n_threads) {
+  return run_tasks(hists, n_hists, feature_datas, len, is_head, n_threads, 0);
+}
+
+
+/*!
+ * ヒストグラムをファイルに書き出す
+ * 1次元なら"# hist <指定> bins=<数> lo=<下限> hi=<上限> ..."の見出し行に続けて、
+ * 全ての区間を"下端 上端 数 密度"の形式で書き出す
+ * 2次元なら"# hist2d <指定> bins=<数>x<数> ..."の見出し行に続けて、数が0でない区間だけを
+ * "横軸の下端 横軸の上端 縦軸の下端 縦軸の上端 数 密度"の形式で書き出す
+ * 密度は、範囲内の値の数と区間の幅(2次元なら面積)で割った値で、範囲全体で積分すると1になる
+ * @param [in] f 出力ファイルのファイルポインタ
+ * @param [in] h ヒストグラム
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+int write_histogram(FILE *f, const histogram *h) {
+  const hist_spec *hs       = h->spec;
+  uint64_t         in_range = h->total - h->underflow - h->overflow;
+  unsigned int     x, y;
+
+  if (hs->n_axes == 1) {
+    if (fprintf(f, "# hist %s bins=%u lo=%lf hi=%lf log=%d count=%llu underflow=%llu overflow=%llu\n", hs->text,
+                hs->bins[0], bin_edge(h, 0, 0), bin_edge(h, 0, hs->bins[0]), hs->use_log, (unsigned long long)h->total,
+                (unsigned long long)h->underflow, (unsigned long long)h->overflow) < 0) return -1;
+    for (x = 0; x < hs->bins[0]; x++) {
+      double   lo = bin_edge(h, 0, x), hi = bin_edge(h, 0, x + 1);
+      uint64_t c  = h->counts[x];
+      if (fprintf(f, "%lf %lf %llu %g\n", lo, hi, (unsigned long long)c,
+                  in_range > 0 ? (double)c / (double)in_range / (hi - lo) : 0.0) < 0) return -1;
+    }
+    return 0;
+  }
+
+  if (fprintf(f, "# hist2d %s bins=%ux%u x=%lf:%lf y=%lf:%lf log=%d count=%llu underflow=%llu overflow=%llu\n",
+              hs->text, hs->bins[0], hs->bins[1], bin_edge(h, 0, 0), bin_edge(h, 0, hs->bins[0]), bin_edge(h, 1, 0),
+              bin_edge(h, 1, hs->bins[1]), hs->use_log, (unsigned long long)h->total, (unsigned long long)h->underflow,
+              (unsigned long long)h->overflow) < 0) return -1;
+  for (y = 0; y < hs->bins[1]; y++) {
+    double ylo = bin_edge(h, 1, y), yhi = bin_edge(h, 1, y + 1);
+    for (x = 0; x < hs->bins[0]; x++) {
+      uint64_t c = h->counts[(size_t)y * hs->bins[0] + x];
+      double   xlo, xhi;
+      if (c == 0) continue;
+      xlo = bin_edge(h, 0, x);
+      xhi = bin_edge(h, 0, x + 1);
+      if (fprintf(f, "%lf %lf %lf %lf %llu %g\n", xlo, xhi, ylo, yhi, (unsigned long long)c,
+                  (double)c / (double)in_range / ((xhi - xlo) * (yhi - ylo))) < 0) return -1;
+    }
+  }
+  return 0;
+}
+
+
+/*!
+ * 特徴データ全体のヒストグラムを、指定ごとに作ってファイルに書き出す
+ * @param [in] f             出力ファイルのファイルポインタ
+ * @param [in] specs         ヒストグラムの設定の配列
+ * @param [in] n_specs       設定の数
+ * @param [in] feature_datas 特徴データの配列
+ * @param [in] len           特徴データの要素数
+ * @param [in] n_threads     ワーカスレッドの数
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+int write_histograms(FILE *f, const hist_spec *specs, unsigned int n_specs, const feature *feature_datas, unsigned int len,
+                     unsigned int n_threads) {
+  histogram    hists[MAX_HIST_SPECS];
+  unsigned int i, n = 0;
+  int          ret = -1;
+
+  for (n = 0; n < n_specs; n++) {
+    if (histogram_init(&hists[n], &specs[n]) != 0) goto done;
+  }
+  if (fit_histogram_ranges(hists, n, feature_datas, len, n_threads) != 0) goto done;
+  if (accumulate_histograms(hists, n, feature_datas, len, 1, n_threads) != 0) goto done;
+  for (i = 0; i < n; i++) {
+    if (write_histogram(f, &hists[i]) != 0) goto done;
+  }
+  ret = 0;
+
+done:
+  for (i = 0; i < n; i++) histogram_destroy(&hists[i]);
+  return ret;
+}
+
+
+
+
+/*!
+ * 設定の区間の総数を求める
+ * @param [in] hs 設定
+ * @return 区間の総数
+ */
+static unsigned int n_cells(const hist_spec *hs) {
+  return hs->n_axes == 2 ? hs->bins[0] * hs->bins[1] : hs->bins[0];
+}
+
+
+/*!
+ * 特徴の名前をHIST_xxxに変換する
+ * @param [in] str 名前の先頭
+ * @param [in] n   名前の長さ
+ * @return HIST_xxx(名前が不正なら-1)
+ */
+static int parse_feature(const char *str, size_t n) {
+  int i;
+
+  for (i = 0; i < N_FEATURES; i++) {
+    if (strlen(FEATURE_NAME[i]) == n && strncmp(str, FEATURE_NAME[i], n) == 0) return i;
+  }
+  return -1;
+}
+
+
+/*!
+ * ヒストグラムの範囲を決め、値から区間の番号への倍率を求める
+ * @param [in,out] h  ヒストグラム
+ * @param [in]     lo 各軸の範囲の下限(対数の区間なら正の値)
+ * @param [in]     hi 各軸の範囲の上限(下限より大きい値)
+ */
+static void set_range(histogram *h, const double *lo, const double *hi) {
+  int i;
+
+  for (i = 0; i < h->spec->n_axes; i++) {
+    h->t_lo[i]  = h->spec->use_log ? log(lo[i]) : lo[i];
+    h->t_hi[i]  = h->spec->use_log ? log(hi[i]) : hi[i];
+    h->scale[i] = h->spec->bins[i] / (h->t_hi[i] - h->t_lo[i]);
+  }
+  h->has_range = 1;
+}
+
+
+/*!
+ * 行の範囲をタスクに分けて、範囲を求めるか数を数える
+ * 行数がMIN_TASK_ROWSに満たない分割はせず、タスクが1つならスレッドプールを使わずに実行する
+ * @param [in,out] hists     ヒストグラムの配列
+ * @param [in]     n_hists   ヒストグラムの数
+ * @param [in]     fd        特徴データの配列
+ * @param [in]     len       特徴データの要素数
+ * @param [in]     is_head   fd[0]が最初の行かどうか
+ * @param [in]     n_threads ワーカスレッドの数
+ * @param [in]     fit       1なら範囲の決まっていないヒストグラムの範囲を求め、0なら数を数える
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+static int run_tasks(histogram *hists, unsigned int n_hists, const feature *fd, unsigned int len, int is_head,
+                     unsigned int n_threads, int fit) {
+  hist_task   *tasks;
+  uint64_t    *counts = NULL;
+  double      *bounds = NULL;
+  size_t       stride = 0;
+  thread_pool *pool = NULL;
+  unsigned int n_tasks, i, j, k;
+  int          ret = -1;
+
+  if (n_hists == 0) return 0;
+  n_tasks = n_threads > 0 ? n_threads : 1;
+  if (n_tasks > len / MIN_TASK_ROWS) n_tasks = len / MIN_TASK_ROWS > 0 ? len / MIN_TASK_ROWS : 1;
+
+  for (j = 0; j < n_hists; j++) stride += 3 + (size_t)n_cells(hists[j].spec);
+  tasks = (hist_task *)malloc(sizeof(hist_task) * n_tasks);
+  if (fit) {
+    bounds = (double *)malloc(sizeof(double) * 4 * n_hists * n_tasks);
+  } else {
+    counts = (uint64_t *)calloc(stride * n_tasks, sizeof(uint64_t));
+  }
+  if (tasks == NULL || (fit ? bounds == NULL : counts == NULL)) goto done;
+
+  for (i = 0; i < n_tasks; i++) {
+    tasks[i].hists    = hists;
+    tasks[i].n_hists  = n_hists;
+    tasks[i].fd       = fd;
+    tasks[i].begin    = (unsigned int)((uint64_t)len * i / n_tasks);
+    tasks[i].end      = (unsigned int)((uint64_t)len * (i + 1) / n_tasks);
+    tasks[i].skip_cog = is_head && i == 0;
+    tasks[i].counts   = fit ? NULL : counts + stride * i;
+    tasks[i].min      = fit ? bounds + (size_t)4 * n_hists * i : NULL;
+    tasks[i].max      = fit ? tasks[i].min + 2 * n_hists : NULL;
+  }
+  if (n_threads > 1 && n_tasks > 1) pool = thread_pool_create(n_threads);
+  for (i = 0; i < n_tasks; i++) {
+    if (pool == NULL || thread_pool_submit(pool, fit ? range_task : count_task, &tasks[i]) != 0) {
+      (fit ? range_task : count_task)(&tasks[i], 0);
+    }
+  }
+  if (pool != NULL) {
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+  }
+
+  // タスクごとの結果をまとめる
+  for (j = 0; j < n_hists; j++) {
+    histogram *h = &hists[j];
+    if (fit) {
+      double lo[2], hi[2];
+      int    a;
+      if (h->has_range) continue;
+      for (a = 0; a < h->spec->n_axes; a++) {
+        lo[a] = tasks[0].min[2 * j + a];
+        hi[a] = tasks[0].max[2 * j + a];
+        for (i = 1; i < n_tasks; i++) {
+          if (tasks[i].min[2 * j + a] < lo[a]) lo[a] = tasks[i].min[2 * j + a];
+          if (tasks[i].max[2 * j + a] > hi[a]) hi[a] = tasks[i].max[2 * j + a];
+        }
+        // 値が無いか全て同じ値なら、幅を持たせる
+        if (lo[a] > hi[a]) {
+          lo[a] = h->spec->use_log ? 1.0 : 0.0;
+          hi[a] = h->spec->use_log ? 10.0 : 1.0;
+        } else if (lo[a] == hi[a]) {
+          hi[a] = h->spec->use_log ? lo[a] * 10.0 : lo[a] + 1.0;
+        }
+      }
+      set_range(h, lo, hi);
+    } else {
+      size_t   base = 0, cells = n_cells(h->spec);
+      uint64_t *c;
+      for (k = 0; k < j; k++) base += 3 + (size_t)n_cells(hists[k].spec);
+      for (i = 0; i < n_tasks; i++) {
+        c = counts + stride * i + base;
+        h->total     += c[0];
+        h->underflow += c[1];
+        h->overflow  += c[2];
+        for (k = 0; k < cells; k++) h->counts[k] += c[3 + k];
+      }
+    }
+  }
+  ret = 0;
+
+done:
+  free(tasks);
+  free(counts);
+  free(bounds);
+  return ret;
+}
+
+
+/*!
+ * 担当する行を、タスク専用の領域に数える(スレッドプールのタスク)
+ * 2次元では、どちらかの軸が下限を下回ればunderflowに、そうでなくどちらかが上限を上回ればoverflowに数える
+ * @param [in,out] arg       hist_task
+ * @param [in]     worker_id ワーカスレッドの番号(使わない)
+ */
+static void count_task(void *arg, unsigned int worker_id) {
+  hist_task   *t = (hist_task *)arg;
+  uint64_t    *c = t->counts;
+  unsigned int j, i;
+
+  (void)worker_id;
+  for (j = 0; j < t->n_hists; j++) {
+    const histogram *h  = &t->hists[j];
+    const hist_spec *hs = h->spec;
+    size_t           off0 = FEATURE_OFFSET[hs->axis[0]];
+    size_t           off1 = FEATURE_OFFSET[hs->axis[hs->n_axes - 1]];
+    unsigned int     begin = t->begin;
+
+    if (t->skip_cog && (hs->axis[0] == HIST_COG || (hs->n_axes == 2 && hs->axis[1] == HIST_COG))) begin++;
+    for (i = begin; i < t->end; i++) {
+      long x = bin_index(h, 0, FEATURE_VALUE(&t->fd[i], off0));
+      long y = hs->n_axes == 2 ? bin_index(h, 1, FEATURE_VALUE(&t->fd[i], off1)) : 0;
+      c[0]++;
+      if (x < 0 || y < 0) {
+        c[1]++;
+      } else if (x >= (long)hs->bins[0] || y >= (long)hs->bins[1]) {
+        c[2]++;
+      } else {
+        c[3 + (size_t)y * hs->bins[0] + x]++;
+      }
+    }
+    c += 3 + n_cells(hs);
+  }
+}
+
+
+/*!
+ * 担当する行の、ヒストグラム・軸ごとの最小値と最大値を求める(スレッドプールのタスク)
+ * 値が無ければ、最小値を最大値より大きくしておく
+ * @param [in,out] arg       hist_task
+ * @param [in]     worker_id ワーカスレッドの番号(使わない)
+ */
+static void range_task(void *arg, unsigned int worker_id) {
+  hist_task   *t = (hist_task *)arg;
+  unsigned int j, i;
+  int          a;
+
+  (void)worker_id;
+  for (j = 0; j < t->n_hists; j++) {
+    const hist_spec *hs = t->hists[j].spec;
+    for (a = 0; a < hs->n_axes; a++) {
+      size_t       off   = FEATURE_OFFSET[hs->axis[a]];
+      unsigned int begin = t->begin + (t->skip_cog && hs->axis[a] == HIST_COG ? 1 : 0);
+      double       lo = INFINITY, hi = -INFINITY;
+      for (i = begin; i < t->end; i++) {
+        double v = FEATURE_VALUE(&t->fd[i], off);
+        if (!isfinite(v) || (hs->use_log && v <= 0.0)) continue;
+        if (v < lo) lo = v;
+        if (v > hi) hi = v;
+      }
+      t->min[2 * j + a] = lo;
+      t->max[2 * j + a] = hi;
+    }
+  }
+}
+
+
+/*!
+ * 値が入る区間の番号を求める(上限と等しい値は最後の区間に入れる)
+ * @param [in] h    ヒストグラム
+ * @param [in] axis 軸
+ * @param [in] v    値
+ * @return 区間の番号(下限を下回るか数でなければ-1を、上限を上回ればbinsを返す)
+ */
+static long bin_index(const histogram *h, int axis, double v) {
+  unsigned int bins = h->spec->bins[axis];
+  double       t;
+
+  if (h->spec->use_log) {
+    if (!(v > 0.0)) return -1;
+    v = log(v);
+  }
+  if (!(v >= h->t_lo[axis])) return -1;
+  if (v > h->t_hi[axis]) return bins;
+  t = (v - h->t_lo[axis]) * h->scale[axis];
+  return t < bins ? (long)t : (long)bins - 1;
+}
+
+
+/*!
+ * i番目の区間の下端の値を求める(i = binsなら範囲の上限)
+ * @param [in] h    ヒストグラム
+ * @param [in] axis 軸
+ * @param [in] i    区間の番号
+ * @return 下端の値
+ */
+static double bin_edge(const histogram *h, int axis, unsigned int i) {
+  double t = i == h->spec->bins[axis] ? h->t_hi[axis] : h->t_lo[axis] + i / h->scale[axis];
+  return h->spec->use_log ? exp(t) : t;
+}
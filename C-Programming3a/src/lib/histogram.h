@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "data_handler.h"
+
+#define MAX_HIST_SPECS   8        // --histオプションを指定できる最大の回数
+#define HIST_MAX_CELLS  (1u << 22)  // 1つのヒストグラムの区間の数の上限
+
+#define HIST_LEN   FEATURE_LEN   // 距離の総和
+#define HIST_AREA  FEATURE_AREA  // 面積
+#define HIST_COG   FEATURE_COG   // 重心位置の変化
+
+
+// ヒストグラムの設定
+typedef struct {
+  const char   *text;       // 指定された文字列(見出し行に用いる)
+  int           n_axes;     // 軸の数(1か2)
+  int           axis[2];    // 各軸の特徴(HIST_xxx)
+  unsigned int  bins[2];    // 各軸の区間の数
+  int           has_range;  // 範囲を指定したかどうか(0ならデータの最小値と最大値を用いる)
+  double        lo[2];      // 各軸の範囲の下限
+  double        hi[2];      // 各軸の範囲の上限
+  int           use_log;    // 区間を対数の等間隔に取るかどうか
+} hist_spec;
+
+// 数えたヒストグラム
+typedef struct {
+  const hist_spec *spec;       // 設定
+  int              has_range;  // 範囲が決まったかどうか
+  double           t_lo[2];    // 各軸の範囲の下限(対数なら対数を取った値)
+  double           t_hi[2];    // 各軸の範囲の上限(同上)
+  double           scale[2];   // 値から区間の番号への倍率
+  uint64_t        *counts;     // 区間ごとの数(1軸目が速く変わる順)
+  uint64_t         total;      // 数えた値の数(範囲外も含む)
+  uint64_t         underflow;  // 範囲の下限を下回った値の数(対数なら0以下の値も含む)
+  uint64_t         overflow;   // 範囲の上限を上回った値の数
+} histogram;
+
+
+// 指定 "feature[,feature]:bins[xbins][:lo:hi[:lo:hi]][:log]" を解析する
+// (featureは len, area, cog のいずれか。2つ指定すると2次元の同時分布になる)
+int  parse_hist_spec(const char *spec, hist_spec *hs);
+int  histogram_init(histogram *h, const hist_spec *hs);
+void histogram_destroy(histogram *h);
+// 範囲を指定していないヒストグラムの範囲を、特徴データの最小値と最大値に合わせる
+int  fit_histogram_ranges(histogram *hists, unsigned int n_hists, const feature *feature_datas, unsigned int len,
+                          unsigned int n_threads);
+// 特徴データを数えて加える。ワーカスレッドごとのヒストグラムに数えてから、最後に足し合わせる
+// (is_headが1なら、feature_datas[0]は最初の行なので、重心位置の変化を数えない)
+int  accumulate_histograms(histogram *hists, unsigned int n_hists, const feature *feature_datas, unsigned int len,
+                           int is_head, unsigned int n_threads);
+// 見出し行に続けて、1次元なら全ての区間を、2次元なら数が0でない区間だけを書き出す
+int  write_histogram(FILE *f, const histogram *h);
+// 特徴データ全体のヒストグラムを作って書き出す(上の関数をまとめたもの)
+int  write_histograms(FILE *f, const hist_spec *specs, unsigned int n_specs, const feature *feature_datas, unsigned int len,
+                      unsigned int n_threads);
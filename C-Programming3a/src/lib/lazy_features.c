@@ -0,0 +1,452 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lazy_features.h"
+#include "parse_cache.h"
+
+#define LINE_BUF_SIZE  512  // 1行の最大の長さ(read_csv()と同じ。超えた分は読み捨てる)
+
+
+// キャッシュしたページ
+typedef struct cache_page {
+  uint64_t           page;              // ページの番号
+  unsigned int       n_blocks;          // ページにあるブロックの数(最後のページ以外はLAZY_PAGE)
+  feature            rows[LAZY_PAGE];   // ブロックの特徴データ
+  struct cache_page *newer;             // 次に新しく参照したページ(LRUの連結リスト)
+  struct cache_page *older;             // 次に古く参照したページ
+  struct cache_page *chain;             // ハッシュ表で、同じバケットにある次のページ
+} cache_page;
+
+struct lazy_features {
+  int           fd;             // 入力ファイルのディスクリプタ
+  const char   *map;            // マップした入力ファイル(空のファイルならNULL)
+  uint64_t      file_size;      // 入力ファイルのバイト数
+  unsigned int  merge_num;      // ダウンサンプリングで結合するデータの数
+  data_fmt     *work;           // ページを求めるときの、1ブロック分の行
+  // 入力を先頭から調べた状態
+  page_mark    *marks;          // ページの始まりの目印
+  uint64_t      n_marks;        // 記録した目印の数
+  uint64_t      cap_marks;      // marksの要素数
+  uint64_t      n_stored;       // キャッシュから読み込んだか、キャッシュに書き出した目印の数
+  uint64_t      scan_pos;       // 次に調べる行の位置
+  uint64_t      n_blocks;       // 調べ終えたブロックの数
+  data_fmt     *block;          // 調べている途中のブロックの行(merge_num個)
+  unsigned int  n_block_rows;   // blockにある行の数
+  position      last_cog;       // 最後に調べ終えたブロックの重心位置
+  int           scan_done;      // 最後まで調べたかどうか
+  // ページのキャッシュ
+  cache_page  **buckets;        // ハッシュ表(ページの番号で引く)
+  unsigned int  n_buckets;      // ハッシュ表のバケット数
+  unsigned int  n_pages;        // 確保したページの数
+  unsigned int  cap_pages;      // キャッシュするページの最大数
+  cache_page   *newest;         // 最も新しく参照したページ
+  cache_page   *oldest;         // 最も古く参照したページ(キャッシュが一杯なら、これを再利用する)
+};
+
+
+static int         next_row(const lazy_features *ctx, uint64_t *pos, data_fmt *row);
+static int         scan_row(lazy_features *ctx);
+static int         scan_to_page(lazy_features *ctx, uint64_t page);
+static cache_page *get_page(lazy_features *ctx, uint64_t page);
+static void        compute_page(lazy_features *ctx, cache_page *cp);
+static void        touch_page(lazy_features *ctx, cache_page *cp);
+static void        unlink_page(lazy_features *ctx, cache_page *cp);
+
+
+
+
+/*!
+ * 入力ファイルをマップして開く
+ * 開くときには入力を読まないので、大きな入力もすぐに開ける。入力は、参照したブロックに
+ * 必要な所まで先頭から調べ、LAZY_PAGE個のブロックごとに始まりの位置だけを記録する
+ * 参照したブロックの特徴データはページ単位で求め、最大cache_pages個のページを、
+ * 最も古く参照したものから捨てながら(LRU)キャッシュするので、メモリの使用量は参照した範囲で決まる
+ * 結果は、入力全体を配列に読み込んで処理した場合と同じになる
+ * @param [in] filename    入力ファイル名(csv)
+ * @param [in] merge_num   ダウンサンプリングで結合するデータの数
+ * @param [in] cache_pages キャッシュするページの最大数(0ならLAZY_CACHE_PAGES)
+ * @return 開いた状態。開けなかったときはNULLを返す(エラーメッセージは標準エラー出力に表示する)
+ */
+lazy_features *lazy_open(const char *filename, unsigned int merge_num, unsigned int cache_pages) {
+  lazy_features *ctx = (lazy_features *)calloc(1, sizeof(lazy_features));
+  struct stat    st;
+
+  if (ctx == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return NULL;
+  }
+  ctx->merge_num = merge_num;
+  ctx->cap_pages = cache_pages > 0 ? cache_pages : LAZY_CACHE_PAGES;
+  ctx->n_buckets = ctx->cap_pages;
+  ctx->work      = (data_fmt *)malloc(sizeof(data_fmt) * merge_num);
+  ctx->block     = (data_fmt *)malloc(sizeof(data_fmt) * merge_num);
+  ctx->buckets   = (cache_page **)calloc(ctx->n_buckets, sizeof(cache_page *));
+  if (ctx->work == NULL || ctx->block == NULL || ctx->buckets == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    ctx->fd = -1;
+    lazy_close(ctx);
+    return NULL;
+  }
+
+  ctx->fd = open(filename, O_RDONLY);
+  if (ctx->fd < 0 || fstat(ctx->fd, &st) != 0) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    lazy_close(ctx);
+    return NULL;
+  }
+  ctx->file_size = (uint64_t)st.st_size;
+  if (ctx->file_size > 0) {
+    void *map = mmap(NULL, (size_t)ctx->file_size, PROT_READ, MAP_PRIVATE, ctx->fd, 0);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "ファイル:%sをマップできません\n", filename);
+      lazy_close(ctx);
+      return NULL;
+    }
+    ctx->map = (const char *)map;
+    madvise(map, (size_t)ctx->file_size, MADV_RANDOM);  // 参照したページだけを読み込む
+  }
+  return ctx;
+}
+
+
+/*!
+ * 入力ファイルを閉じ、キャッシュを解放する
+ * @param [in,out] ctx 開いた状態(NULLなら何もしない)
+ */
+void lazy_close(lazy_features *ctx) {
+  cache_page *cp, *next;
+
+  if (ctx == NULL) return;
+  for (cp = ctx->newest; cp != NULL; cp = next) {
+    next = cp->older;
+    free(cp);
+  }
+  if (ctx->map != NULL) munmap((void *)ctx->map, (size_t)ctx->file_size);
+  if (ctx->fd >= 0) close(ctx->fd);
+  free(ctx->buckets);
+  free(ctx->marks);
+  free(ctx->block);
+  free(ctx->work);
+  free(ctx);
+}
+
+
+/*!
+ * 前回までに記録したページの始まりの目印を、キャッシュ(parse_cache)から読み込む
+ * 最後の目印のページの始まりから調べ直せば、それまでの行を全て調べた状態になるので、
+ * 目印を記録した範囲のブロックは、先頭から調べずにすぐ求められる
+ * キャッシュは入力ファイルのサイズと更新時刻などをキーとするので、入力が変われば用いない
+ * @param [in,out] ctx      開いた直後の状態
+ * @param [in]     filename 入力ファイル名
+ * @return 読み込んだなら0を、有効なキャッシュが無いかメモリ確保に失敗したなら-1を返す
+ */
+int lazy_load_marks(lazy_features *ctx, const char *filename) {
+  parse_cache      pc;
+  const page_mark *marks;
+  unsigned int     len, i;
+
+  if (ctx->n_marks > 0 || ctx->scan_pos > 0) return -1;  // 調べ始めた後には読み込まない
+  marks = (const page_mark *)parse_cache_load(&pc, filename, PARSE_CACHE_MARKS, ctx->merge_num, &len);
+  if (marks == NULL) return -1;
+  for (i = 0; i < len && marks[i].offset < ctx->file_size; i++) continue;
+  if (len == 0 || i < len || (ctx->marks = (page_mark *)malloc(sizeof(page_mark) * len)) == NULL) {
+    parse_cache_release(&pc);
+    return -1;
+  }
+  memcpy(ctx->marks, marks, sizeof(page_mark) * len);
+  parse_cache_release(&pc);
+
+  // 最後のページは、その始まりから調べ直す(同じ目印をもう1度記録する)
+  ctx->cap_marks = len;
+  ctx->n_marks   = len - 1;
+  ctx->n_stored  = len;
+  ctx->scan_pos  = ctx->marks[len - 1].offset;
+  ctx->n_blocks  = (uint64_t)(len - 1) * LAZY_PAGE;
+  ctx->last_cog  = ctx->marks[len - 1].prev_cog;
+  return 0;
+}
+
+
+/*!
+ * 記録したページの始まりの目印を、キャッシュ(parse_cache)に書き出す
+ * 次にlazy_load_marks()で読み込めば、今回調べた範囲を調べ直さずに済む
+ * @param [in,out] ctx      開いた状態
+ * @param [in]     filename 入力ファイル名
+ * @return 成功したか、新たに記録した目印が無ければ0を、書き出せなかったなら-1を返す
+ */
+int lazy_store_marks(lazy_features *ctx, const char *filename) {
+  if (ctx->n_marks <= ctx->n_stored || ctx->n_marks > UINT_MAX) return 0;
+  if (parse_cache_store(filename, PARSE_CACHE_MARKS, ctx->merge_num, ctx->marks, (unsigned int)ctx->n_marks) != 0) return -1;
+  ctx->n_stored = ctx->n_marks;
+  return 0;
+}
+
+
+/*!
+ * i番目のブロックの特徴データを求める
+ * ブロックを含むページがキャッシュに無ければ、ページの始まりから入力を読んで求める
+ * @param [in,out] ctx 開いた状態
+ * @param [in]     i   ブロックの番号(0から)
+ * @param [out]    out 特徴データ
+ * @return 求めたなら1を、ブロックが無ければ0を、メモリ確保に失敗したなら-1を返す
+ */
+int feature_at_block(lazy_features *ctx, uint64_t i, feature *out) {
+  cache_page *cp;
+
+  if (scan_to_page(ctx, i / LAZY_PAGE) != 0) return -1;
+  if (i / LAZY_PAGE >= ctx->n_marks) return 0;
+  cp = get_page(ctx, i / LAZY_PAGE);
+  if (cp == NULL) return -1;
+  if (i % LAZY_PAGE >= cp->n_blocks) return 0;
+  *out = cp->rows[i % LAZY_PAGE];
+  return 1;
+}
+
+
+/*!
+ * 時間がt0以上t1以下のブロックを探す
+ * t1より後に始まるページまで入力を調べ、ページの始まりの時間を二分探索してから、
+ * t0を含むページからブロックを順に求める
+ * @param [in,out] ctx   開いた状態
+ * @param [in]     t0    時間の下限
+ * @param [in]     t1    時間の上限
+ * @param [out]    out   特徴データを格納する配列(NULLなら格納しない)
+ * @param [in]     max   outに格納する最大の数
+ * @param [out]    first 最初のブロックの番号(ブロックが無ければ、t0より後の最初のブロックの番号)
+ * @param [out]    count ブロックの数(maxを超えることもある)
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int features_in_range(lazy_features *ctx, double t0, double t1, feature *out, size_t max, uint64_t *first, uint64_t *count) {
+  uint64_t lo = 0, hi, i;
+  feature  fd;
+  int      ret;
+
+  while (!ctx->scan_done && (ctx->n_marks == 0 || ctx->marks[ctx->n_marks - 1].time <= t1)) {
+    if (scan_row(ctx) != 0) return -1;
+  }
+  // 始まりの時間がt0以下の最後のページ
+  hi = ctx->n_marks;
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (ctx->marks[mid].time <= t0) lo = mid; else hi = mid;
+  }
+
+  *first = lo * LAZY_PAGE;
+  *count = 0;
+  for (i = lo * LAZY_PAGE; (ret = feature_at_block(ctx, i, &fd)) == 1; i++) {
+    if (fd.time < t0) {
+      *first = i + 1;
+      continue;
+    }
+    if (fd.time > t1) break;
+    if (out != NULL && *count < max) out[*count] = fd;
+    (*count)++;
+  }
+  return ret < 0 ? -1 : 0;
+}
+
+
+/*!
+ * ブロックの総数を求める(入力ファイルを最後まで調べる)
+ * @param [in,out] ctx   開いた状態
+ * @param [out]    count ブロックの総数
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int lazy_block_count(lazy_features *ctx, uint64_t *count) {
+  while (!ctx->scan_done) {
+    if (scan_row(ctx) != 0) return -1;
+  }
+  *count = ctx->n_blocks;
+  return 0;
+}
+
+
+
+
+/*!
+ * posの位置から次の有効な行を読み、posを次の行の位置に進める(無効な行は読み飛ばす)
+ * @param [in]     ctx 開いた状態
+ * @param [in,out] pos 読む位置
+ * @param [out]    row 読んだ行
+ * @return 読んだなら1を、ファイルの終わりなら0を返す
+ */
+static int next_row(const lazy_features *ctx, uint64_t *pos, data_fmt *row) {
+  char buf[LINE_BUF_SIZE];
+
+  while (*pos < ctx->file_size) {
+    const char *p    = ctx->map + *pos;
+    size_t      rest = (size_t)(ctx->file_size - *pos);
+    const char *nl   = (const char *)memchr(p, '\n', rest);
+    size_t      take = nl != NULL ? (size_t)(nl - p) : rest;
+    size_t      copy = take < sizeof(buf) - 1 ? take : sizeof(buf) - 1;
+
+    memcpy(buf, p, copy);
+    buf[copy] = '\0';
+    *pos += take + (nl != NULL);
+    if (parse_data_line(buf, row)) return 1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 入力を1行調べる
+ * ページの最初の行ならページの始まりの目印を記録し、ブロックの行が揃ったら平均を取って
+ * 重心位置を記録する(次のページの最初のブロックの重心位置の変化を求めるため)
+ * @param [in,out] ctx 開いた状態
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+static int scan_row(lazy_features *ctx) {
+  uint64_t pos = ctx->scan_pos;
+  data_fmt row, avg;
+  feature  fd;
+
+  if (!next_row(ctx, &pos, &row)) {
+    ctx->scan_done = 1;
+    if (ctx->n_block_rows > 0) ctx->n_blocks++;  // 最後のブロックは、残った行だけで平均を取る
+    ctx->n_block_rows = 0;
+    return 0;
+  }
+  if (ctx->n_block_rows == 0 && ctx->n_blocks % LAZY_PAGE == 0) {
+    if (ctx->n_marks == ctx->cap_marks) {
+      uint64_t   cap   = ctx->cap_marks > 0 ? ctx->cap_marks * 2 : 64;
+      page_mark *marks = (page_mark *)realloc(ctx->marks, sizeof(page_mark) * cap);
+      if (marks == NULL) {
+        fputs("メモリ確保に失敗しました\n", stderr);
+        return -1;
+      }
+      ctx->marks     = marks;
+      ctx->cap_marks = cap;
+    }
+    // 前の行の直後を記録する(間にある無効な行は、ページを求めるときにも読み飛ばす)
+    ctx->marks[ctx->n_marks].offset   = ctx->scan_pos;
+    ctx->marks[ctx->n_marks].time     = row.time;
+    ctx->marks[ctx->n_marks].prev_cog = ctx->last_cog;
+    ctx->n_marks++;
+  }
+  ctx->scan_pos = pos;
+  ctx->block[ctx->n_block_rows++] = row;
+  if (ctx->n_block_rows == ctx->merge_num) {
+    down_sample(&avg, ctx->block, ctx->merge_num, ctx->merge_num);
+    derive_feature(&fd, &avg, &ctx->last_cog, 1);  // 重心位置だけを用いる
+    ctx->n_blocks++;
+    ctx->n_block_rows = 0;
+  }
+  return 0;
+}
+
+
+/*!
+ * page番目のページの始まりが分かるまで(または最後まで)入力を調べる
+ * @param [in,out] ctx  開いた状態
+ * @param [in]     page ページの番号
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+static int scan_to_page(lazy_features *ctx, uint64_t page) {
+  while (!ctx->scan_done && ctx->n_marks <= page) {
+    if (scan_row(ctx) != 0) return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * ページをキャッシュから取り出す。無ければ求めてキャッシュに加える
+ * キャッシュが一杯なら、最も古く参照したページの領域を再利用する
+ * @param [in,out] ctx  開いた状態
+ * @param [in]     page ページの番号(始まりの目印が記録済みであること)
+ * @return ページ。メモリ確保に失敗したときはNULLを返す
+ */
+static cache_page *get_page(lazy_features *ctx, uint64_t page) {
+  cache_page **bucket = &ctx->buckets[page % ctx->n_buckets];
+  cache_page  *cp;
+
+  for (cp = *bucket; cp != NULL; cp = cp->chain) {
+    if (cp->page == page) {
+      touch_page(ctx, cp);
+      return cp;
+    }
+  }
+
+  if (ctx->n_pages < ctx->cap_pages) {
+    cp = (cache_page *)malloc(sizeof(cache_page));
+    if (cp == NULL) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      return NULL;
+    }
+    ctx->n_pages++;
+  } else {
+    cache_page **p;
+    cp = ctx->oldest;
+    for (p = &ctx->buckets[cp->page % ctx->n_buckets]; *p != cp; p = &(*p)->chain) continue;
+    *p = cp->chain;
+    unlink_page(ctx, cp);
+  }
+  cp->page  = page;
+  compute_page(ctx, cp);
+  cp->chain = *bucket;
+  *bucket   = cp;
+  cp->newer = NULL;
+  cp->older = ctx->newest;
+  if (ctx->newest != NULL) ctx->newest->newer = cp;
+  ctx->newest = cp;
+  if (ctx->oldest == NULL) ctx->oldest = cp;
+  return cp;
+}
+
+
+/*!
+ * ページの始まりから入力を読み、ページにあるブロックの特徴データを求める
+ * 各ブロックはdown_sample()で平均を取ってからderive_feature()に渡すので、
+ * down_sample_features()で入力全体を処理した場合と同じ結果になる
+ * @param [in,out] ctx 開いた状態
+ * @param [in,out] cp  ページ(pageを設定しておくこと)
+ */
+static void compute_page(lazy_features *ctx, cache_page *cp) {
+  const page_mark *mark = &ctx->marks[cp->page];
+  uint64_t         pos  = mark->offset;
+  position         prev = mark->prev_cog;
+  unsigned int     k;
+
+  for (k = 0; k < LAZY_PAGE; k++) {
+    data_fmt     avg;
+    unsigned int n = 0;
+    while (n < ctx->merge_num && next_row(ctx, &pos, &ctx->work[n])) n++;
+    if (n == 0) break;
+    down_sample(&avg, ctx->work, n, n);
+    derive_feature(&cp->rows[k], &avg, &prev, cp->page == 0 && k == 0);
+  }
+  cp->n_blocks = k;
+}
+
+
+/*!
+ * ページを、最も新しく参照したページにする
+ * @param [in,out] ctx 開いた状態
+ * @param [in,out] cp  ページ
+ */
+static void touch_page(lazy_features *ctx, cache_page *cp) {
+  if (ctx->newest == cp) return;
+  unlink_page(ctx, cp);
+  cp->newer = NULL;
+  cp->older = ctx->newest;
+  if (ctx->newest != NULL) ctx->newest->newer = cp;
+  ctx->newest = cp;
+  if (ctx->oldest == NULL) ctx->oldest = cp;
+}
+
+
+/*!
+ * ページをLRUの連結リストから外す
+ * @param [in,out] ctx 開いた状態
+ * @param [in,out] cp  ページ
+ */
+static void unlink_page(lazy_features *ctx, cache_page *cp) {
+  if (cp->newer != NULL) cp->newer->older = cp->older; else ctx->newest = cp->older;
+  if (cp->older != NULL) cp->older->newer = cp->newer; else ctx->oldest = cp->newer;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "data_handler.h"
+
+#define LAZY_PAGE          64  // まとめて求めてキャッシュするブロックの数(1ページ)
+#define LAZY_CACHE_PAGES  256  // キャッシュするページ数のデフォルト
+
+
+typedef struct lazy_features lazy_features;
+
+// ページの始まりの目印(入力を先頭から調べながら、ページごとに1つ記録する)
+typedef struct {
+  uint64_t offset;    // ページの最初の行の、ファイルの先頭からの位置
+  double   time;      // ページの最初のブロックの時間
+  position prev_cog;  // 前のページの最後のブロックの重心位置(重心位置の変化を求めるため)
+} page_mark;
+
+
+// 入力ファイルをマップして開く。ブロックの特徴データは、参照されたときに初めて求める
+// (入力の時間の列は昇順であること。1つのスレッドから使うこと)
+// 最初に参照したブロックより前の行は、ページの始まりを記録するために全て調べるので、
+// 後ろの方のブロックを初めて参照するときは、その位置までの長さに比例した時間がかかる
+lazy_features *lazy_open(const char *filename, unsigned int merge_num, unsigned int cache_pages);
+void           lazy_close(lazy_features *ctx);
+// 前回までに記録したページの始まりの目印をキャッシュ(parse_cache)から読み込み、先頭から調べ直すのを省く
+// 開いた直後に呼ぶこと。読み込んだなら0を、有効なキャッシュが無ければ-1を返す
+int  lazy_load_marks(lazy_features *ctx, const char *filename);
+// 記録したページの始まりの目印をキャッシュに書き出す。成功したか、新たに記録した目印が無ければ0を返す
+int  lazy_store_marks(lazy_features *ctx, const char *filename);
+// i番目のブロックの特徴データを求める。求めたなら1を、ブロックが無ければ0を、失敗したなら-1を返す
+int  feature_at_block(lazy_features *ctx, uint64_t i, feature *out);
+// 時間がt0以上t1以下のブロックを探し、最初のブロックの番号をfirstに、数をcountに格納する
+// 特徴データは、outに先頭から最大max個まで格納する(outがNULLなら格納しない)
+int  features_in_range(lazy_features *ctx, double t0, double t1, feature *out, size_t max, uint64_t *first, uint64_t *count);
+// ブロックの総数を求める(入力ファイルを最後まで調べる)
+int  lazy_block_count(lazy_features *ctx, uint64_t *count);
@@ -0,0 +1,160 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_input.h"
+
+#define LINE_BUF_SIZE  512  // 1行の最大の長さ(read_csv()と同じ。超えた分は読み捨てる)
+
+
+static int next_line(mapped_input *mi, char *buf, size_t size);
+static int map_window(mapped_input *mi, uint64_t offset);
+
+
+
+
+/*!
+ * 入力ファイルを開く
+ * ファイル全体ではなく、windowバイトの窓を順にマップするので、
+ * アドレス空間やメモリに収まらない大きさのファイルも読める
+ * @param [out] mi       読み取りの状態(使い終わったらmapped_input_close()で閉じる)
+ * @param [in]  filename 入力ファイル名
+ * @param [in]  window   一度にマップするバイト数
+ * @return 成功したなら0を、開けなかったなら-1を返す(エラーメッセージは標準エラー出力に表示する)
+ */
+int mapped_input_open(mapped_input *mi, const char *filename, size_t window) {
+  size_t      page = (size_t)sysconf(_SC_PAGESIZE);
+  struct stat st;
+
+  memset(mi, 0, sizeof(*mi));
+  mi->filename = filename;
+  mi->window   = (window + page - 1) / page * page;
+  if (mi->window == 0) mi->window = page;
+  mi->fd = open(filename, O_RDONLY);
+  if (mi->fd < 0) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    return -1;
+  }
+  if (fstat(mi->fd, &st) != 0) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    close(mi->fd);
+    return -1;
+  }
+  mi->file_size = (uint64_t)st.st_size;
+  posix_fadvise(mi->fd, 0, 0, POSIX_FADV_SEQUENTIAL);  // カーネルの先読みの幅を広げる
+  return 0;
+}
+
+
+/*!
+ * 次の有効なフレームを読む(無効な行はread_csv()と同じく無視して、行番号を表示する)
+ * @param [in,out] mi    読み取りの状態
+ * @param [out]    frame 読んだフレーム
+ * @return 読んだなら1を、ファイルの終わりなら0を、マップに失敗したなら-1を返す
+ */
+int mapped_input_next(mapped_input *mi, data_fmt *frame) {
+  char buf[LINE_BUF_SIZE];
+  int  ret;
+
+  while ((ret = next_line(mi, buf, sizeof(buf))) == 1) {
+    mi->line_no++;
+    if (parse_data_line(buf, frame)) return 1;
+    fprintf(stderr, "Invalid format data at line %" PRIu64 " ... ignored!\n", mi->line_no);
+  }
+  return ret;
+}
+
+
+/*!
+ * 入力ファイルを閉じる
+ * @param [in,out] mi 読み取りの状態
+ */
+void mapped_input_close(mapped_input *mi) {
+  if (mi->map != NULL) {
+    munmap(mi->map, mi->map_len);
+    posix_fadvise(mi->fd, (off_t)mi->offset, (off_t)mi->map_len, POSIX_FADV_DONTNEED);
+  }
+  if (mi->fd >= 0) close(mi->fd);
+  mi->map = NULL;
+  mi->fd  = -1;
+}
+
+
+
+
+/*!
+ * 次の1行をbufに取り出す(改行は含めない)
+ * 窓の境界をまたぐ行は、次の窓をマップしてから続きを連結する
+ * @param [in,out] mi   読み取りの状態
+ * @param [out]    buf  行を格納するバッファ(size - 1バイトを超える分は読み捨てる)
+ * @param [in]     size bufのバイト数
+ * @return 取り出したなら1を、ファイルの終わりなら0を、マップに失敗したなら-1を返す
+ */
+static int next_line(mapped_input *mi, char *buf, size_t size) {
+  size_t n = 0;
+  int    got = 0;  // 行の一部でも取り出したかどうか(最後の行に改行が無い場合)
+
+  for (;;) {
+    const char *p, *nl;
+    size_t      rest, take, copy;
+
+    if (mi->map == NULL || mi->pos == mi->map_len) {
+      uint64_t next = mi->map == NULL ? 0 : mi->offset + mi->map_len;
+      if (next >= mi->file_size) return got;
+      if (map_window(mi, next) != 0) return -1;
+    }
+    p    = mi->map + mi->pos;
+    rest = mi->map_len - mi->pos;
+    nl   = (const char *)memchr(p, '\n', rest);
+    take = nl != NULL ? (size_t)(nl - p) : rest;
+    copy = take < size - 1 - n ? take : size - 1 - n;
+    memcpy(buf + n, p, copy);
+    n       += copy;
+    buf[n]   = '\0';
+    got      = 1;
+    mi->pos += take;
+    if (nl != NULL) {
+      mi->pos++;  // 改行を読み飛ばす
+      return 1;
+    }
+  }
+}
+
+
+/*!
+ * 読み終えた窓を外し、offsetから始まる窓をマップする
+ * 読み終えた窓のページはもう読まないので、ページキャッシュから追い出して、
+ * 入力の大きさによらずメモリの使用量を一定に保つ
+ * マップした窓の次の窓は、読み始める前に先読みを要求しておく
+ * @param [in,out] mi     読み取りの状態
+ * @param [in]     offset マップする窓の、ファイルの先頭からの位置(ページサイズの倍数)
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int map_window(mapped_input *mi, uint64_t offset) {
+  uint64_t next;
+
+  if (mi->map != NULL) {
+    munmap(mi->map, mi->map_len);
+    posix_fadvise(mi->fd, (off_t)mi->offset, (off_t)mi->map_len, POSIX_FADV_DONTNEED);
+    mi->map = NULL;
+  }
+  mi->offset  = offset;
+  mi->pos     = 0;
+  mi->map_len = mi->file_size - offset < mi->window ? (size_t)(mi->file_size - offset) : mi->window;
+  mi->map     = (char *)mmap(NULL, mi->map_len, PROT_READ, MAP_PRIVATE, mi->fd, (off_t)offset);
+  if (mi->map == MAP_FAILED) {
+    mi->map = NULL;
+    fprintf(stderr, "ファイル:%sをマップできません\n", mi->filename);
+    return -1;
+  }
+  madvise(mi->map, mi->map_len, MADV_SEQUENTIAL);
+  next = offset + mi->map_len;
+  if (next < mi->file_size) {
+    posix_fadvise(mi->fd, (off_t)next, (off_t)(mi->file_size - next < mi->window ? mi->file_size - next : mi->window),
+                  POSIX_FADV_WILLNEED);
+  }
+  return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "data_handler.h"
+
+#define MAPPED_WINDOW  (64u << 20)  // 一度にマップする窓のデフォルトのバイト数
+
+
+// 入力ファイルを、窓ごとにmmapしながら先頭から読む状態
+typedef struct {
+  const char *filename;   // エラーメッセージに用いるファイル名
+  int         fd;         // 入力ファイルのディスクリプタ
+  uint64_t    file_size;  // 入力ファイルのバイト数
+  uint64_t    offset;     // マップしている窓の、ファイルの先頭からの位置
+  char       *map;        // マップしている窓(NULLなら、まだマップしていない)
+  size_t      map_len;    // マップしている窓のバイト数
+  size_t      pos;        // 窓の中の、次に読む位置
+  size_t      window;     // 窓のバイト数(ページサイズの倍数)
+  uint64_t    line_no;    // 読み取った行番号
+} mapped_input;
+
+
+// 入力ファイルを開く(windowは、ページサイズの倍数に切り上げる)
+int  mapped_input_open(mapped_input *mi, const char *filename, size_t window);
+// 次の有効なフレームを読む。読んだなら1を、ファイルの終わりなら0を、失敗したなら-1を返す
+// 窓を読み終えるたびに、次の窓の先読みを要求し、読み終えた窓はページキャッシュから追い出す
+int  mapped_input_next(mapped_input *mi, data_fmt *frame);
+void mapped_input_close(mapped_input *mi);
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "archive.h"
+#include "decompress.h"
+#include "feature_stream.h"
+#include "merge.h"
+
+#define LINE_BUF_SIZE  512  // 読み込み用バッファの大きさ(read_csv()と同じ)
+
+
+// merge_features()で特徴データを加えていく配列
+typedef struct {
+  feature      *rows;  // 特徴データの配列
+  unsigned int  len;   // 特徴データの要素数
+  size_t        cap;   // 配列の容量
+} feature_array;
+
+
+static int  read_frame(merge_input *in);
+static int  input_before(const merge_input *a, const merge_input *b);
+static void sift_up(frame_merger *m, unsigned int i);
+static void sift_down(frame_merger *m, unsigned int i);
+static int  append_features(const feature *feature_datas, unsigned int len, uint64_t first_row, void *arg);
+
+
+
+
+/*!
+ * 入力ファイルを開き、それぞれの最初のフレームを読んでヒープに入れる
+ * 圧縮された入力ファイルは、読みながら展開する
+ * @param [out] m         併合の状態(使い終わったらmerger_close()で閉じる)
+ * @param [in]  filenames 入力ファイル名の配列
+ * @param [in]  n         入力ファイルの数(1以上MAX_MERGE_INPUTS以下)
+ * @param [in]  n_threads 圧縮された入力ファイルを展開するスレッド数
+ * @return 成功したなら0を、開けないか読み取れないファイル(圧縮アーカイブを含む)があったなら-1を返す
+ */
+int merger_open(frame_merger *m, char *const *filenames, unsigned int n, unsigned int n_threads) {
+  unsigned int i;
+  int          ret;
+
+  memset(m, 0, sizeof(*m));
+  for (i = 0; i < n; i++) {
+    merge_input *in = &m->inputs[i];
+    in->filename = filenames[i];
+    in->index    = i;
+    if (is_archive_file(filenames[i])) {  // アーカイブは行ごとに読めない(テキストとして解析すると、全ての行が無効になる)
+      fprintf(stderr, "ファイル:%sは圧縮アーカイブなので、併合できません\n", filenames[i]);
+      merger_close(m);
+      return -1;
+    }
+    in->f        = open_input(filenames[i], n_threads);
+    if (in->f == NULL) {
+      merger_close(m);
+      return -1;
+    }
+    m->n_inputs++;
+    ret = read_frame(in);
+    if (ret < 0) {
+      merger_close(m);
+      return -1;
+    }
+    if (ret == 1) {
+      m->heap[m->n_heap] = in;
+      sift_up(m, m->n_heap++);
+    }
+  }
+  return 0;
+}
+
+
+/*!
+ * 時間が最も早いフレームを取り出し、そのフレームの入力から次のフレームを読む
+ * 各入力の中ではフレームが時間の昇順に並んでいる必要がある
+ * (並んでいなければ、併合した結果が昇順にならないので、エラーとする)
+ * @param [in,out] m     併合の状態
+ * @param [out]    frame 取り出したフレーム
+ * @return 取り出したなら1を、全て読み終えたなら0を、時間の列が昇順でないか読み取れない入力があったなら-1を返す
+ */
+int merger_next(frame_merger *m, data_fmt *frame) {
+  merge_input *top;
+  int          ret;
+
+  if (m->n_heap == 0) return 0;
+  top    = m->heap[0];
+  *frame = top->frame;
+  ret = read_frame(top);
+  if (ret < 0) return -1;
+  if (ret == 1) {
+    if (top->frame.time < frame->time) {
+      fprintf(stderr, "ファイル:%sの%u行目で時間が戻っているので、併合できません\n", top->filename, top->line_no);
+      return -1;
+    }
+  } else {
+    m->heap[0] = m->heap[--m->n_heap];  // 読み終えた入力はヒープから除く
+  }
+  if (m->n_heap > 0) sift_down(m, 0);
+  return 1;
+}
+
+
+/*!
+ * 入力ファイルを閉じる
+ * @param [in,out] m 併合の状態
+ */
+void merger_close(frame_merger *m) {
+  unsigned int i;
+
+  for (i = 0; i < m->n_inputs; i++) {
+    if (m->inputs[i].f != NULL) fclose(m->inputs[i].f);
+    m->inputs[i].f = NULL;
+  }
+  m->n_heap = 0;
+}
+
+
+/*!
+ * 併合したフレームを、ダウンサンプリングしながら特徴データにする
+ * フレームはfeature_streamで1つずつ処理するので、併合したフレームを全て並べた配列に
+ * 対してdown_sample_features()を呼んだ場合と同じ結果になり、フレームの数はDEFAULT_LENに制限されない
+ * @param [in,out] m             併合の状態
+ * @param [in]     merge_num     ダウンサンプリングで結合するデータの数
+ * @param [in]     use_approx    平方根を近似計算するかどうか
+ * @param [out]    feature_datas 特徴データの配列(free()で解放する)
+ * @param [out]    len           特徴データの要素数
+ * @return 成功したなら0を、失敗したなら-1を返す(エラーメッセージは標準エラー出力に表示する)
+ */
+int merge_features(frame_merger *m, unsigned int merge_num, int use_approx, feature **feature_datas, unsigned int *len) {
+  feature_array  out = {NULL, 0, 0};
+  feature_stream fs;
+  data_fmt       frame;
+  int            ret;
+
+  if (feature_stream_init(&fs, merge_num, use_approx, append_features, &out) != 0) goto nomem;
+  while ((ret = merger_next(m, &frame)) == 1) {
+    if (feature_stream_push(&fs, &frame) != 0) goto nomem;
+  }
+  if (ret < 0) {
+    feature_stream_destroy(&fs);
+    free(out.rows);
+    return -1;
+  }
+  if (feature_stream_finish(&fs) != 0) goto nomem;
+
+  feature_stream_destroy(&fs);
+  *feature_datas = out.rows;
+  *len           = out.len;
+  return 0;
+
+nomem:
+  fputs("メモリ確保に失敗しました\n", stderr);
+  feature_stream_destroy(&fs);
+  free(out.rows);
+  return -1;
+}
+
+
+
+
+/*!
+ * 入力から、次の有効なフレームを読む(無効な行はread_csv()と同じく無視して、行番号を表示する)
+ * @param [in,out] in 入力ファイルの読み取り位置
+ * @return 読んだなら1を、ファイルの終わりなら0を、読み取りに失敗したなら-1を返す
+ */
+static int read_frame(merge_input *in) {
+  char buf[LINE_BUF_SIZE];
+
+  while (fgets(buf, sizeof(buf), in->f) != NULL) {
+    in->line_no++;
+    if (parse_data_line(buf, &in->frame)) return 1;
+    fprintf(stderr, "Invalid format data at %s line %u ... ignored!\n", in->filename, in->line_no);
+  }
+  if (ferror(in->f)) {  // 圧縮データの展開に失敗したときなど
+    fprintf(stderr, "ファイル:%sの読み取りに失敗しました\n", in->filename);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 入力aの次のフレームを、入力bの次のフレームより先に併合するかどうか
+ * @param [in] a 入力
+ * @param [in] b 入力
+ * @return 時間が早いか、時間が同じで先に指定した入力なら1を、それ以外なら0を返す
+ */
+static int input_before(const merge_input *a, const merge_input *b) {
+  if (a->frame.time != b->frame.time) return a->frame.time < b->frame.time;
+  return a->index < b->index;
+}
+
+
+/*!
+ * ヒープのi番目の要素を、親より先にならなくなるまで上げる
+ * @param [in,out] m 併合の状態
+ * @param [in]     i 要素の位置
+ */
+static void sift_up(frame_merger *m, unsigned int i) {
+  while (i > 0) {
+    unsigned int  parent = (i - 1) / 2;
+    merge_input  *tmp;
+    if (!input_before(m->heap[i], m->heap[parent])) break;
+    tmp = m->heap[i]; m->heap[i] = m->heap[parent]; m->heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+
+/*!
+ * ヒープのi番目の要素を、子より後にならなくなるまで下げる
+ * @param [in,out] m 併合の状態
+ * @param [in]     i 要素の位置
+ */
+static void sift_down(frame_merger *m, unsigned int i) {
+  for (;;) {
+    unsigned int  first = i;
+    unsigned int  left  = 2 * i + 1, right = 2 * i + 2;
+    merge_input  *tmp;
+    if (left  < m->n_heap && input_before(m->heap[left],  m->heap[first])) first = left;
+    if (right < m->n_heap && input_before(m->heap[right], m->heap[first])) first = right;
+    if (first == i) break;
+    tmp = m->heap[i]; m->heap[i] = m->heap[first]; m->heap[first] = tmp;
+    i = first;
+  }
+}
+
+
+/*!
+ * ストリームから受け取った特徴データを、配列の末尾に加える(feature_streamのsink)
+ * @param [in]     feature_datas 特徴データ
+ * @param [in]     len           特徴データの要素数
+ * @param [in]     first_row     feature_datas[0]の行番号(未使用)
+ * @param [in,out] arg           加える配列(feature_array。足りなければ拡張する)
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+static int append_features(const feature *feature_datas, unsigned int len, uint64_t first_row, void *arg) {
+  feature_array *out = (feature_array *)arg;
+  (void)first_row;
+
+  if (out->len + (size_t)len > out->cap) {
+    size_t   new_cap = out->cap == 0 ? STREAM_CHUNK : out->cap * 2;
+    feature *grown   = (feature *)realloc(out->rows, sizeof(feature) * new_cap);
+    if (grown == NULL) return -1;
+    out->rows = grown;
+    out->cap  = new_cap;
+  }
+  memcpy(out->rows + out->len, feature_datas, sizeof(feature) * len);
+  out->len += len;
+  return 0;
+}
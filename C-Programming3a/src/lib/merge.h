@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdio.h>
+#include "data_handler.h"
+
+#define MAX_MERGE_INPUTS  16  // 併合できる入力ファイルの数の上限
+
+
+// 1つの入力ファイルの読み取り位置
+typedef struct {
+  FILE         *f;         // 入力ファイルのファイルポインタ
+  const char   *filename;  // エラーメッセージに用いるファイル名
+  data_fmt      frame;     // 次に併合するフレーム
+  unsigned int  line_no;   // 読み取った行番号
+  unsigned int  index;     // 入力の順番(時間が同じフレームは、先に指定した入力から併合する)
+} merge_input;
+
+// 複数の入力ファイルを、時間の列の順に併合する状態
+typedef struct {
+  merge_input   inputs[MAX_MERGE_INPUTS];
+  merge_input  *heap[MAX_MERGE_INPUTS];  // 次のフレームの時間の最小ヒープ(読み終えた入力は除く)
+  unsigned int  n_inputs;                // 入力ファイルの数
+  unsigned int  n_heap;                  // ヒープにある入力の数
+} frame_merger;
+
+
+// 入力ファイルを開き(圧縮されていれば展開しながら読む)、それぞれの最初のフレームを読んでおく
+int  merger_open(frame_merger *m, char *const *filenames, unsigned int n, unsigned int n_threads);
+// 時間が最も早いフレームを取り出す。取り出したなら1を、全て読み終えたなら0を、
+// ある入力の時間の列が昇順でなければ-1を返す
+int  merger_next(frame_merger *m, data_fmt *frame);
+void merger_close(frame_merger *m);
+// 併合したフレームを、merge_num個ずつダウンサンプリングしながら特徴データにする
+// (入力を配列に読み込まずに、merge_num個分のフレームと特徴データの配列だけで処理する)
+int  merge_features(frame_merger *m, unsigned int merge_num, int use_approx, feature **feature_datas, unsigned int *len);
@@ -0,0 +1,91 @@
+#define _GNU_SOURCE  // sched_setaffinity, cpu_set_t
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "numa.h"
+
+#define NODE_DIR       "/sys/devices/system/node"
+#define LIST_BUF_SIZE  4096  // sysfsの番号の列の最大の長さ
+
+
+static int read_list(const char *path, cpu_set_t *set);
+
+
+
+
+/*!
+ * CPUを持つNUMAノードの数を返す
+ * libnumaに依存しないように、sysfsの一覧を直接読む
+ * @return ノードの数(sysfsから読めない環境では1)
+ */
+unsigned int numa_node_count(void) {
+  cpu_set_t nodes;  // ノード番号の集合(CPUの集合の型を流用する)
+  int       n;
+
+  if (read_list(NODE_DIR "/has_cpu", &nodes) != 0) return 1;
+  n = CPU_COUNT(&nodes);
+  return n > 0 ? (unsigned int)n : 1;
+}
+
+
+/*!
+ * 呼び出したスレッドを、index番目のNUMAノードのCPUに固定する
+ * Linuxのファーストタッチの方針により、以降にこのスレッドが初めて書き込んだページは
+ * このノードのメモリに置かれ、スレッドが他のノードに移されることもない
+ * @param [in] index ノードの順番(0 ~ numa_node_count()-1)
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+int numa_bind_node(unsigned int index) {
+  cpu_set_t nodes;
+  cpu_set_t cpus;
+  char      path[64];
+  int       node;
+
+  if (read_list(NODE_DIR "/has_cpu", &nodes) != 0) return -1;
+  for (node = 0; node < CPU_SETSIZE; node++) {
+    if (CPU_ISSET(node, &nodes) && index-- == 0) break;
+  }
+  if (node == CPU_SETSIZE) return -1;
+  snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", node);
+  if (read_list(path, &cpus) != 0 || CPU_COUNT(&cpus) == 0) return -1;
+  return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? 0 : -1;
+}
+
+
+
+
+/*!
+ * sysfsの番号の列("0-3,8-11"の形式)を読み、集合にする
+ * @param [in]  path ファイル名
+ * @param [out] set  番号の集合
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int read_list(const char *path, cpu_set_t *set) {
+  char  buf[LIST_BUF_SIZE];
+  char *p = buf;
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) return -1;
+  if (fgets(buf, sizeof(buf), f) == NULL) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  CPU_ZERO(set);
+  while (*p != '\0' && *p != '\n') {
+    char *end;
+    long  lo = strtol(p, &end, 10);
+    long  hi = lo;
+    if (end == p) return -1;
+    if (*end == '-') {
+      p  = end + 1;
+      hi = strtol(p, &end, 10);
+      if (end == p) return -1;
+    }
+    if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return -1;
+    for (; lo <= hi; lo++) CPU_SET(lo, set);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+
+// オンラインのNUMAノードの数を返す(sysfsから読めなければ1)
+unsigned int numa_node_count(void);
+// 呼び出したスレッドを、index番目のNUMAノードのCPUでだけ動くようにする
+// (以降にそのスレッドが初めて書き込んだページは、そのノードのメモリに置かれる)
+int numa_bind_node(unsigned int index);
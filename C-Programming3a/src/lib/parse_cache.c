@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "data_handler.h"
+#include "fixed_point.h"
+#include "lazy_features.h"
+#include "parse_cache.h"
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE  0
+#endif
+
+#define CACHE_MAGIC         "G3PC"  // キャッシュファイルの先頭の4バイト
+#define CACHE_VERSION            3  // キャッシュのフォーマットのバージョン(解析の仕様を変えたら上げること。3: 8192行で切り捨てていた版のキャッシュを無効にする)
+#define CACHE_DIR_NAME   "group03"  // キャッシュディレクトリの名前
+#define CACHE_ALIGN             64  // 配列の先頭のアライメント
+#define ROUND_UP(n, align)  (((n) + (align) - 1) / (align) * (align))
+
+
+// キャッシュファイルのヘッダ
+// 同じホストでのみ読み書きするので、ホストのバイトオーダーのまま格納する
+// ヘッダの後に入力ファイルの絶対パスが続き、data_offsetバイト目から配列が始まる
+typedef struct {
+  char     magic[4];     // CACHE_MAGIC
+  uint32_t version;      // CACHE_VERSION
+  uint32_t kind;         // PARSE_CACHE_xxx
+  uint32_t param;        // 種類ごとの付加情報(PARSE_CACHE_MARKSなら結合するデータの数)
+  uint32_t elem_size;    // 配列の要素のバイト数
+  uint64_t dev;          // 入力ファイルのデバイス番号
+  uint64_t ino;          // 入力ファイルのiノード番号
+  uint64_t size;         // 入力ファイルのバイト数
+  int64_t  mtime_sec;    // 入力ファイルの更新時刻(秒)
+  int64_t  mtime_nsec;   // 入力ファイルの更新時刻(ナノ秒)
+  uint64_t len;          // 配列の要素数
+  uint32_t path_len;     // 入力ファイルの絶対パスのバイト数
+  uint32_t data_offset;  // 配列の先頭のオフセット
+} cache_header;
+
+
+static int      cache_path(char *path, size_t n, const char *real_path, int kind, unsigned int param, int create_dir);
+static int      beside_path(char *path, size_t n, const char *real_path, int kind, unsigned int param);
+static int      kind_suffix(char *suffix, size_t n, int kind, unsigned int param);
+static size_t   elem_size_of(int kind);
+static void     fill_identity(cache_header *h, const struct stat *st);
+static uint64_t hash_path(const char *s);
+static int      store_to(const char *path, const cache_header *h, const char *real_path, const void *datas);
+
+
+
+
+/*!
+ * キャッシュファイルをmmapし、解析結果の配列を得る
+ * @param [out] pc       マップしたキャッシュ(使い終わったらparse_cache_release()で解放する)
+ * @param [in]  filename 入力ファイル名
+ * @param [in]  kind     配列の種類(PARSE_CACHE_xxx)
+ * @param [in]  param    種類ごとの付加情報(PARSE_CACHE_MARKSなら結合するデータの数、他は0)
+ * @param [out] len      配列の要素数
+ * @return 配列の先頭へのポインタ(読み取り専用)。有効なキャッシュが無ければNULLを返す
+ */
+const void *parse_cache_load(parse_cache *pc, const char *filename, int kind, unsigned int param, unsigned int *len) {
+  char                real_path[PATH_MAX];
+  char                path[PATH_MAX];
+  struct stat         st, cache_st;
+  cache_header        key;
+  const cache_header *h;
+  int                 i, fd;
+
+  pc->map      = NULL;
+  pc->map_size = 0;
+  if (realpath(filename, real_path) == NULL || stat(real_path, &st) != 0) return NULL;
+  fill_identity(&key, &st);
+
+  // キャッシュディレクトリ、入力ファイルの隣の順に探す
+  for (i = 0; i < 2; i++) {
+    if ((i == 0 ? cache_path(path, sizeof(path), real_path, kind, param, 0) : beside_path(path, sizeof(path), real_path, kind, param)) != 0) continue;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) continue;
+    if (fstat(fd, &cache_st) != 0 || (size_t)cache_st.st_size < sizeof(cache_header)) {
+      close(fd);
+      continue;
+    }
+    pc->map_size = (size_t)cache_st.st_size;
+    pc->map      = mmap(NULL, pc->map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (pc->map == MAP_FAILED) {
+      pc->map = NULL;
+      continue;
+    }
+
+    h = (const cache_header *)pc->map;
+    if (memcmp(h->magic, CACHE_MAGIC, 4) == 0 && h->version == CACHE_VERSION &&
+        h->kind == (uint32_t)kind && h->param == param && h->elem_size == elem_size_of(kind) &&
+        h->dev == key.dev && h->ino == key.ino && h->size == key.size &&
+        h->mtime_sec == key.mtime_sec && h->mtime_nsec == key.mtime_nsec &&
+        h->len <= UINT_MAX && h->path_len == strlen(real_path) &&
+        sizeof(cache_header) + h->path_len <= h->data_offset &&
+        h->data_offset + h->len * h->elem_size == pc->map_size &&
+        memcmp((const char *)(h + 1), real_path, h->path_len) == 0) {
+      *len = (unsigned int)h->len;
+      return (const char *)pc->map + h->data_offset;
+    }
+    parse_cache_release(pc);  // 古いキャッシュ、もしくはハッシュが衝突した別のファイルのキャッシュ
+  }
+  return NULL;
+}
+
+
+/*!
+ * 解析結果の配列をキャッシュファイルに書き出す
+ * 一時ファイルに書き出してからrenameするので、書き出し中のキャッシュを他のプロセスが
+ * 読むことはない
+ * @param [in] filename 入力ファイル名
+ * @param [in] kind     配列の種類(PARSE_CACHE_xxx)
+ * @param [in] param    種類ごとの付加情報(PARSE_CACHE_MARKSなら結合するデータの数、他は0)
+ * @param [in] datas    配列
+ * @param [in] len      配列の要素数
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+int parse_cache_store(const char *filename, int kind, unsigned int param, const void *datas, unsigned int len) {
+  char         real_path[PATH_MAX];
+  char         path[PATH_MAX];
+  struct stat  st;
+  cache_header h;
+
+  if (realpath(filename, real_path) == NULL || stat(real_path, &st) != 0) return -1;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CACHE_MAGIC, 4);
+  h.version     = CACHE_VERSION;
+  h.kind        = (uint32_t)kind;
+  h.param       = (uint32_t)param;
+  h.elem_size   = (uint32_t)elem_size_of(kind);
+  h.len         = len;
+  h.path_len    = (uint32_t)strlen(real_path);
+  h.data_offset = (uint32_t)ROUND_UP(sizeof(cache_header) + h.path_len, CACHE_ALIGN);
+  fill_identity(&h, &st);
+
+  if (cache_path(path, sizeof(path), real_path, kind, param, 1) == 0 && store_to(path, &h, real_path, datas) == 0) return 0;
+  if (beside_path(path, sizeof(path), real_path, kind, param) == 0 && store_to(path, &h, real_path, datas) == 0) return 0;
+  return -1;
+}
+
+
+/*!
+ * parse_cache_load()でマップしたキャッシュを解放する
+ * @param [in,out] pc 解放するキャッシュ(キャッシュを用いていなければ何もしない)
+ */
+void parse_cache_release(parse_cache *pc) {
+  if (pc->map != NULL) munmap(pc->map, pc->map_size);
+  pc->map      = NULL;
+  pc->map_size = 0;
+}
+
+
+
+
+/*!
+ * キャッシュディレクトリ内のキャッシュファイルのパスを求める
+ * ファイル名は、入力ファイルの絶対パスのハッシュ値と配列の種類から作る
+ * @param [out] path       キャッシュファイルのパス
+ * @param [in]  n          pathのバイト数
+ * @param [in]  real_path  入力ファイルの絶対パス
+ * @param [in]  kind       配列の種類(PARSE_CACHE_xxx)
+ * @param [in]  param      種類ごとの付加情報
+ * @param [in]  create_dir キャッシュディレクトリが無ければ作成するかどうか
+ * @return 成功したなら0を、キャッシュディレクトリが使えないなら-1を返す
+ */
+static int cache_path(char *path, size_t n, const char *real_path, int kind, unsigned int param, int create_dir) {
+  const char *xdg  = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  char        base[PATH_MAX];
+  char        suffix[16];
+  int         ret;
+
+  // XDG Base Directory仕様に従い、相対パスの$XDG_CACHE_HOMEは無視する
+  if (xdg != NULL && xdg[0] == '/') {
+    ret = snprintf(base, sizeof(base), "%s", xdg);
+  } else if (home != NULL && home[0] != '\0') {
+    ret = snprintf(base, sizeof(base), "%s/.cache", home);
+  } else {
+    return -1;
+  }
+  if (ret < 0 || (size_t)ret >= sizeof(base)) return -1;
+
+  ret = snprintf(path, n, "%s/" CACHE_DIR_NAME, base);
+  if (ret < 0 || (size_t)ret >= n) return -1;
+  if (create_dir) {
+    if (mkdir(base, 0700) != 0 && errno != EEXIST) return -1;
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) return -1;
+  }
+
+  if (kind_suffix(suffix, sizeof(suffix), kind, param) != 0) return -1;
+  ret = snprintf(path, n, "%s/" CACHE_DIR_NAME "/%016llx.%s.g3pc", base, (unsigned long long)hash_path(real_path), suffix);
+  return ret < 0 || (size_t)ret >= n ? -1 : 0;
+}
+
+
+/*!
+ * 入力ファイルの隣に置くキャッシュファイルのパスを求める
+ * @param [out] path      キャッシュファイルのパス
+ * @param [in]  n         pathのバイト数
+ * @param [in]  real_path 入力ファイルの絶対パス
+ * @param [in]  kind      配列の種類(PARSE_CACHE_xxx)
+ * @param [in]  param     種類ごとの付加情報
+ * @return 成功したなら0を、パスが長すぎるなら-1を返す
+ */
+static int beside_path(char *path, size_t n, const char *real_path, int kind, unsigned int param) {
+  char suffix[16];
+  int  ret;
+
+  if (kind_suffix(suffix, sizeof(suffix), kind, param) != 0) return -1;
+  ret = snprintf(path, n, "%s.%s.g3pc", real_path, suffix);
+  return ret < 0 || (size_t)ret >= n ? -1 : 0;
+}
+
+
+/*!
+ * キャッシュファイル名の、配列の種類を表す部分を求める
+ * ページの始まりの目印は結合するデータの数ごとに異なるので、別のファイルにする("p30"など)
+ * @param [out] suffix 配列の種類を表す文字列
+ * @param [in]  n      suffixのバイト数
+ * @param [in]  kind   配列の種類(PARSE_CACHE_xxx)
+ * @param [in]  param  種類ごとの付加情報
+ * @return 成功したなら0を、suffixに収まらないなら-1を返す
+ */
+static int kind_suffix(char *suffix, size_t n, int kind, unsigned int param) {
+  int ret;
+
+  if (kind == PARSE_CACHE_MARKS) {
+    ret = snprintf(suffix, n, "p%u", param);
+  } else {
+    ret = snprintf(suffix, n, "%c", kind == PARSE_CACHE_FIXED ? 'x' : 'd');
+  }
+  return ret < 0 || (size_t)ret >= n ? -1 : 0;
+}
+
+
+/*!
+ * 配列の要素のバイト数を返す
+ * @param [in] kind 配列の種類(PARSE_CACHE_xxx)
+ * @return 要素のバイト数
+ */
+static size_t elem_size_of(int kind) {
+  if (kind == PARSE_CACHE_MARKS) return sizeof(page_mark);
+  return kind == PARSE_CACHE_FIXED ? sizeof(fixed_fmt) : sizeof(data_fmt);
+}
+
+
+/*!
+ * 入力ファイルを識別する情報(デバイス, iノード, サイズ, 更新時刻)をヘッダに設定する
+ * @param [out] h  設定するヘッダ
+ * @param [in]  st 入力ファイルの情報
+ */
+static void fill_identity(cache_header *h, const struct stat *st) {
+  h->dev        = (uint64_t)st->st_dev;
+  h->ino        = (uint64_t)st->st_ino;
+  h->size       = (uint64_t)st->st_size;
+  h->mtime_sec  = (int64_t)st->st_mtim.tv_sec;
+  h->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+}
+
+
+/*!
+ * パスのハッシュ値(FNV-1a)を求める
+ * @param [in] s パス
+ * @return ハッシュ値
+ */
+static uint64_t hash_path(const char *s) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *s != '\0'; s++) {
+    h ^= (unsigned char)*s;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+
+/*!
+ * キャッシュファイルを書き出す(一時ファイルに書き出してからrenameする)
+ * @param [in] path      キャッシュファイルのパス
+ * @param [in] h         ヘッダ
+ * @param [in] real_path 入力ファイルの絶対パス
+ * @param [in] datas     配列
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+static int store_to(const char *path, const cache_header *h, const char *real_path, const void *datas) {
+  static const char pad[CACHE_ALIGN] = {0};
+  char  tmp_path[PATH_MAX];
+  FILE *f;
+  int   fd, ok;
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path)) return -1;
+  fd = mkstemp(tmp_path);
+  if (fd < 0) return -1;
+  f = fdopen(fd, "wb");
+  if (f == NULL) {
+    close(fd);
+    unlink(tmp_path);
+    return -1;
+  }
+  ok = fwrite(h, sizeof(*h), 1, f) == 1 &&
+       fwrite(real_path, 1, h->path_len, f) == h->path_len &&
+       fwrite(pad, 1, h->data_offset - sizeof(*h) - h->path_len, f) == h->data_offset - sizeof(*h) - h->path_len &&
+       fwrite(datas, h->elem_size, (size_t)h->len, f) == (size_t)h->len;
+  if (fclose(f) != 0 || !ok || rename(tmp_path, path) != 0) {
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+
+#define PARSE_CACHE_DOUBLE  0  // data_fmtの配列のキャッシュ
+#define PARSE_CACHE_FIXED   1  // fixed_fmtの配列のキャッシュ(-xオプション)
+#define PARSE_CACHE_MARKS   2  // lazy_featuresのページの始まりの目印(page_mark)の配列のキャッシュ(--rangeオプション)
+
+
+// mmapしたキャッシュファイル
+typedef struct {
+  void   *map;       // マップした領域の先頭(キャッシュを用いていなければNULL)
+  size_t  map_size;  // マップした領域のバイト数
+} parse_cache;
+
+
+// 入力ファイルを解析した結果の配列を、バイナリ形式でディスクにキャッシュする
+// キャッシュは$XDG_CACHE_HOME/group03/(無ければ~/.cache/group03/、どちらも使えなけ
+// れば入力ファイルの隣)に置き、入力ファイルのパス、サイズ、更新時刻、iノードと
+// paramをキーとする。いずれかが変われば、キャッシュは無効となる
+// (paramは種類ごとの付加情報。PARSE_CACHE_MARKSなら結合するデータの数で、他は0)
+const void *parse_cache_load(parse_cache *pc, const char *filename, int kind, unsigned int param, unsigned int *len);
+int parse_cache_store(const char *filename, int kind, unsigned int param, const void *datas, unsigned int len);
+void parse_cache_release(parse_cache *pc);
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data_handler.h"
+#include "fixed_point.h"
+#include "partition.h"
+#include "thread_pool.h"
+
+
+// 1つの部分の処理
+typedef struct {
+  const data_fmt  *datas;          // 写す元の入力データ(固定小数点数で処理するならNULL)
+  const fixed_fmt *fixed_datas;    // 写す元の固定小数点数の入力データ(datasを用いるならNULL)
+  data_fmt        *placed;         // 入力データの写す先
+  fixed_fmt       *fixed_placed;   // 固定小数点数の入力データの写す先
+  unsigned int     len;            // 部分の入力データ数
+  unsigned int     merge_num;      // 1ブロックの行数
+  feature         *feature_datas;  // 部分の特徴データの出力先
+  int              use_approx;     // 近似計算を用いるかどうか
+} partition_task;
+
+
+static void run_partition(void *arg, unsigned int worker_id);
+static void join_partition(feature *f, const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int len,
+                           unsigned int merge_num, int use_approx);
+
+
+
+
+/*!
+ * 入力を部分に分け、部分ごとに入力を写してから特徴データを求める
+ * 各部分の最初のブロックは、部分の中では先頭となるので、重心位置の変化だけを最後に
+ * 直前のブロックから求め直す
+ * @param [out] feature_datas 特徴データを格納する配列
+ * @param [out] placed        入力データの写す先(固定小数点数で処理するならNULL)
+ * @param [out] fixed_placed  固定小数点数の入力データの写す先(placedを用いるならNULL)
+ * @param [in]  datas         入力データ(固定小数点数で処理するならNULL)
+ * @param [in]  fixed_datas   固定小数点数の入力データ(datasを用いるならNULL)
+ * @param [in]  len           入力データ数
+ * @param [in]  merge_num     1ブロックの行数
+ * @param [in]  use_approx    平方根を近似計算するかどうか
+ * @param [in]  n_threads     ワーカスレッド数(部分の数)
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int down_sample_features_partitioned(feature *feature_datas, data_fmt *placed, fixed_fmt *fixed_placed,
+    const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int len, unsigned int merge_num,
+    int use_approx, unsigned int n_threads) {
+  unsigned int    n_blocks = len / merge_num + (len % merge_num != 0);
+  unsigned int    n_parts  = n_threads < n_blocks ? n_threads : n_blocks;
+  unsigned int    per_part, i;
+  partition_task *tasks;
+  thread_pool    *pool = NULL;
+
+  if (n_parts == 0) return 0;
+  per_part = n_blocks / n_parts + (n_blocks % n_parts != 0);  // 1つの部分のブロック数
+  n_parts  = n_blocks / per_part + (n_blocks % per_part != 0);
+  tasks = (partition_task *)malloc(sizeof(partition_task) * n_parts);
+  if (tasks == NULL) return -1;
+  for (i = 0; i < n_parts; i++) {
+    partition_task *t     = &tasks[i];
+    size_t          first = (size_t)i * per_part * merge_num;  // 部分の最初の行
+
+    t->datas         = datas        != NULL ? datas + first        : NULL;
+    t->fixed_datas   = fixed_datas  != NULL ? fixed_datas + first  : NULL;
+    t->placed        = placed       != NULL ? placed + first       : NULL;
+    t->fixed_placed  = fixed_placed != NULL ? fixed_placed + first : NULL;
+    t->len           = (unsigned int)(len - first < (size_t)per_part * merge_num ? len - first : (size_t)per_part * merge_num);
+    t->merge_num     = merge_num;
+    t->feature_datas = feature_datas + (size_t)i * per_part;
+    t->use_approx    = use_approx;
+  }
+
+  if (n_parts > 1) pool = thread_pool_create(n_threads);  // 作れなくても、このスレッドで順に処理する
+  for (i = 0; i < n_parts; i++) {
+    if (pool == NULL || thread_pool_submit(pool, run_partition, &tasks[i]) != 0) {
+      run_partition(&tasks[i], 0);
+    }
+  }
+  if (pool != NULL) {
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+  }
+
+  // 部分の境目のブロックの重心位置の変化を、直前のブロックとの間で求め直す
+  for (i = 1; i < n_parts; i++) {
+    size_t prev = ((size_t)i * per_part - 1) * merge_num;  // 直前のブロックの最初の行
+    join_partition(tasks[i].feature_datas,
+        placed != NULL ? placed + prev : NULL, fixed_placed != NULL ? fixed_placed + prev : NULL,
+        (unsigned int)(len - prev < (size_t)merge_num * 2 ? len - prev : (size_t)merge_num * 2), merge_num, use_approx);
+  }
+  free(tasks);
+  return 0;
+}
+
+
+
+
+/*!
+ * 1つの部分の入力データを写し、その部分の特徴データを求める(スレッドプールのタスク)
+ * 写す先と特徴データのページは、ここで初めて書き込まれるので、このスレッドのノードに置かれる
+ * @param [in] arg       partition_task
+ * @param [in] worker_id ワーカスレッドの番号(未使用)
+ */
+static void run_partition(void *arg, unsigned int worker_id) {
+  partition_task *t = (partition_task *)arg;
+  (void)worker_id;
+
+  if (t->datas != NULL) {
+    memcpy(t->placed, t->datas, sizeof(data_fmt) * t->len);
+    if (t->use_approx) {
+      down_sample_features_approx(t->feature_datas, t->placed, t->len, t->merge_num);
+    } else {
+      down_sample_features(t->feature_datas, t->placed, t->len, t->merge_num);
+    }
+  } else {
+    memcpy(t->fixed_placed, t->fixed_datas, sizeof(fixed_fmt) * t->len);
+    if (t->use_approx) {
+      down_sample_features_fixed_approx(t->feature_datas, t->fixed_placed, t->len, t->merge_num);
+    } else {
+      down_sample_features_fixed(t->feature_datas, t->fixed_placed, t->len, t->merge_num);
+    }
+  }
+}
+
+
+/*!
+ * 部分の最初のブロックの重心位置の変化を、直前のブロックとの間で求め直す
+ * 2つのブロックを、特徴データを求めたときと同じ関数でダウンサンプリングするので、値は1度に処理した場合と同じになる
+ * @param [out] f           部分の最初のブロックの特徴データ
+ * @param [in]  datas       直前のブロックの最初のデータ(固定小数点数で処理するならNULL)
+ * @param [in]  fixed_datas 直前のブロックの最初の固定小数点数のデータ(datasを用いるならNULL)
+ * @param [in]  len         2つのブロックのデータ数
+ * @param [in]  merge_num   1ブロックの行数
+ * @param [in]  use_approx  平方根を近似計算するかどうか
+ */
+static void join_partition(feature *f, const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int len,
+                           unsigned int merge_num, int use_approx) {
+  data_fmt avg[2];
+  feature  pair[2];
+
+  if (datas != NULL) {
+    down_sample(avg, datas, len, merge_num);
+  } else {
+    down_sample_fixed(avg, fixed_datas, len, merge_num);
+  }
+  if (use_approx) {
+    position prev_cog_pos = {0.0, 0.0, 0.0};
+    derive_features_approx(pair, avg, 2, &prev_cog_pos, 1);
+  } else {
+    derive_features(pair, avg, 2);
+  }
+  f->cog_change = pair[1].cog_change;
+}
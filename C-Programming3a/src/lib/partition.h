@@ -0,0 +1,14 @@
+#pragma once
+
+#include "data_handler.h"
+#include "fixed_point.h"
+
+
+// 入力をブロックの区切りでn_threads個の部分に分け、部分ごとにワーカスレッドが
+// 入力をplacedまたはfixed_placedに写してから、その部分の特徴データを求める(--numaオプション)
+// 写す先と特徴データは、ARENA_FIRST_TOUCHのアリーナから確保しておけば、その部分を
+// 処理したスレッドのノードに置かれる。datasとfixed_datasは、どちらか一方(使わない方はNULL)を与える
+// 結果は、down_sample_features()などで入力全体を1度に処理した場合と同じになる
+int down_sample_features_partitioned(feature *feature_datas, data_fmt *placed, fixed_fmt *fixed_placed,
+    const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int len, unsigned int merge_num,
+    int use_approx, unsigned int n_threads);
@@ -0,0 +1,299 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pose_index.h"
+
+
+// 索引ファイルのヘッダ
+// ヘッダの直後からk-d木の順に並べたレコードが始まる
+typedef struct {
+  char     magic[4];     // POSE_INDEX_MAGIC
+  uint32_t version;      // POSE_INDEX_VERSION
+  uint32_t record_size;  // レコードのバイト数(sizeof(pose_record))
+  uint32_t reserved;     // 0
+  uint64_t len;          // レコードの数
+} pose_index_header;
+
+
+static void   build_range(pose_record *records, size_t lo, size_t hi);
+static void   select_nth(pose_record *records, size_t lo, size_t hi, size_t nth, unsigned int axis);
+static size_t radius_range(const pose_record *records, size_t lo, size_t hi, const double p[3], double r2,
+                           pose_visit visit, void *arg);
+static double side_length(const position *a, const position *b);
+
+
+
+
+/*!
+ * ダウンサンプリングデータの各行から、索引のレコードを作る
+ * 面積は、特徴データと同じくヘロンの公式で求める
+ * @param [out] records         レコードの配列(len個)
+ * @param [in]  down_smpl_datas ダウンサンプリングデータの配列
+ * @param [in]  len             ダウンサンプリングデータの要素数
+ */
+void make_pose_records(pose_record *records, const data_fmt *down_smpl_datas, unsigned int len) {
+  unsigned int i;
+
+  for (i = 0; i < len; i++, records++, down_smpl_datas++) {
+    const data_fmt *d = down_smpl_datas;
+    double          s;
+
+    records->cog[0]  = (d->pos1.x + d->pos2.x + d->pos3.x) / 3;
+    records->cog[1]  = (d->pos1.y + d->pos2.y + d->pos3.y) / 3;
+    records->cog[2]  = (d->pos1.z + d->pos2.z + d->pos3.z) / 3;
+    records->side[0] = side_length(&d->pos1, &d->pos2);
+    records->side[1] = side_length(&d->pos2, &d->pos3);
+    records->side[2] = side_length(&d->pos3, &d->pos1);
+    s = (records->side[0] + records->side[1] + records->side[2]) / 2;
+    records->area    = sqrt(s * (s - records->side[0]) * (s - records->side[1]) * (s - records->side[2]));
+    records->time    = d->time;
+    records->block   = i;
+    records->axis    = 0;
+  }
+}
+
+
+/*!
+ * レコードを、重心位置のk-d木の順に並べ替える
+ * 範囲[lo, hi)の中央(lo + (hi - lo) / 2)のレコードを節とし、その前には分割する軸の値が
+ * 節以下のレコードを、後には節以上のレコードを置いて、前後の範囲を再帰的に並べる
+ * 分割する軸は、範囲の中で値の広がりが最も大きい軸とする
+ * 節の位置は範囲から決まるので、子へのポインタを持たずに配列のまま書き出せる
+ * @param [in,out] records レコードの配列
+ * @param [in]     len     レコードの数
+ */
+void build_pose_index(pose_record *records, size_t len) {
+  build_range(records, 0, len);
+}
+
+
+/*!
+ * 索引をファイルに書き出す
+ * @param [in] f       出力ファイルのファイルポインタ(バイナリモードで開いておくこと)
+ * @param [in] records k-d木の順に並べたレコードの配列
+ * @param [in] len     レコードの数
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+int write_pose_index(FILE *f, const pose_record *records, size_t len) {
+  pose_index_header h;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, POSE_INDEX_MAGIC, sizeof(h.magic));
+  h.version     = POSE_INDEX_VERSION;
+  h.record_size = sizeof(pose_record);
+  h.len         = len;
+  if (fwrite(&h, sizeof(h), 1, f) != 1) return -1;
+  if (len > 0 && fwrite(records, sizeof(pose_record), len, f) != len) return -1;
+  return 0;
+}
+
+
+/*!
+ * 索引ファイルをmmapして読み込む
+ * 壊れたファイルで配列の外を読まないよう、全てのレコードの軸の値を確かめておく
+ * @param [out] idx      読み込んだ索引(使い終わったらrelease_pose_index()で解放する)
+ * @param [in]  filename 索引ファイル名
+ * @return 成功したなら0を、失敗したなら-1を返す(エラーメッセージは標準エラー出力に表示する)
+ */
+int load_pose_index(pose_index *idx, const char *filename) {
+  const pose_index_header *h;
+  struct stat              st;
+  void                    *map;
+  size_t                   i;
+  int                      fd;
+
+  memset(idx, 0, sizeof(*idx));
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ファイル:%sが開けません\n", filename);
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pose_index_header)) {
+    close(fd);
+    goto broken;
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "ファイル:%sをマップできません\n", filename);
+    return -1;
+  }
+  h = (const pose_index_header *)map;
+  idx->map      = map;
+  idx->map_size = (size_t)st.st_size;
+  idx->records  = (const pose_record *)(h + 1);
+  idx->len      = (size_t)h->len;
+  if (memcmp(h->magic, POSE_INDEX_MAGIC, sizeof(h->magic)) != 0 || h->version != POSE_INDEX_VERSION
+      || h->record_size != sizeof(pose_record) || h->len > ((size_t)st.st_size - sizeof(*h)) / sizeof(pose_record)) {
+    release_pose_index(idx);
+    goto broken;
+  }
+  for (i = 0; i < idx->len; i++) {
+    if (idx->records[i].axis > 2) {
+      release_pose_index(idx);
+      goto broken;
+    }
+  }
+  return 0;
+
+broken:
+  fprintf(stderr, "ファイル:%sは、対応していないか壊れた索引ファイルです\n", filename);
+  return -1;
+}
+
+
+/*!
+ * 読み込んだ索引を解放する
+ * @param [in,out] idx load_pose_index()で読み込んだ索引
+ */
+void release_pose_index(pose_index *idx) {
+  if (idx->map != NULL) munmap(idx->map, idx->map_size);
+  memset(idx, 0, sizeof(*idx));
+}
+
+
+/*!
+ * 重心位置が点pから半径r以内のレコードを全て探す
+ * 節の分割する軸で、点と節の差がrより大きければ、反対側の範囲には半径の中のレコードが無いので調べない
+ * @param [in] idx   索引
+ * @param [in] p     点(x, y, z)
+ * @param [in] r     半径
+ * @param [in] visit 見つかったレコードを受け取る関数(k-d木の順に呼ばれる)
+ * @param [in] arg   visitに渡す引数
+ * @return 見つかったレコードの数
+ */
+size_t pose_index_radius(const pose_index *idx, const double p[3], double r, pose_visit visit, void *arg) {
+  return radius_range(idx->records, 0, idx->len, p, r * r, visit, arg);
+}
+
+
+
+
+/*!
+ * 範囲[lo, hi)を、k-d木の順に並べ替える
+ * @param [in,out] records レコードの配列
+ * @param [in]     lo      範囲の先頭
+ * @param [in]     hi      範囲の末尾の次
+ */
+static void build_range(pose_record *records, size_t lo, size_t hi) {
+  while (hi - lo > 1) {
+    double       min[3], max[3];
+    size_t       i, mid = lo + (hi - lo) / 2;
+    unsigned int a, axis = 0;
+
+    for (a = 0; a < 3; a++) min[a] = max[a] = records[lo].cog[a];
+    for (i = lo + 1; i < hi; i++) {
+      for (a = 0; a < 3; a++) {
+        if (records[i].cog[a] < min[a]) min[a] = records[i].cog[a];
+        if (records[i].cog[a] > max[a]) max[a] = records[i].cog[a];
+      }
+    }
+    for (a = 1; a < 3; a++) {
+      if (max[a] - min[a] > max[axis] - min[axis]) axis = a;
+    }
+    select_nth(records, lo, hi, mid, axis);
+    records[mid].axis = axis;
+    build_range(records, lo, mid);
+    lo = mid + 1;  // 後の範囲は、再帰せずに続けて並べる
+  }
+  if (hi - lo == 1) records[lo].axis = 0;
+}
+
+
+/*!
+ * 範囲[lo, hi)の中で、軸axisの値がnth番目に小さいレコードをnthの位置に置き、
+ * その前には値がそれ以下の、後にはそれ以上のレコードを置く(クイックセレクト)
+ * 同じ値が多くても偏らないよう、ピボットより小さい、等しい、大きいの3つに分ける
+ * @param [in,out] records レコードの配列
+ * @param [in]     lo      範囲の先頭
+ * @param [in]     hi      範囲の末尾の次
+ * @param [in]     nth     置く位置
+ * @param [in]     axis    比べる軸
+ */
+static void select_nth(pose_record *records, size_t lo, size_t hi, size_t nth, unsigned int axis) {
+  while (hi - lo > 1) {
+    double      a = records[lo].cog[axis];
+    double      b = records[lo + (hi - lo) / 2].cog[axis];
+    double      c = records[hi - 1].cog[axis];
+    double      pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));  // 3つの中央値
+    size_t      lt = lo, i = lo, gt = hi;
+    pose_record tmp;
+
+    while (i < gt) {
+      if (records[i].cog[axis] < pivot) {
+        tmp = records[lt]; records[lt] = records[i]; records[i] = tmp;
+        lt++;
+        i++;
+      } else if (records[i].cog[axis] > pivot) {
+        gt--;
+        tmp = records[gt]; records[gt] = records[i]; records[i] = tmp;
+      } else {
+        i++;
+      }
+    }
+    if (nth < lt) {
+      hi = lt;
+    } else if (nth >= gt) {
+      lo = gt;
+    } else {
+      return;
+    }
+  }
+}
+
+
+/*!
+ * 範囲[lo, hi)の部分木から、半径の中のレコードを探す
+ * 点に近い側の範囲はループで、遠い側の範囲は再帰で調べる
+ * @param [in] records k-d木の順に並べたレコードの配列
+ * @param [in] lo      範囲の先頭
+ * @param [in] hi      範囲の末尾の次
+ * @param [in] p       点(x, y, z)
+ * @param [in] r2      半径の2乗
+ * @param [in] visit   見つかったレコードを受け取る関数
+ * @param [in] arg     visitに渡す引数
+ * @return 見つかったレコードの数
+ */
+static size_t radius_range(const pose_record *records, size_t lo, size_t hi, const double p[3], double r2,
+                           pose_visit visit, void *arg) {
+  size_t found = 0;
+
+  while (lo < hi) {
+    size_t             mid  = lo + (hi - lo) / 2;
+    const pose_record *node = &records[mid];
+    double             dx   = p[0] - node->cog[0];
+    double             dy   = p[1] - node->cog[1];
+    double             dz   = p[2] - node->cog[2];
+    double             d2   = dx * dx + dy * dy + dz * dz;
+    double             diff = p[node->axis] - node->cog[node->axis];
+
+    if (d2 <= r2) {
+      visit(node, sqrt(d2), arg);
+      found++;
+    }
+    if (diff < 0.0) {
+      if (diff * diff <= r2) found += radius_range(records, mid + 1, hi, p, r2, visit, arg);
+      hi = mid;
+    } else {
+      if (diff * diff <= r2) found += radius_range(records, lo, mid, p, r2, visit, arg);
+      lo = mid + 1;
+    }
+  }
+  return found;
+}
+
+
+/*!
+ * 2点間の距離を求める
+ * @param [in] a 座標点1
+ * @param [in] b 座標点2
+ * @return aとbの距離
+ */
+static double side_length(const position *a, const position *b) {
+  return sqrt((b->x - a->x) * (b->x - a->x) + (b->y - a->y) * (b->y - a->y) + (b->z - a->z) * (b->z - a->z));
+}
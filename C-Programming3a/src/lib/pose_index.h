@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "data_handler.h"
+
+#define POSE_INDEX_MAGIC    "G3KD"  // 姿勢の索引ファイルの先頭の4バイト
+#define POSE_INDEX_VERSION       1  // フォーマットのバージョン
+#define POSE_INDEX_SUFFIX  ".g3kd"  // 出力ファイル名に付けて、索引ファイルの名前とする
+
+
+// ブロック(ダウンサンプリングデータの1行)ごとの、重心位置と三角形の形
+typedef struct {
+  double   cog[3];   // 重心位置(x, y, z)
+  double   side[3];  // 三角形の辺の長さ(1-2, 2-3, 3-1)
+  double   area;     // 三角形の面積
+  double   time;     // ブロックの時間(出力の行の時間)
+  uint32_t block;    // ブロックの番号(出力の行の番号)
+  uint32_t axis;     // k-d木で、このレコードが範囲を分割する軸(0: x, 1: y, 2: z)
+} pose_record;
+
+// 読み込んだ索引
+typedef struct {
+  const pose_record *records;   // k-d木の順に並べたレコード(読み取り専用)
+  size_t             len;       // レコードの数
+  void              *map;       // マップした領域
+  size_t             map_size;  // マップした領域のバイト数
+} pose_index;
+
+// 半径の中で見つかったレコードを受け取る関数の型(distは点からの距離)
+typedef void (*pose_visit)(const pose_record *rec, double dist, void *arg);
+
+
+// ダウンサンプリングデータの各行から、重心位置と三角形の辺の長さ・面積を求める
+void   make_pose_records(pose_record *records, const data_fmt *down_smpl_datas, unsigned int len);
+// レコードを、重心位置のk-d木の順(範囲の中央を根とする、ポインタを持たない平衡木)に並べ替える
+void   build_pose_index(pose_record *records, size_t len);
+// k-d木の順に並べたレコードを、ヘッダに続けてそのまま書き出す(ホストのバイトオーダー)
+int    write_pose_index(FILE *f, const pose_record *records, size_t len);
+int    load_pose_index(pose_index *idx, const char *filename);
+void   release_pose_index(pose_index *idx);
+// 重心位置が点pから半径r以内のレコードを全て探し、visitに渡す。見つかった数を返す
+size_t pose_index_radius(const pose_index *idx, const double p[3], double r, pose_visit visit, void *arg);
@@ -0,0 +1,210 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fft.h"
+#include "spectral.h"
+
+
+static int  spectral_blocks(spectral_feature *spectra, const data_fmt *datas, const fixed_fmt *fixed_datas,
+                            unsigned int n_blocks, unsigned int n, const spectral_spec *ss);
+static void frame_cog(double cog[3], const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int i);
+static void block_features(spectral_feature *sf, const double *re, const double *im, unsigned int batch, unsigned int lane,
+                           unsigned int n, double t0, double t1, const spectral_spec *ss);
+
+
+
+
+/*!
+ * 周波数帯の指定を解析する
+ * @param [in]  spec 周波数帯の指定("lo:hi"、0 <= lo < hi、単位はHz)
+ * @param [out] ss   解析した設定
+ * @return 成功したなら0を、指定が不正なら-1を返す
+ */
+int parse_spectral_spec(const char *spec, spectral_spec *ss) {
+  char *p;
+
+  ss->band_lo = strtod(spec, &p);
+  if (p == spec || *p != ':') goto invalid;
+  spec = p + 1;
+  ss->band_hi = strtod(spec, &p);
+  if (p == spec || *p != '\0') goto invalid;
+  if (!(ss->band_lo >= 0.0 && ss->band_lo < ss->band_hi) || !isfinite(ss->band_hi)) {
+    fputs("周波数帯は、0 <= lo < hi の有限の値で指定してください\n", stderr);
+    return -1;
+  }
+  return 0;
+
+invalid:
+  fputs("周波数帯の指定が不正です(lo:hi)\n", stderr);
+  return -1;
+}
+
+
+/*!
+ * ブロックごとに、重心の運動の周波数特徴を求める
+ * ブロックはdown_sample()と同じくmerge_num行ずつ区切り、最後のブロックは残りの行とする
+ * 同じ長さのブロックは、同じ計画(回転因子)を用いてSPECTRAL_BATCH個ずつまとめてFFTする
+ * @param [out] spectra     周波数特徴を格納する配列(ブロック数分)
+ * @param [in]  datas       オリジナルのデータ(固定小数点数で処理するならNULL)
+ * @param [in]  fixed_datas 固定小数点数のデータ(datasを用いるならNULL)
+ * @param [in]  len         データ数
+ * @param [in]  merge_num   1ブロックの行数
+ * @param [in]  ss          周波数特徴の設定
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int derive_spectral_features(spectral_feature *spectra, const data_fmt *datas, const fixed_fmt *fixed_datas,
+    unsigned int len, unsigned int merge_num, const spectral_spec *ss) {
+  unsigned int repeat = len / merge_num;
+  unsigned int rest   = len % merge_num;
+  size_t       skip   = (size_t)repeat * merge_num;
+
+  if (repeat > 0 && spectral_blocks(spectra, datas, fixed_datas, repeat, merge_num, ss) != 0) return -1;
+  if (rest == 0) return 0;
+  // 残ったデータは長さが異なるので、別の計画で変換する
+  return spectral_blocks(spectra + repeat, datas != NULL ? datas + skip : NULL, fixed_datas != NULL ? fixed_datas + skip : NULL,
+      1, rest, ss);
+}
+
+
+
+
+/*!
+ * 長さnのブロックを、まとめてFFTして周波数特徴を求める
+ * 1つのブロックから重心のx, y, zの3系列を作り(最小二乗で当てはめた直線は引いておく)、
+ * 要素ごとに全系列の値を並べて、fft_execute()でまとめて変換する
+ * @param [out] spectra     周波数特徴を格納する配列
+ * @param [in]  datas       最初のブロックの先頭のデータ(固定小数点数で処理するならNULL)
+ * @param [in]  fixed_datas 最初のブロックの先頭の固定小数点数のデータ(datasを用いるならNULL)
+ * @param [in]  n_blocks    ブロックの数
+ * @param [in]  n           1ブロックの行数
+ * @param [in]  ss          周波数特徴の設定
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+static int spectral_blocks(spectral_feature *spectra, const data_fmt *datas, const fixed_fmt *fixed_datas,
+                           unsigned int n_blocks, unsigned int n, const spectral_spec *ss) {
+  unsigned int  group = n_blocks < SPECTRAL_BATCH ? n_blocks : SPECTRAL_BATCH;
+  unsigned int  batch = group * 3;
+  unsigned int  first, w, t, a;
+  fft_plan     *plan;
+  double       *re, *im;
+
+  plan = fft_plan_create(n, batch);
+  re   = (double *)malloc(sizeof(double) * n * batch * 2);
+  if (plan == NULL || re == NULL) {
+    fft_plan_destroy(plan);
+    free(re);
+    return -1;
+  }
+  im = re + (size_t)n * batch;
+
+  for (first = 0; first < n_blocks; first += group) {
+    unsigned int cnt = n_blocks - first < group ? n_blocks - first : group;
+
+    memset(re, 0, sizeof(double) * n * batch);
+    memset(im, 0, sizeof(double) * n * batch);
+    for (w = 0; w < cnt; w++) {
+      double       sum[3]   = {0.0, 0.0, 0.0};  // Σ x_t
+      double       sum_t[3] = {0.0, 0.0, 0.0};  // Σ t x_t
+      double       t_mean   = (n - 1) / 2.0;
+      double       t_var    = ((double)n * n - 1) * n / 12;  // Σ (t - t_mean)^2
+      double       mean, slope;
+      unsigned int row0     = (first + w) * n;
+
+      for (t = 0; t < n; t++) {
+        double cog[3];
+        frame_cog(cog, datas, fixed_datas, row0 + t);
+        for (a = 0; a < 3; a++) {
+          re[(size_t)t * batch + w * 3 + a] = cog[a];
+          sum[a]   += cog[a];
+          sum_t[a] += (double)t * cog[a];
+        }
+      }
+      // 直流成分と、ブロック全体にわたる移動(1次の傾向)を除き、重心の往復運動だけを見る
+      // 平均だけを引くと、ゆっくりした移動が最も低い周波数(k = 1)の大きな成分となり、卓越周波数が常にそこになる
+      for (a = 0; a < 3; a++) {
+        mean  = sum[a] / n;
+        slope = t_var > 0.0 ? (sum_t[a] - t_mean * sum[a]) / t_var : 0.0;
+        for (t = 0; t < n; t++) {
+          re[(size_t)t * batch + w * 3 + a] -= mean + slope * (t - t_mean);
+        }
+      }
+    }
+
+    fft_execute(plan, re, im);
+
+    for (w = 0; w < cnt; w++) {
+      unsigned int row0 = (first + w) * n;
+      double       t0   = datas != NULL ? datas[row0].time : (double)fixed_datas[row0].time / FIXED_SCALE;
+      double       t1   = datas != NULL ? datas[row0 + n - 1].time : (double)fixed_datas[row0 + n - 1].time / FIXED_SCALE;
+      block_features(&spectra[first + w], re, im, batch, w * 3, n, t0, t1, ss);
+    }
+  }
+  fft_plan_destroy(plan);
+  free(re);
+  return 0;
+}
+
+
+/*!
+ * 1フレームの重心位置を求める
+ * @param [out] cog         重心位置(x, y, z)
+ * @param [in]  datas       データ(固定小数点数で処理するならNULL)
+ * @param [in]  fixed_datas 固定小数点数のデータ(datasを用いるならNULL)
+ * @param [in]  i           フレームの位置
+ */
+static void frame_cog(double cog[3], const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int i) {
+  if (datas != NULL) {
+    const data_fmt *d = &datas[i];
+    cog[0] = (d->pos1.x + d->pos2.x + d->pos3.x) / 3;
+    cog[1] = (d->pos1.y + d->pos2.y + d->pos3.y) / 3;
+    cog[2] = (d->pos1.z + d->pos2.z + d->pos3.z) / 3;
+  } else {
+    const int32_t *p = fixed_datas[i].pos;
+    cog[0] = ((int64_t)p[0] + p[3] + p[6]) / (3.0 * FIXED_SCALE);
+    cog[1] = ((int64_t)p[1] + p[4] + p[7]) / (3.0 * FIXED_SCALE);
+    cog[2] = ((int64_t)p[2] + p[5] + p[8]) / (3.0 * FIXED_SCALE);
+  }
+}
+
+
+/*!
+ * 1ブロックのスペクトルから、周波数特徴を求める
+ * パワーは重心のx, y, zのスペクトルの2乗和とし、k = 1 .. n / 2 の片側スペクトルのみを見る
+ * サンプリング周波数は、ブロックの最初と最後の行の時間から (n - 1) / (t1 - t0) とする
+ * 周波数帯の成分の分散は、Parsevalの定理より Σ c_k |X_k|^2 / n^2 (c_kは両側の分を合わせて2、ナイキスト周波数のみ1)
+ * @param [out] sf    周波数特徴
+ * @param [in]  re    変換結果の実部
+ * @param [in]  im    変換結果の虚部
+ * @param [in]  batch まとめて変換した系列の数
+ * @param [in]  lane  このブロックのx成分の系列の番号(y, zはその次に並ぶ)
+ * @param [in]  n     ブロックの行数
+ * @param [in]  t0    ブロックの最初の行の時間
+ * @param [in]  t1    ブロックの最後の行の時間
+ * @param [in]  ss    周波数特徴の設定
+ */
+static void block_features(spectral_feature *sf, const double *re, const double *im, unsigned int batch, unsigned int lane,
+                           unsigned int n, double t0, double t1, const spectral_spec *ss) {
+  double       fs   = t1 > t0 ? (n - 1) / (t1 - t0) : 0.0;  // サンプリング周波数
+  double       peak = -1.0;
+  unsigned int k, a;
+
+  sf->dom_freq    = 0.0;
+  sf->band_energy = 0.0;
+  for (k = 1; k <= n / 2; k++) {
+    double power = 0.0;
+    double freq  = k * fs / n;
+    for (a = 0; a < 3; a++) {
+      size_t j = (size_t)k * batch + lane + a;
+      power += re[j] * re[j] + im[j] * im[j];
+    }
+    if (power > peak) {
+      peak         = power;
+      sf->dom_freq = freq;
+    }
+    if (fs > 0.0 && freq >= ss->band_lo && freq <= ss->band_hi) {
+      sf->band_energy += (n % 2 == 0 && k == n / 2 ? 1.0 : 2.0) * power;
+    }
+  }
+  sf->band_energy /= (double)n * n;
+}
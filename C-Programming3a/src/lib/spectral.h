@@ -0,0 +1,27 @@
+#pragma once
+
+#include "data_handler.h"
+#include "fixed_point.h"
+
+#define SPECTRAL_BATCH  8  // まとめてFFTするブロックの数(1ブロックにつき、重心のx, y, zの3系列)
+
+
+// 重心の運動の周波数特徴
+typedef struct {
+  double dom_freq;     // パワーが最大となる周波数(Hz)
+  double band_energy;  // 指定した周波数帯の成分の分散(重心の変位の2乗の単位)
+} spectral_feature;
+
+// 周波数特徴の設定
+typedef struct {
+  double band_lo;  // 周波数帯の下限(Hz)
+  double band_hi;  // 周波数帯の上限(Hz)
+} spectral_spec;
+
+
+// 周波数帯の指定 "lo:hi" を解析する
+int parse_spectral_spec(const char *spec, spectral_spec *ss);
+// ダウンサンプリングと同じブロック(merge_num行ずつ、最後は残りの行)ごとに、
+// 各フレームの重心位置をFFTして周波数特徴を求める(datasとfixed_datasの、使わない方はNULL)
+int derive_spectral_features(spectral_feature *spectra, const data_fmt *datas, const fixed_fmt *fixed_datas,
+    unsigned int len, unsigned int merge_num, const spectral_spec *ss);
@@ -0,0 +1,325 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "data_handler.h"
+#include "fixed_point.h"
+#include "sweep.h"
+#include "thread_pool.h"
+
+#define MAX_LIST_LEN  256  // 1つのパラメータに指定できる値の最大個数
+
+
+// 1組の(merge_num, offset)の処理(出力する特徴だけが異なる設定は、この結果を共有する)
+typedef struct {
+  unsigned int     merge_num;      // ダウンサンプリングで結合するデータの数
+  const data_fmt  *datas;          // 入力データ(固定小数点数で処理するならNULL)
+  const fixed_fmt *fixed_datas;    // 固定小数点数の入力データ(datasを用いるならNULL)
+  unsigned int     len;            // 入力データ数(オフセット適用後)
+  feature         *feature_datas;  // 特徴データの出力先
+  unsigned int     n_rows;         // 特徴データの要素数
+  int              use_approx;     // 近似計算を用いるかどうか
+} sweep_task;
+
+
+static int  parse_uint_list(const char *str, size_t n, unsigned int *vals, unsigned int min_val, const char *name);
+static int  parse_feature_list(const char *str, size_t n, int *vals);
+static void run_task(void *arg, unsigned int worker_id);
+static int  write_config(FILE *f, const sweep_config *config, const sweep_task *task);
+
+
+
+
+/*!
+ * スイープの設定の指定を解析し、全ての組み合わせを生成する
+ * 指定は "merge_num[,...][:offset[,...][:features[,...]]]" の形式で、
+ * offsetを省略すると0、featuresを省略するとallとなる
+ * @param [in]  spec      設定の指定
+ * @param [out] configs   生成した設定の配列(mallocで確保する。呼び出し側で解放すること)
+ * @param [out] n_configs 生成した設定の数
+ * @return 成功したなら0を、指定が不正なら-1を返す
+ */
+int parse_sweep_spec(const char *spec, sweep_config **configs, unsigned int *n_configs) {
+  unsigned int  merge_nums[MAX_LIST_LEN];
+  unsigned int  offsets[MAX_LIST_LEN] = {0};
+  int           features[MAX_LIST_LEN] = {SWEEP_ALL};
+  int           n_merge, n_offset = 1, n_feature = 1;
+  const char   *sep1 = strchr(spec, ':');
+  const char   *sep2 = sep1 != NULL ? strchr(sep1 + 1, ':') : NULL;
+  int           i, j, k;
+  sweep_config *c;
+
+  n_merge = parse_uint_list(spec, sep1 != NULL ? (size_t)(sep1 - spec) : strlen(spec), merge_nums, 1, "ダウンサンプリングの要素数");
+  if (n_merge < 0) return -1;
+  if (sep1 != NULL) {
+    n_offset = parse_uint_list(sep1 + 1, sep2 != NULL ? (size_t)(sep2 - sep1 - 1) : strlen(sep1 + 1), offsets, 0, "オフセット");
+    if (n_offset < 0) return -1;
+  }
+  if (sep2 != NULL) {
+    n_feature = parse_feature_list(sep2 + 1, strlen(sep2 + 1), features);
+    if (n_feature < 0) return -1;
+  }
+
+  *n_configs = (unsigned int)(n_merge * n_offset * n_feature);
+  *configs   = c = (sweep_config *)malloc(sizeof(sweep_config) * *n_configs);
+  if (c == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return -1;
+  }
+  for (i = 0; i < n_merge; i++) {
+    for (j = 0; j < n_offset; j++) {
+      for (k = 0; k < n_feature; k++, c++) {
+        c->merge_num = merge_nums[i];
+        c->offset    = offsets[j];
+        c->features  = features[k];
+      }
+    }
+  }
+  return 0;
+}
+
+
+/*!
+ * 全ての設定をスレッドプールで並列に処理し、結果を設定の順にファイルに書き出す
+ * 特徴データは(merge_num, offset)の組ごとに1度だけ求め、出力する特徴だけが異なる設定で共有する
+ * 入力データは全てのタスクで共有し、読み取りのみを行う
+ * 特徴データの領域は、全ての設定の分をあらかじめ1つのアリーナから切り出しておく
+ * @param [in] f           出力ファイルのファイルポインタ
+ * @param [in] datas       入力データ(固定小数点数で処理するならNULL)
+ * @param [in] fixed_datas 固定小数点数の入力データ(datasを用いるならNULL)
+ * @param [in] len         入力データ数
+ * @param [in] configs     設定の配列
+ * @param [in] n_configs   設定の数
+ * @param [in] n_threads   ワーカスレッド数
+ * @param [in] arena_flags 作業領域のアリーナに与えるARENA_xxxフラグ
+ * @param [in] use_approx  平方根を近似計算するかどうか
+ * @return 成功したなら0を、失敗したなら-1を返す
+ */
+int run_sweep(FILE *f, const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int len,
+    const sweep_config *configs, unsigned int n_configs, unsigned int n_threads, int arena_flags, int use_approx) {
+  sweep_task   *tasks;
+  unsigned int *task_of;  // 設定ごとの、特徴データを求めるタスクの番号
+  unsigned int  n_tasks = 0;
+  thread_pool  *pool;
+  arena         work_arena;
+  size_t        total = 0;
+  unsigned int  i;
+  int           ret = 0;
+
+  tasks   = (sweep_task *)malloc(sizeof(sweep_task) * n_configs);
+  task_of = (unsigned int *)malloc(sizeof(unsigned int) * n_configs);
+  if (tasks == NULL || task_of == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    free(tasks);
+    free(task_of);
+    return -1;
+  }
+  // parse_sweep_spec()は特徴を最も内側で変えて設定を並べるので、同じ組の設定は隣り合う
+  for (i = 0; i < n_configs; i++) {
+    sweep_task   *t;
+    unsigned int  offset = configs[i].offset < len ? configs[i].offset : len;
+
+    if (i > 0 && configs[i].merge_num == configs[i - 1].merge_num && configs[i].offset == configs[i - 1].offset) {
+      task_of[i] = task_of[i - 1];
+      continue;
+    }
+    task_of[i]     = n_tasks;
+    t              = &tasks[n_tasks++];
+    t->merge_num   = configs[i].merge_num;
+    t->datas       = datas       != NULL ? datas + offset       : NULL;
+    t->fixed_datas = fixed_datas != NULL ? fixed_datas + offset : NULL;
+    t->len         = len - offset;
+    t->use_approx  = use_approx;
+    t->n_rows      = t->len / t->merge_num + (t->len % t->merge_num != 0);
+    total += sizeof(feature) * (size_t)t->n_rows + 64;  // 64はアラインメントの余裕分
+  }
+
+  // タスクの実行中にアリーナを操作しないよう、全ての領域を先に切り出しておく
+  // (ARENA_FIRST_TOUCHなら、各タスクの領域のページは、タスクを処理するワーカスレッドのノードに置かれる)
+  arena_init(&work_arena, total, arena_flags);
+  for (i = 0; i < n_tasks; i++) {
+    tasks[i].feature_datas = (feature *)arena_alloc(&work_arena, sizeof(feature) * tasks[i].n_rows);
+    if (tasks[i].feature_datas == NULL) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      ret = -1;
+      goto cleanup;
+    }
+  }
+
+  pool = thread_pool_create(n_threads);
+  if (pool == NULL) {
+    fputs("スレッドプールを作成できませんでした\n", stderr);
+    ret = -1;
+    goto cleanup;
+  }
+  for (i = 0; i < n_tasks; i++) {
+    if (thread_pool_submit(pool, run_task, &tasks[i]) != 0) {
+      run_task(&tasks[i], 0);  // 投入できなかったタスクはこのスレッドで処理する
+    }
+  }
+  thread_pool_wait(pool);
+  thread_pool_destroy(pool);
+
+  for (i = 0; i < n_configs; i++) {
+    if (write_config(f, &configs[i], &tasks[task_of[i]]) != 0) {
+      fputs("特徴データの書き込みに失敗しました\n", stderr);
+      ret = -1;
+      break;
+    }
+  }
+
+cleanup:
+  arena_destroy(&work_arena);
+  free(task_of);
+  free(tasks);
+  return ret;
+}
+
+
+
+
+/*!
+ * 数値のカンマ区切りリストを解析する
+ * @param [in]  str     解析する文字列
+ * @param [in]  n       解析する文字列の長さ
+ * @param [out] vals    解析した値の格納先(MAX_LIST_LEN個分の領域が必要)
+ * @param [in]  min_val 値の最小値
+ * @param [in]  name    エラーメッセージに用いる、値の名前
+ * @return 解析した値の個数(不正な指定なら-1)
+ */
+static int parse_uint_list(const char *str, size_t n, unsigned int *vals, unsigned int min_val, const char *name) {
+  const char *end = str + n;
+  int         count = 0;
+
+  while (str < end) {
+    char          *check;
+    unsigned long  val = strtoul(str, &check, 10);
+    if (check == str || (check != end && *check != ',') || *str == '-') {
+      fprintf(stderr, "%sのリストに数値以外がありました\n", name);
+      return -1;
+    }
+    if (check != end && check + 1 == end) {
+      fprintf(stderr, "%sのリストの末尾にカンマがあります\n", name);
+      return -1;
+    }
+    if (val < min_val || val >= UINT_MAX) {
+      fprintf(stderr, "%sの値が範囲外です\n", name);
+      return -1;
+    }
+    if (count == MAX_LIST_LEN) {
+      fprintf(stderr, "%sの値が多すぎます\n", name);
+      return -1;
+    }
+    vals[count++] = (unsigned int)val;
+    str = check == end ? end : check + 1;
+  }
+  if (count == 0) {
+    fprintf(stderr, "%sが指定されていません\n", name);
+    return -1;
+  }
+  return count;
+}
+
+
+/*!
+ * 特徴の組み合わせのカンマ区切りリストを解析する
+ * 各要素は len, area, cog を+でつないだもの、もしくは all
+ * @param [in]  str  解析する文字列
+ * @param [in]  n    解析する文字列の長さ
+ * @param [out] vals 解析した値(SWEEP_xxxの論理和)の格納先(MAX_LIST_LEN個分の領域が必要)
+ * @return 解析した値の個数(不正な指定なら-1)
+ */
+static int parse_feature_list(const char *str, size_t n, int *vals) {
+  static const struct {
+    const char *name;
+    int         flag;
+  } FEATURE_NAMES[] = {
+    {"len", SWEEP_LEN}, {"area", SWEEP_AREA}, {"cog", SWEEP_COG}, {"all", SWEEP_ALL}
+  };
+  const char *end = str + n;
+  int         count = 0;
+
+  if (str == end) {
+    fputs("出力する特徴が指定されていません\n", stderr);
+    return -1;
+  }
+  vals[0] = 0;
+  while (str <= end) {
+    size_t       name_len = strcspn(str, "+,");
+    unsigned int i;
+
+    if (str + name_len > end) name_len = (size_t)(end - str);
+    for (i = 0; i < sizeof(FEATURE_NAMES) / sizeof(FEATURE_NAMES[0]); i++) {
+      if (strlen(FEATURE_NAMES[i].name) == name_len && strncmp(str, FEATURE_NAMES[i].name, name_len) == 0) break;
+    }
+    if (i == sizeof(FEATURE_NAMES) / sizeof(FEATURE_NAMES[0])) {
+      fprintf(stderr, "特徴の名前:%.*sは無効です(len, area, cog, allのいずれかを指定してください)\n", (int)name_len, str);
+      return -1;
+    }
+    vals[count] |= FEATURE_NAMES[i].flag;
+    str += name_len;
+    if (str == end || *str == ',') {  // 1つの組み合わせの終わり
+      if (++count == MAX_LIST_LEN && str != end) {
+        fputs("特徴の組み合わせが多すぎます\n", stderr);
+        return -1;
+      }
+      if (str == end) break;
+      vals[count] = 0;
+    }
+    str++;
+  }
+  return count;
+}
+
+
+/*!
+ * 1組の(merge_num, offset)について、ダウンサンプリングと特徴データの抽出を行う(スレッドプールのタスク)
+ * @param [in,out] arg       処理する組(sweep_task)
+ * @param [in]     worker_id ワーカスレッドの番号(未使用)
+ */
+static void run_task(void *arg, unsigned int worker_id) {
+  sweep_task *t = (sweep_task *)arg;
+  (void)worker_id;
+
+  if (t->fixed_datas != NULL && t->use_approx) {
+    down_sample_features_fixed_approx(t->feature_datas, t->fixed_datas, t->len, t->merge_num);
+  } else if (t->fixed_datas != NULL) {
+    down_sample_features_fixed(t->feature_datas, t->fixed_datas, t->len, t->merge_num);
+  } else if (t->use_approx) {
+    down_sample_features_approx(t->feature_datas, t->datas, t->len, t->merge_num);
+  } else {
+    down_sample_features(t->feature_datas, t->datas, t->len, t->merge_num);
+  }
+}
+
+
+/*!
+ * 1つの設定の結果を、見出し行に続けて書き出す
+ * 書式は通常の出力と同じで、選ばれていない特徴の列は省く
+ * (最初の行には重心位置の変化を出力しない)
+ * @param [in] f      出力ファイルのファイルポインタ
+ * @param [in] config 書き出す設定
+ * @param [in] task   設定の(merge_num, offset)の組の処理結果
+ * @return 成功したなら0を、書き込みに失敗したなら-1を返す
+ */
+static int write_config(FILE *f, const sweep_config *config, const sweep_task *task) {
+  const feature *fd       = task->feature_datas;
+  int            features = config->features;
+  unsigned int   i;
+
+  fprintf(f, "# merge_num=%u offset=%u features=%s%s%s rows=%u\n",
+      config->merge_num, config->offset,
+      features & SWEEP_LEN  ? "len"  : "",
+      features & SWEEP_AREA ? (features & SWEEP_LEN ? "+area" : "area") : "",
+      features & SWEEP_COG  ? (features & (SWEEP_LEN | SWEEP_AREA) ? "+cog" : "cog") : "",
+      task->n_rows);
+  for (i = 0; i < task->n_rows; i++, fd++) {
+    fprintf(f, "%lf", fd->time);
+    if (features & SWEEP_LEN)           fprintf(f, " %lf", fd->len);
+    if (features & SWEEP_AREA)          fprintf(f, " %lf", fd->area);
+    if (features & SWEEP_COG && i != 0) fprintf(f, " %lf", fd->cog_change);
+    fputc('\n', f);
+  }
+  return ferror(f) ? -1 : 0;  // fprintf()が失敗すると、エラー指示子がセットされる
+}
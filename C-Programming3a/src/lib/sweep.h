@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+#include "data_handler.h"
+#include "fixed_point.h"
+
+#define SWEEP_LEN   0x01  // 距離の総和を出力する
+#define SWEEP_AREA  0x02  // 面積を出力する
+#define SWEEP_COG   0x04  // 重心位置の変化を出力する
+#define SWEEP_ALL   (SWEEP_LEN | SWEEP_AREA | SWEEP_COG)
+
+
+// パラメータスイープの1つの設定
+typedef struct {
+  unsigned int merge_num;  // ダウンサンプリングで結合するデータの数
+  unsigned int offset;     // ブロックの区切りをずらすために読み飛ばす先頭のデータ数
+  int          features;   // 出力する特徴(SWEEP_xxxの論理和)
+} sweep_config;
+
+
+// 設定の指定 "merge_num[,...][:offset[,...][:features[,...]]]" を解析し、
+// それらの全ての組み合わせを生成する(featuresは len, area, cog を+でつないだものか all)
+int parse_sweep_spec(const char *spec, sweep_config **configs, unsigned int *n_configs);
+// datasとfixed_datasのどちらか一方(使わない方はNULL)を、全ての設定で並列に処理し、
+// 設定ごとの見出し行に続けて、結果をfに書き出す(use_approxなら近似計算を用いる)
+int run_sweep(FILE *f, const data_fmt *datas, const fixed_fmt *fixed_datas, unsigned int len,
+    const sweep_config *configs, unsigned int n_configs, unsigned int n_threads, int arena_flags, int use_approx);
@@ -0,0 +1,208 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "numa.h"
+#include "thread_pool.h"
+
+
+typedef struct task {
+  task_func    func;  // 実行する関数
+  void        *arg;   // 関数に渡す引数
+  struct task *next;  // 次のタスク(キューの連結リスト)
+} task;
+
+typedef struct {
+  thread_pool  *pool;       // 所属するスレッドプール
+  unsigned int  worker_id;  // ワーカスレッドの番号
+  int           node;       // ワーカスレッドを固定するNUMAノードの順番(-1なら固定しない)
+} worker_arg;
+
+struct thread_pool {
+  pthread_mutex_t  mutex;        // キューとカウンタを保護するミューテックス
+  pthread_cond_t   task_cond;    // タスクが投入されたことを通知する条件変数
+  pthread_cond_t   done_cond;    // 全てのタスクが終了したことを通知する条件変数
+  task            *head;         // タスクキューの先頭
+  task            *tail;         // タスクキューの末尾
+  unsigned int     n_pending;    // 未完了(キュー内 + 実行中)のタスク数
+  unsigned int     n_threads;    // ワーカスレッド数
+  int              is_shutdown;  // 終了要求フラグ
+  pthread_t       *threads;      // ワーカスレッドの配列
+  worker_arg      *args;         // ワーカスレッドに渡す引数の配列
+};
+
+
+static void *worker_main(void *arg);
+
+
+static int pool_numa = 0;  // ワーカスレッドをNUMAノードに固定するかどうか
+
+
+
+
+/*!
+ * 以降に生成するスレッドプールのワーカスレッドを、NUMAノードに順に固定するかどうかを設定する
+ * 固定すると、ワーカスレッドが初めて書き込んだ作業領域のページはそのスレッドのノードに置かれ
+ * (ファーストタッチ)、スレッドが他のノードに移されて遠いメモリを読むことも無くなる
+ * ノードが1つしか無い環境では、固定しない
+ * @param [in] enable 固定するなら0以外
+ */
+void thread_pool_set_numa(int enable) {
+  pool_numa = enable;
+}
+
+
+/*!
+ * スレッドプールを生成する
+ * @param [in] n_threads ワーカスレッド数(0なら1とみなす)
+ * @return 生成したスレッドプール。失敗したときはNULLを返す
+ */
+thread_pool *thread_pool_create(unsigned int n_threads) {
+  unsigned int i;
+  unsigned int n_nodes = pool_numa ? numa_node_count() : 1;
+  thread_pool *pool = (thread_pool *)calloc(1, sizeof(thread_pool));
+  if (pool == NULL) return NULL;
+
+  if (n_threads == 0) n_threads = 1;
+  pool->threads = (pthread_t  *)malloc(sizeof(pthread_t)  * n_threads);
+  pool->args    = (worker_arg *)malloc(sizeof(worker_arg) * n_threads);
+  if (pool->threads == NULL || pool->args == NULL) {
+    free(pool->threads);
+    free(pool->args);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->task_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  for (i = 0; i < n_threads; i++) {
+    pool->args[i].pool      = pool;
+    pool->args[i].worker_id = i;
+    pool->args[i].node      = n_nodes > 1 ? (int)(i % n_nodes) : -1;  // 隣の番号のスレッドは、別のノードに置く
+    if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->args[i]) != 0) {
+      break;
+    }
+  }
+  pool->n_threads = i;  // 生成に成功したスレッド数
+  if (i == 0) {
+    thread_pool_destroy(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+
+/*!
+ * スレッドプールのワーカスレッド数を返す
+ * @param [in] pool スレッドプール
+ * @return ワーカスレッド数
+ */
+unsigned int thread_pool_size(const thread_pool *pool) {
+  return pool->n_threads;
+}
+
+
+/*!
+ * タスクをスレッドプールに投入する
+ * @param [in] pool スレッドプール
+ * @param [in] func 実行する関数
+ * @param [in] arg  関数に渡す引数
+ * @return 投入に成功したなら0を、失敗したなら-1を返す
+ */
+int thread_pool_submit(thread_pool *pool, task_func func, void *arg) {
+  task *t = (task *)malloc(sizeof(task));
+  if (t == NULL) return -1;
+  t->func = func;
+  t->arg  = arg;
+  t->next = NULL;
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->tail == NULL) {
+    pool->head = t;
+  } else {
+    pool->tail->next = t;
+  }
+  pool->tail = t;
+  pool->n_pending++;
+  pthread_cond_signal(&pool->task_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+
+/*!
+ * 投入済みの全てのタスクが終了するまで待つ
+ * @param [in] pool スレッドプール
+ */
+void thread_pool_wait(thread_pool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->n_pending > 0) {
+    pthread_cond_wait(&pool->done_cond, &pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+
+/*!
+ * スレッドプールを破棄する
+ * キューに残っているタスクを全て実行してから、ワーカスレッドを終了させる
+ * @param [in] pool スレッドプール
+ */
+void thread_pool_destroy(thread_pool *pool) {
+  unsigned int i;
+  if (pool == NULL) return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->is_shutdown = 1;
+  pthread_cond_broadcast(&pool->task_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (i = 0; i < pool->n_threads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->task_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  free(pool->threads);
+  free(pool->args);
+  free(pool);
+}
+
+
+
+
+/*!
+ * ワーカスレッドのメインループ
+ * @param [in] arg worker_arg構造体へのポインタ
+ * @return 常にNULLを返す
+ */
+static void *worker_main(void *arg) {
+  worker_arg  *warg = (worker_arg *)arg;
+  thread_pool *pool = warg->pool;
+
+  if (warg->node >= 0) numa_bind_node((unsigned int)warg->node);  // 固定できなくても、そのまま処理する
+  for (;;) {
+    task *t;
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->head == NULL && !pool->is_shutdown) {
+      pthread_cond_wait(&pool->task_cond, &pool->mutex);
+    }
+    if (pool->head == NULL) {  // 終了要求があり、キューが空になったとき
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+    t = pool->head;
+    pool->head = t->next;
+    if (pool->head == NULL) pool->tail = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    t->func(t->arg, warg->worker_id);
+    free(t);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->n_pending == 0) {
+      pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+  }
+  return NULL;
+}
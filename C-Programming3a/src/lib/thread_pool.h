@@ -0,0 +1,17 @@
+#pragma once
+
+
+// スレッドプールに投入するタスクの関数型
+// worker_idには、タスクを実行するワーカスレッドの番号(0 ~ スレッド数-1)が渡される
+typedef void (*task_func)(void *arg, unsigned int worker_id);
+
+typedef struct thread_pool thread_pool;
+
+
+// 以降に生成するスレッドプールのワーカスレッドを、NUMAノードに順に固定するかどうかを設定する
+void thread_pool_set_numa(int enable);
+thread_pool *thread_pool_create(unsigned int n_threads);
+unsigned int thread_pool_size(const thread_pool *pool);
+int  thread_pool_submit(thread_pool *pool, task_func func, void *arg);
+void thread_pool_wait(thread_pool *pool);
+void thread_pool_destroy(thread_pool *pool);
@@ -0,0 +1,552 @@
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "window.h"
+
+#define NO_POS     UINT_MAX  // ヒープに含まれないスロットの位置
+#define PART_NONE  0         // 窓に含まれない
+#define PART_LOW   1         // 小さい方から除く部分
+#define PART_MID   2         // 集約に用いる中央の部分
+#define PART_HIGH  3         // 大きい方から除く部分
+
+// スロットaがbより根に近くあるべきか(最大ヒープなら値の大きい方、最小ヒープなら小さい方)
+#define HEAP_BEFORE(h, a, b) ((h)->is_max ? (h)->vals[a] > (h)->vals[b] : (h)->vals[a] < (h)->vals[b])
+
+
+// 窓の中の位置(スロット)を要素とするヒープ
+// スロットごとのヒープ内の位置を持つので、任意のスロットをO(log n)で取り除ける
+typedef struct {
+  unsigned int *heap;    // スロットのヒープ
+  unsigned int *pos;     // スロットごとのヒープ内の位置(含まれないならNO_POS)
+  unsigned int  size;    // 要素数
+  int           is_max;  // 最大ヒープかどうか
+  const double *vals;    // スロットごとの値
+} slot_heap;
+
+// 1列分の窓の順序統計量
+// 値の小さい方からk個(low)、大きい方からk個(high)、残り(mid)の3つに分けて保持する
+// 中央値はk = (n - 1) / 2 とした場合で、midの最小値と最大値の平均となる
+typedef struct {
+  double        *vals;       // スロットごとの値
+  unsigned char *part;       // スロットが属する部分(PART_xxx)
+  slot_heap      low;        // 小さい方のk個(最大ヒープ)
+  slot_heap      mid_min;    // 中央の部分(最小ヒープ)
+  slot_heap      mid_max;    // 中央の部分(最大ヒープ)
+  slot_heap      high;       // 大きい方のk個(最小ヒープ)
+  unsigned int   mid_size;   // 中央の部分の要素数
+  double         mid_sum;    // 中央の部分の総和
+  unsigned int   n_updates;  // 総和を計算し直してから、総和を更新した回数
+} order_stat;
+
+// 窓の区切り方(boundsがNULLなら、一定の幅の窓を一定の間隔でずらす)
+typedef struct {
+  const unsigned int *bounds;  // バケットの境界
+  unsigned int        len;     // データ数
+  unsigned int        width;   // 窓の幅
+  unsigned int        step;    // 窓をずらす間隔
+} window_spec;
+
+// data_fmtの座標の列の位置(fixed_fmtのpos[]と同じ順)
+static const size_t COORD_OFFSET[FIXED_COL] = {
+  offsetof(data_fmt, pos1.x), offsetof(data_fmt, pos1.y), offsetof(data_fmt, pos1.z),
+  offsetof(data_fmt, pos2.x), offsetof(data_fmt, pos2.y), offsetof(data_fmt, pos2.z),
+  offsetof(data_fmt, pos3.x), offsetof(data_fmt, pos3.y), offsetof(data_fmt, pos3.z),
+};
+
+
+static int          aggregate_windows(data_fmt *down_smpl_datas, const data_fmt *datas, const fixed_fmt *fixed_datas,
+                        const window_spec *ws, unsigned int n_windows, const aggregator *agg);
+static void         window_range(const window_spec *ws, unsigned int i, unsigned int *begin, unsigned int *end);
+static unsigned int trim_count(const aggregator *agg, unsigned int n);
+static double       aggregated_value(const order_stat *os, const aggregator *agg, unsigned int n, double scale);
+static void         os_insert(order_stat *os, unsigned int slot, double val, int use_heaps);
+static void         os_remove(order_stat *os, unsigned int slot, int use_heaps);
+static void         os_rebalance(order_stat *os, unsigned int k);
+static void         os_to_mid(order_stat *os, unsigned int slot);
+static void         os_from_mid(order_stat *os, unsigned int slot, slot_heap *dst, int part);
+static void         heap_push(slot_heap *h, unsigned int slot);
+static void         heap_remove(slot_heap *h, unsigned int slot);
+static void         heap_sift_up(slot_heap *h, unsigned int i);
+static void         heap_sift_down(slot_heap *h, unsigned int i);
+
+
+
+
+/*!
+ * 集約方法の指定を解析する
+ * "mean"(平均)、"median"(中央値)、"trim[:percent]"(両端からpercent%ずつ除いた刈り込み平均)のいずれか
+ * @param [in]  spec 集約方法の指定
+ * @param [out] agg  解析した集約方法
+ * @return 成功したなら0を、指定が不正なら-1を返す
+ */
+int parse_aggregator(const char *spec, aggregator *agg) {
+  agg->trim = 0.0;
+  if (strcmp(spec, "mean") == 0) {
+    agg->kind = AGG_MEAN;
+    return 0;
+  }
+  if (strcmp(spec, "median") == 0) {
+    agg->kind = AGG_MEDIAN;
+    return 0;
+  }
+  if (strncmp(spec, "trim", 4) == 0 && (spec[4] == '\0' || spec[4] == ':')) {
+    double  percent = DEFAULT_TRIM_PERCENT;
+    char   *check;
+
+    if (spec[4] == ':') {
+      percent = strtod(spec + 5, &check);
+      if (check == spec + 5 || *check != '\0') {
+        fprintf(stderr, "刈り込む割合:%sに数値以外がありました\n", spec + 5);
+        return -1;
+      }
+      if (!(percent >= 0.0 && percent < 50.0)) {
+        fputs("刈り込む割合には、0以上50未満の値(%)を指定してください\n", stderr);
+        return -1;
+      }
+    }
+    agg->kind = AGG_TRIM;
+    agg->trim = percent / 100.0;
+    return 0;
+  }
+  fprintf(stderr, "集約方法:%sは指定できません(mean, median, trim[:percent])\n", spec);
+  return -1;
+}
+
+
+/*!
+ * 窓の数を求める
+ * 窓はstepの倍数の位置から始まり、末尾のデータを含む窓で終わる
+ * step == width なら、ダウンサンプリングの要素数(len / width の切り上げ)と同じになる
+ * @param [in] len   データ数
+ * @param [in] width 窓の幅
+ * @param [in] step  窓をずらす間隔
+ * @return 窓の数
+ */
+unsigned int window_count(unsigned int len, unsigned int width, unsigned int step) {
+  unsigned long long last;  // 窓の始まりとなり得る位置の上限(この位置を含まない)
+
+  if (len == 0) return 0;
+  // 前の窓が末尾に届いていない間だけ、次の窓を作る
+  last = (unsigned long long)len + step > width ? (unsigned long long)len + step - width : 0;
+  if (last > len) last = len;
+  if (last <= step) return 1;
+  return (unsigned int)((last + step - 1) / step);
+}
+
+
+/*!
+ * 一定の幅の窓をずらしながら、窓ごとにデータを集約する
+ * @param [out] down_smpl_datas 集約したデータを格納する配列(window_count()個)
+ * @param [in]  datas           オリジナルのデータ
+ * @param [in]  len             オリジナルのデータ数
+ * @param [in]  width           窓の幅
+ * @param [in]  step            窓をずらす間隔
+ * @param [in]  agg             集約方法
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int down_sample_windows(data_fmt *down_smpl_datas, const data_fmt *datas, unsigned int len,
+    unsigned int width, unsigned int step, const aggregator *agg) {
+  window_spec ws = {NULL, len, width, step};
+  return aggregate_windows(down_smpl_datas, datas, NULL, &ws, window_count(len, width, step), agg);
+}
+
+
+/*!
+ * 固定小数点数のデータを、一定の幅の窓をずらしながら集約する
+ * 値は整数のままdoubleで保持するので、平均と刈り込み平均の総和に誤差は生じない
+ * @param [out] down_smpl_datas 集約したデータを格納する配列(window_count()個)
+ * @param [in]  datas           オリジナルのデータ
+ * @param [in]  len             オリジナルのデータ数
+ * @param [in]  width           窓の幅
+ * @param [in]  step            窓をずらす間隔
+ * @param [in]  agg             集約方法
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int down_sample_windows_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas, unsigned int len,
+    unsigned int width, unsigned int step, const aggregator *agg) {
+  window_spec ws = {NULL, len, width, step};
+  return aggregate_windows(down_smpl_datas, NULL, datas, &ws, window_count(len, width, step), agg);
+}
+
+
+/*!
+ * 時間のバケットごとにデータを集約する
+ * @param [out] down_smpl_datas 集約したデータを格納する配列
+ * @param [in]  datas           オリジナルのデータ
+ * @param [in]  bounds          バケットの境界(time_buckets()で求めたもの)
+ * @param [in]  n_buckets       バケットの数
+ * @param [in]  agg             集約方法
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int down_sample_windows_buckets(data_fmt *down_smpl_datas, const data_fmt *datas,
+    const unsigned int *bounds, unsigned int n_buckets, const aggregator *agg) {
+  window_spec ws = {bounds, 0, 0, 0};
+  return aggregate_windows(down_smpl_datas, datas, NULL, &ws, n_buckets, agg);
+}
+
+
+/*!
+ * 固定小数点数のデータを、時間のバケットごとに集約する
+ * @param [out] down_smpl_datas 集約したデータを格納する配列
+ * @param [in]  datas           オリジナルのデータ
+ * @param [in]  bounds          バケットの境界(time_buckets_fixed()で求めたもの)
+ * @param [in]  n_buckets       バケットの数
+ * @param [in]  agg             集約方法
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+int down_sample_windows_buckets_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas,
+    const unsigned int *bounds, unsigned int n_buckets, const aggregator *agg) {
+  window_spec ws = {bounds, 0, 0, 0};
+  return aggregate_windows(down_smpl_datas, NULL, datas, &ws, n_buckets, agg);
+}
+
+
+
+
+/*!
+ * 窓ごとにデータを集約する
+ * 列ごとに、全ての窓を順に処理する(1列分の作業領域だけをキャッシュに載せておくため)
+ * 窓の始まりと終わりはどちらも単調に増加するので、前の窓から外れたデータを取り除き、
+ * 新たに加わったデータを挿入するだけでよい。データは(行番号 % 窓の最大幅)のスロットに置く
+ * @param [out] down_smpl_datas 集約したデータを格納する配列
+ * @param [in]  datas           オリジナルのデータ(固定小数点数で処理するならNULL)
+ * @param [in]  fixed_datas     固定小数点数のデータ(datasを用いるならNULL)
+ * @param [in]  ws              窓の区切り方
+ * @param [in]  n_windows       窓の数
+ * @param [in]  agg             集約方法
+ * @return 成功したなら0を、メモリ確保に失敗したなら-1を返す
+ */
+static int aggregate_windows(data_fmt *down_smpl_datas, const data_fmt *datas, const fixed_fmt *fixed_datas,
+    const window_spec *ws, unsigned int n_windows, const aggregator *agg) {
+  unsigned int   cap = 1;  // 窓の最大幅(スロット数)
+  unsigned int   w, c, r, begin, end;
+  int            use_heaps = agg->kind != AGG_MEAN;  // 平均なら総和だけを保持すればよい
+  double         scale     = fixed_datas != NULL ? FIXED_SCALE : 1.0;
+  order_stat     os;
+  unsigned int  *idx;
+  void          *mem;
+
+  if (n_windows == 0) return 0;
+  for (w = 0; w < n_windows; w++) {
+    window_range(ws, w, &begin, &end);
+    if (end - begin > cap) cap = end - begin;
+  }
+  mem = malloc((sizeof(double) + 1 + sizeof(unsigned int) * 8) * (size_t)cap);
+  if (mem == NULL) return -1;
+  os.vals         = (double *)mem;
+  idx             = (unsigned int *)(os.vals + cap);
+  os.low.heap     = idx;
+  os.low.pos      = idx + cap;
+  os.mid_min.heap = idx + cap * 2;
+  os.mid_min.pos  = idx + cap * 3;
+  os.mid_max.heap = idx + cap * 4;
+  os.mid_max.pos  = idx + cap * 5;
+  os.high.heap    = idx + cap * 6;
+  os.high.pos     = idx + cap * 7;
+  os.part         = (unsigned char *)(idx + cap * 8);
+  os.low.is_max   = os.mid_max.is_max = 1;
+  os.high.is_max  = os.mid_min.is_max = 0;
+  os.low.vals     = os.mid_min.vals = os.mid_max.vals = os.high.vals = os.vals;
+
+  for (w = 0; w < n_windows; w++) {
+    window_range(ws, w, &begin, &end);
+    down_smpl_datas[w].time = fixed_datas != NULL ? (double)fixed_datas[begin].time / FIXED_SCALE : datas[begin].time;
+  }
+
+  for (c = 0; c < FIXED_COL; c++) {
+    unsigned int prev_begin = 0, prev_end = 0;
+
+    memset(os.part, PART_NONE, cap);
+    memset(os.low.pos, 0xff, sizeof(unsigned int) * cap);
+    memset(os.mid_min.pos, 0xff, sizeof(unsigned int) * cap);
+    memset(os.mid_max.pos, 0xff, sizeof(unsigned int) * cap);
+    memset(os.high.pos, 0xff, sizeof(unsigned int) * cap);
+    os.low.size = os.mid_min.size = os.mid_max.size = os.high.size = 0;
+    os.mid_size  = 0;
+    os.mid_sum   = 0.0;
+    os.n_updates = 0;
+
+    for (w = 0; w < n_windows; w++) {
+      unsigned int n;
+
+      window_range(ws, w, &begin, &end);
+      // 前の窓から外れたデータを取り除く
+      for (r = prev_begin; r < begin && r < prev_end; r++) {
+        os_remove(&os, r % cap, use_heaps);
+      }
+      // 新たに窓に加わったデータを挿入する
+      for (r = begin > prev_end ? begin : prev_end; r < end; r++) {
+        double val = fixed_datas != NULL ? (double)fixed_datas[r].pos[c] : *(const double *)((const char *)&datas[r] + COORD_OFFSET[c]);
+        os_insert(&os, r % cap, val, use_heaps);
+      }
+      n = end - begin;
+      if (use_heaps) os_rebalance(&os, trim_count(agg, n));
+      // 削除による桁落ちが溜まらないよう、窓の幅の回数だけ更新したら総和を計算し直す
+      if (os.n_updates >= cap) {
+        os.mid_sum = 0.0;
+        for (r = begin; r < end; r++) {
+          if (os.part[r % cap] == PART_MID) os.mid_sum += os.vals[r % cap];
+        }
+        os.n_updates = 0;
+      }
+      *(double *)((char *)&down_smpl_datas[w] + COORD_OFFSET[c]) = aggregated_value(&os, agg, n, scale);
+      prev_begin = begin;
+      prev_end   = end;
+    }
+  }
+  free(mem);
+  return 0;
+}
+
+
+/*!
+ * 窓の範囲を求める
+ * @param [in]  ws    窓の区切り方
+ * @param [in]  i     窓の番号
+ * @param [out] begin 窓の最初のデータの位置
+ * @param [out] end   窓の最後のデータの次の位置
+ */
+static void window_range(const window_spec *ws, unsigned int i, unsigned int *begin, unsigned int *end) {
+  if (ws->bounds != NULL) {
+    *begin = ws->bounds[i];
+    *end   = ws->bounds[i + 1];
+  } else {
+    *begin = i * ws->step;
+    *end   = ws->len - *begin > ws->width ? *begin + ws->width : ws->len;
+  }
+}
+
+
+/*!
+ * 小さい方と大きい方から、それぞれ除くデータ数を求める
+ * @param [in] agg 集約方法
+ * @param [in] n   窓のデータ数
+ * @return 除くデータ数(中央の部分が1つ以上残るように、(n - 1) / 2 以下とする)
+ */
+static unsigned int trim_count(const aggregator *agg, unsigned int n) {
+  unsigned int k;
+
+  if (n == 0) return 0;
+  if (agg->kind == AGG_MEDIAN) return (n - 1) / 2;
+  k = (unsigned int)floor(n * agg->trim);
+  return k <= (n - 1) / 2 ? k : (n - 1) / 2;
+}
+
+
+/*!
+ * 中央の部分から、集約した値を求める
+ * 割る数にスケールを掛けてから割るので、固定小数点数の平均はdown_sample_fixed()と同じ値になる
+ * @param [in] os    1列分の順序統計量
+ * @param [in] agg   集約方法
+ * @param [in] n     窓のデータ数
+ * @param [in] scale 値のスケール(固定小数点数ならFIXED_SCALE、それ以外は1)
+ * @return 集約した値
+ */
+static double aggregated_value(const order_stat *os, const aggregator *agg, unsigned int n, double scale) {
+  if (agg->kind == AGG_MEAN) return os->mid_sum / (n * scale);
+  if (agg->kind == AGG_MEDIAN) {
+    double lo = os->vals[os->mid_min.heap[0]];
+    double hi = os->vals[os->mid_max.heap[0]];
+    return os->mid_size == 1 ? lo / scale : (lo + hi) / (2 * scale);
+  }
+  return os->mid_sum / (os->mid_size * scale);
+}
+
+
+/*!
+ * スロットにデータを挿入する
+ * 小さい方の部分の最大値より小さければlowへ、大きい方の部分の最小値より大きければhighへ、
+ * それ以外はmidへ入れるので、各部分の大小関係は保たれる(各部分の要素数はos_rebalance()で直す)
+ * @param [in,out] os        1列分の順序統計量
+ * @param [in]     slot      スロット
+ * @param [in]     val       値
+ * @param [in]     use_heaps ヒープを保持するかどうか(平均なら総和のみを保持する)
+ */
+static void os_insert(order_stat *os, unsigned int slot, double val, int use_heaps) {
+  os->vals[slot] = val;
+  if (use_heaps && os->low.size > 0 && val < os->vals[os->low.heap[0]]) {
+    os->part[slot] = PART_LOW;
+    heap_push(&os->low, slot);
+  } else if (use_heaps && os->high.size > 0 && val > os->vals[os->high.heap[0]]) {
+    os->part[slot] = PART_HIGH;
+    heap_push(&os->high, slot);
+  } else if (use_heaps) {
+    os_to_mid(os, slot);
+  } else {
+    os->part[slot] = PART_MID;
+    os->mid_size++;
+    os->mid_sum += val;
+    os->n_updates++;
+  }
+}
+
+
+/*!
+ * スロットのデータを取り除く
+ * @param [in,out] os        1列分の順序統計量
+ * @param [in]     slot      スロット
+ * @param [in]     use_heaps ヒープを保持しているかどうか
+ */
+static void os_remove(order_stat *os, unsigned int slot, int use_heaps) {
+  switch (os->part[slot]) {
+    case PART_LOW:
+      heap_remove(&os->low, slot);
+      break;
+    case PART_HIGH:
+      heap_remove(&os->high, slot);
+      break;
+    default:
+      if (use_heaps) {
+        heap_remove(&os->mid_min, slot);
+        heap_remove(&os->mid_max, slot);
+      }
+      os->mid_size--;
+      os->mid_sum -= os->vals[slot];
+      os->n_updates++;
+      if (os->mid_size == 0) {  // 空になったら、桁落ちの無い0から数え直す
+        os->mid_sum   = 0.0;
+        os->n_updates = 0;
+      }
+      break;
+  }
+  os->part[slot] = PART_NONE;
+}
+
+
+/*!
+ * lowとhighの要素数をkにそろえる
+ * 各部分の境界の値(ヒープの先頭)を隣の部分へ移すので、大小関係は保たれる
+ * @param [in,out] os 1列分の順序統計量
+ * @param [in]     k  lowとhighのそれぞれの要素数(midが1つ以上残ること)
+ */
+static void os_rebalance(order_stat *os, unsigned int k) {
+  unsigned int slot;
+
+  while (os->low.size > k) {
+    slot = os->low.heap[0];
+    heap_remove(&os->low, slot);
+    os_to_mid(os, slot);
+  }
+  while (os->high.size > k) {
+    slot = os->high.heap[0];
+    heap_remove(&os->high, slot);
+    os_to_mid(os, slot);
+  }
+  while (os->low.size < k) {
+    os_from_mid(os, os->mid_min.heap[0], &os->low, PART_LOW);
+  }
+  while (os->high.size < k) {
+    os_from_mid(os, os->mid_max.heap[0], &os->high, PART_HIGH);
+  }
+}
+
+
+/*!
+ * スロットを中央の部分に入れる
+ * @param [in,out] os   1列分の順序統計量
+ * @param [in]     slot スロット
+ */
+static void os_to_mid(order_stat *os, unsigned int slot) {
+  os->part[slot] = PART_MID;
+  heap_push(&os->mid_min, slot);
+  heap_push(&os->mid_max, slot);
+  os->mid_size++;
+  os->mid_sum += os->vals[slot];
+  os->n_updates++;
+}
+
+
+/*!
+ * 中央の部分のスロットを、lowかhighへ移す
+ * @param [in,out] os   1列分の順序統計量
+ * @param [in]     slot スロット
+ * @param [in,out] dst  移す先のヒープ
+ * @param [in]     part 移す先の部分(PART_LOWかPART_HIGH)
+ */
+static void os_from_mid(order_stat *os, unsigned int slot, slot_heap *dst, int part) {
+  heap_remove(&os->mid_min, slot);
+  heap_remove(&os->mid_max, slot);
+  os->mid_size--;
+  os->mid_sum -= os->vals[slot];
+  os->n_updates++;
+  os->part[slot] = (unsigned char)part;
+  heap_push(dst, slot);
+}
+
+
+
+
+/*!
+ * ヒープにスロットを加える
+ * @param [in,out] h    ヒープ
+ * @param [in]     slot スロット
+ */
+static void heap_push(slot_heap *h, unsigned int slot) {
+  h->heap[h->size] = slot;
+  h->pos[slot]     = h->size;
+  heap_sift_up(h, h->size++);
+}
+
+
+/*!
+ * ヒープから、任意のスロットを取り除く
+ * 末尾の要素を空いた位置に移し、上下どちらかへ移動させる
+ * @param [in,out] h    ヒープ
+ * @param [in]     slot スロット(ヒープに含まれていること)
+ */
+static void heap_remove(slot_heap *h, unsigned int slot) {
+  unsigned int i    = h->pos[slot];
+  unsigned int last = h->heap[--h->size];
+
+  h->pos[slot] = NO_POS;
+  if (i == h->size) return;
+  h->heap[i]   = last;
+  h->pos[last] = i;
+  heap_sift_up(h, i);
+  heap_sift_down(h, h->pos[last]);
+}
+
+
+/*!
+ * ヒープの要素を、親との順序が正しくなるまで根の方へ移動させる
+ * @param [in,out] h ヒープ
+ * @param [in]     i 移動させる要素の位置
+ */
+static void heap_sift_up(slot_heap *h, unsigned int i) {
+  unsigned int slot = h->heap[i];
+
+  while (i > 0) {
+    unsigned int parent = (i - 1) / 2;
+    if (!HEAP_BEFORE(h, slot, h->heap[parent])) break;
+    h->heap[i] = h->heap[parent];
+    h->pos[h->heap[i]] = i;
+    i = parent;
+  }
+  h->heap[i]    = slot;
+  h->pos[slot]  = i;
+}
+
+
+/*!
+ * ヒープの要素を、子との順序が正しくなるまで葉の方へ移動させる
+ * @param [in,out] h ヒープ
+ * @param [in]     i 移動させる要素の位置
+ */
+static void heap_sift_down(slot_heap *h, unsigned int i) {
+  unsigned int slot = h->heap[i];
+
+  for (;;) {
+    unsigned int child = i * 2 + 1;
+    if (child >= h->size) break;
+    if (child + 1 < h->size && HEAP_BEFORE(h, h->heap[child + 1], h->heap[child])) child++;
+    if (!HEAP_BEFORE(h, h->heap[child], slot)) break;
+    h->heap[i] = h->heap[child];
+    h->pos[h->heap[i]] = i;
+    i = child;
+  }
+  h->heap[i]    = slot;
+  h->pos[slot]  = i;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "data_handler.h"
+#include "fixed_point.h"
+
+#define AGG_MEAN     0  // 平均
+#define AGG_MEDIAN   1  // 中央値
+#define AGG_TRIM     2  // 刈り込み平均
+
+#define DEFAULT_TRIM_PERCENT  10.0  // "trim"とだけ指定したときに、両端から除く割合(%)
+
+
+// 窓の中のデータを1つにまとめる方法
+typedef struct {
+  int    kind;  // AGG_xxx
+  double trim;  // 刈り込み平均で、両端からそれぞれ除く割合(0以上0.5未満)
+} aggregator;
+
+
+// 集約方法の指定 "mean", "median", "trim[:percent]" を解析する
+int parse_aggregator(const char *spec, aggregator *agg);
+// 幅widthの窓をstepずつずらすときの窓の数を求める(末尾のデータを含む窓で終わる)
+unsigned int window_count(unsigned int len, unsigned int width, unsigned int step);
+// 窓ごとに、列ごとの順序統計量で集約する(窓の時間は、窓の先頭のデータの時間とする)
+// 窓をずらすときは、外れたデータの削除と加わったデータの挿入のみを行い、1データあたりO(log width)で更新する
+int down_sample_windows(data_fmt *down_smpl_datas, const data_fmt *datas, unsigned int len,
+    unsigned int width, unsigned int step, const aggregator *agg);
+int down_sample_windows_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas, unsigned int len,
+    unsigned int width, unsigned int step, const aggregator *agg);
+// 時間のバケット(time_buckets()で求めた境界)ごとに集約する
+int down_sample_windows_buckets(data_fmt *down_smpl_datas, const data_fmt *datas,
+    const unsigned int *bounds, unsigned int n_buckets, const aggregator *agg);
+int down_sample_windows_buckets_fixed(data_fmt *down_smpl_datas, const fixed_fmt *datas,
+    const unsigned int *bounds, unsigned int n_buckets, const aggregator *agg);
@@ -1,17 +1,113 @@
 #include <getopt.h>
 #include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lib/arena.h"
+#include "lib/archive.h"
+#include "lib/daemon.h"
+#include "lib/decompress.h"
+#include "lib/events.h"
+#include "lib/feature_file.h"
+#include "lib/feature_stream.h"
+#include "lib/feature_tee.h"
+#include "lib/feature_writer.h"
 #include "lib/data_handler.h"
+#include "lib/filter.h"
+#include "lib/fixed_point.h"
+#include "lib/histogram.h"
+#include "lib/lazy_features.h"
+#include "lib/mapped_input.h"
+#include "lib/merge.h"
+#include "lib/parse_cache.h"
+#include "lib/partition.h"
+#include "lib/pose_index.h"
+#include "lib/spectral.h"
+#include "lib/sweep.h"
+#include "lib/thread_pool.h"
+#include "lib/window.h"
 
-#define DEFAULT_LEN       8192
 #define DEFAULT_MERGE_NUM   30
 #define DEFAULT_OUTPUT_FILENAME ("enshu3-out.txt")  // カッコでくくっておかないと、C言語の文字列の結合の危険性がある
+#define OPT_EVENTS        0x100  // --eventsオプション(1文字のオプションと重ならない値)
+#define OPT_SPECTRAL      0x101  // --spectralオプション
+#define OPT_BINARY        0x102  // --binaryオプション
+#define OPT_INDEX         0x103  // --indexオプション
+#define OPT_MERGE         0x104  // --mergeオプション
+#define OPT_STREAM        0x105  // --streamオプション
+#define OPT_HIST          0x106  // --histオプション
+#define OPT_PAIRWISE      0x107  // --pairwiseオプション
+#define OPT_RANGE         0x108  // --rangeオプション
+#define OPT_NUMA          0x109  // --numaオプション
+#define OPT_HUGEPAGES     0x10a  // --hugepagesオプション(-Hオプションと同じ)
 
-static int  opt_parse(int argc, char *argv[], unsigned int *merge_num, char **in_filename, char **out_filename);
-static int  convert_str2int(const char *str);
+// コマンドライン引数で指定される設定
+typedef struct {
+  char         *in_filename;       // 読み込むcsvファイル名
+  char         *out_filename;      // 書き込むファイル名(形式を付けずに-oオプションで指定した出力先)
+  char         *dump_filename;     // ダウンサンプリングデータを書き出すファイル名(NULLなら書き出さない)
+  char         *archive_filename;  // 入力データを書き出すアーカイブのファイル名(NULLなら書き出さない)
+  char         *sock_path;         // デーモンモードで待ち受けるソケットのパス(NULLなら通常モード)
+  char         *sweep_spec;        // パラメータスイープの設定の指定(NULLならスイープしない)
+  char         *merge_filenames[MAX_MERGE_INPUTS - 1];  // 入力ファイルと時間の列で併合するファイル名(--mergeオプション)
+  unsigned int  n_merge;           // 併合するファイルの数(0なら併合しない)
+  unsigned int  merge_num;         // ダウンサンプリングで結合するデータの数
+  unsigned int  window_step;       // 窓をずらす間隔(0なら、merge_numずつずらす)
+  aggregator    agg;               // 窓の中のデータの集約方法
+  filter_spec   filter;            // 平滑化フィルタの設定(幅が0なら平滑化しない)
+  event_spec    events[MAX_EVENT_SPECS];  // イベント検出の設定(--eventsオプション)
+  unsigned int  n_events;          // イベント検出の設定の数(0なら特徴データを書き出す)
+  hist_spec     hists[MAX_HIST_SPECS];  // ヒストグラムの設定(--histオプション)
+  unsigned int  n_hists;           // ヒストグラムの設定の数(0なら特徴データを書き出す)
+  spectral_spec spectral;          // 周波数特徴の設定
+  int           use_spectral;      // 周波数特徴の列を加えるかどうか
+  double        time_span;         // 時間でダウンサンプリングするときのバケットの時間幅(0なら行数で結合する)
+  unsigned int  n_threads;         // ワーカスレッド数
+  int           arena_flags;       // 作業領域のアリーナに与えるARENA_xxxフラグ
+  int           use_numa;          // ワーカスレッドをNUMAノードに固定し、作業領域を書き込むスレッドのノードに置くかどうか
+  int           use_fixed;         // 座標を固定小数点数(千分の一単位の整数)で処理するかどうか
+  int           use_cache;         // 解析結果のキャッシュを用いるかどうか
+  int           use_approx;        // 平方根を近似計算するかどうか
+  int           use_pairwise;      // ブロックの総和を、固定の形の二分木で求めるかどうか
+  int           use_binary;        // 特徴データをバイナリ形式で書き出すかどうか
+  int           make_index;        // 出力ファイルの隣に、重心位置の索引を書き出すかどうか
+  int           use_stream;        // 入力を配列に読み込まずに、窓ごとにマップしながら処理するかどうか
+  int           use_range;         // 指定した時間の範囲のブロックだけを求めるかどうか
+  double        range_t0;          // 求める時間の範囲の下限(--rangeオプション)
+  double        range_t1;          // 求める時間の範囲の上限
+  sink_spec     sinks[MAX_SINKS];  // 特徴データの出力先(-oオプション。最初の出力先はout_filename)
+  unsigned int  n_sinks;           // 出力先の数
+  int           use_tee;           // 出力先ごとのスレッドで書き出すかどうか(複数の出力先か、summary形式)
+} cmd_options;
+
+// --streamオプションで、特徴データを書き出す先
+typedef struct {
+  FILE           *f;           // 出力ファイルのファイルポインタ(teeを用いるならNULL)
+  feature_tee    *tee;         // 複数の出力先に書き出すtee(用いないならNULL)
+  feature_writer *writer;      // テキスト形式で書き出すライタ(用いないならNULL)
+  int             use_binary;  // バイナリ形式で書き出すかどうか
+  unsigned int    n_threads;   // ヒストグラムを数えるワーカスレッド数
+  histogram      *hists;       // 特徴データの代わりに数えるヒストグラム(NULLなら特徴データを書き出す)
+  unsigned int    n_hists;     // ヒストグラムの数
+} stream_output;
+
+static int  opt_parse(int argc, char *argv[], cmd_options *opts);
+static int  convert_str2int(const char *str, const char *name);
+static double convert_str2double(const char *str, const char *name);
+static int  parse_time_range(const char *arg, double *t0, double *t1);
 static void show_usage(const char *prog_name);
-static void write_features(FILE *f, const feature *feature_datas, unsigned int len);
+static int  write_down_samples(const char *filename, const data_fmt *down_smpl_datas, unsigned int len);
+static int  write_archive_file(const char *filename, const fixed_fmt *datas, unsigned int len);
+static int  write_index_file(const char *out_filename, pose_record *records, const data_fmt *down_smpl_datas, unsigned int len);
+static int  write_output_file(const cmd_options *opts, const feature *feature_datas, const spectral_feature *spectra,
+                              feature_event *events, unsigned int len);
+static int  run_merged(const cmd_options *opts);
+static int  run_streamed(const cmd_options *opts);
+static int  write_stream_rows(const feature *feature_datas, unsigned int len, uint64_t first_row, void *arg);
+static void discard_stream_output(stream_output *out);
+static int  run_range(const cmd_options *opts);
 
 
 
@@ -23,16 +119,35 @@ static void write_features(FILE *f, const feature *feature_datas, unsigned int l
  * @return 終了コード
  */
 int main(int argc, char *argv[]) {
-  static    data_fmt datas[DEFAULT_LEN];             /* csvデータを収める配列 */
+  data_fmt        *data_buf = NULL;                  /* csvデータを収める配列(読みながら広げる) */
+  fixed_fmt       *fixed_buf = NULL;                 /* csvデータを固定小数点数で収める配列(-xオプション) */
+  data_fmt        *smooth_buf = NULL;                /* 平滑化したデータを収める配列(-Fオプション) */
+  const  data_fmt *datas = NULL;                     /* 処理するデータ(キャッシュを用いるなら、マップした領域) */
+  const fixed_fmt *fixed_datas = NULL;               /* 処理する固定小数点数のデータ(同上) */
+  size_t           n_read;                           /* 読み込んだデータ数 */
+  const void      *cached;                           /* キャッシュの配列(キャッシュが無ければNULL) */
+  parse_cache      cache = {NULL, 0};                /* マップしたキャッシュ */
   FILE     *in_fp;                                   /* 読み込むcsvファイルのファイルポインタ */
   FILE     *out_fp;                                  /* 書き込むファイルのファイルポインタ */
-  char     *in_filename  = argv[argc - 1];           /* 読み込むcsvファイル名 */
-  char     *out_filename = DEFAULT_OUTPUT_FILENAME;  /* 書き込むファイル名 */
-  data_fmt *down_smpl_datas;                         /* ダウンサンプリングした後のデータ配列へのポインタ */
+  data_fmt *down_smpl_datas = NULL;                  /* ダウンサンプリングした後のデータ配列へのポインタ */
   feature  *feature_datas;                           /* ダウンサンプリングデータの特徴を収める配列へのポインタ */
+  feature_event *events = NULL;                      /* 検出したイベントを収める配列(--eventsオプション) */
+  pose_record *pose_records = NULL;                  /* 重心位置の索引のレコードを収める配列(--indexオプション) */
+  spectral_feature *spectra = NULL;                  /* 周波数特徴を収める配列(--spectralオプション) */
   unsigned int len;                                  /* csvファイルの有効要素数 */
   unsigned int alloc_num;                            /* ダウンサンプリングデータの要素数 */
-  unsigned int merge_num = DEFAULT_MERGE_NUM;        /* ダウンサンプリングで結合するデータの数 */
+  unsigned int *bounds = NULL;                       /* 時間のバケットの境界(-Tオプション) */
+  unsigned int  n_empty;                             /* データの無い時間のバケットの数 */
+  int           use_two_pass;                        /* ダウンサンプリングデータの配列を作ってから特徴を求めるか */
+  int           use_windows;                         /* 窓の順序統計量で集約するか(-M, -Wオプション) */
+  int           use_partition;                       /* 入力を部分に分け、ワーカスレッドのノードに写して処理するか(--numaオプション) */
+  data_fmt     *placed = NULL;                       /* 部分ごとに写した入力データ(--numaオプション) */
+  fixed_fmt    *fixed_placed = NULL;                 /* 部分ごとに写した固定小数点数の入力データ(--numaオプション) */
+  cmd_options  opts;                                 /* コマンドライン引数で指定された設定 */
+  int          is_archive;                           /* 入力ファイルが圧縮アーカイブかどうか */
+  arena        work_arena;                           /* ダウンサンプリングデータと特徴データの作業領域 */
+  sweep_config *sweep_configs = NULL;                /* パラメータスイープの設定の配列 */
+  unsigned int  n_sweep_configs = 0;                 /* パラメータスイープの設定の数 */
 
   // コマンドライン引数が無いとき、使い方を表示して終了
   if (argc < 2) {
@@ -41,76 +156,565 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
   /* ----- オプション解析 ----- */
-  if (opt_parse(argc, argv, &merge_num, &in_filename, &out_filename) != 0) {
+  opts.in_filename  = argv[argc - 1];
+  opts.out_filename = NULL;
+  opts.dump_filename = NULL;
+  opts.archive_filename = NULL;
+  opts.sock_path    = NULL;
+  opts.sweep_spec   = NULL;
+  opts.n_merge      = 0;
+  opts.merge_num    = DEFAULT_MERGE_NUM;
+  opts.window_step  = 0;
+  opts.agg.kind     = AGG_MEAN;
+  opts.agg.trim     = 0.0;
+  opts.filter.width = 0;
+  opts.filter.order = 0;
+  opts.n_events     = 0;
+  opts.n_hists      = 0;
+  opts.use_spectral = 0;
+  opts.time_span    = 0.0;
+  opts.n_threads    = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+  opts.arena_flags  = 0;
+  opts.use_numa     = 0;
+  opts.use_fixed    = 0;
+  opts.use_cache    = 0;
+  opts.use_approx   = 0;
+  opts.use_pairwise = 0;
+  opts.use_binary   = 0;
+  opts.make_index   = 0;
+  opts.use_stream   = 0;
+  opts.use_range    = 0;
+  opts.n_sinks      = 0;
+  if (opt_parse(argc, argv, &opts) != 0) {
     return EXIT_FAILURE;
   }
+  set_sum_mode(opts.use_pairwise ? SUM_PAIRWISE : SUM_SEQUENTIAL);
+  thread_pool_set_numa(opts.use_numa);
 
-  /* ----- データの読み取り ----- */
-  in_fp = fopen(in_filename, "r");  // 読み取るファイルをオープン
-  if (in_fp == NULL) {  // ファイルがオープン出来ないとき、
-    fprintf(stderr, "ファイル:%sが開けません\n", in_filename);
+  /* ----- デーモンモード ----- */
+  if (opts.sock_path != NULL) {
+    return run_daemon(opts.sock_path, opts.n_threads, opts.arena_flags) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  // 形式を付けずに指定した出力ファイル(どちらも指定が無ければ既定の出力ファイル)を、最初の出力先とする
+  if (opts.out_filename != NULL || opts.n_sinks == 0) {
+    if (opts.n_sinks == MAX_SINKS) {
+      fprintf(stderr, "-oオプションで指定できる出力先は%d個までです\n", MAX_SINKS);
+      return EXIT_FAILURE;
+    }
+    memmove(&opts.sinks[1], &opts.sinks[0], sizeof(sink_spec) * opts.n_sinks);
+    opts.sinks[0].format = opts.use_binary ? SINK_BINARY : SINK_TEXT;
+    opts.sinks[0].path   = opts.out_filename != NULL ? opts.out_filename : DEFAULT_OUTPUT_FILENAME;
+    opts.n_sinks++;
+  }
+  opts.out_filename = (char *)opts.sinks[0].path;
+  opts.use_binary   = opts.sinks[0].format == SINK_BINARY;
+  opts.use_tee      = opts.n_sinks > 1 || opts.sinks[0].format == SINK_SUMMARY;
+  // 出力先ごとのスレッドは、特徴データ(周波数特徴の列を除く)を書き出す
+  if (opts.use_tee && (opts.sweep_spec != NULL || opts.n_events > 0 || opts.n_hists > 0 || opts.use_spectral)) {
+    fputs("複数の出力先とsummary形式は、-S, --events, --hist, --spectralオプションと同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (opts.sweep_spec != NULL && opts.time_span > 0.0) {
+    fputs("-Sオプションと-Tオプションは同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  // 平均で、merge_numずつずらす場合は、従来のダウンサンプリングと同じなので窓を用いない
+  use_windows = opts.agg.kind != AGG_MEAN || (opts.window_step != 0 && opts.window_step != opts.merge_num);
+  if (opts.sweep_spec != NULL && opts.n_events > 0) {
+    fputs("-Sオプションと--eventsオプションは同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (opts.sweep_spec != NULL && opts.make_index) {
+    fputs("-Sオプションと--indexオプションは同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (opts.sweep_spec != NULL && opts.dump_filename != NULL) {
+    fputs("-Sオプションと-Dオプションは同時に指定できません\n", stderr);  // 設定ごとのダウンサンプリングデータを作らないため
+    return EXIT_FAILURE;
+  }
+  if (opts.sweep_spec != NULL && use_windows) {
+    fputs("-Sオプションと-M, -Wオプションは同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  // 周波数特徴は、-mオプションで区切ったブロックごとに求める
+  if (opts.use_spectral && (opts.sweep_spec != NULL || opts.time_span > 0.0 || opts.n_events > 0
+        || (opts.window_step != 0 && opts.window_step != opts.merge_num))) {
+    fputs("--spectralオプションは、-S, -T, -W, --eventsオプションと同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  // バイナリ形式はfeature構造体の配列のみを格納する
+  if (opts.use_binary && (opts.sweep_spec != NULL || opts.n_events > 0 || opts.use_spectral)) {
+    fputs("--binaryオプションは、-S, --events, --spectralオプションと同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  // ヒストグラムは、特徴データやイベントの代わりに書き出す
+  if (opts.n_hists > 0 && (opts.sweep_spec != NULL || opts.n_events > 0 || opts.use_spectral || opts.use_binary)) {
+    fputs("--histオプションは、-S, --events, --spectral, --binaryオプションと同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (opts.time_span > 0.0 && opts.window_step != 0) {
+    fputs("-Tオプションと-Wオプションは同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  // 固定小数点数の総和は整数で誤差が無く、窓の集約は窓をずらしながら総和を更新する
+  if (opts.use_pairwise && (opts.use_fixed || use_windows)) {
+    fputs("--pairwiseオプションは、-x, -M, -Wオプションと同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (opts.use_fixed && opts.filter.width != 0) {
+    fputs("-xオプションと-Fオプションは同時に指定できません\n", stderr);  // 平滑化した値は千分の一単位にならない
+    return EXIT_FAILURE;
+  }
+  if (opts.use_fixed && llround(opts.time_span * FIXED_SCALE) <= 0 && opts.time_span > 0.0) {
+    fputs("-xオプションでは、時間幅を0.001秒以上にしてください\n", stderr);
     return EXIT_FAILURE;
   }
-  len = read_csv(in_fp, datas);  // ファイルを読み取り、有効データ数を取得
-  fclose(in_fp);                 // 読み取ったファイルをクローズ
+  // 時間の範囲を指定したときは、-mオプションのブロックの特徴データを、範囲の分だけ求めて書き出す
+  if (opts.use_range && (opts.n_merge > 0 || opts.use_stream || opts.sweep_spec != NULL || opts.time_span > 0.0 || use_windows
+        || opts.filter.width != 0 || opts.use_fixed || opts.use_approx || opts.archive_filename != NULL
+        || opts.dump_filename != NULL || opts.use_spectral || opts.make_index || opts.n_events > 0 || opts.n_hists > 0 || opts.use_tee)) {
+    fputs("--rangeオプションは、-A, -a, -D, -F, -M, -S, -T, -W, -x, --events, --hist, --index, --merge, --spectral, --streamオプション、"
+          "複数の出力先、summary形式と同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (opts.use_range) {
+    return run_range(&opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  // 併合したフレームと--streamオプションの入力は、配列に読み込まずに、-mオプションのブロックごとに特徴データにする
+  if ((opts.n_merge > 0 || opts.use_stream) && (opts.sweep_spec != NULL || opts.time_span > 0.0 || use_windows || opts.filter.width != 0
+        || opts.use_fixed || opts.use_cache || opts.archive_filename != NULL || opts.dump_filename != NULL
+        || opts.use_spectral || opts.make_index)) {
+    fputs("--merge, --streamオプションは、-A, -C, -D, -F, -M, -S, -T, -W, -x, --spectral, --indexオプションと同時に指定できません\n", stderr);
+    return EXIT_FAILURE;
+  }
+  if (opts.use_stream && opts.n_events > 0) {
+    fputs("--streamオプションと--eventsオプションは同時に指定できません\n", stderr);  // 特徴データを全て持たないため
+    return EXIT_FAILURE;
+  }
+  if (opts.use_stream) {
+    unsigned int i;
+    for (i = 0; i < opts.n_hists; i++) {
+      if (!opts.hists[i].has_range) {
+        // 特徴データを全て持たないので、最小値と最大値を先に求められない
+        fprintf(stderr, "--streamオプションでは、ヒストグラム:%sの範囲(lo:hi)を指定してください\n", opts.hists[i].text);
+        return EXIT_FAILURE;
+      }
+    }
+    return run_streamed(&opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (opts.n_merge > 0) {
+    return run_merged(&opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  // 入力を読み取る前に、スイープの設定の誤りを検出しておく
+  if (opts.sweep_spec != NULL && parse_sweep_spec(opts.sweep_spec, &sweep_configs, &n_sweep_configs) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  /* ----- データの読み取り ----- */
+  // キャッシュが有効なら、ファイルを解析せずにキャッシュをマップして用いる
+  cached = opts.use_cache ? parse_cache_load(&cache, opts.in_filename, opts.use_fixed ? PARSE_CACHE_FIXED : PARSE_CACHE_DOUBLE, 0, &len) : NULL;
+  if (cached != NULL) {
+    if (opts.use_fixed) {
+      fixed_datas = (const fixed_fmt *)cached;
+    } else {
+      datas = (const data_fmt *)cached;
+    }
+  } else {
+    is_archive = is_archive_file(opts.in_filename);  // 圧縮アーカイブかどうかはマジックで判定する
+    if (is_archive) {
+      in_fp = fopen(opts.in_filename, "rb");  // 読み取るファイルをオープン
+      if (in_fp == NULL) {  // ファイルがオープン出来ないとき、
+        fprintf(stderr, "ファイル:%sが開けません\n", opts.in_filename);
+        return EXIT_FAILURE;
+      }
+    } else if ((in_fp = open_input(opts.in_filename, opts.n_threads)) == NULL) {  // 圧縮されていれば、展開しながら読む
+      return EXIT_FAILURE;
+    }
+    // 配列は読みながら広げるので、入力の行数に上限は無い
+    if (is_archive && opts.use_fixed) {
+      fixed_buf = read_archive_fixed(in_fp, &n_read);
+    } else if (is_archive) {
+      data_buf = read_archive(in_fp, &n_read);
+    } else if (opts.use_fixed) {
+      fixed_buf = read_csv_fixed(in_fp, &n_read);  // ファイルを読み取り、有効データ数を取得
+    } else {
+      data_buf = read_csv(in_fp, &n_read);  // ファイルを読み取り、有効データ数を取得
+    }
+    if (data_buf == NULL && fixed_buf == NULL) {
+      // アーカイブが壊れていれば、途中までのデータで処理を続けずにエラーとする(理由は出力済み)
+      if (!is_archive) fputs("メモリ確保に失敗しました\n", stderr);
+      return EXIT_FAILURE;
+    }
+    if (ferror(in_fp)) {  // 圧縮データの展開に失敗したときなど
+      fprintf(stderr, "ファイル:%sの読み取りに失敗しました\n", opts.in_filename);
+      return EXIT_FAILURE;
+    }
+    fclose(in_fp);                 // 読み取ったファイルをクローズ
+    // 以降の処理はブロックの番号をunsigned intで数えるので、それを超える入力は--streamオプションで処理する
+    if (n_read > UINT_MAX) {
+      fputs("有効なデータが多すぎます(--streamオプションを用いてください)\n", stderr);
+      return EXIT_FAILURE;
+    }
+    len         = (unsigned int)n_read;
+    datas       = data_buf;
+    fixed_datas = fixed_buf;
+    // 読み取りに失敗した場合はここに来ないので、キャッシュには常にファイル全体の解析結果を書き出す
+    if (opts.use_cache && parse_cache_store(opts.in_filename, opts.use_fixed ? PARSE_CACHE_FIXED : PARSE_CACHE_DOUBLE, 0,
+          opts.use_fixed ? (const void *)fixed_buf : (const void *)data_buf, len) != 0) {
+      fputs("解析結果をキャッシュに書き込むことが出来ませんでした\n", stderr);  // キャッシュが無くとも処理は続ける
+    }
+  }
+
+  /* ----- アーカイブの書き出し ----- */
+  if (opts.archive_filename != NULL) {
+    if (!opts.use_fixed) {
+      fixed_buf = (fixed_fmt *)malloc(sizeof(fixed_fmt) * ((size_t)len + 1));
+      if (fixed_buf == NULL) {
+        fputs("メモリ確保に失敗しました\n", stderr);
+        return EXIT_FAILURE;
+      }
+      if (quantize_datas(fixed_buf, datas, len) != 0) {  // 量子化で値が変わるなら、アーカイブは書き出さない
+        return EXIT_FAILURE;
+      }
+      fixed_datas = fixed_buf;
+    }
+    if (write_archive_file(opts.archive_filename, fixed_datas, len) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* ----- 平滑化(-Fオプション) ----- */
+  // アーカイブとキャッシュには元のデータを残し、以降の処理は全て平滑化したデータに対して行う
+  if (opts.filter.width != 0) {
+    smooth_buf = (data_fmt *)malloc(sizeof(data_fmt) * ((size_t)len + 1));
+    if (smooth_buf == NULL || smooth_datas(smooth_buf, datas, len, &opts.filter) != 0) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      return EXIT_FAILURE;
+    }
+    datas = smooth_buf;
+  }
+
+  /* ----- パラメータスイープ ----- */
+  // 読み取ったデータを全ての設定で共有し、並列に処理して1つのファイルに書き出す
+  if (sweep_configs != NULL) {
+    int ret;
+    out_fp = fopen(opts.out_filename, "w");
+    if (out_fp == NULL) {
+      fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts.out_filename);
+      return EXIT_FAILURE;
+    }
+    ret = run_sweep(out_fp, opts.use_fixed ? NULL : datas, opts.use_fixed ? fixed_datas : NULL, len,
+        sweep_configs, n_sweep_configs, opts.n_threads, opts.arena_flags, opts.use_approx);
+    free(sweep_configs);
+    parse_cache_release(&cache);
+    free(smooth_buf);
+    free(fixed_buf);
+    free(data_buf);
+    if (fclose(out_fp) != 0) {
+      fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts.out_filename);
+      return EXIT_FAILURE;
+    }
+    if (ret != 0) {
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+
+  /* ----- 時間によるバケット分け(-Tオプション) ----- */
+  // 行数ではなく時間の列で区切るので、ダウンサンプリングデータの要素数はバケットの境界を求めるまで分からない
+  if (opts.time_span > 0.0) {
+    int ret;
+    arena_init(&work_arena, sizeof(unsigned int) * ((size_t)len + 1), opts.arena_flags);
+    bounds = (unsigned int *)arena_alloc(&work_arena, sizeof(unsigned int) * ((size_t)len + 1));
+    if (bounds == NULL) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      return EXIT_FAILURE;
+    }
+    if (opts.use_fixed) {
+      ret = time_buckets_fixed(bounds, fixed_datas, len, llround(opts.time_span * FIXED_SCALE), &alloc_num, &n_empty);
+    } else {
+      ret = time_buckets(bounds, datas, len, opts.time_span, &alloc_num, &n_empty);
+    }
+    if (ret != 0) {
+      fputs("時間の列が昇順に並んでいないので、時間で区切ることが出来ません\n", stderr);
+      return EXIT_FAILURE;
+    }
+    if (n_empty > 0) {
+      fprintf(stderr, "データの無い区間が%u個あったので、飛ばしました\n", n_empty);
+    }
+  }
 
 
   /* ----- ダウンサンプリングデータと特徴データのメモリ確保 ----- */
-  alloc_num       = len % merge_num == 0 ? (len / merge_num) : (len / merge_num + 1);
-  down_smpl_datas = (data_fmt *)malloc(sizeof(data_fmt) * alloc_num);
-  feature_datas   = (feature  *)malloc(sizeof(feature)  * alloc_num);
-  if (down_smpl_datas == NULL || feature_datas == NULL) {
+  // 両方の配列を収める容量を、アリーナに一度に確保しておく
+  // ダウンサンプリングデータの配列は、-Dオプションで書き出すときと、窓で集約するときと、
+  // 時間で区切って近似計算するとき(1パスの近似計算版が無いため)と、索引を作るときだけ必要となる
+  // --numaオプションでは、行数で区切る1パスの処理を部分に分け、入力データもアリーナに写して、
+  // その部分を処理するワーカスレッドのノードに置く(読み込んだ配列は、読み込んだスレッドのノードにある)
+  use_two_pass  = opts.dump_filename != NULL || use_windows || (bounds != NULL && opts.use_approx) || opts.make_index;
+  use_partition = opts.use_numa && bounds == NULL && !use_two_pass;
+  if (bounds == NULL) {
+    if (use_windows) {
+      alloc_num = window_count(len, opts.merge_num, opts.window_step != 0 ? opts.window_step : opts.merge_num);
+    } else {
+      alloc_num = len % opts.merge_num == 0 ? (len / opts.merge_num) : (len / opts.merge_num + 1);
+    }
+    arena_init(&work_arena, (sizeof(data_fmt) + sizeof(feature)) * (size_t)alloc_num + 128
+        + (use_partition ? (opts.use_fixed ? sizeof(fixed_fmt) : sizeof(data_fmt)) * (size_t)len + 64 : 0), opts.arena_flags);
+  }
+  if (use_two_pass) {
+    down_smpl_datas = (data_fmt *)arena_alloc(&work_arena, sizeof(data_fmt) * alloc_num);
+  }
+  if (use_partition && opts.use_fixed) {
+    fixed_placed = (fixed_fmt *)arena_alloc(&work_arena, sizeof(fixed_fmt) * len);
+  } else if (use_partition) {
+    placed = (data_fmt *)arena_alloc(&work_arena, sizeof(data_fmt) * len);
+  }
+  feature_datas = (feature *)arena_alloc(&work_arena, sizeof(feature) * alloc_num);
+  if (opts.n_events > 0) {
+    events = (feature_event *)arena_alloc(&work_arena, sizeof(feature_event) * ((alloc_num + 1) / 2 + 1));
+  }
+  if (opts.use_spectral) {
+    spectra = (spectral_feature *)arena_alloc(&work_arena, sizeof(spectral_feature) * alloc_num);
+  }
+  if (opts.make_index) {
+    pose_records = (pose_record *)arena_alloc(&work_arena, sizeof(pose_record) * alloc_num);
+  }
+  if ((use_two_pass && down_smpl_datas == NULL) || feature_datas == NULL || (opts.n_events > 0 && events == NULL)
+      || (use_partition && placed == NULL && fixed_placed == NULL)
+      || (opts.use_spectral && spectra == NULL) || (opts.make_index && pose_records == NULL)) {
     fputs("メモリ確保に失敗しました\n", stderr);
     return EXIT_FAILURE;
   }
 
 
   /* -----  ダウンサンプリングと特徴データの抽出 ----- */
-  down_sample(down_smpl_datas, datas, len, merge_num);
-  derive_features(feature_datas, down_smpl_datas, alloc_num);
+  if (use_partition) {
+    if (down_sample_features_partitioned(feature_datas, placed, fixed_placed, opts.use_fixed ? NULL : datas,
+          opts.use_fixed ? fixed_datas : NULL, len, opts.merge_num, opts.use_approx, opts.n_threads) != 0) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      return EXIT_FAILURE;
+    }
+    // 以降の処理(--spectralオプションなど)も、ワーカスレッドのノードに写した方を読む
+    if (opts.use_fixed) {
+      fixed_datas = fixed_placed;
+    } else {
+      datas = placed;
+    }
+  } else if (use_two_pass) {
+    if (use_windows) {
+      unsigned int step = opts.window_step != 0 ? opts.window_step : opts.merge_num;
+      int          ret;
+      if (bounds != NULL && opts.use_fixed) {
+        ret = down_sample_windows_buckets_fixed(down_smpl_datas, fixed_datas, bounds, alloc_num, &opts.agg);
+      } else if (bounds != NULL) {
+        ret = down_sample_windows_buckets(down_smpl_datas, datas, bounds, alloc_num, &opts.agg);
+      } else if (opts.use_fixed) {
+        ret = down_sample_windows_fixed(down_smpl_datas, fixed_datas, len, opts.merge_num, step, &opts.agg);
+      } else {
+        ret = down_sample_windows(down_smpl_datas, datas, len, opts.merge_num, step, &opts.agg);
+      }
+      if (ret != 0) {
+        fputs("メモリ確保に失敗しました\n", stderr);
+        return EXIT_FAILURE;
+      }
+    } else if (bounds != NULL && opts.use_fixed) {
+      down_sample_buckets_fixed(down_smpl_datas, fixed_datas, bounds, alloc_num);
+    } else if (bounds != NULL) {
+      down_sample_buckets(down_smpl_datas, datas, bounds, alloc_num);
+    } else if (opts.use_fixed) {
+      down_sample_fixed(down_smpl_datas, fixed_datas, len, opts.merge_num);
+    } else {
+      down_sample(down_smpl_datas, datas, len, opts.merge_num);
+    }
+    if (opts.use_approx) {
+      position prev_cog_pos = {0.0, 0.0, 0.0};
+      derive_features_approx(feature_datas, down_smpl_datas, alloc_num, &prev_cog_pos, 1);
+    } else {
+      derive_features(feature_datas, down_smpl_datas, alloc_num);
+    }
+    if (opts.dump_filename != NULL && write_down_samples(opts.dump_filename, down_smpl_datas, alloc_num) != 0) {
+      return EXIT_FAILURE;
+    }
+  } else if (bounds != NULL && opts.use_fixed) {
+    down_sample_features_buckets_fixed(feature_datas, fixed_datas, bounds, alloc_num);
+  } else if (bounds != NULL) {
+    down_sample_features_buckets(feature_datas, datas, bounds, alloc_num);
+  } else if (opts.use_fixed && opts.use_approx) {
+    down_sample_features_fixed_approx(feature_datas, fixed_datas, len, opts.merge_num);
+  } else if (opts.use_fixed) {
+    down_sample_features_fixed(feature_datas, fixed_datas, len, opts.merge_num);
+  } else if (opts.use_approx) {
+    down_sample_features_approx(feature_datas, datas, len, opts.merge_num);
+  } else {
+    down_sample_features(feature_datas, datas, len, opts.merge_num);  // 中間配列を作らずに1パスで処理
+  }
+
+
+  /* ----- 周波数特徴の抽出(--spectralオプション) ----- */
+  if (opts.use_spectral && derive_spectral_features(spectra, opts.use_fixed ? NULL : datas, opts.use_fixed ? fixed_datas : NULL,
+        len, opts.merge_num, &opts.spectral) != 0) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    return EXIT_FAILURE;
+  }
 
 
   /* ----- データの書き込み ----- */
-  out_fp = fopen(out_filename, "w");  // 出力ファイルをオープン
-  if (out_fp == NULL) {  // ファイルがオープン出来ないとき、
-    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", out_filename);
+  if (write_output_file(&opts, feature_datas, spectra, events, alloc_num) != 0) {
+    return EXIT_FAILURE;
+  }
+  if (opts.make_index && write_index_file(opts.out_filename, pose_records, down_smpl_datas, alloc_num) != 0) {
     return EXIT_FAILURE;
   }
-  write_features(out_fp, feature_datas, alloc_num);  // ファイルに書き込む
 
 
   // この後すぐにプログラムを終了するので、
   // 明示的に解放しなくともよいが、お行儀よく解放しておく。
-  free(down_smpl_datas);  // ダウンサンプリングデータ領域の解放
-  free(feature_datas);    // 特徴データ領域の解放
+  arena_destroy(&work_arena);  // ダウンサンプリングデータと特徴データの領域の解放
+  parse_cache_release(&cache); // キャッシュのマップの解除
+  free(smooth_buf);
+  free(fixed_buf);
+  free(data_buf);              // 入力データの配列の解放
   return EXIT_SUCCESS;    // 正常終了
 }
 
 
 /*!
  * オプションを解析する
- * @param [in]  argc         コマンドライン引数の個数(プログラム名も含む)
- * @param [in]  argv         コマンドライン引数の配列
- * @param [out] merge_num    ダウンサンプリングでまとめる数
- * @param [out] in_filename  読み込むファイル名
- * @param [out] out_filename 出力ファイル名
+ * @param [in]     argc コマンドライン引数の個数(プログラム名も含む)
+ * @param [in]     argv コマンドライン引数の配列
+ * @param [in,out] opts 解析結果を格納する設定(あらかじめデフォルト値を設定しておくこと)
  * @return 正常に解析出来たならば0を、プログラムを終了させるときは-1を返す
  */
-static int opt_parse(int argc, char *argv[], unsigned int *merge_num, char **in_filename, char **out_filename) {
-  char ch;  // オプション文字格納用変数
-  while ((ch = getopt(argc, argv, "f:hm:o:")) != -1) {
+static int opt_parse(int argc, char *argv[], cmd_options *opts) {
+  static const struct option LONG_OPTIONS[] = {
+    {"events",    required_argument, NULL, OPT_EVENTS},
+    {"spectral",  required_argument, NULL, OPT_SPECTRAL},
+    {"binary",    no_argument,       NULL, OPT_BINARY},
+    {"index",     no_argument,       NULL, OPT_INDEX},
+    {"merge",     required_argument, NULL, OPT_MERGE},
+    {"stream",    no_argument,       NULL, OPT_STREAM},
+    {"hist",      required_argument, NULL, OPT_HIST},
+    {"pairwise",  no_argument,       NULL, OPT_PAIRWISE},
+    {"range",     required_argument, NULL, OPT_RANGE},
+    {"numa",      no_argument,       NULL, OPT_NUMA},
+    {"hugepages", no_argument,       NULL, OPT_HUGEPAGES},
+    {NULL,        0,                 NULL, 0}
+  };
+  int       ch;    // オプション文字格納用変数
+  int       ret;   // 解析関数の戻り値
+  sink_spec sink;  // -oオプションで指定された出力先
+  while ((ch = getopt_long(argc, argv, "A:aCD:F:f:Hhj:M:m:o:S:s:T:W:x", LONG_OPTIONS, NULL)) != -1) {
     switch (ch) {
+      case 'A':  // 入力データを書き出すアーカイブのファイル名を指定する
+        opts->archive_filename = optarg;
+        break;
+      case 'a':  // 平方根を近似計算する
+        opts->use_approx = 1;
+        break;
+      case 'C':  // 解析結果のキャッシュを用いる
+        opts->use_cache = 1;
+        break;
+      case 'D':  // ダウンサンプリングデータを書き出すファイル名を指定する
+        opts->dump_filename = optarg;
+        break;
+      case 'F':  // 平滑化フィルタを指定する
+        if (parse_filter_spec(optarg, &opts->filter) != 0) return -1;
+        break;
       case 'f':  // 入力ファイル名を指定する
-        *in_filename = optarg;
+        opts->in_filename = optarg;
+        break;
+      case 'H':  // 作業領域にヒュージページを用いる
+      case OPT_HUGEPAGES:
+        opts->arena_flags |= ARENA_HUGEPAGE;
         break;
       case 'h':  // ヘルプを表示する
         show_usage(argv[0]);
         exit(EXIT_SUCCESS);   // ヘルプは正常終了コードをシステムに返す
+      case 'j':  // ワーカスレッド数を指定
+        opts->n_threads = convert_str2int(optarg, "スレッド数");
+        break;
+      case 'M':  // 窓の中のデータの集約方法を指定
+        if (parse_aggregator(optarg, &opts->agg) != 0) return -1;
+        break;
       case 'm':  // ダウンサンプリングでまとめる数を指定
-        *merge_num = convert_str2int(optarg);
+        opts->merge_num = convert_str2int(optarg, "ダウンサンプリングの要素数");
+        break;
+      case 'o':  // 出力ファイル名を指定する("format:path"なら、その形式の出力先を加える)
+        ret = parse_sink_spec(optarg, &sink);
+        if (ret < 0) return -1;
+        if (ret == 0) {
+          opts->out_filename = optarg;
+          break;
+        }
+        if (opts->n_sinks == MAX_SINKS) {
+          fprintf(stderr, "-oオプションで指定できる出力先は%d個までです\n", MAX_SINKS);
+          return -1;
+        }
+        opts->sinks[opts->n_sinks++] = sink;
+        break;
+      case 'S':  // パラメータスイープの設定を指定する
+        opts->sweep_spec = optarg;
+        break;
+      case 's':  // デーモンモードで待ち受けるソケットのパスを指定する
+        opts->sock_path = optarg;
+        break;
+      case 'T':  // 時間でダウンサンプリングするときの時間幅を指定
+        opts->time_span = convert_str2double(optarg, "時間幅");
+        break;
+      case 'W':  // 窓をずらす間隔を指定(スライディングウィンドウ)
+        opts->window_step = convert_str2int(optarg, "窓をずらす間隔");
         break;
-      case 'o':  // 出力ファイル名を指定する
-        *out_filename = optarg;
+      case 'x':  // 固定小数点数で処理する
+        opts->use_fixed = 1;
+        break;
+      case OPT_EVENTS:  // 特徴データの代わりに、閾値をまたいだ区間を書き出す
+        if (opts->n_events == MAX_EVENT_SPECS) {
+          fprintf(stderr, "--eventsオプションは%d回までしか指定できません\n", MAX_EVENT_SPECS);
+          return -1;
+        }
+        if (parse_event_spec(optarg, &opts->events[opts->n_events]) != 0) return -1;
+        opts->n_events++;
+        break;
+      case OPT_SPECTRAL:  // 重心の運動の周波数特徴の列を加える
+        if (parse_spectral_spec(optarg, &opts->spectral) != 0) return -1;
+        opts->use_spectral = 1;
+        break;
+      case OPT_BINARY:  // 特徴データをバイナリ形式で書き出す
+        opts->use_binary = 1;
+        break;
+      case OPT_INDEX:  // 出力ファイルの隣に、重心位置の索引を書き出す
+        opts->make_index = 1;
+        break;
+      case OPT_MERGE:  // 入力ファイルと時間の列で併合するファイルを加える
+        if (opts->n_merge == MAX_MERGE_INPUTS - 1) {
+          fprintf(stderr, "--mergeオプションは%d回までしか指定できません\n", MAX_MERGE_INPUTS - 1);
+          return -1;
+        }
+        opts->merge_filenames[opts->n_merge++] = optarg;
+        break;
+      case OPT_STREAM:  // 入力を配列に読み込まずに、窓ごとにマップしながら処理する
+        opts->use_stream = 1;
+        break;
+      case OPT_HIST:  // 特徴データの代わりに、特徴の分布を書き出す
+        if (opts->n_hists == MAX_HIST_SPECS) {
+          fprintf(stderr, "--histオプションは%d回までしか指定できません\n", MAX_HIST_SPECS);
+          return -1;
+        }
+        if (parse_hist_spec(optarg, &opts->hists[opts->n_hists]) != 0) return -1;
+        opts->n_hists++;
+        break;
+      case OPT_PAIRWISE:  // ブロックの総和を、固定の形の二分木で求める
+        opts->use_pairwise = 1;
+        break;
+      case OPT_RANGE:  // 指定した時間の範囲のブロックだけを求めて書き出す
+        if (parse_time_range(optarg, &opts->range_t0, &opts->range_t1) != 0) return -1;
+        opts->use_range = 1;
+        break;
+      case OPT_NUMA:  // ワーカスレッドをNUMAノードに固定し、作業領域をファーストタッチで置く
+        opts->use_numa     = 1;
+        opts->arena_flags |= ARENA_FIRST_TOUCH;
         break;
       default:   // 存在しないオプションが指定されたとき
         fputs("無効なオプションが指定されています\n", stderr);
@@ -123,10 +727,11 @@ static int opt_parse(int argc, char *argv[], unsigned int *merge_num, char **in_
 
 /*!
  * 引数の文字列を数値に変換する。
- * @param [in] str 数値に変換する文字列
+ * @param [in] str  数値に変換する文字列
+ * @param [in] name エラーメッセージに用いる、値の名前
  * @return 変換した数値
  */
-static int convert_str2int(const char *str) {
+static int convert_str2int(const char *str, const char *name) {
   char *check;
   int   num = strtol(str, &check, 10);  // char * -> long
   if (*check != '\0') {
@@ -134,16 +739,67 @@ static int convert_str2int(const char *str) {
     exit(EXIT_FAILURE);
   }
   if (num <= 0) {
-    fputs("ダウンサンプリングの要素数に0以下の値を指定しないでください\n", stderr);
+    fprintf(stderr, "%sに0以下の値を指定しないでください\n", name);
     exit(EXIT_FAILURE);
   } else if (num == INT_MAX) {
-    fputs("ダウンサンプリングの要素数の値が大きすぎます\n", stderr);
+    fprintf(stderr, "%sの値が大きすぎます\n", name);
+    exit(EXIT_FAILURE);
+  }
+  return num;
+}
+
+
+/*!
+ * 引数の文字列を、正の実数に変換する。
+ * @param [in] str  数値に変換する文字列
+ * @param [in] name エラーメッセージに用いる、値の名前
+ * @return 変換した数値
+ */
+static double convert_str2double(const char *str, const char *name) {
+  char   *check;
+  double  num = strtod(str, &check);
+  if (check == str || *check != '\0') {
+    fputs("文字列に数値以外がありました\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (!(num > 0.0) || num == HUGE_VAL) {
+    fprintf(stderr, "%sには0より大きい有限の値を指定してください\n", name);
     exit(EXIT_FAILURE);
   }
   return num;
 }
 
 
+/*!
+ * --rangeオプションの時間の範囲 "t0:t1" を解析する
+ * @param [in]  arg 時間の範囲の指定
+ * @param [out] t0  時間の下限
+ * @param [out] t1  時間の上限
+ * @return 正常に解析出来たならば0を、それ以外なら-1を返す
+ */
+static int parse_time_range(const char *arg, double *t0, double *t1) {
+  const char *hi;
+  char       *check;
+
+  *t0 = strtod(arg, &check);
+  if (check == arg || *check != ':') {
+    fprintf(stderr, "時間の範囲:%sは t0:t1 の形式で指定してください\n", arg);
+    return -1;
+  }
+  hi  = check + 1;
+  *t1 = strtod(hi, &check);
+  if (check == hi || *check != '\0' || !isfinite(*t0) || !isfinite(*t1)) {
+    fprintf(stderr, "時間の範囲:%sは t0:t1 の形式で指定してください\n", arg);
+    return -1;
+  }
+  if (*t0 > *t1) {
+    fputs("時間の範囲は、t0をt1以下にしてください\n", stderr);
+    return -1;
+  }
+  return 0;
+}
+
+
 /*!
  * プログラムの使い方を表示する
  * @param [in] prog_name プログラム名
@@ -155,14 +811,50 @@ static void show_usage(const char *prog_name) {
   printf("    %s [-options] -f filename [-options]\n\n", prog_name);
 
   puts("オプション:");
+  puts("  -A : 入力データを圧縮アーカイブとして書き出すファイル名を指定します");
+  puts("  -a : 平方根を単精度で近似計算します(平方根ごとの相対誤差1e-7未満。面積は外積から求めます)");
+  puts("  -C : 入力ファイルの解析結果をキャッシュし、次回以降の解析を省きます");
+  puts("  -D : ダウンサンプリングデータを書き出すファイル名を指定します");
+  puts("  -F : ダウンサンプリングの前に、座標を平滑化します(ma:width, sg:width:order)");
   puts("  -f : 入力csvファイル名を指定します");
+  puts("  -H : 作業領域をヒュージページで確保します(--hugepagesと同じ)");
   puts("  -h : 使い方を表示します");
+  puts("  -j : ワーカスレッド数を指定します");
+  puts("  -M : 窓の中のデータの集約方法を指定します(mean, median, trim[:percent])");
   puts("  -m : ダウンサンプリングでまとめる要素数を指定します");
-  puts("  -o : 出力ファイル名を指定します\n");
+  puts("  -o : 出力ファイル名を指定します。format:path の形式で、出力先を追加できます");
+  puts("       (format: text, binary, summary  それぞれ別のスレッドで書き出します)");
+  puts("  -S : 指定した設定の全ての組み合わせで処理し、結果を1つのファイルに書き出します");
+  puts("       (merge_num[,...][:offset[,...][:features[,...]]]  features: len+area+cog, all)");
+  puts("  -s : デーモンモードで起動し、指定したUnixドメインソケットで待ち受けます");
+  puts("  -T : 行数ではなく、時間の列で指定した秒数ごとに区切ってダウンサンプリングします");
+  puts("  -W : -mで指定した幅の窓を、指定した要素数ずつずらしながらダウンサンプリングします");
+  puts("  -x : 座標を固定小数点数(小数点以下3桁)として、整数演算で処理します");
+  puts("  --events : 特徴データの代わりに、特徴が閾値をまたいだ区間を書き出します");
+  puts("             (feature>on[:off[:min_duration]] または feature<on[...]  feature: len, area, cog)");
+  puts("  --spectral : 重心の運動の卓越周波数と、指定した周波数帯(lo:hi Hz)の成分の分散の列を加えます");
+  puts("  --binary : 特徴データを、g3searchでmmapして読めるバイナリ形式で書き出します");
+  puts("  --index : 出力ファイル名に.g3kdを付けたファイルに、ブロックの重心位置のk-d木を書き出します");
+  puts("  --merge : 同時に記録した別のcsvファイルを、時間の列の順に入力ファイルと併合して処理します");
+  puts("  --stream : 入力を配列に読み込まずに少しずつマップし、特徴データを順に書き出します(大きな入力用)");
+  puts("  --hist : 特徴データの代わりに、特徴の分布を区間ごとに数えて書き出します");
+  puts("           (feature[,feature]:bins[xbins][:lo:hi[:lo:hi]][:log]  feature: len, area, cog)");
+  puts("  --pairwise : ブロックの総和を、データ数だけで形の決まる二分木で求めます(どの環境でも同じ結果)");
+  puts("  --range : 時間がt0以上t1以下のブロックの特徴データだけを求めて書き出します(t0:t1  大きな入力用)");
+  puts("  --numa : ワーカスレッドをNUMAノードに固定し、作業領域を処理するスレッドのノードに置きます");
+  puts("  --hugepages : -Hと同じです\n");
 
   puts("使用例:");
   puts("  $ group03.exe enshu3.txt");
-  puts("  $ group03.exe -m 120 -f enshu3.txt -o out.txt\n");
+  puts("  $ group03.exe -m 120 -f enshu3.txt -o out.txt");
+  puts("  $ group03.exe -S 10,30,60:0,5:all,len+area enshu3.txt");
+  puts("  $ group03.exe -M median -m 30 -W 5 enshu3.txt");
+  puts("  $ group03.exe --events 'cog>20:10:0.5' enshu3.txt");
+  puts("  $ group03.exe -o out.txt -o binary:out.g3f -o summary:out.sum enshu3.txt");
+  puts("  $ group03.exe --hist len:50 --hist area,len:40:log enshu3.txt");
+  puts("  $ group03.exe --range 120.5:130 -o part.txt huge.txt");
+  puts("  $ group03.exe --merge camera2.txt --merge camera3.txt camera1.txt");
+  puts("  $ group03.exe -s /tmp/group03.sock -j 8\n");
 
   puts("補足:");
   puts("  同じオプションを複数回指定した場合は、後の指定を優先します");
@@ -170,22 +862,399 @@ static void show_usage(const char *prog_name) {
 
 
 /*!
- * 結果をファイルに出力する
- * @param [in] f             出力ファイルにファイルポインタ
+ * ダウンサンプリングデータをファイルに出力する
+ * 入力csvファイルと同じ書式で書き出す
+ * @param [in] filename        出力ファイル名
+ * @param [in] down_smpl_datas ダウンサンプリングデータの配列
+ * @param [in] len             ダウンサンプリングデータの要素数
+ * @return 正常に書き出せたなら0を、それ以外なら-1を返す
+ */
+static int write_down_samples(const char *filename, const data_fmt *down_smpl_datas, unsigned int len) {
+  unsigned int i;
+  int          ret = 0;
+  FILE        *f   = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", filename);
+    return -1;
+  }
+  for (i = 0; i < len && ret == 0; i++, down_smpl_datas++) {
+    if (fprintf(f, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf\n",
+            down_smpl_datas->time,
+            down_smpl_datas->pos1.x, down_smpl_datas->pos1.y, down_smpl_datas->pos1.z,
+            down_smpl_datas->pos2.x, down_smpl_datas->pos2.y, down_smpl_datas->pos2.z,
+            down_smpl_datas->pos3.x, down_smpl_datas->pos3.y, down_smpl_datas->pos3.z) < 0) {
+      ret = -1;
+    }
+  }
+  if (fclose(f) != 0 || ret != 0) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 固定小数点数のデータを、圧縮アーカイブとしてファイルに出力する
+ * @param [in] filename 出力ファイル名
+ * @param [in] datas    固定小数点数のデータの配列
+ * @param [in] len      データ数
+ * @return 正常に書き出せたなら0を、それ以外なら-1を返す
+ */
+static int write_archive_file(const char *filename, const fixed_fmt *datas, unsigned int len) {
+  int   ret;
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", filename);
+    return -1;
+  }
+  ret = write_archive(f, datas, len);
+  if (fclose(f) != 0 || ret != 0) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * ダウンサンプリングデータの重心位置の索引を、出力ファイルの隣(出力ファイル名 + POSE_INDEX_SUFFIX)に書き出す
+ * @param [in]  out_filename    出力ファイル名
+ * @param [out] records         索引のレコードを作る領域(len個)
+ * @param [in]  down_smpl_datas ダウンサンプリングデータの配列
+ * @param [in]  len             ダウンサンプリングデータの要素数
+ * @return 正常に書き出せたなら0を、それ以外なら-1を返す
+ */
+static int write_index_file(const char *out_filename, pose_record *records, const data_fmt *down_smpl_datas, unsigned int len) {
+  char  filename[PATH_MAX];
+  int   ret;
+  FILE *f;
+
+  if (snprintf(filename, sizeof(filename), "%s%s", out_filename, POSE_INDEX_SUFFIX) >= (int)sizeof(filename)) {
+    fprintf(stderr, "ファイル名:%s%sが長すぎます\n", out_filename, POSE_INDEX_SUFFIX);
+    return -1;
+  }
+  make_pose_records(records, down_smpl_datas, len);
+  build_pose_index(records, len);
+  f = fopen(filename, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", filename);
+    return -1;
+  }
+  ret = write_pose_index(f, records, len);
+  if (fclose(f) != 0 || ret != 0) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 特徴データ(イベント検出モードではイベント、--histオプションではヒストグラム)を出力ファイルに書き出す
+ * @param [in]  opts          コマンドライン引数で指定された設定
+ * @param [in]  feature_datas 特徴データの配列
+ * @param [in]  spectra       周波数特徴の配列(--spectralオプションを指定しないならNULL)
+ * @param [out] events        イベントを収める領域((len + 1) / 2 + 1個。イベントを検出しないならNULL)
+ * @param [in]  len           特徴データの要素数
+ * @return 正常に書き出せたなら0を、それ以外なら-1を返す
+ */
+static int write_output_file(const cmd_options *opts, const feature *feature_datas, const spectral_feature *spectra,
+                             feature_event *events, unsigned int len) {
+  FILE        *out_fp;
+  feature_tee *tee;
+  int          ret = 0;
+
+  if (opts->use_tee) {
+    // 特徴データを1度だけ渡し、出力先ごとのスレッドがそれぞれの形式で書き出す(失敗はtee_close()が表示する)
+    tee = tee_open(opts->sinks, opts->n_sinks, opts->n_threads);
+    if (tee == NULL) return -1;
+    ret = tee_write(tee, feature_datas, len);
+    return tee_close(tee) != 0 || ret != 0 ? -1 : 0;
+  }
+  out_fp = fopen(opts->out_filename, opts->use_binary ? "wb" : "w");  // 出力ファイルをオープン
+  if (out_fp == NULL) {  // ファイルがオープン出来ないとき、
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts->out_filename);
+    return -1;
+  }
+  if (opts->n_events > 0) {
+    // イベント検出モードでは、特徴データの代わりに、閾値をまたいだ区間だけを書き出す
+    unsigned int i;
+    for (i = 0; i < opts->n_events && ret == 0; i++) {
+      unsigned int n_found = detect_events(events, feature_datas, len, &opts->events[i]);
+      ret = write_events(out_fp, &opts->events[i], events, n_found);
+    }
+  } else if (opts->n_hists > 0) {
+    // 特徴データの代わりに、分布を区間ごとに数えた結果だけを書き出す
+    ret = write_histograms(out_fp, opts->hists, opts->n_hists, feature_datas, len, opts->n_threads);
+  } else if (opts->use_binary) {
+    // 検索ツール(g3search)がmmapして読めるよう、特徴データの配列をそのまま書き出す
+    ret = write_feature_file(out_fp, feature_datas, len);
+  } else {
+    // ワーカスレッドで行の範囲ごとに文字列に変換し、行の順に書き込む
+    ret = write_features_parallel(out_fp, feature_datas, spectra, len, opts->n_threads);
+  }
+  if (fclose(out_fp) != 0 || ret != 0) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts->out_filename);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * 入力ファイルと--mergeオプションで指定したファイルを、時間の列の順に併合して処理する
+ * フレームはファイルから1つずつ取り出してダウンサンプリングするので、入力全体を配列に読み込まない
+ * (DEFAULT_LEN行を超える入力も処理できる)
+ * @param [in] opts コマンドライン引数で指定された設定
+ * @return 正常に処理出来たなら0を、それ以外なら-1を返す
+ */
+static int run_merged(const cmd_options *opts) {
+  char          *filenames[MAX_MERGE_INPUTS];
+  frame_merger   merger;
+  feature       *feature_datas = NULL;
+  feature_event *events = NULL;
+  unsigned int   i, len;
+  int            ret;
+
+  filenames[0] = opts->in_filename;
+  for (i = 0; i < opts->n_merge; i++) filenames[i + 1] = opts->merge_filenames[i];
+  if (merger_open(&merger, filenames, opts->n_merge + 1, opts->n_threads) != 0) {
+    return -1;
+  }
+  ret = merge_features(&merger, opts->merge_num, opts->use_approx, &feature_datas, &len);
+  merger_close(&merger);
+  if (ret != 0) {
+    return -1;
+  }
+  if (opts->n_events > 0) {
+    events = (feature_event *)malloc(sizeof(feature_event) * ((len + 1) / 2 + 1));
+    if (events == NULL) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      free(feature_datas);
+      return -1;
+    }
+  }
+  ret = write_output_file(opts, feature_datas, NULL, events, len);
+  free(events);
+  free(feature_datas);
+  return ret;
+}
+
+
+/*!
+ * 入力を配列に読み込まずに処理し、特徴データを順に出力ファイルに書き出す(--streamオプション)
+ * 入力ファイルは窓ごとにマップし(--mergeオプションを指定したか、入力ファイルが圧縮されているなら、
+ * 併合の処理で展開しながら読んだフレームを用い)、
+ * STREAM_CHUNK行の特徴データが揃うごとに書き出すので、メモリの使用量は入力の大きさによらない
+ * (--histオプションでは、揃うごとにヒストグラムに数え、最後にヒストグラムだけを書き出す)
+ * 行数などは64ビットで数えるので、配列(DEFAULT_LEN)やunsigned intの範囲を超える入力も処理できる
+ * @param [in] opts コマンドライン引数で指定された設定
+ * @return 正常に処理出来たなら0を、それ以外なら-1を返す
+ */
+static int run_streamed(const cmd_options *opts) {
+  char           *filenames[MAX_MERGE_INPUTS];
+  frame_merger    merger;
+  mapped_input    input;
+  feature_stream  fs;
+  stream_output   out;
+  histogram       hists[MAX_HIST_SPECS];
+  data_fmt        frame;
+  unsigned int    i, n_hists;
+  int             next = 1;    // 入力から最後に読んだ結果(1: フレーム, 0: 終わり, -1: 失敗)
+  int             failed;      // 書き込みに失敗したかどうか
+  int             use_merger;  // 併合の処理でフレームを読むかどうか
+
+  // アーカイブは行ごとに読めないので、テキストとして解析しないように先に弾く(--mergeの入力はmerger_open()が調べる)
+  if (opts->n_merge == 0 && is_archive_file(opts->in_filename)) {
+    fprintf(stderr, "ファイル:%sは圧縮アーカイブなので、--streamオプションでは読めません\n", opts->in_filename);
+    return -1;
+  }
+  out.f          = opts->use_tee ? NULL : fopen(opts->out_filename, opts->use_binary ? "wb" : "w");
+  out.tee        = opts->use_tee ? tee_open(opts->sinks, opts->n_sinks, opts->n_threads) : NULL;
+  out.use_binary = opts->use_binary;
+  out.n_threads  = opts->n_threads;
+  out.hists      = opts->n_hists > 0 ? hists : NULL;
+  out.n_hists    = opts->n_hists;
+  out.writer     = NULL;
+  if (out.f == NULL && out.tee == NULL) {
+    if (!opts->use_tee) fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts->out_filename);
+    return -1;
+  }
+  // テキスト形式は、ワーカスレッドを使い回して、次の特徴データを求めている間に変換する
+  if (out.f != NULL && !opts->use_binary && opts->n_hists == 0 && (out.writer = feature_writer_open(out.f, opts->n_threads)) == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    discard_stream_output(&out);
+    return -1;
+  }
+  for (n_hists = 0; n_hists < opts->n_hists; n_hists++) {
+    if (histogram_init(&hists[n_hists], &opts->hists[n_hists]) != 0) break;
+  }
+  if (n_hists < opts->n_hists) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    for (i = 0; i < n_hists; i++) histogram_destroy(&hists[i]);
+    discard_stream_output(&out);
+    return -1;
+  }
+  use_merger = opts->n_merge > 0 || detect_input_format(opts->in_filename) != INPUT_PLAIN;  // 圧縮データはマップして読めない
+  if (use_merger) {
+    filenames[0] = opts->in_filename;
+    for (i = 0; i < opts->n_merge; i++) filenames[i + 1] = opts->merge_filenames[i];
+    next = merger_open(&merger, filenames, opts->n_merge + 1, opts->n_threads);
+  } else {
+    next = mapped_input_open(&input, opts->in_filename, MAPPED_WINDOW);
+  }
+  if (next != 0) {
+    for (i = 0; i < n_hists; i++) histogram_destroy(&hists[i]);
+    discard_stream_output(&out);
+    return -1;
+  }
+  if (feature_stream_init(&fs, opts->merge_num, opts->use_approx, write_stream_rows, &out) != 0) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    if (use_merger) merger_close(&merger); else mapped_input_close(&input);
+    for (i = 0; i < n_hists; i++) histogram_destroy(&hists[i]);
+    discard_stream_output(&out);
+    return -1;
+  }
+
+  // バイナリ形式の要素数は、書き終えてから書き直す
+  failed = out.f != NULL && opts->use_binary && write_feature_header(out.f, 0) != 0;
+  while (!failed && (next = use_merger ? merger_next(&merger, &frame) : mapped_input_next(&input, &frame)) == 1) {
+    failed = feature_stream_push(&fs, &frame) != 0;
+  }
+  if (!failed && next == 0) {
+    failed = feature_stream_finish(&fs) != 0;
+  }
+  if (!failed && next == 0 && out.f != NULL && opts->use_binary) {
+    failed = fflush(out.f) != 0 || fseek(out.f, 0, SEEK_SET) != 0 || write_feature_header(out.f, fs.n_rows) != 0;
+  }
+  for (i = 0; !failed && next == 0 && i < n_hists; i++) {
+    failed = write_histogram(out.f, &hists[i]) != 0;
+  }
+
+  if (use_merger) merger_close(&merger); else mapped_input_close(&input);
+  feature_stream_destroy(&fs);
+  for (i = 0; i < n_hists; i++) histogram_destroy(&hists[i]);
+  if (out.tee != NULL && tee_close(out.tee) != 0) failed = 1;  // 失敗した出力先は、tee_close()が表示する
+  if (out.writer != NULL && feature_writer_close(out.writer) != 0) failed = 1;
+  if (out.f != NULL && (fclose(out.f) != 0 || failed)) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts->out_filename);
+    failed = 1;
+  }
+  if (failed) return -1;
+  return next == 0 ? 0 : -1;
+}
+
+
+/*!
+ * 特徴データを、出力ファイルの末尾に書き出す(feature_streamのsink)
+ * 複数の出力先に書き出す場合はteeに渡し、ヒストグラムを数える場合は、書き出さずにヒストグラムに加える
  * @param [in] feature_datas 特徴データの配列
  * @param [in] len           特徴データの要素数
+ * @param [in] first_row     feature_datas[0]の、出力全体での行番号
+ * @param [in] arg           書き出す先(stream_output)
+ * @return 成功したなら0を、失敗したなら-1を返す
  */
-static void write_features(FILE *f, const feature *feature_datas, unsigned int len) {
-  unsigned int i;
-  fprintf(f, "%lf %lf %lf\n",
-      feature_datas->time,
-      feature_datas->len,
-      feature_datas->area);
-  for (i = 1, feature_datas++; i < len; i++, feature_datas++) {
-    fprintf(f, "%lf %lf %lf %lf\n",
-        feature_datas->time,
-        feature_datas->len,
-        feature_datas->area,
-        feature_datas->cog_change);
+static int write_stream_rows(const feature *feature_datas, unsigned int len, uint64_t first_row, void *arg) {
+  const stream_output *out = (const stream_output *)arg;
+
+  if (out->tee != NULL) {
+    return tee_write(out->tee, feature_datas, len);
+  }
+  if (out->hists != NULL) {
+    return accumulate_histograms(out->hists, out->n_hists, feature_datas, len, first_row == 0, out->n_threads);
+  }
+  if (out->use_binary) {
+    return fwrite(feature_datas, sizeof(feature), len, out->f) == len ? 0 : -1;
+  }
+  return feature_writer_write(out->writer, feature_datas, len, first_row == 0);
+}
+
+
+/*!
+ * 処理を中断したときに、--streamオプションの出力先を閉じる
+ * @param [in,out] out 書き出す先
+ */
+static void discard_stream_output(stream_output *out) {
+  if (out->tee != NULL) tee_close(out->tee);
+  if (out->writer != NULL) feature_writer_close(out->writer);
+  if (out->f != NULL) fclose(out->f);
+}
+
+
+/*!
+ * 時間がt0以上t1以下のブロックの特徴データだけを求めて書き出す(--rangeオプション)
+ * 入力ファイルはマップするだけで配列に読み込まず、範囲を含むページのブロックだけを求めるので、
+ * 大きな入力の一部分を、入力全体を処理するよりも少ない時間とメモリで取り出せる
+ * 書き出す行は、入力全体を処理した出力の、同じブロックの行と同じになる
+ * 範囲より前の行はページの始まりを記録するために全て調べるので、-Cオプションでは記録した目印を
+ * キャッシュし、次回以降は調べ終えた範囲を調べ直さない
+ * @param [in] opts コマンドライン引数で指定された設定
+ * @return 正常に処理出来たなら0を、それ以外なら-1を返す
+ */
+static int run_range(const cmd_options *opts) {
+  lazy_features *ctx;
+  feature       *rows;
+  size_t         cap = (size_t)LAZY_PAGE * LAZY_CACHE_PAGES;  // 最初に確保する行数(キャッシュに収まる範囲)
+  uint64_t       first, count;
+  FILE          *out_fp;
+  int            ret;
+
+  // マップして読むので、圧縮した入力は扱えない
+  if (detect_input_format(opts->in_filename) != INPUT_PLAIN || is_archive_file(opts->in_filename)) {
+    fputs("--rangeオプションでは、圧縮していないcsvファイルを入力してください\n", stderr);
+    return -1;
+  }
+  ctx = lazy_open(opts->in_filename, opts->merge_num, 0);
+  if (ctx == NULL) {
+    return -1;
+  }
+  if (opts->use_cache) lazy_load_marks(ctx, opts->in_filename);  // 有効なキャッシュが無ければ、先頭から調べる
+  rows = (feature *)malloc(sizeof(feature) * cap);
+  if (rows == NULL) {
+    fputs("メモリ確保に失敗しました\n", stderr);
+    lazy_close(ctx);
+    return -1;
+  }
+  ret = features_in_range(ctx, opts->range_t0, opts->range_t1, rows, cap, &first, &count);
+  if (ret == 0 && count > UINT_MAX) {
+    fputs("時間の範囲にあるブロックが多すぎます\n", stderr);
+    ret = -1;
+  } else if (ret == 0 && count > cap) {
+    // 配列に収まらなかったなら、広げて求め直す(範囲の後ろの方のページは、キャッシュに残っている)
+    feature *grown = (feature *)realloc(rows, sizeof(feature) * count);
+    if (grown == NULL) {
+      fputs("メモリ確保に失敗しました\n", stderr);
+      ret = -1;
+    } else {
+      rows = grown;
+      ret  = features_in_range(ctx, opts->range_t0, opts->range_t1, rows, count, &first, &count);
+    }
+  }
+  if (ret == 0 && opts->use_cache && lazy_store_marks(ctx, opts->in_filename) != 0) {
+    fputs("解析結果をキャッシュに書き込むことが出来ませんでした\n", stderr);  // キャッシュが無くとも処理は続ける
+  }
+  lazy_close(ctx);
+  if (ret != 0) {
+    free(rows);
+    return -1;
+  }
+
+  out_fp = fopen(opts->out_filename, opts->use_binary ? "wb" : "w");
+  if (out_fp == NULL) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts->out_filename);
+    free(rows);
+    return -1;
+  }
+  if (opts->use_binary) {
+    ret = write_feature_file(out_fp, rows, (unsigned int)count);
+  } else {
+    ret = write_feature_rows(out_fp, rows, (unsigned int)count, first == 0, opts->n_threads);
+  }
+  if (fclose(out_fp) != 0 || ret != 0) {
+    fprintf(stderr, "ファイル:%sに書き込むことが出来ませんでした\n", opts->out_filename);
+    ret = -1;
   }
+  free(rows);
+  return ret;
 }